@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <chrono>
 #include <filesystem>
 #include <fstream>
@@ -10,6 +11,7 @@
 #include "MeshAsset.h"
 #include "PrefabAsset.h"
 #include "TextureAsset.h"
+#include "VirtualTextureAsset.h"
 
 #define TINYGLTF_IMPLEMENTATION
 #define STB_IMAGE_IMPLEMENTATION
@@ -32,6 +34,74 @@ struct ConverterState {
   }
 };
 
+// Has to match PAGE_SIZE and PAGE_BORDER of textured_lit_virtual.frag
+constexpr uint32_t kVirtualPageSize = 128;
+constexpr uint32_t kVirtualPageBorder = 4;
+// Textures this large are additionally stored as virtual textures
+constexpr uint32_t kVirtualTextureMinSize = 4096;
+
+bool IsVirtualTextureSize(uint32_t width, uint32_t height) {
+  auto is_pow2 = [](uint32_t x) { return x != 0 && (x & (x - 1)) == 0; };
+  return is_pow2(width) && is_pow2(height) &&
+         std::min(width, height) >= kVirtualPageSize &&
+         std::max(width, height) >= kVirtualTextureMinSize;
+}
+
+void ConvertVirtualTexture(const Assets::TextureInfo& tex_info,
+                           const std::vector<uint8_t>& mip_chain,
+                           const fs::path& output) {
+  Assets::VirtualTextureInfo info;
+  info.texture_format = Assets::TextureFormat::RGBA8;
+  info.compression_mode = Assets::CompressionMode::LZ4;
+  info.pixel_size[0] = tex_info.pixel_size[0];
+  info.pixel_size[1] = tex_info.pixel_size[1];
+  info.page_size = kVirtualPageSize;
+  info.page_border = kVirtualPageBorder;
+  info.original_file = tex_info.original_file;
+
+  const int32_t stride = kVirtualPageSize + 2 * kVirtualPageBorder;
+  std::vector<std::vector<char>> pages;
+  size_t mip_offset = 0;
+  for (const Assets::MipInfo& mip : tex_info.mips) {
+    int32_t width = mip.pixel_size[0];
+    int32_t height = mip.pixel_size[1];
+    if (std::min(width, height) < static_cast<int32_t>(kVirtualPageSize))
+      break;
+
+    Assets::VirtualMipInfo virtual_mip;
+    virtual_mip.page_count[0] = width / kVirtualPageSize;
+    virtual_mip.page_count[1] = height / kVirtualPageSize;
+    virtual_mip.first_page = static_cast<uint32_t>(pages.size());
+    info.mips.push_back(virtual_mip);
+
+    const uint8_t* src = mip_chain.data() + mip_offset;
+    for (uint32_t page_y = 0; page_y < virtual_mip.page_count[1]; ++page_y) {
+      for (uint32_t page_x = 0; page_x < virtual_mip.page_count[0];
+           ++page_x) {
+        std::vector<char> page(stride * stride * 4);
+        for (int32_t y = 0; y < stride; ++y) {
+          int32_t src_y = page_y * kVirtualPageSize + y - kVirtualPageBorder;
+          src_y = (src_y + height) % height;
+          for (int32_t x = 0; x < stride; ++x) {
+            int32_t src_x =
+                page_x * kVirtualPageSize + x - kVirtualPageBorder;
+            src_x = (src_x + width) % width;
+            memcpy(&page[(y * stride + x) * 4],
+                   &src[(src_y * width + src_x) * 4], 4);
+          }
+        }
+        pages.push_back(std::move(page));
+      }
+    }
+
+    mip_offset += mip.data_size;
+  }
+
+  Assets::AssetFile file = Assets::PackVirtualTexture(&info, pages);
+
+  Assets::SaveBinaryFile(output.string().c_str(), file);
+}
+
 bool ConvertImage(const fs::path& input, const fs::path& output) {
   int tex_width, tex_height, tex_channels;
   stbi_uc* pixels =
@@ -51,12 +121,62 @@ bool ConvertImage(const fs::path& input, const fs::path& output) {
   tex_info.texture_format = Assets::TextureFormat::RGBA8;
   tex_info.original_file = input.string();
 
-  Assets::AssetFile new_image = Assets::PackTexture(&tex_info, pixels);
-
+  // Store whole mip chain, so that renderer can stream it level by level
+  std::vector<uint8_t> mip_chain(pixels, pixels + texture_size);
   stbi_image_free(pixels);
 
+  uint32_t width = tex_width;
+  uint32_t height = tex_height;
+  size_t mip_offset = 0;
+  while (true) {
+    Assets::MipInfo mip;
+    mip.pixel_size[0] = width;
+    mip.pixel_size[1] = height;
+    mip.data_size = width * height * 4;
+    tex_info.mips.push_back(mip);
+
+    if (width == 1 && height == 1) break;
+
+    uint32_t mip_width = std::max(width / 2, 1u);
+    uint32_t mip_height = std::max(height / 2, 1u);
+    size_t next_offset = mip_offset + mip.data_size;
+    mip_chain.resize(next_offset + mip_width * mip_height * 4);
+
+    // Box filter, edge texels of odd sized levels are clamped
+    const uint8_t* src = mip_chain.data() + mip_offset;
+    uint8_t* dst = mip_chain.data() + next_offset;
+    for (uint32_t y = 0; y < mip_height; ++y) {
+      uint32_t y0 = std::min(y * 2, height - 1);
+      uint32_t y1 = std::min(y * 2 + 1, height - 1);
+      for (uint32_t x = 0; x < mip_width; ++x) {
+        uint32_t x0 = std::min(x * 2, width - 1);
+        uint32_t x1 = std::min(x * 2 + 1, width - 1);
+        for (uint32_t c = 0; c < 4; ++c) {
+          uint32_t sum = src[(y0 * width + x0) * 4 + c] +
+                         src[(y0 * width + x1) * 4 + c] +
+                         src[(y1 * width + x0) * 4 + c] +
+                         src[(y1 * width + x1) * 4 + c];
+          dst[(y * mip_width + x) * 4 + c] = static_cast<uint8_t>(sum / 4);
+        }
+      }
+    }
+
+    mip_offset = next_offset;
+    width = mip_width;
+    height = mip_height;
+  }
+
+  Assets::AssetFile new_image =
+      Assets::PackTexture(&tex_info, mip_chain.data());
+
   Assets::SaveBinaryFile(output.string().c_str(), new_image);
 
+  if (IsVirtualTextureSize(tex_width, tex_height)) {
+    fs::path virtual_path = output;
+    virtual_path.replace_extension(".vtx");
+    ConvertVirtualTexture(tex_info, mip_chain, virtual_path);
+  }
+
   return true;
 }
 
@@ -416,6 +536,25 @@ void ExtractGltfMaterials(tinygltf::Model& model, const fs::path& input,
       material_info.transparency = Assets::TransparencyMode::kOpaque;
     }
 
+    // Plain opaque materials with large enough base color sample its
+    // virtual texture instead, written next to the regular one
+    if (material_info.base_effect == "texturedPBR_opaque") {
+      tinygltf::Texture base_color = model.textures[pbr.baseColorTexture.index];
+      tinygltf::Image base_image = model.images[base_color.source];
+
+      fs::path image_path = input.parent_path() / base_image.uri;
+      int width, height, channels;
+      if (stbi_info(image_path.u8string().c_str(), &width, &height,
+                    &channels) &&
+          IsVirtualTextureSize(width, height)) {
+        fs::path virtual_path = material_info.textures["base_color"];
+        virtual_path.replace_extension(".vtx");
+
+        material_info.base_effect = "texturedPBR_virtual";
+        material_info.textures["base_color"] = virtual_path.string();
+      }
+    }
+
     Assets::AssetFile file = Assets::PackMaterial(&material_info);
 
     Assets::SaveBinaryFile(material_path.string().c_str(), file);
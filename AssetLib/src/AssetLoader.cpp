@@ -52,6 +52,44 @@ bool LoadBinaryFile(const char* path, AssetFile& output_file) {
   return true;
 }
 
+bool LoadBinaryFileHeader(const char* path, AssetFile& output_file,
+                          uint64_t& blob_offset) {
+  std::ifstream in_file;
+  in_file.open(path, std::ios::binary);
+
+  if (!in_file.is_open()) return false;
+
+  in_file.read(output_file.type, 4);
+
+  in_file.read(reinterpret_cast<char*>(&output_file.version), sizeof(uint32_t));
+
+  uint32_t length = 0;
+  in_file.read(reinterpret_cast<char*>(&length), sizeof(uint32_t));
+
+  uint32_t blob_length = 0;
+  in_file.read(reinterpret_cast<char*>(&blob_length), sizeof(uint32_t));
+
+  output_file.json.resize(length);
+  in_file.read(output_file.json.data(), length);
+
+  blob_offset = 4 + 3 * sizeof(uint32_t) + length;
+
+  return in_file.good();
+}
+
+bool LoadBinaryFileRange(const char* path, uint64_t offset, uint64_t size,
+                         char* destination) {
+  std::ifstream in_file;
+  in_file.open(path, std::ios::binary);
+
+  if (!in_file.is_open()) return false;
+
+  in_file.seekg(offset);
+  in_file.read(destination, size);
+
+  return in_file.good();
+}
+
 CompressionMode ParseCompression(const char* compression) {
   if (strcmp(compression, "LZ4") == 0)
     return CompressionMode::LZ4;
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -16,6 +17,14 @@ namespace Assets {
 
   bool SaveBinaryFile(const char* path, const AssetFile& file);
   bool LoadBinaryFile(const char* path, AssetFile& output_file);
+  /*
+  Load everything but the binary blob, blob_offset is set to where the blob
+  starts in the file, so that parts of it can be read on demand
+  */
+  bool LoadBinaryFileHeader(const char* path, AssetFile& output_file,
+                            uint64_t& blob_offset);
+  bool LoadBinaryFileRange(const char* path, uint64_t offset, uint64_t size,
+                           char* destination);
 
   CompressionMode ParseCompression(const char* compression);
 
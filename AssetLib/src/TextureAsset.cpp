@@ -27,18 +27,45 @@ TextureInfo ReadTextureInfo(AssetFile& file) {
   info.texture_size = texture_metadata["buffer_size"];
   info.original_file = texture_metadata["original_file"];
 
+  if (texture_metadata.contains("mips")) {
+    for (const nlohmann::json& mip_metadata : texture_metadata["mips"]) {
+      MipInfo mip;
+      mip.pixel_size[0] = mip_metadata["width"];
+      mip.pixel_size[1] = mip_metadata["height"];
+      mip.data_size = mip_metadata["buffer_size"];
+      mip.compressed_offset = mip_metadata["offset"];
+      mip.compressed_size = mip_metadata["compressed_size"];
+      info.mips.push_back(mip);
+    }
+  }
+
   return info;
 }
 
 void UnpackTexture(TextureInfo* info, const char* src_buffer, size_t src_size,
                    char* destination) {
-  if (info->compression_mode == CompressionMode::LZ4) {
+  if (!info->mips.empty()) {
+    UnpackTextureMip(info, 0, src_buffer, destination);
+  } else if (info->compression_mode == CompressionMode::LZ4) {
     LZ4_decompress_safe(src_buffer, destination, src_size, info->texture_size);
   } else {
     memcpy(destination, src_buffer, src_size);
   }
 }
 
+void UnpackTextureMip(const TextureInfo* info, uint32_t mip,
+                      const char* src_buffer, char* destination) {
+  const MipInfo& mip_info = info->mips[mip];
+  const char* src = src_buffer + mip_info.compressed_offset;
+  if (info->compression_mode == CompressionMode::LZ4) {
+    LZ4_decompress_safe(src, destination,
+                        static_cast<int>(mip_info.compressed_size),
+                        static_cast<int>(mip_info.data_size));
+  } else {
+    memcpy(destination, src, mip_info.compressed_size);
+  }
+}
+
 AssetFile PackTexture(TextureInfo* info, void* pixel_data) {
   nlohmann::json texture_metadata;
   texture_metadata["format"] = "RGBA8";
@@ -54,15 +81,44 @@ AssetFile PackTexture(TextureInfo* info, void* pixel_data) {
   file.type[3] = 'I';
   file.version = 1;
 
-  int compress_staging = LZ4_compressBound(info->texture_size);
-  file.binary_blob.resize(compress_staging);
+  texture_metadata["compression"] = "LZ4";
+
+  if (info->mips.empty()) {
+    int compress_staging = LZ4_compressBound(info->texture_size);
+    file.binary_blob.resize(compress_staging);
 
-  int compressed_size = LZ4_compress_default(
-      static_cast<const char*>(pixel_data), file.binary_blob.data(),
-      info->texture_size, compress_staging);
-  file.binary_blob.resize(compressed_size);
+    int compressed_size = LZ4_compress_default(
+        static_cast<const char*>(pixel_data), file.binary_blob.data(),
+        info->texture_size, compress_staging);
+    file.binary_blob.resize(compressed_size);
 
-  texture_metadata["compression"] = "LZ4";
+    file.json = texture_metadata.dump();
+    return file;
+  }
+
+  const char* src = static_cast<const char*>(pixel_data);
+  nlohmann::json mips_metadata = nlohmann::json::array();
+  for (MipInfo& mip : info->mips) {
+    int compress_staging = LZ4_compressBound(static_cast<int>(mip.data_size));
+    mip.compressed_offset = file.binary_blob.size();
+    file.binary_blob.resize(mip.compressed_offset + compress_staging);
+
+    int compressed_size = LZ4_compress_default(
+        src, file.binary_blob.data() + mip.compressed_offset,
+        static_cast<int>(mip.data_size), compress_staging);
+    mip.compressed_size = compressed_size;
+    file.binary_blob.resize(mip.compressed_offset + compressed_size);
+    src += mip.data_size;
+
+    nlohmann::json mip_metadata;
+    mip_metadata["width"] = mip.pixel_size[0];
+    mip_metadata["height"] = mip.pixel_size[1];
+    mip_metadata["buffer_size"] = mip.data_size;
+    mip_metadata["offset"] = mip.compressed_offset;
+    mip_metadata["compressed_size"] = mip.compressed_size;
+    mips_metadata.push_back(mip_metadata);
+  }
+  texture_metadata["mips"] = mips_metadata;
 
   std::string stringified = texture_metadata.dump();
   file.json = stringified;
@@ -6,19 +6,39 @@ namespace Assets {
 
   enum class TextureFormat : uint32_t { Unknown = 0, RGBA8 };
 
+  struct MipInfo {
+    uint32_t pixel_size[2];
+    uint64_t data_size;
+    uint64_t compressed_offset;
+    uint64_t compressed_size;
+  };
+
   struct TextureInfo {
+    // Size of mip 0
     uint64_t texture_size;
     TextureFormat texture_format;
     CompressionMode compression_mode;
     uint32_t pixel_size[3];
     std::string original_file;
+    // Empty for textures packed without mip chain
+    std::vector<MipInfo> mips;
   };
 
   TextureInfo ReadTextureInfo(AssetFile& file);
 
   void UnpackTexture(TextureInfo* info, const char* src_buffer, size_t src_size,
                      char* destination);
-
+  /*
+  Unpack single level of mip chain, each level is compressed separately so
+  that it can be streamed on its own
+  */
+  void UnpackTextureMip(const TextureInfo* info, uint32_t mip,
+                        const char* src_buffer, char* destination);
+
+  /*
+  Pack texture, if info->mips is not empty pixel_data holds all levels of mip
+  chain one after another
+  */
   AssetFile PackTexture(TextureInfo* info, void* pixel_data);
 
 }
\ No newline at end of file
@@ -0,0 +1,121 @@
+#include "VirtualTextureAsset.h"
+
+#include <json/single_include/nlohmann/json.hpp>
+#include <lz4/lib/lz4.h>
+
+namespace Assets {
+
+uint64_t VirtualTextureInfo::GetPageDataSize() const {
+  uint64_t stride = page_size + 2 * page_border;
+  return stride * stride * 4;
+}
+
+uint32_t VirtualTextureInfo::GetPageIndex(uint32_t mip, uint32_t x,
+                                          uint32_t y) const {
+  return mips[mip].first_page + y * mips[mip].page_count[0] + x;
+}
+
+VirtualTextureInfo ReadVirtualTextureInfo(AssetFile& file) {
+  VirtualTextureInfo info;
+  nlohmann::json texture_metadata = nlohmann::json::parse(file.json);
+
+  std::string format_string = texture_metadata["format"];
+  info.texture_format = format_string == "RGBA8" ? TextureFormat::RGBA8
+                                                 : TextureFormat::Unknown;
+
+  std::string compression_string = texture_metadata["compression"];
+  info.compression_mode = ParseCompression(compression_string.c_str());
+
+  info.pixel_size[0] = texture_metadata["width"];
+  info.pixel_size[1] = texture_metadata["height"];
+  info.page_size = texture_metadata["page_size"];
+  info.page_border = texture_metadata["page_border"];
+  info.original_file = texture_metadata["original_file"];
+
+  for (const nlohmann::json& mip_metadata : texture_metadata["mips"]) {
+    VirtualMipInfo mip;
+    mip.page_count[0] = mip_metadata["pages_x"];
+    mip.page_count[1] = mip_metadata["pages_y"];
+    mip.first_page = mip_metadata["first_page"];
+    info.mips.push_back(mip);
+  }
+
+  const nlohmann::json& offsets = texture_metadata["page_offsets"];
+  const nlohmann::json& sizes = texture_metadata["page_sizes"];
+  info.pages.resize(offsets.size());
+  for (size_t i = 0; i < info.pages.size(); ++i) {
+    info.pages[i].compressed_offset = offsets[i];
+    info.pages[i].compressed_size = sizes[i];
+  }
+
+  return info;
+}
+
+void UnpackVirtualPage(const VirtualTextureInfo* info, uint32_t page,
+                       const char* src_buffer, char* destination) {
+  const VirtualPageInfo& page_info = info->pages[page];
+  if (info->compression_mode == CompressionMode::LZ4) {
+    LZ4_decompress_safe(src_buffer, destination,
+                        static_cast<int>(page_info.compressed_size),
+                        static_cast<int>(info->GetPageDataSize()));
+  } else {
+    memcpy(destination, src_buffer, page_info.compressed_size);
+  }
+}
+
+AssetFile PackVirtualTexture(VirtualTextureInfo* info,
+                             const std::vector<std::vector<char>>& pages) {
+  nlohmann::json texture_metadata;
+  texture_metadata["format"] = "RGBA8";
+  texture_metadata["compression"] = "LZ4";
+  texture_metadata["width"] = info->pixel_size[0];
+  texture_metadata["height"] = info->pixel_size[1];
+  texture_metadata["page_size"] = info->page_size;
+  texture_metadata["page_border"] = info->page_border;
+  texture_metadata["original_file"] = info->original_file;
+
+  AssetFile file;
+  file.type[0] = 'V';
+  file.type[1] = 'T';
+  file.type[2] = 'E';
+  file.type[3] = 'X';
+  file.version = 1;
+
+  nlohmann::json mips_metadata = nlohmann::json::array();
+  for (const VirtualMipInfo& mip : info->mips) {
+    nlohmann::json mip_metadata;
+    mip_metadata["pages_x"] = mip.page_count[0];
+    mip_metadata["pages_y"] = mip.page_count[1];
+    mip_metadata["first_page"] = mip.first_page;
+    mips_metadata.push_back(mip_metadata);
+  }
+  texture_metadata["mips"] = mips_metadata;
+
+  nlohmann::json offsets = nlohmann::json::array();
+  nlohmann::json sizes = nlohmann::json::array();
+  info->pages.resize(pages.size());
+  for (size_t i = 0; i < pages.size(); ++i) {
+    int data_size = static_cast<int>(pages[i].size());
+    int compress_staging = LZ4_compressBound(data_size);
+    VirtualPageInfo& page = info->pages[i];
+    page.compressed_offset = file.binary_blob.size();
+    file.binary_blob.resize(page.compressed_offset + compress_staging);
+
+    int compressed_size = LZ4_compress_default(
+        pages[i].data(), file.binary_blob.data() + page.compressed_offset,
+        data_size, compress_staging);
+    page.compressed_size = compressed_size;
+    file.binary_blob.resize(page.compressed_offset + compressed_size);
+
+    offsets.push_back(page.compressed_offset);
+    sizes.push_back(page.compressed_size);
+  }
+  texture_metadata["page_offsets"] = offsets;
+  texture_metadata["page_sizes"] = sizes;
+
+  file.json = texture_metadata.dump();
+
+  return file;
+}
+
+}  // namespace Assets
\ No newline at end of file
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "AssetLoader.h"
+#include "TextureAsset.h"
+
+namespace Assets {
+
+  struct VirtualMipInfo {
+    uint32_t page_count[2];
+    // Index of the first page of this mip in VirtualTextureInfo::pages
+    uint32_t first_page;
+  };
+
+  struct VirtualPageInfo {
+    uint64_t compressed_offset;
+    uint64_t compressed_size;
+  };
+
+  /*
+  Texture split into square pages, each compressed on its own so that single
+  pages can be read from disk and decoded on demand
+
+  - Pages store page_border extra texels on every side, copied from their
+    neighbours (wrapped around at texture edges), so that filtering inside
+    the page never reads texels of unrelated pages
+  - Mips go down to the first one that fits into single page in its smaller
+    dimension
+  */
+  struct VirtualTextureInfo {
+    TextureFormat texture_format;
+    CompressionMode compression_mode;
+    uint32_t pixel_size[2];
+    uint32_t page_size;
+    uint32_t page_border;
+    std::string original_file;
+    std::vector<VirtualMipInfo> mips;
+    std::vector<VirtualPageInfo> pages;
+
+    // Size of single decoded page, border included
+    uint64_t GetPageDataSize() const;
+    uint32_t GetPageIndex(uint32_t mip, uint32_t x, uint32_t y) const;
+  };
+
+  VirtualTextureInfo ReadVirtualTextureInfo(AssetFile& file);
+
+  /*
+  Unpack single page, src_buffer holds only compressed data of that page
+  */
+  void UnpackVirtualPage(const VirtualTextureInfo* info, uint32_t page,
+                         const char* src_buffer, char* destination);
+
+  /*
+  Pack texture pages, pages holds decoded data of every page in order of
+  info->pages, offsets and sizes of info->pages are filled in
+  */
+  AssetFile PackVirtualTexture(VirtualTextureInfo* info,
+                               const std::vector<std::vector<char>>& pages);
+
+}
\ No newline at end of file
@@ -0,0 +1,260 @@
+// Body of the instance cull shaders, which only differ in how visible instances take slots of their
+// batch. With USE_SUBGROUPS lanes of a subgroup add up their counts and only one of them does the
+// atomic, which needs GL_KHR_shader_subgroup_ballot
+
+layout(local_size_x = 256) in;
+
+// Values of OcclusionMode
+#define OCCLUSION_NONE 0
+#define OCCLUSION_PYRAMID 1
+#define OCCLUSION_EARLY 2
+#define OCCLUSION_LATE 3
+
+// Results of testVisibility, rejections in the order of GPUCullStats
+#define VISIBLE 0
+#define REJECTED_SPHERE 1
+#define REJECTED_BOX 2
+#define REJECTED_SMALL 3
+#define REJECTED_OCCLUSION 4
+
+struct DrawCullData {
+	mat4 view;
+	float P00, P11, znear, zfar;
+	float frustum[4];
+	float minWidth, minHeight;
+
+	uint maxDrawCount;
+
+	int cullingEnabled;
+	int occlusionMode;
+	int distCull;
+};
+
+layout(push_constant) uniform constants {
+	DrawCullData cullData;
+};
+
+struct ObjectData {
+	vec4 modelRows[3];
+	vec4 bounds;
+	vec4 extents;
+};
+
+layout(std140, set = 0, binding = 0) readonly buffer ObjectBuffer {
+	ObjectData objects[];
+} objectBuffer;
+
+struct DrawCommand {
+	uint indexCount;
+    uint instanceCount;
+    uint firstIndex;
+    int  vertexOffset;
+    uint firstInstance;
+};
+
+layout(set = 0, binding = 1)  buffer InstanceBuffer {
+	DrawCommand draws[];
+} drawBuffer;
+
+struct GPUInstance {
+	uint objectID;
+	uint batchID;
+};
+
+layout(set = 0, binding = 2) readonly buffer InstanceBuffer2 {
+	GPUInstance instances[];
+} instanceBuffer;
+
+layout(set = 0, binding = 3)  buffer InstanceBuffer3 {
+	uint ids[];
+} finalInstanceBuffer;
+
+layout(set = 0, binding = 4) uniform sampler2D depthPyramid;
+
+// Visibility of every object as of last late phase, instances move between slots but objects keep their id
+layout(set = 0, binding = 5) buffer VisibilityBuffer {
+	uint visible[];
+} visibilityBuffer;
+
+layout(set = 0, binding = 6) buffer CullStatsBuffer {
+	uint earlyInstances;
+	uint lateInstances;
+	uint rejected[4];
+} cullStats;
+
+bool projectSphere(vec3 C, float r, float znear, float P00, float P11, out vec4 aabb) {
+	if (C.z < r + znear) return false;
+
+	vec2 cx = -C.xz;
+	vec2 vx = vec2(sqrt(dot(cx, cx) - r * r), r);
+	vec2 minx = mat2(vx.x, vx.y, -vx.y, vx.x) * cx;
+	vec2 maxx = mat2(vx.x, -vx.y, vx.y, vx.x) * cx;
+
+	vec2 cy = -C.yz;
+	vec2 vy = vec2(sqrt(dot(cy, cy) - r * r), r);
+	vec2 miny = mat2(vy.x, vy.y, -vy.y, vy.x) * cy;
+	vec2 maxy = mat2(vy.x, -vy.y, vy.y, vy.x) * cy;
+
+	aabb = vec4(minx.x / minx.y * P00, miny.x / miny.y * P11, maxx.x / maxx.y * P00, maxy.x / maxy.y * P11);
+	aabb = aabb.xwzy * vec4(0.5f, -0.5f, 0.5f, -0.5f) + vec4(0.5f);
+
+	return true;
+}
+
+// Same as projectSphere for the box around C, false if it reaches past the near plane. nearest is the
+// depth of its nearest corner
+bool projectBox(vec3 C, vec3 extents, float znear, float P00, float P11, out vec4 aabb, out float nearest) {
+	// World axes in view space, flipped the same way as the center
+	mat3 axes = mat3(cullData.view) * mat3(extents.x, 0, 0, 0, extents.y, 0, 0, 0, extents.z);
+	axes[0].yz *= -1;
+	axes[1].yz *= -1;
+	axes[2].yz *= -1;
+
+	nearest = C.z;
+	for (int i = 0; i < 8; i++) {
+		vec3 corner = C;
+		corner += (i & 1) != 0 ? axes[0] : -axes[0];
+		corner += (i & 2) != 0 ? axes[1] : -axes[1];
+		corner += (i & 4) != 0 ? axes[2] : -axes[2];
+		if (corner.z < znear) return false;
+
+		// Starts at the first corner, so that a box off screen ends up outside of 0 to 1
+		vec2 uv = corner.xy / corner.z * vec2(P00, P11) * vec2(0.5f, -0.5f) + vec2(0.5f);
+		aabb = i == 0 ? vec4(uv, uv) : vec4(min(aabb.xy, uv), max(aabb.zw, uv));
+		nearest = min(nearest, corner.z);
+	}
+
+	return true;
+}
+
+uint testVisibility(uint objectIndex) {
+	if (cullData.cullingEnabled == 0) return VISIBLE;
+	uint index = objectIndex;
+
+	vec4 sphereBounds = objectBuffer.objects[index].bounds;
+
+	vec3 center = sphereBounds.xyz;
+	center = (cullData.view * vec4(center, 1.f)).xyz;
+	float radius = sphereBounds.w;
+
+	bool visible = true;
+
+	visible = visible && center.z * cullData.frustum[1] - abs(center.x) * cullData.frustum[0] > -radius;
+	visible = visible && center.z * cullData.frustum[3] - abs(center.y) * cullData.frustum[2] > -radius;
+
+	if (cullData.distCull != 0) {
+		visible = visible && -center.z + radius > cullData.znear && -center.z - radius < cullData.zfar;
+	}
+	if (!visible) return REJECTED_SPHERE;
+
+	center.y *= -1;
+	center.z *= -1;
+
+	// Both rects bound the object on screen, and so does their overlap, which is what long thin objects need
+	vec4 sphereAabb;
+	bool sphereProjected = projectSphere(center, radius, cullData.znear, cullData.P00, cullData.P11, sphereAabb);
+	vec4 boxAabb;
+	float boxNearest;
+	bool boxProjected = projectBox(center, objectBuffer.objects[index].extents.xyz, cullData.znear, cullData.P00,
+		cullData.P11, boxAabb, boxNearest);
+
+	if (boxProjected && (boxAabb.z < 0 || boxAabb.x > 1 || boxAabb.w < 0 || boxAabb.y > 1)) return REJECTED_BOX;
+	if (!sphereProjected && !boxProjected) return VISIBLE;
+
+	vec4 aabb = sphereProjected ? sphereAabb : boxAabb;
+	if (sphereProjected && boxProjected) aabb = vec4(max(sphereAabb.xy, boxAabb.xy), min(sphereAabb.zw, boxAabb.zw));
+	vec2 size = max(aabb.zw - aabb.xy, vec2(0.f));
+
+	if (size.x < cullData.minWidth && size.y < cullData.minHeight) return REJECTED_SMALL;
+
+	bool depthTest = cullData.occlusionMode == OCCLUSION_PYRAMID || cullData.occlusionMode == OCCLUSION_LATE;
+	if (depthTest) {
+		vec2 pyramidSize = vec2(textureSize(depthPyramid, 0));
+		float width = size.x * pyramidSize.x;
+		float height = size.y * pyramidSize.y;
+
+		float level = floor(log2(max(width, height)));
+
+		float depth = textureLod(depthPyramid, (aabb.xy + aabb.zw) * 0.5, level).x;
+		// Either bounds the nearest point, the farther one is tighter
+		float nearest = sphereProjected ? center.z - radius : boxNearest;
+		if (sphereProjected && boxProjected) nearest = max(nearest, boxNearest);
+		float depthSphere = 1 - cullData.znear / nearest;
+
+		if (depthSphere > depth) return REJECTED_OCCLUSION;
+	}
+
+	return VISIBLE;
+}
+
+// Slot of a visible instance among the visible ones of its batch
+uint allocateSlot(uint batch) {
+#ifdef USE_SUBGROUPS
+	// Lanes of the batch of the first remaining lane take one range of slots together, until every lane
+	// is done. That is one round per batch among the lanes, instances are not ordered by batch, but
+	// objects registered together tend to share batches and neighbouring slots
+	for (;;) {
+		if (subgroupBroadcastFirst(batch) == batch) {
+			uvec4 lanes = subgroupBallot(true);
+			uint offset = subgroupBallotExclusiveBitCount(lanes);
+			uint first = 0;
+			if (offset == 0) first = atomicAdd(drawBuffer.draws[batch].instanceCount, subgroupBallotBitCount(lanes));
+			return subgroupBroadcastFirst(first) + offset;
+		}
+	}
+#else
+	return atomicAdd(drawBuffer.draws[batch].instanceCount, 1);
+#endif
+}
+
+// How much a lane adds to a counter for which counted lanes count one, only one lane gets a nonzero value
+uint aggregateCount(bool counted) {
+#ifdef USE_SUBGROUPS
+	uint count = subgroupBallotBitCount(subgroupBallot(counted));
+	return subgroupElect() ? count : 0;
+#else
+	return counted ? 1 : 0;
+#endif
+}
+
+void main() {
+	uint gid = gl_GlobalInvocationID.x;
+	// Lanes run to the end even without an instance, so that counts are aggregated over whole subgroups
+	bool tested = gid < cullData.maxDrawCount;
+
+	// Early phase only looks at instances visible last frame, late phase tests all of them but draws
+	// only the rest
+	bool twoPhase = cullData.occlusionMode == OCCLUSION_EARLY || cullData.occlusionMode == OCCLUSION_LATE;
+	uint objectId = 0;
+	if (tested) objectId = instanceBuffer.instances[gid].objectID;
+	bool lastVisible = tested && twoPhase && visibilityBuffer.visible[objectId] != 0;
+	if (cullData.occlusionMode == OCCLUSION_EARLY && !lastVisible) tested = false;
+
+	uint result = VISIBLE;
+	if (tested) result = testVisibility(objectId);
+	bool visible = tested && result == VISIBLE;
+
+	// Late phase tests every instance again
+	bool countRejection = tested && !visible && cullData.occlusionMode != OCCLUSION_EARLY;
+	for (uint i = 0; i < 4; i++) {
+		uint count = aggregateCount(countRejection && result == i + 1);
+		if (count > 0) atomicAdd(cullStats.rejected[i], count);
+	}
+
+	if (tested && cullData.occlusionMode == OCCLUSION_LATE) {
+		visibilityBuffer.visible[objectId] = visible ? 1 : 0;
+		visible = visible && !lastVisible;
+	}
+
+	uint earlyCount = aggregateCount(visible && cullData.occlusionMode == OCCLUSION_EARLY);
+	if (earlyCount > 0) atomicAdd(cullStats.earlyInstances, earlyCount);
+	uint lateCount = aggregateCount(visible && cullData.occlusionMode == OCCLUSION_LATE);
+	if (lateCount > 0) atomicAdd(cullStats.lateInstances, lateCount);
+
+	if (visible) {
+		// Draw of the batch starts with no instances, visible ones are packed from its first instance
+		uint batch = instanceBuffer.instances[gid].batchID;
+		uint slot = allocateSlot(batch);
+		finalInstanceBuffer.ids[drawBuffer.draws[batch].firstInstance + slot] = objectId;
+	}
+}
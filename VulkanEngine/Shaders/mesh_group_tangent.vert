@@ -0,0 +1,132 @@
+#version 460
+
+#define MAX_DIR_LIGHT 1
+#define MAX_POINT_LIGHT 2
+#define MAX_SPOT_LIGHT 2
+
+layout(location = 0) out VS_OUT {
+	vec3 color;
+	vec3 normal;
+	vec3 fragPos;
+	vec2 textureCoords;
+	vec4 worldCoords;
+	vec3 tangentViewPos;
+	vec3 tangentFragPos;
+	vec3 tangentDirLightDirection[MAX_DIR_LIGHT];
+	vec3 tangentPointLightPos[MAX_POINT_LIGHT];
+	vec3 tangentSpotLightPos[MAX_SPOT_LIGHT];
+} vs_out;
+
+layout(location = 0) in vec3 pos;
+layout(location = 1) in vec3 normal;
+layout(location = 2) in vec3 color;
+layout(location = 3) in vec2 textureCoords;
+layout(location = 4) in vec4 tangent;
+
+struct CameraData {
+	mat4 view;
+	mat4 projection;
+	mat4 viewProj;
+	vec3 pos;
+};
+
+struct DirectionalLight {
+	float ambient;
+	float diffuse;
+	float specular;
+	vec3 direction;
+	vec4 color;
+	mat4 viewProj;
+};
+
+struct PointLight {
+	float ambient;
+	float diffuse;
+	float specular;
+	vec3 position;
+	vec4 color;
+	mat4 viewProj[6];
+	float constant;
+	float linear;
+	float quadratic;
+	float farPlane;
+};
+
+struct SpotLight {
+	float ambient;
+	float diffuse;
+	float specular;
+	vec3 position;
+	vec3 direction;
+	vec4 color;
+	float cutOffInner;
+	float cutOffOuter;
+};
+
+layout(set = 0, binding = 0) uniform SceneData {
+	CameraData cameraData;
+	vec4 fogColor;
+	vec4 fogDistances;
+	uint directionalLightsCount;
+	DirectionalLight directionalLights[MAX_DIR_LIGHT];
+	uint pointLightsCount;
+	PointLight pointLights[MAX_POINT_LIGHT];
+	uint spotLightsCount;
+	SpotLight spotLights[MAX_SPOT_LIGHT];
+} sceneData;
+
+struct GroupInstance {
+	vec4 positionScale;
+	vec4 rotation;
+};
+
+layout(std430, set = 1, binding = 0) readonly buffer GroupInstanceBuffer {
+	GroupInstance instances[];
+} groupBuffer;
+
+layout(set = 1, binding = 1) readonly buffer InstanceBuffer {
+	uint ids[];
+} instanceBuffer;
+
+mat3 rotationMatrix(vec4 q) {
+	vec3 q2 = q.xyz * 2.f;
+	float xx = q.x * q2.x, yy = q.y * q2.y, zz = q.z * q2.z;
+	float xy = q.x * q2.y, xz = q.x * q2.z, yz = q.y * q2.z;
+	float wx = q.w * q2.x, wy = q.w * q2.y, wz = q.w * q2.z;
+	return mat3(1.f - yy - zz, xy + wz, xz - wy,
+	            xy - wz, 1.f - xx - zz, yz + wx,
+	            xz + wy, yz - wx, 1.f - xx - yy);
+}
+
+void main() {
+	GroupInstance instance = groupBuffer.instances[instanceBuffer.ids[gl_InstanceIndex]];
+	mat3 rotation = rotationMatrix(instance.rotation);
+	float scale = instance.positionScale.w;
+	mat4 modelMatrix = mat4(vec4(rotation[0] * scale, 0.f), vec4(rotation[1] * scale, 0.f),
+	                        vec4(rotation[2] * scale, 0.f), vec4(instance.positionScale.xyz, 1.f));
+	mat4 transformMatrix = sceneData.cameraData.viewProj * modelMatrix;
+	gl_Position = transformMatrix * vec4(pos, 1.f);
+	vs_out.color = color;
+	// Scale is uniform, so rotation alone keeps normals right
+	mat3 normalMat = rotation;
+	vs_out.normal = normalize(normalMat * normal);
+	vs_out.fragPos = vec3(modelMatrix * vec4(pos, 1.f));
+	vs_out.textureCoords = textureCoords;
+
+	vs_out.worldCoords = modelMatrix * vec4(pos, 1.f);
+
+	vec3 T = normalize(normalMat * tangent.xyz);
+	vec3 N = vs_out.normal;
+	T = normalize(T - dot(T, N) * N);
+	vec3 B = normalize(cross(N, T) * tangent.w);
+	mat3 TBN = transpose(mat3(T, B, N));
+	vs_out.tangentViewPos = TBN * sceneData.cameraData.pos;
+	vs_out.tangentFragPos = TBN * vec3(modelMatrix * vec4(pos, 1.f));
+
+  for (int i = 0; i < sceneData.directionalLightsCount; i++)
+    vs_out.tangentDirLightDirection[i] = TBN * -sceneData.directionalLights[i].direction;
+  for (int i = 0; i < sceneData.pointLightsCount; i++)
+    vs_out.tangentPointLightPos[i] = TBN * sceneData.pointLights[i].position;
+  for (int i = 0; i < sceneData.spotLightsCount; i++)
+      vs_out.tangentSpotLightPos[i] = TBN * sceneData.spotLights[i].position;
+}
\ No newline at end of file
@@ -76,8 +76,7 @@ layout(set = 0, binding = 0) uniform SceneData {
 } sceneData;
 
 struct ObjectData {
-	mat4 model;
-	mat4 normalMat;
+	vec4 modelRows[3];
 	vec4 bounds;
 	vec4 extents;
 };
@@ -86,22 +85,34 @@ layout(std140, set = 1, binding = 0) readonly buffer ObjectBuffer {
 	ObjectData objects[];
 } objectBuffer;
 
+mat4 modelMatrix(uint index) {
+	ObjectData object = objectBuffer.objects[index];
+	return transpose(mat4(object.modelRows[0], object.modelRows[1], object.modelRows[2], vec4(0, 0, 0, 1)));
+}
+
+// Inverse transpose up to scale, which normalization removes anyway
+mat3 normalMatrix(mat4 model) {
+	mat3 m = mat3(model);
+	mat3 cofactor = mat3(cross(m[1], m[2]), cross(m[2], m[0]), cross(m[0], m[1]));
+	return cofactor * sign(dot(m[0], cofactor[0]));
+}
+
 layout(set = 1, binding = 1) readonly buffer InstanceBuffer {
 	uint ids[];
 } instanceBuffer;
 
 void main() {
 	uint index = instanceBuffer.ids[gl_InstanceIndex];
-	mat4 modelMatrix = objectBuffer.objects[index].model;
-	mat4 transformMatrix = sceneData.cameraData.viewProj * modelMatrix;
+	mat4 model = modelMatrix(index);
+	mat4 transformMatrix = sceneData.cameraData.viewProj * model;
 	gl_Position = transformMatrix * vec4(pos, 1.f);
 	vs_out.color = color;
-	mat3 normalMat = mat3(objectBuffer.objects[index].normalMat);
+	mat3 normalMat = normalMatrix(model);
 	vs_out.normal = normalize(normalMat * normal);
-	vs_out.fragPos = vec3(modelMatrix * vec4(pos, 1.f));
+	vs_out.fragPos = vec3(model * vec4(pos, 1.f));
 	vs_out.textureCoords = textureCoords;
 
-	vs_out.worldCoords = modelMatrix * vec4(pos, 1.f);
+	vs_out.worldCoords = model * vec4(pos, 1.f);
 
 	vec3 T = normalize(normalMat * tangent.xyz);
 	vec3 N = vs_out.normal;
@@ -109,7 +120,7 @@ void main() {
 	vec3 B = normalize(cross(N, T) * tangent.w);
 	mat3 TBN = transpose(mat3(T, B, N));
 	vs_out.tangentViewPos = TBN * sceneData.cameraData.pos;
-	vs_out.tangentFragPos = TBN * vec3(modelMatrix * vec4(pos, 1.f));
+	vs_out.tangentFragPos = TBN * vec3(model * vec4(pos, 1.f));
 
   for (int i = 0; i < sceneData.directionalLightsCount; i++)
     vs_out.tangentDirLightDirection[i] = TBN * -sceneData.directionalLights[i].direction;
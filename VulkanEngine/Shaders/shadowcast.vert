@@ -7,8 +7,7 @@ layout(location = 3) in vec2 textureCoords;
 layout(location = 4) in vec4 tangent;
 
 struct ObjectData {
-	mat4 model;
-	mat4 normalMat;
+	vec4 modelRows[3];
 	vec4 bounds;
 	vec4 extents;
 };
@@ -17,12 +16,17 @@ layout(std140, set = 1, binding = 0) readonly buffer ObjectBuffer {
 	ObjectData objects[];
 } objectBuffer;
 
+mat4 modelMatrix(uint index) {
+	ObjectData object = objectBuffer.objects[index];
+	return transpose(mat4(object.modelRows[0], object.modelRows[1], object.modelRows[2], vec4(0, 0, 0, 1)));
+}
+
 layout(set = 1, binding = 1) readonly buffer InstanceBuffer {
 	uint ids[];
 } instanceBuffer;
 
 void main() {
 	uint index = instanceBuffer.ids[gl_InstanceIndex];
-	mat4 modelMatrix = objectBuffer.objects[index].model;
-	gl_Position = modelMatrix * vec4(pos, 1.f);
+	mat4 model = modelMatrix(index);
+	gl_Position = model * vec4(pos, 1.f);
 }
\ No newline at end of file
@@ -0,0 +1,39 @@
+#version 460
+
+layout(location = 0) in vec3 pos;
+layout(location = 1) in vec3 normal;
+layout(location = 2) in vec3 color;
+layout(location = 3) in vec2 textureCoords;
+layout(location = 4) in vec4 tangent;
+
+struct GroupInstance {
+	vec4 positionScale;
+	vec4 rotation;
+};
+
+layout(std430, set = 1, binding = 0) readonly buffer GroupInstanceBuffer {
+	GroupInstance instances[];
+} groupBuffer;
+
+layout(set = 1, binding = 1) readonly buffer InstanceBuffer {
+	uint ids[];
+} instanceBuffer;
+
+mat3 rotationMatrix(vec4 q) {
+	vec3 q2 = q.xyz * 2.f;
+	float xx = q.x * q2.x, yy = q.y * q2.y, zz = q.z * q2.z;
+	float xy = q.x * q2.y, xz = q.x * q2.z, yz = q.y * q2.z;
+	float wx = q.w * q2.x, wy = q.w * q2.y, wz = q.w * q2.z;
+	return mat3(1.f - yy - zz, xy + wz, xz - wy,
+	            xy - wz, 1.f - xx - zz, yz + wx,
+	            xz + wy, yz - wx, 1.f - xx - yy);
+}
+
+void main() {
+	GroupInstance instance = groupBuffer.instances[instanceBuffer.ids[gl_InstanceIndex]];
+	mat3 rotation = rotationMatrix(instance.rotation);
+	float scale = instance.positionScale.w;
+	mat4 modelMatrix = mat4(vec4(rotation[0] * scale, 0.f), vec4(rotation[1] * scale, 0.f),
+	                        vec4(rotation[2] * scale, 0.f), vec4(instance.positionScale.xyz, 1.f));
+	gl_Position = modelMatrix * vec4(pos, 1.f);
+}
\ No newline at end of file
@@ -0,0 +1,112 @@
+#include "BatchSort.h"
+
+#include <algorithm>
+#include <array>
+#include <functional>
+
+#include "ThreadPool.h"
+
+namespace Renderer {
+
+namespace {
+
+constexpr uint32_t kDigitBits = 11;
+constexpr uint32_t kDigitValues = 1 << kDigitBits;
+constexpr uint32_t kHandleDigits = (32 + kDigitBits - 1) / kDigitBits;
+constexpr uint32_t kDigitCount =
+    kHandleDigits + (64 + kDigitBits - 1) / kDigitBits;
+
+// Below this std::sort wins over the fixed cost of the passes
+constexpr size_t kMinRadixSortSize = 512;
+// Smallest part of the array worth handing to another worker
+constexpr size_t kMinChunkSize = 16384;
+
+// Least significant first, handle only breaks ties of the key
+uint32_t GetDigit(const RenderScene::RenderBatch& batch, uint32_t digit) {
+  if (digit < kHandleDigits)
+    return (batch.object.handle >> (digit * kDigitBits)) & (kDigitValues - 1);
+  return static_cast<uint32_t>(batch.sort_key >>
+                               ((digit - kHandleDigits) * kDigitBits)) &
+         (kDigitValues - 1);
+}
+
+}  // namespace
+
+void SortRenderBatches(std::vector<RenderScene::RenderBatch>& batches,
+                       Engine::ThreadPool* thread_pool) {
+  const size_t size = batches.size();
+  if (size < kMinRadixSortSize) {
+    std::sort(batches.begin(), batches.end(),
+              [](const RenderScene::RenderBatch& lhs,
+                 const RenderScene::RenderBatch& rhs) {
+                return (lhs.sort_key == rhs.sort_key
+                            ? lhs.object.handle < rhs.object.handle
+                            : lhs.sort_key < rhs.sort_key);
+              });
+    return;
+  }
+
+  size_t chunk_count = 1;
+  if (thread_pool != nullptr) {
+    chunk_count = std::clamp<size_t>(size / kMinChunkSize, 1,
+                                     thread_pool->GetThreadCount() + 1);
+  }
+  const size_t chunk_size = (size + chunk_count - 1) / chunk_count;
+
+  auto for_each_chunk = [&](const std::function<void(uint32_t)>& work) {
+    if (chunk_count == 1)
+      work(0);
+    else
+      thread_pool->ParallelFor(static_cast<uint32_t>(chunk_count), work);
+  };
+
+  std::vector<RenderScene::RenderBatch> scratch(size);
+  std::vector<RenderScene::RenderBatch>* src = &batches;
+  std::vector<RenderScene::RenderBatch>* dst = &scratch;
+
+  // Digit counts of every chunk, turned into scatter offsets in place
+  std::vector<std::array<size_t, kDigitValues>> offsets(chunk_count);
+
+  for (uint32_t digit = 0; digit < kDigitCount; ++digit) {
+    for_each_chunk([&](uint32_t chunk) {
+      std::array<size_t, kDigitValues>& histogram = offsets[chunk];
+      histogram.fill(0);
+
+      size_t end = std::min(size, (chunk + 1) * chunk_size);
+      for (size_t i = chunk * chunk_size; i < end; ++i)
+        ++histogram[GetDigit((*src)[i], digit)];
+    });
+
+    // Chunks of the same digit value follow each other in chunk order, which
+    // keeps the sort stable
+    bool shared_digit = false;
+    size_t offset = 0;
+    for (uint32_t value = 0; value < kDigitValues && !shared_digit; ++value) {
+      size_t value_count = 0;
+      for (size_t chunk = 0; chunk < chunk_count; ++chunk) {
+        size_t count = offsets[chunk][value];
+        offsets[chunk][value] = offset;
+        offset += count;
+        value_count += count;
+      }
+      shared_digit = value_count == size;
+    }
+    if (shared_digit) continue;
+
+    for_each_chunk([&](uint32_t chunk) {
+      std::array<size_t, kDigitValues>& scatter = offsets[chunk];
+
+      size_t end = std::min(size, (chunk + 1) * chunk_size);
+      for (size_t i = chunk * chunk_size; i < end; ++i) {
+        const RenderScene::RenderBatch& batch = (*src)[i];
+        (*dst)[scatter[GetDigit(batch, digit)]++] = batch;
+      }
+    });
+
+    std::swap(src, dst);
+  }
+
+  if (src != &batches) batches.swap(scratch);
+}
+
+}  // namespace Renderer
\ No newline at end of file
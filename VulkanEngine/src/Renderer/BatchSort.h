@@ -0,0 +1,26 @@
+#pragma once
+
+#include <vector>
+
+#include "Scene.h"
+
+namespace Engine {
+class ThreadPool;
+}
+
+namespace Renderer {
+
+/*
+Stable LSD radix sort of batches by sort key, then by object handle, same
+order as comparing the pair
+
+- 11 bit digits, passes where all batches share the digit are skipped, so
+  unused high bits of handles cost a histogram only
+- Large arrays are split into one chunk per worker, each pass counts digits
+  of chunks and scatters them in parallel
+- Small arrays fall back to std::sort, thread_pool may be null
+*/
+void SortRenderBatches(std::vector<RenderScene::RenderBatch>& batches,
+                       Engine::ThreadPool* thread_pool);
+
+}
\ No newline at end of file
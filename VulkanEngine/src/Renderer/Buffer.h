@@ -10,6 +10,7 @@
 namespace Renderer {
 
 class BufferBase {
+  friend class Defragmenter;
  public:
   BufferBase() : buffer_(VK_NULL_HANDLE), buffer_size_(0) {}
 
@@ -28,6 +29,7 @@ class BufferBase {
  protected:
   VkBuffer buffer_;
   VkDeviceSize buffer_size_;
+  VkBufferUsageFlags usage_;
   VmaAllocation allocation_;
 };
 
@@ -46,6 +48,7 @@ class Buffer : public BufferBase {
               VmaAllocationCreateFlags alloc_flags = 0) {
     allocator_ = allocator;
     buffer_size_ = size;
+    usage_ = usage;
 
     VkBufferCreateInfo buffer_info{};
     buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -0,0 +1,547 @@
+#include "Bvh.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "Mesh.h"
+
+namespace Renderer {
+
+namespace {
+
+constexpr uint32_t kBinCount = 16;
+// Leaf bounds are grown by this fraction of their size on every side
+constexpr float kMarginFraction = 0.1f;
+// Refit rebuilds instead once more than 1 / kRebuildDivisor of all leaves
+// moved since the last build
+constexpr size_t kRebuildDivisor = 4;
+
+Aabb Fatten(const Aabb& bounds) {
+  glm::vec3 margin = (bounds.max - bounds.min) * kMarginFraction;
+  return Aabb{bounds.min - margin, bounds.max + margin};
+}
+
+Aabb EmptyAabb() {
+  return Aabb{glm::vec3(std::numeric_limits<float>::max()),
+              glm::vec3(std::numeric_limits<float>::lowest())};
+}
+
+bool operator==(const Aabb& lhs, const Aabb& rhs) {
+  return lhs.min == rhs.min && lhs.max == rhs.max;
+}
+
+}  // namespace
+
+Aabb Aabb::FromBounds(const RenderBounds& bounds) {
+  return Aabb{bounds.origin - bounds.extents, bounds.origin + bounds.extents};
+}
+
+float Aabb::IntersectRay(const glm::vec3& origin,
+                         const glm::vec3& inverse_direction,
+                         float max_distance) const {
+  glm::vec3 t0 = (min - origin) * inverse_direction;
+  glm::vec3 t1 = (max - origin) * inverse_direction;
+  glm::vec3 near = glm::min(t0, t1);
+  glm::vec3 far = glm::max(t0, t1);
+  float enter = std::max(std::max(near.x, near.y), std::max(near.z, 0.f));
+  float exit = std::min(std::min(far.x, far.y), std::min(far.z, max_distance));
+  return enter <= exit ? enter : -1.f;
+}
+
+void Bvh::Build(const std::vector<Handle<SceneObject>>& objects,
+                const std::vector<Aabb>& bounds) {
+  Clear();
+  if (objects.empty()) return;
+
+  std::vector<BuildItem> items(objects.size());
+  uint32_t max_slot = 0;
+  for (size_t i = 0; i < objects.size(); ++i) {
+    items[i].bounds = Fatten(bounds[i]);
+    items[i].centroid = (bounds[i].min + bounds[i].max) * 0.5f;
+    items[i].object = objects[i];
+    max_slot = std::max(max_slot, objects[i].handle);
+  }
+
+  leaves_.assign(max_slot + 1, kNull);
+  nodes_.reserve(2 * items.size() - 1);
+  root_ = BuildRange(items, 0, items.size());
+  object_count_ = items.size();
+}
+
+void Bvh::Clear() {
+  nodes_.clear();
+  free_head_ = kNull;
+  root_ = kNull;
+  leaves_.clear();
+  object_count_ = 0;
+  moved_count_ = 0;
+  dirty_leaves_.clear();
+}
+
+void Bvh::Insert(Handle<SceneObject> object, const Aabb& bounds) {
+  if (Contains(object)) {
+    Update(object, bounds);
+    return;
+  }
+
+  int32_t leaf = AllocateNode();
+  nodes_[leaf].bounds = Fatten(bounds);
+  nodes_[leaf].object = object;
+  if (object.handle >= leaves_.size()) leaves_.resize(object.handle + 1, kNull);
+  leaves_[object.handle] = leaf;
+  InsertLeaf(leaf);
+  ++object_count_;
+}
+
+bool Bvh::Remove(Handle<SceneObject> object) {
+  int32_t leaf = GetLeaf(object);
+  if (leaf == kNull) return false;
+
+  if (nodes_[leaf].moved) --moved_count_;
+  RemoveLeaf(leaf);
+  FreeNode(leaf);
+  leaves_[object.handle] = kNull;
+  --object_count_;
+  return true;
+}
+
+void Bvh::Update(Handle<SceneObject> object, const Aabb& bounds) {
+  int32_t leaf = GetLeaf(object);
+  if (leaf == kNull) return;
+
+  Node& node = nodes_[leaf];
+  if (node.bounds.Contains(bounds)) return;
+
+  node.bounds = Fatten(bounds);
+  if (!node.moved) {
+    node.moved = true;
+    ++moved_count_;
+  }
+  if (!node.dirty) {
+    node.dirty = true;
+    dirty_leaves_.push_back(leaf);
+  }
+}
+
+void Bvh::Refit() {
+  if (moved_count_ > 0 && moved_count_ * kRebuildDivisor > object_count_) {
+    // Leaves are fat already, so they are built from as they are
+    std::vector<BuildItem> items;
+    items.reserve(object_count_);
+    for (const Node& node : nodes_) {
+      if (!node.IsLeaf() || !node.object.IsValid()) continue;
+      items.push_back(BuildItem{
+          node.bounds, (node.bounds.min + node.bounds.max) * 0.5f,
+          node.object});
+    }
+
+    std::vector<int32_t> leaves = std::move(leaves_);
+    Clear();
+    leaves_ = std::move(leaves);
+    if (items.empty()) return;
+    nodes_.reserve(2 * items.size() - 1);
+    root_ = BuildRange(items, 0, items.size());
+    object_count_ = items.size();
+    return;
+  }
+
+  // Ancestors whose bounds did not change leave theirs as they are, unless
+  // another moved leaf below them changes them
+  for (int32_t leaf : dirty_leaves_) {
+    if (!nodes_[leaf].dirty) continue;
+    nodes_[leaf].dirty = false;
+
+    for (int32_t index = nodes_[leaf].parent; index != kNull;
+         index = nodes_[index].parent) {
+      Node& node = nodes_[index];
+      Aabb bounds = nodes_[node.children[0]].bounds.Union(
+          nodes_[node.children[1]].bounds);
+      if (bounds == node.bounds) break;
+      node.bounds = bounds;
+    }
+  }
+  dirty_leaves_.clear();
+}
+
+bool Bvh::Contains(Handle<SceneObject> object) const {
+  return GetLeaf(object) != kNull;
+}
+
+void Bvh::QueryFrustum(const glm::vec4* planes, uint32_t plane_count,
+                       std::vector<Handle<SceneObject>>& result) const {
+  if (root_ == kNull) return;
+
+  // Subtrees fully inside of the frustum are taken without plane tests
+  struct Entry {
+    int32_t index;
+    bool inside;
+  };
+  std::vector<Entry> stack;
+  stack.reserve(64);
+  stack.push_back(Entry{root_, false});
+
+  while (!stack.empty()) {
+    Entry entry = stack.back();
+    stack.pop_back();
+    const Node& node = nodes_[entry.index];
+
+    bool inside = entry.inside;
+    if (!inside) {
+      bool outside = false;
+      inside = true;
+      for (uint32_t i = 0; i < plane_count && !outside; ++i) {
+        glm::vec3 normal(planes[i]);
+        glm::bvec3 positive = glm::greaterThanEqual(normal, glm::vec3(0.f));
+        glm::vec3 farthest = glm::mix(node.bounds.min, node.bounds.max,
+                                      glm::vec3(positive));
+        glm::vec3 nearest = glm::mix(node.bounds.max, node.bounds.min,
+                                     glm::vec3(positive));
+        outside = glm::dot(normal, farthest) + planes[i].w < 0.f;
+        inside = inside && glm::dot(normal, nearest) + planes[i].w >= 0.f;
+      }
+      if (outside) continue;
+    }
+
+    if (node.IsLeaf()) {
+      result.push_back(node.object);
+    } else {
+      stack.push_back(Entry{node.children[0], inside});
+      stack.push_back(Entry{node.children[1], inside});
+    }
+  }
+}
+
+void Bvh::QuerySphere(const glm::vec3& center, float radius,
+                      std::vector<Handle<SceneObject>>& result) const {
+  if (root_ == kNull) return;
+
+  std::vector<int32_t> stack;
+  stack.reserve(64);
+  stack.push_back(root_);
+  float radius_squared = radius * radius;
+
+  while (!stack.empty()) {
+    const Node& node = nodes_[stack.back()];
+    stack.pop_back();
+
+    glm::vec3 closest = glm::clamp(center, node.bounds.min, node.bounds.max);
+    glm::vec3 offset = closest - center;
+    if (glm::dot(offset, offset) > radius_squared) continue;
+
+    if (node.IsLeaf()) {
+      result.push_back(node.object);
+    } else {
+      stack.push_back(node.children[0]);
+      stack.push_back(node.children[1]);
+    }
+  }
+}
+
+void Bvh::QueryAabb(const Aabb& bounds,
+                    std::vector<Handle<SceneObject>>& result) const {
+  if (root_ == kNull) return;
+
+  std::vector<int32_t> stack;
+  stack.reserve(64);
+  stack.push_back(root_);
+
+  while (!stack.empty()) {
+    const Node& node = nodes_[stack.back()];
+    stack.pop_back();
+    if (!node.bounds.Overlaps(bounds)) continue;
+
+    if (node.IsLeaf()) {
+      result.push_back(node.object);
+    } else {
+      stack.push_back(node.children[0]);
+      stack.push_back(node.children[1]);
+    }
+  }
+}
+
+float Bvh::RayCast(const glm::vec3& origin, const glm::vec3& direction,
+                   float max_distance,
+                   const std::function<float(Handle<SceneObject>, float)>& hit,
+                   Handle<SceneObject>* hit_object) const {
+  if (root_ == kNull) return -1.f;
+
+  glm::vec3 inverse_direction = 1.f / direction;
+  float closest = max_distance;
+  bool found = false;
+
+  struct Entry {
+    int32_t index;
+    float distance;
+  };
+  std::vector<Entry> stack;
+  stack.reserve(64);
+  float root_distance =
+      nodes_[root_].bounds.IntersectRay(origin, inverse_direction, closest);
+  if (root_distance >= 0.f) stack.push_back(Entry{root_, root_distance});
+
+  while (!stack.empty()) {
+    Entry entry = stack.back();
+    stack.pop_back();
+    if (entry.distance > closest) continue;
+    const Node& node = nodes_[entry.index];
+
+    if (node.IsLeaf()) {
+      float distance = hit(node.object, entry.distance);
+      if (distance >= 0.f && distance <= closest) {
+        closest = distance;
+        found = true;
+        if (hit_object) *hit_object = node.object;
+      }
+      continue;
+    }
+
+    Entry children[2];
+    for (int i = 0; i < 2; ++i) {
+      children[i].index = node.children[i];
+      children[i].distance = nodes_[node.children[i]].bounds.IntersectRay(
+          origin, inverse_direction, closest);
+    }
+    // Nearer child is popped first
+    if (children[0].distance >= 0.f && children[1].distance >= 0.f &&
+        children[0].distance < children[1].distance)
+      std::swap(children[0], children[1]);
+    for (const Entry& child : children) {
+      if (child.distance >= 0.f) stack.push_back(child);
+    }
+  }
+
+  return found ? closest : -1.f;
+}
+
+uint32_t Bvh::GetDepth() const {
+  if (root_ == kNull) return 0;
+
+  uint32_t depth = 0;
+  std::vector<std::pair<int32_t, uint32_t>> stack = {{root_, 1}};
+  while (!stack.empty()) {
+    auto [index, node_depth] = stack.back();
+    stack.pop_back();
+    depth = std::max(depth, node_depth);
+    if (nodes_[index].IsLeaf()) continue;
+    stack.push_back({nodes_[index].children[0], node_depth + 1});
+    stack.push_back({nodes_[index].children[1], node_depth + 1});
+  }
+  return depth;
+}
+
+float Bvh::GetSahCost() const {
+  if (root_ == kNull) return 0.f;
+
+  float area = 0.f;
+  for (const Node& node : nodes_) {
+    if (!node.IsLeaf()) area += node.bounds.SurfaceArea();
+  }
+  float root_area = nodes_[root_].bounds.SurfaceArea();
+  return root_area > 0.f ? area / root_area : 0.f;
+}
+
+int32_t Bvh::AllocateNode() {
+  if (free_head_ == kNull) {
+    nodes_.emplace_back();
+    return static_cast<int32_t>(nodes_.size() - 1);
+  }
+
+  int32_t index = free_head_;
+  free_head_ = nodes_[index].parent;
+  nodes_[index] = Node();
+  return index;
+}
+
+void Bvh::FreeNode(int32_t index) {
+  // Free nodes look like leaves without object, and link through parent
+  Node& node = nodes_[index];
+  node = Node();
+  node.parent = free_head_;
+  free_head_ = index;
+}
+
+int32_t Bvh::BuildRange(std::vector<BuildItem>& items, size_t first,
+                        size_t last) {
+  // Nodes may move while children are built, so they are accessed by index
+  int32_t index = AllocateNode();
+
+  if (last - first == 1) {
+    nodes_[index].bounds = items[first].bounds;
+    nodes_[index].object = items[first].object;
+    leaves_[items[first].object.handle] = index;
+    return index;
+  }
+
+  Aabb bounds = EmptyAabb();
+  Aabb centroids = EmptyAabb();
+  for (size_t i = first; i < last; ++i) {
+    bounds = bounds.Union(items[i].bounds);
+    centroids = centroids.Union(Aabb{items[i].centroid, items[i].centroid});
+  }
+
+  glm::vec3 size = centroids.max - centroids.min;
+  int axis = size.x > size.y ? (size.x > size.z ? 0 : 2)
+                             : (size.y > size.z ? 1 : 2);
+  float extent = size[axis];
+
+  size_t middle = first;
+  if (extent > 0.f) {
+    struct Bin {
+      Aabb bounds = EmptyAabb();
+      size_t count = 0;
+    };
+    Bin bins[kBinCount];
+    float scale = kBinCount / extent;
+    auto bin_of = [&](const BuildItem& item) {
+      uint32_t bin = static_cast<uint32_t>(
+          (item.centroid[axis] - centroids.min[axis]) * scale);
+      return std::min(bin, kBinCount - 1);
+    };
+    for (size_t i = first; i < last; ++i) {
+      Bin& bin = bins[bin_of(items[i])];
+      bin.bounds = bin.bounds.Union(items[i].bounds);
+      ++bin.count;
+    }
+
+    // Cost of splitting after every bin, right sides swept first
+    float right_costs[kBinCount];
+    Aabb right = EmptyAabb();
+    size_t right_count = 0;
+    for (uint32_t i = kBinCount - 1; i > 0; --i) {
+      right = right.Union(bins[i].bounds);
+      right_count += bins[i].count;
+      right_costs[i - 1] =
+          right_count > 0 ? right.SurfaceArea() * right_count : 0.f;
+    }
+
+    float best_cost = std::numeric_limits<float>::max();
+    uint32_t best_split = 0;
+    Aabb left = EmptyAabb();
+    size_t left_count = 0;
+    for (uint32_t i = 0; i < kBinCount - 1; ++i) {
+      left = left.Union(bins[i].bounds);
+      left_count += bins[i].count;
+      if (left_count == 0 || left_count == last - first) continue;
+      float cost = left.SurfaceArea() * left_count + right_costs[i];
+      if (cost < best_cost) {
+        best_cost = cost;
+        best_split = i;
+      }
+    }
+
+    middle = std::partition(items.begin() + first, items.begin() + last,
+                            [&](const BuildItem& item) {
+                              return bin_of(item) <= best_split;
+                            }) -
+             items.begin();
+  }
+
+  // Centroids all in one place, or in one bin due to rounding
+  if (middle == first || middle == last) {
+    middle = first + (last - first) / 2;
+    std::nth_element(items.begin() + first, items.begin() + middle,
+                     items.begin() + last,
+                     [axis](const BuildItem& lhs, const BuildItem& rhs) {
+                       return lhs.centroid[axis] < rhs.centroid[axis];
+                     });
+  }
+
+  int32_t left_child = BuildRange(items, first, middle);
+  int32_t right_child = BuildRange(items, middle, last);
+  Node& node = nodes_[index];
+  node.bounds = bounds;
+  node.children[0] = left_child;
+  node.children[1] = right_child;
+  nodes_[left_child].parent = index;
+  nodes_[right_child].parent = index;
+  return index;
+}
+
+void Bvh::InsertLeaf(int32_t leaf) {
+  if (root_ == kNull) {
+    root_ = leaf;
+    nodes_[leaf].parent = kNull;
+    return;
+  }
+
+  // Descend towards the sibling whose union with the leaf costs the least,
+  // inherited cost is the growth of every ancestor on the way
+  Aabb leaf_bounds = nodes_[leaf].bounds;
+  int32_t sibling = root_;
+  while (!nodes_[sibling].IsLeaf()) {
+    const Node& node = nodes_[sibling];
+    float area = node.bounds.SurfaceArea();
+    float combined_area = node.bounds.Union(leaf_bounds).SurfaceArea();
+    float cost = 2.f * combined_area;
+    float inheritance = 2.f * (combined_area - area);
+
+    float child_costs[2];
+    for (int i = 0; i < 2; ++i) {
+      const Node& child = nodes_[node.children[i]];
+      float union_area = child.bounds.Union(leaf_bounds).SurfaceArea();
+      child_costs[i] = inheritance + (child.IsLeaf()
+                                          ? union_area
+                                          : union_area -
+                                                child.bounds.SurfaceArea());
+    }
+
+    if (cost < child_costs[0] && cost < child_costs[1]) break;
+    sibling = node.children[child_costs[0] < child_costs[1] ? 0 : 1];
+  }
+
+  int32_t old_parent = nodes_[sibling].parent;
+  int32_t new_parent = AllocateNode();
+  nodes_[new_parent].parent = old_parent;
+  nodes_[new_parent].children[0] = sibling;
+  nodes_[new_parent].children[1] = leaf;
+  nodes_[sibling].parent = new_parent;
+  nodes_[leaf].parent = new_parent;
+
+  if (old_parent == kNull) {
+    root_ = new_parent;
+  } else {
+    Node& parent = nodes_[old_parent];
+    parent.children[parent.children[0] == sibling ? 0 : 1] = new_parent;
+  }
+  RefitUpwards(new_parent);
+}
+
+void Bvh::RemoveLeaf(int32_t leaf) {
+  if (leaf == root_) {
+    root_ = kNull;
+    return;
+  }
+
+  int32_t parent = nodes_[leaf].parent;
+  int32_t grandparent = nodes_[parent].parent;
+  int32_t sibling = nodes_[parent].children[0] == leaf
+                        ? nodes_[parent].children[1]
+                        : nodes_[parent].children[0];
+
+  nodes_[sibling].parent = grandparent;
+  if (grandparent == kNull) {
+    root_ = sibling;
+  } else {
+    Node& node = nodes_[grandparent];
+    node.children[node.children[0] == parent ? 0 : 1] = sibling;
+    RefitUpwards(grandparent);
+  }
+  FreeNode(parent);
+}
+
+void Bvh::RefitUpwards(int32_t index) {
+  for (; index != kNull; index = nodes_[index].parent) {
+    Node& node = nodes_[index];
+    node.bounds = nodes_[node.children[0]].bounds.Union(
+        nodes_[node.children[1]].bounds);
+  }
+}
+
+int32_t Bvh::GetLeaf(Handle<SceneObject> object) const {
+  if (object.handle >= leaves_.size()) return kNull;
+  int32_t leaf = leaves_[object.handle];
+  if (leaf == kNull || nodes_[leaf].object != object) return kNull;
+  return leaf;
+}
+
+}  // namespace Renderer
\ No newline at end of file
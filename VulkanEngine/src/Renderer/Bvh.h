@@ -0,0 +1,145 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "SlotMap.h"
+
+namespace Renderer {
+
+struct RenderBounds;
+struct SceneObject;
+
+struct Aabb {
+  glm::vec3 min{0.f};
+  glm::vec3 max{0.f};
+
+  static Aabb FromBounds(const RenderBounds& bounds);
+
+  Aabb Union(const Aabb& other) const {
+    return Aabb{glm::min(min, other.min), glm::max(max, other.max)};
+  }
+  bool Contains(const Aabb& other) const {
+    return glm::all(glm::lessThanEqual(min, other.min)) &&
+           glm::all(glm::greaterThanEqual(max, other.max));
+  }
+  bool Overlaps(const Aabb& other) const {
+    return glm::all(glm::lessThanEqual(min, other.max)) &&
+           glm::all(glm::greaterThanEqual(max, other.min));
+  }
+  /*
+  Distance the ray enters at, within max_distance, negative for a miss.
+  Rays starting inside enter at 0
+  */
+  float IntersectRay(const glm::vec3& origin,
+                     const glm::vec3& inverse_direction,
+                     float max_distance) const;
+  float SurfaceArea() const {
+    glm::vec3 size = max - min;
+    return 2.f * (size.x * size.y + size.y * size.z + size.z * size.x);
+  }
+};
+
+/*
+Dynamic bounding volume hierarchy over scene objects, one object per leaf
+
+- Build sorts all objects top down with binned SAH, best quality, meant for
+  loading and for when updates degraded the tree
+- Leaves keep their bounds grown by a margin, objects moving within it cost
+  nothing. Objects leaving it get new leaf bounds, and Refit fixes bounds of
+  all nodes above them in one bottom up pass
+- Insert descends to the sibling that grows the tree the least, remove
+  splices the leaf out, neither touches the rest of the tree
+*/
+class Bvh {
+ public:
+  void Build(const std::vector<Handle<SceneObject>>& objects,
+             const std::vector<Aabb>& bounds);
+  void Clear();
+
+  void Insert(Handle<SceneObject> object, const Aabb& bounds);
+  // Returns false if object is not in the tree
+  bool Remove(Handle<SceneObject> object);
+  /*
+  New bounds of object already in the tree, ancestors are fixed by the next
+  Refit
+  */
+  void Update(Handle<SceneObject> object, const Aabb& bounds);
+  void Refit();
+  bool Contains(Handle<SceneObject> object) const;
+
+  /*
+  Objects whose bounds are not fully outside of any plane
+
+  - Planes point inwards, xyz is the normal and w the distance
+  */
+  void QueryFrustum(const glm::vec4* planes, uint32_t plane_count,
+                    std::vector<Handle<SceneObject>>& result) const;
+  void QuerySphere(const glm::vec3& center, float radius,
+                   std::vector<Handle<SceneObject>>& result) const;
+  void QueryAabb(const Aabb& bounds,
+                 std::vector<Handle<SceneObject>>& result) const;
+  /*
+  Walk objects whose bounds the ray enters within max_distance, nearer nodes
+  first. hit gets the distance the ray enters the bounds at and returns the
+  distance of the actual hit on the object, or a negative value for a miss
+
+  - Returns distance of the closest hit, negative if nothing was hit
+  - Hits shorten the ray, so farther subtrees are skipped
+  */
+  float RayCast(const glm::vec3& origin, const glm::vec3& direction,
+                float max_distance,
+                const std::function<float(Handle<SceneObject>, float)>& hit,
+                Handle<SceneObject>* hit_object = nullptr) const;
+
+  size_t GetObjectCount() const { return object_count_; }
+  uint32_t GetDepth() const;
+  // Sum of inner node surface areas relative to root, lower is better
+  float GetSahCost() const;
+  // Leaves that left their bounds since the last build
+  uint32_t GetMovedCount() const { return moved_count_; }
+
+ private:
+  static constexpr int32_t kNull = -1;
+
+  struct Node {
+    Aabb bounds;
+    int32_t parent = kNull;
+    int32_t children[2] = {kNull, kNull};
+    Handle<SceneObject> object;
+    // Ancestors have to be refit
+    bool dirty = false;
+    // Left its bounds since the last build
+    bool moved = false;
+
+    bool IsLeaf() const { return children[0] == kNull; }
+  };
+
+  struct BuildItem {
+    Aabb bounds;
+    glm::vec3 centroid;
+    Handle<SceneObject> object;
+  };
+
+  int32_t AllocateNode();
+  void FreeNode(int32_t index);
+  int32_t BuildRange(std::vector<BuildItem>& items, size_t first, size_t last);
+  void InsertLeaf(int32_t leaf);
+  void RemoveLeaf(int32_t leaf);
+  void RefitUpwards(int32_t index);
+  int32_t GetLeaf(Handle<SceneObject> object) const;
+
+  std::vector<Node> nodes_;
+  int32_t free_head_ = kNull;
+  int32_t root_ = kNull;
+  // Leaf of every object, indexed by slot of its handle
+  std::vector<int32_t> leaves_;
+  size_t object_count_ = 0;
+  uint32_t moved_count_ = 0;
+  std::vector<int32_t> dirty_leaves_;
+};
+
+}
\ No newline at end of file
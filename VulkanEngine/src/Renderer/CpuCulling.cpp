@@ -0,0 +1,445 @@
+#include "CpuCulling.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "ThreadPool.h"
+#include "VulkanEngine.h"
+
+// MSVC compiles intrinsics of any instruction set without extra flags
+#ifdef _MSC_VER
+#define CULL_TARGET_AVX2
+#else
+#define CULL_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace Renderer {
+
+namespace {
+
+// Instances per job, a multiple of the widest vector
+constexpr uint32_t kChunkSize = 4096;
+
+bool SupportsAvx2() {
+#ifdef _MSC_VER
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7) return false;
+  __cpuid(info, 1);
+  // OS has to save upper halves of registers as well
+  bool os_saves_ymm = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+  __cpuidex(info, 7, 0);
+  return os_saves_ymm && (info[1] & (1 << 5)) != 0;
+#else
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+
+// Instance bounds gathered by object id, one array per component
+struct SphereArrays {
+  std::vector<float> x;
+  std::vector<float> y;
+  std::vector<float> z;
+  std::vector<float> radius;
+};
+
+struct SphereTest {
+  // First three rows of view matrix
+  float view[3][4];
+  float frustum[4];
+  float z_near;
+  float z_far;
+  bool dist_cull;
+};
+
+glm::vec3 ToView(const SphereTest& test, float x, float y, float z) {
+  return glm::vec3(
+      test.view[0][0] * x + test.view[0][1] * y + test.view[0][2] * z +
+          test.view[0][3],
+      test.view[1][0] * x + test.view[1][1] * y + test.view[1][2] * z +
+          test.view[1][3],
+      test.view[2][0] * x + test.view[2][1] * y + test.view[2][2] * z +
+          test.view[2][3]);
+}
+
+bool IsSphereVisible(const SphereTest& test, const glm::vec3& center,
+                     float radius) {
+  bool visible = center.z * test.frustum[1] -
+                         std::abs(center.x) * test.frustum[0] >
+                     -radius &&
+                 center.z * test.frustum[3] -
+                         std::abs(center.y) * test.frustum[2] >
+                     -radius;
+  if (test.dist_cull) {
+    visible = visible && -center.z + radius > test.z_near &&
+              -center.z - radius < test.z_far;
+  }
+  return visible;
+}
+
+void TestSpheresScalar(const SphereArrays& spheres, const SphereTest& test,
+                       uint32_t first, uint32_t last, uint8_t* visible) {
+  for (uint32_t i = first; i < last; ++i) {
+    glm::vec3 center = ToView(test, spheres.x[i], spheres.y[i], spheres.z[i]);
+    visible[i] = IsSphereVisible(test, center, spheres.radius[i]);
+  }
+}
+
+void TestSpheresSse(const SphereArrays& spheres, const SphereTest& test,
+                    uint32_t first, uint32_t last, uint8_t* visible) {
+  const __m128 sign_mask = _mm_set1_ps(-0.f);
+  const __m128 zero = _mm_setzero_ps();
+  __m128 view[3][4];
+  for (int row = 0; row < 3; ++row) {
+    for (int column = 0; column < 4; ++column)
+      view[row][column] = _mm_set1_ps(test.view[row][column]);
+  }
+  const __m128 frustum0 = _mm_set1_ps(test.frustum[0]);
+  const __m128 frustum1 = _mm_set1_ps(test.frustum[1]);
+  const __m128 frustum2 = _mm_set1_ps(test.frustum[2]);
+  const __m128 frustum3 = _mm_set1_ps(test.frustum[3]);
+  const __m128 z_near = _mm_set1_ps(test.z_near);
+  const __m128 z_far = _mm_set1_ps(test.z_far);
+
+  uint32_t i = first;
+  for (; i + 4 <= last; i += 4) {
+    __m128 x = _mm_loadu_ps(&spheres.x[i]);
+    __m128 y = _mm_loadu_ps(&spheres.y[i]);
+    __m128 z = _mm_loadu_ps(&spheres.z[i]);
+    __m128 radius = _mm_loadu_ps(&spheres.radius[i]);
+
+    __m128 center[3];
+    for (int row = 0; row < 3; ++row) {
+      center[row] = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(view[row][0], x), _mm_mul_ps(view[row][1], y)),
+          _mm_add_ps(_mm_mul_ps(view[row][2], z), view[row][3]));
+    }
+    __m128 abs_x = _mm_andnot_ps(sign_mask, center[0]);
+    __m128 abs_y = _mm_andnot_ps(sign_mask, center[1]);
+    __m128 negative_radius = _mm_sub_ps(zero, radius);
+
+    __m128 mask = _mm_and_ps(
+        _mm_cmpgt_ps(_mm_sub_ps(_mm_mul_ps(center[2], frustum1),
+                                _mm_mul_ps(abs_x, frustum0)),
+                     negative_radius),
+        _mm_cmpgt_ps(_mm_sub_ps(_mm_mul_ps(center[2], frustum3),
+                                _mm_mul_ps(abs_y, frustum2)),
+                     negative_radius));
+    if (test.dist_cull) {
+      __m128 depth = _mm_sub_ps(zero, center[2]);
+      mask = _mm_and_ps(mask,
+                        _mm_cmpgt_ps(_mm_add_ps(depth, radius), z_near));
+      mask = _mm_and_ps(mask, _mm_cmplt_ps(_mm_sub_ps(depth, radius), z_far));
+    }
+
+    int bits = _mm_movemask_ps(mask);
+    for (int lane = 0; lane < 4; ++lane) visible[i + lane] = (bits >> lane) & 1;
+  }
+  TestSpheresScalar(spheres, test, i, last, visible);
+}
+
+CULL_TARGET_AVX2 void TestSpheresAvx2(const SphereArrays& spheres,
+                                      const SphereTest& test, uint32_t first,
+                                      uint32_t last, uint8_t* visible) {
+  const __m256 sign_mask = _mm256_set1_ps(-0.f);
+  const __m256 zero = _mm256_setzero_ps();
+  __m256 view[3][4];
+  for (int row = 0; row < 3; ++row) {
+    for (int column = 0; column < 4; ++column)
+      view[row][column] = _mm256_set1_ps(test.view[row][column]);
+  }
+  const __m256 frustum0 = _mm256_set1_ps(test.frustum[0]);
+  const __m256 frustum1 = _mm256_set1_ps(test.frustum[1]);
+  const __m256 frustum2 = _mm256_set1_ps(test.frustum[2]);
+  const __m256 frustum3 = _mm256_set1_ps(test.frustum[3]);
+  const __m256 z_near = _mm256_set1_ps(test.z_near);
+  const __m256 z_far = _mm256_set1_ps(test.z_far);
+
+  uint32_t i = first;
+  for (; i + 8 <= last; i += 8) {
+    __m256 x = _mm256_loadu_ps(&spheres.x[i]);
+    __m256 y = _mm256_loadu_ps(&spheres.y[i]);
+    __m256 z = _mm256_loadu_ps(&spheres.z[i]);
+    __m256 radius = _mm256_loadu_ps(&spheres.radius[i]);
+
+    __m256 center[3];
+    for (int row = 0; row < 3; ++row) {
+      center[row] = _mm256_add_ps(
+          _mm256_add_ps(_mm256_mul_ps(view[row][0], x),
+                        _mm256_mul_ps(view[row][1], y)),
+          _mm256_add_ps(_mm256_mul_ps(view[row][2], z), view[row][3]));
+    }
+    __m256 abs_x = _mm256_andnot_ps(sign_mask, center[0]);
+    __m256 abs_y = _mm256_andnot_ps(sign_mask, center[1]);
+    __m256 negative_radius = _mm256_sub_ps(zero, radius);
+
+    __m256 mask = _mm256_and_ps(
+        _mm256_cmp_ps(_mm256_sub_ps(_mm256_mul_ps(center[2], frustum1),
+                                    _mm256_mul_ps(abs_x, frustum0)),
+                      negative_radius, _CMP_GT_OQ),
+        _mm256_cmp_ps(_mm256_sub_ps(_mm256_mul_ps(center[2], frustum3),
+                                    _mm256_mul_ps(abs_y, frustum2)),
+                      negative_radius, _CMP_GT_OQ));
+    if (test.dist_cull) {
+      __m256 depth = _mm256_sub_ps(zero, center[2]);
+      mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_add_ps(depth, radius),
+                                               z_near, _CMP_GT_OQ));
+      mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_sub_ps(depth, radius),
+                                               z_far, _CMP_LT_OQ));
+    }
+
+    int bits = _mm256_movemask_ps(mask);
+    for (int lane = 0; lane < 8; ++lane) visible[i + lane] = (bits >> lane) & 1;
+  }
+  TestSpheresScalar(spheres, test, i, last, visible);
+}
+
+// Same as projectSphere of indirect_cull.glsl
+bool ProjectSphere(const glm::vec3& center, float radius, float z_near,
+                   float P00, float P11, glm::vec4& aabb) {
+  if (center.z < radius + z_near) return false;
+
+  glm::vec2 cx(-center.x, -center.z);
+  glm::vec2 vx(std::sqrt(glm::dot(cx, cx) - radius * radius), radius);
+  glm::vec2 min_x = glm::mat2(vx.x, vx.y, -vx.y, vx.x) * cx;
+  glm::vec2 max_x = glm::mat2(vx.x, -vx.y, vx.y, vx.x) * cx;
+
+  glm::vec2 cy(-center.y, -center.z);
+  glm::vec2 vy(std::sqrt(glm::dot(cy, cy) - radius * radius), radius);
+  glm::vec2 min_y = glm::mat2(vy.x, vy.y, -vy.y, vy.x) * cy;
+  glm::vec2 max_y = glm::mat2(vy.x, -vy.y, vy.y, vy.x) * cy;
+
+  aabb = glm::vec4(min_x.x / min_x.y * P00, min_y.x / min_y.y * P11,
+                   max_x.x / max_x.y * P00, max_y.x / max_y.y * P11);
+  aabb = glm::vec4(aabb.x, aabb.w, aabb.z, aabb.y) *
+             glm::vec4(0.5f, -0.5f, 0.5f, -0.5f) +
+         glm::vec4(0.5f);
+  return true;
+}
+
+/*
+Linear filtered lookup with max reduction, as the depth sampler does it,
+i.e. the farthest of the four texels around uv
+*/
+float SamplePyramid(const CpuDepthPyramid& pyramid, glm::vec2 uv,
+                    float level) {
+  uint32_t max_level = static_cast<uint32_t>(pyramid.levels.size() - 1);
+  uint32_t mip = static_cast<uint32_t>(
+      std::clamp(level, 0.f, static_cast<float>(max_level)));
+  int32_t width = std::max(static_cast<int32_t>(pyramid.width >> mip), 1);
+  int32_t height = std::max(static_cast<int32_t>(pyramid.height >> mip), 1);
+  const std::vector<float>& texels = pyramid.levels[mip];
+
+  int32_t x0 = static_cast<int32_t>(std::floor(uv.x * width - 0.5f));
+  int32_t y0 = static_cast<int32_t>(std::floor(uv.y * height - 0.5f));
+  float depth = 0.f;
+  for (int32_t y : {y0, y0 + 1}) {
+    for (int32_t x : {x0, x0 + 1}) {
+      int32_t clamped_x = std::clamp(x, 0, width - 1);
+      int32_t clamped_y = std::clamp(y, 0, height - 1);
+      depth = std::max(depth, texels[clamped_y * width + clamped_x]);
+    }
+  }
+  return depth;
+}
+
+// Same as projectBox of indirect_cull.glsl
+bool ProjectBox(const DrawCullData& cull_data, const glm::vec3& center,
+                const glm::vec3& extents, glm::vec4& aabb, float& nearest) {
+  glm::mat3 axes = glm::mat3(cull_data.view) *
+                   glm::mat3(extents.x, 0.f, 0.f, 0.f, extents.y, 0.f, 0.f,
+                             0.f, extents.z);
+  for (int axis = 0; axis < 3; ++axis) {
+    axes[axis].y *= -1;
+    axes[axis].z *= -1;
+  }
+
+  nearest = center.z;
+  for (int i = 0; i < 8; ++i) {
+    glm::vec3 corner = center;
+    corner += (i & 1) != 0 ? axes[0] : -axes[0];
+    corner += (i & 2) != 0 ? axes[1] : -axes[1];
+    corner += (i & 4) != 0 ? axes[2] : -axes[2];
+    if (corner.z < cull_data.z_near) return false;
+
+    glm::vec2 uv = glm::vec2(corner) / corner.z *
+                       glm::vec2(cull_data.P00, cull_data.P11) *
+                       glm::vec2(0.5f, -0.5f) +
+                   glm::vec2(0.5f);
+    // Starts at the first corner, so that a box off screen ends up outside
+    // of 0 to 1
+    if (i == 0) {
+      aabb = glm::vec4(uv, uv);
+    } else {
+      aabb.x = std::min(aabb.x, uv.x);
+      aabb.y = std::min(aabb.y, uv.y);
+      aabb.z = std::max(aabb.z, uv.x);
+      aabb.w = std::max(aabb.w, uv.y);
+    }
+    nearest = std::min(nearest, corner.z);
+  }
+  return true;
+}
+
+/*
+Tests of testVisibility in indirect_cull.glsl that follow the sphere
+test, on view space center
+
+- pyramid is null if occlusion is skipped
+*/
+bool IsProjectionVisible(const DrawCullData& cull_data,
+                         const CpuDepthPyramid* pyramid, glm::vec3 center,
+                         float radius, const glm::vec3& extents) {
+  center.y *= -1;
+  center.z *= -1;
+
+  glm::vec4 sphere_aabb;
+  bool sphere_projected =
+      ProjectSphere(center, radius, cull_data.z_near, cull_data.P00,
+                    cull_data.P11, sphere_aabb);
+  glm::vec4 box_aabb;
+  float box_nearest;
+  bool box_projected =
+      ProjectBox(cull_data, center, extents, box_aabb, box_nearest);
+
+  if (box_projected && (box_aabb.z < 0 || box_aabb.x > 1 || box_aabb.w < 0 ||
+                        box_aabb.y > 1))
+    return false;
+  if (!sphere_projected && !box_projected) return true;
+
+  glm::vec4 aabb = sphere_projected ? sphere_aabb : box_aabb;
+  if (sphere_projected && box_projected) {
+    aabb = glm::vec4(std::max(sphere_aabb.x, box_aabb.x),
+                     std::max(sphere_aabb.y, box_aabb.y),
+                     std::min(sphere_aabb.z, box_aabb.z),
+                     std::min(sphere_aabb.w, box_aabb.w));
+  }
+  glm::vec2 size = glm::max(glm::vec2(aabb.z, aabb.w) -
+                                glm::vec2(aabb.x, aabb.y),
+                            glm::vec2(0.f));
+
+  if (size.x < cull_data.min_width && size.y < cull_data.min_height)
+    return false;
+  if (!pyramid) return true;
+
+  float width = size.x * pyramid->width;
+  float height = size.y * pyramid->height;
+  float level = std::floor(std::log2(std::max(width, height)));
+
+  float depth = SamplePyramid(
+      *pyramid, (glm::vec2(aabb.x, aabb.y) + glm::vec2(aabb.z, aabb.w)) * 0.5f,
+      level);
+  float nearest = sphere_projected ? center.z - radius : box_nearest;
+  if (sphere_projected && box_projected)
+    nearest = std::max(nearest, box_nearest);
+  float sphere_depth = 1 - cull_data.z_near / nearest;
+  return sphere_depth <= depth;
+}
+
+}  // namespace
+
+void GatherCullInput(RenderScene& scene, RenderScene::MeshPass& pass,
+                     CpuCullInput& input) {
+  input.instances.resize(pass.instances.size());
+  for (uint32_t i = 0; i < pass.instances.size(); ++i)
+    scene.WriteInstance(&input.instances[i], pass, i);
+
+  input.object_bounds.resize(scene.renderables.GetSize());
+  input.object_extents.resize(scene.renderables.GetSize());
+  for (uint32_t i = 0; i < scene.renderables.GetSize(); ++i) {
+    const RenderBounds& bounds = scene.renderables.bounds[i];
+    input.object_bounds[i] = glm::vec4(bounds.origin, bounds.radius);
+    input.object_extents[i] = bounds.extents;
+  }
+
+  input.draws.resize(pass.indirect_batches.size());
+  scene.FillIndirectArray(input.draws.data(), pass);
+}
+
+void CullOnCpu(const CpuCullInput& input, const DrawCullData& cull_data,
+               const CpuDepthPyramid* pyramid, Engine::ThreadPool* thread_pool,
+               CpuCullOutput& output) {
+  static const bool kHasAvx2 = SupportsAvx2();
+
+  uint32_t count = static_cast<uint32_t>(input.instances.size());
+  output.visible.assign(count, 1);
+
+  SphereTest test;
+  for (int row = 0; row < 3; ++row) {
+    for (int column = 0; column < 4; ++column)
+      test.view[row][column] = cull_data.view[column][row];
+  }
+  std::copy(cull_data.frustum, cull_data.frustum + 4, test.frustum);
+  test.z_near = cull_data.z_near;
+  test.z_far = cull_data.z_far;
+  test.dist_cull = cull_data.dist_cull != 0;
+  bool occlusion = cull_data.occlusion_mode == OcclusionMode::kPyramid &&
+                   pyramid && !pyramid->levels.empty();
+  const CpuDepthPyramid* occlusion_pyramid = occlusion ? pyramid : nullptr;
+
+  SphereArrays spheres;
+  spheres.x.resize(count);
+  spheres.y.resize(count);
+  spheres.z.resize(count);
+  spheres.radius.resize(count);
+
+  auto cull_chunk = [&](uint32_t chunk) {
+    uint32_t first = chunk * kChunkSize;
+    uint32_t last = std::min(first + kChunkSize, count);
+
+    for (uint32_t i = first; i < last; ++i) {
+      const glm::vec4& bounds =
+          input.object_bounds[input.instances[i].object_id];
+      spheres.x[i] = bounds.x;
+      spheres.y[i] = bounds.y;
+      spheres.z[i] = bounds.z;
+      spheres.radius[i] = bounds.w;
+    }
+
+    if (kHasAvx2)
+      TestSpheresAvx2(spheres, test, first, last, output.visible.data());
+    else
+      TestSpheresSse(spheres, test, first, last, output.visible.data());
+
+    for (uint32_t i = first; i < last; ++i) {
+      if (!output.visible[i]) continue;
+      glm::vec3 center =
+          ToView(test, spheres.x[i], spheres.y[i], spheres.z[i]);
+      const glm::vec3& extents =
+          input.object_extents[input.instances[i].object_id];
+      if (!IsProjectionVisible(cull_data, occlusion_pyramid, center,
+                               spheres.radius[i], extents))
+        output.visible[i] = 0;
+    }
+  };
+
+  if (cull_data.culling_enabled) {
+    uint32_t chunk_count = (count + kChunkSize - 1) / kChunkSize;
+    if (thread_pool && chunk_count > 1) {
+      thread_pool->ParallelFor(chunk_count, cull_chunk);
+    } else {
+      for (uint32_t chunk = 0; chunk < chunk_count; ++chunk)
+        cull_chunk(chunk);
+    }
+  }
+
+  // Compaction is a single pass over flags, not worth splitting
+  output.draws = input.draws;
+  output.instance_ids.assign(count, 0);
+  for (uint32_t i = 0; i < count; ++i) {
+    if (!output.visible[i]) continue;
+
+    const GPUInstance& instance = input.instances[i];
+    VkDrawIndexedIndirectCommand& command =
+        output.draws[instance.batch_id].command;
+    output.instance_ids[command.firstInstance + command.instanceCount++] =
+        instance.object_id;
+  }
+}
+
+}  // namespace Renderer
\ No newline at end of file
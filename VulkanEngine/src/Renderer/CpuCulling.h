@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Scene.h"
+
+namespace Engine {
+class ThreadPool;
+}
+
+namespace Renderer {
+
+struct DrawCullData;
+
+/*
+Depth pyramid read back from GPU, every level row by row, level 0 first
+*/
+struct CpuDepthPyramid {
+  uint32_t width = 0;
+  uint32_t height = 0;
+  std::vector<std::vector<float>> levels;
+};
+
+/*
+Everything culling of a pass reads, in the layout uploaded to the GPU
+*/
+struct CpuCullInput {
+  std::vector<GPUInstance> instances;
+  // Bounding sphere of every object, indexed by object id
+  std::vector<glm::vec4> object_bounds;
+  // Half extents of world space box of every object, around sphere center
+  std::vector<glm::vec3> object_extents;
+  // Draws before culling, see RenderScene::FillIndirectArray
+  std::vector<GPUIndirectObject> draws;
+};
+
+/*
+Culled draws as indirect_cull.glsl leaves them
+
+- Ids in the range of a batch are in instance order, the GPU orders them by
+  whichever invocation came first
+- Ids past the visible instances of a batch are left 0, the GPU does not
+  write them
+*/
+struct CpuCullOutput {
+  std::vector<GPUIndirectObject> draws;
+  std::vector<uint32_t> instance_ids;
+  std::vector<uint8_t> visible;
+};
+
+void GatherCullInput(RenderScene& scene, RenderScene::MeshPass& pass,
+                     CpuCullInput& input);
+
+/*
+Cull instances of a pass the same way testVisibility of indirect_cull.glsl
+does, and pack them into the draws of their batches
+
+- Sphere and distance tests run 8 instances at a time with AVX2, 4 with SSE
+  on CPUs without it. Box, small feature and depth pyramid tests are scalar,
+  on the instances that pass
+- Occlusion is skipped if pyramid is null. thread_pool may be null
+*/
+void CullOnCpu(const CpuCullInput& input, const DrawCullData& cull_data,
+               const CpuDepthPyramid* pyramid, Engine::ThreadPool* thread_pool,
+               CpuCullOutput& output);
+
+}
\ No newline at end of file
@@ -0,0 +1,299 @@
+#include "Defragmenter.h"
+
+#include <limits>
+
+#include "Logger.h"
+
+namespace Renderer {
+
+// Updates to wait after a finished defragmentation before starting another
+constexpr uint32_t kRestartInterval = 600;
+
+void Defragmenter::Init(VmaAllocator allocator, LogicalDevice* device) {
+  allocator_ = allocator;
+  device_ = device;
+  updates_since_finish_ = kRestartInterval;
+}
+
+void Defragmenter::Destroy() {
+  RetireMoves(std::numeric_limits<uint64_t>::max());
+  if (context_ != VK_NULL_HANDLE) Finish();
+}
+
+void Defragmenter::Register(BufferBase* buffer) { buffers_.insert(buffer); }
+
+void Defragmenter::Register(Image* image, VkImageLayout layout,
+                            ViewMovedCallback on_view_moved) {
+  images_[image] = {layout, std::move(on_view_moved)};
+}
+
+void Defragmenter::Unregister(BufferBase* buffer) { buffers_.erase(buffer); }
+
+void Defragmenter::Unregister(Image* image) { images_.erase(image); }
+
+void Defragmenter::Update(CommandBuffer command_buffer, uint64_t frame,
+                          VkDeviceSize max_bytes_per_pass, float threshold) {
+  UpdateFragmentation();
+  if (pass_pending_) return;
+
+  if (context_ == VK_NULL_HANDLE) {
+    if (++updates_since_finish_ < kRestartInterval) return;
+    if (fragmentation_ < threshold) return;
+
+    VmaDefragmentationInfo defrag_info{};
+    defrag_info.maxBytesPerPass = max_bytes_per_pass;
+    if (vmaBeginDefragmentation(allocator_, &defrag_info, &context_) !=
+        VK_SUCCESS) {
+      context_ = VK_NULL_HANDLE;
+      return;
+    }
+    LOG_INFO("Started defragmentation at {:.1f}% fragmentation",
+             fragmentation_ * 100.f);
+  }
+
+  RunPass(command_buffer, frame);
+}
+
+void Defragmenter::RetireMoves(uint64_t completed_frame) {
+  if (!pass_pending_ || pass_frame_ > completed_frame) return;
+
+  for (const Move& move : pending_moves_) {
+    if (move.old_buffer != VK_NULL_HANDLE)
+      vkDestroyBuffer(device_->Get(), move.old_buffer, nullptr);
+    if (move.old_view != VK_NULL_HANDLE)
+      vkDestroyImageView(device_->Get(), move.old_view, nullptr);
+    if (move.old_image != VK_NULL_HANDLE)
+      vkDestroyImage(device_->Get(), move.old_image, nullptr);
+  }
+  pending_moves_.clear();
+  pass_pending_ = false;
+
+  if (vmaEndDefragmentationPass(allocator_, context_, &pass_) == VK_SUCCESS)
+    Finish();
+}
+
+bool Defragmenter::IsMoving(const BufferBase* buffer) const {
+  for (const Move& move : pending_moves_)
+    if (move.buffer == buffer) return true;
+  return false;
+}
+
+float Defragmenter::GetFragmentation() const { return fragmentation_; }
+
+VkDeviceSize Defragmenter::GetBytesMoved() const { return bytes_moved_; }
+
+uint32_t Defragmenter::GetAllocationsMoved() const {
+  return allocations_moved_;
+}
+
+uint32_t Defragmenter::GetBlocksFreed() const { return blocks_freed_; }
+
+bool Defragmenter::IsRunning() const { return context_ != VK_NULL_HANDLE; }
+
+void Defragmenter::UpdateFragmentation() {
+  const VkPhysicalDeviceMemoryProperties* memory_props;
+  vmaGetMemoryProperties(allocator_, &memory_props);
+
+  std::vector<VmaBudget> budgets(memory_props->memoryHeapCount);
+  vmaGetHeapBudgets(allocator_, budgets.data());
+
+  VkDeviceSize block_bytes = 0;
+  VkDeviceSize allocation_bytes = 0;
+  for (uint32_t i = 0; i < memory_props->memoryHeapCount; ++i) {
+    if (!(memory_props->memoryHeaps[i].flags &
+          VK_MEMORY_HEAP_DEVICE_LOCAL_BIT))
+      continue;
+
+    block_bytes += budgets[i].statistics.blockBytes;
+    allocation_bytes += budgets[i].statistics.allocationBytes;
+  }
+
+  fragmentation_ =
+      block_bytes > 0
+          ? 1.f - static_cast<float>(static_cast<double>(allocation_bytes) /
+                                     static_cast<double>(block_bytes))
+          : 0.f;
+}
+
+void Defragmenter::RunPass(CommandBuffer command_buffer, uint64_t frame) {
+  pass_ = {};
+  if (vmaBeginDefragmentationPass(allocator_, context_, &pass_) ==
+      VK_SUCCESS) {
+    Finish();
+    return;
+  }
+
+  std::unordered_map<VmaAllocation, BufferBase*> buffer_allocations;
+  for (BufferBase* buffer : buffers_)
+    if (buffer->buffer_ != VK_NULL_HANDLE)
+      buffer_allocations[buffer->allocation_] = buffer;
+
+  std::unordered_map<VmaAllocation, Image*> image_allocations;
+  for (auto& [image, info] : images_)
+    if (image->image_ != VK_NULL_HANDLE)
+      image_allocations[image->allocation_] = image;
+
+  // Frames still in flight may write the resources being read here
+  VkMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  vkCmdPipelineBarrier(command_buffer.Get(),
+                       VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0,
+                       nullptr, 0, nullptr);
+
+  for (uint32_t i = 0; i < pass_.moveCount; ++i) {
+    VmaDefragmentationMove& defrag_move = pass_.pMoves[i];
+    Move move{};
+
+    auto buffer_iter = buffer_allocations.find(defrag_move.srcAllocation);
+    auto image_iter = image_allocations.find(defrag_move.srcAllocation);
+    if (buffer_iter != buffer_allocations.end()) {
+      BufferBase* buffer = buffer_iter->second;
+
+      VkBufferCreateInfo buffer_info{};
+      buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+      buffer_info.size = buffer->buffer_size_;
+      buffer_info.usage = buffer->usage_;
+      buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+      VkBuffer new_buffer = VK_NULL_HANDLE;
+      if (vkCreateBuffer(device_->Get(), &buffer_info, nullptr,
+                         &new_buffer) == VK_SUCCESS &&
+          vmaBindBufferMemory(allocator_, defrag_move.dstTmpAllocation,
+                              new_buffer) == VK_SUCCESS) {
+        CopyBuffer(command_buffer, buffer, new_buffer);
+        move.buffer = buffer;
+        move.old_buffer = buffer->buffer_;
+        buffer->buffer_ = new_buffer;
+      } else if (new_buffer != VK_NULL_HANDLE) {
+        vkDestroyBuffer(device_->Get(), new_buffer, nullptr);
+      }
+    } else if (image_iter != image_allocations.end()) {
+      Image* image = image_iter->second;
+
+      VkImageCreateInfo image_info = image->GetCreateInfo();
+      VkImage new_image = VK_NULL_HANDLE;
+      if (vkCreateImage(device_->Get(), &image_info, nullptr, &new_image) ==
+              VK_SUCCESS &&
+          vmaBindImageMemory(allocator_, defrag_move.dstTmpAllocation,
+                             new_image) == VK_SUCCESS) {
+        const RegisteredImage& info = images_[image];
+        CopyImage(command_buffer, image, info, new_image);
+        move.old_image = image->image_;
+        move.old_view = image->image_view_;
+
+        image->image_ = new_image;
+        image->CreateImageView(image->aspect_flags_);
+        if (info.on_view_moved)
+          info.on_view_moved(move.old_view, image->image_view_);
+      } else if (new_image != VK_NULL_HANDLE) {
+        vkDestroyImage(device_->Get(), new_image, nullptr);
+      }
+    }
+
+    if (move.old_buffer == VK_NULL_HANDLE && move.old_image == VK_NULL_HANDLE) {
+      defrag_move.operation = VMA_DEFRAGMENTATION_MOVE_OPERATION_IGNORE;
+      continue;
+    }
+
+    VmaAllocationInfo allocation_info;
+    vmaGetAllocationInfo(allocator_, defrag_move.srcAllocation,
+                         &allocation_info);
+    bytes_moved_ += allocation_info.size;
+    ++allocations_moved_;
+
+    pending_moves_.push_back(move);
+  }
+
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+  vkCmdPipelineBarrier(command_buffer.Get(), VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0,
+                       nullptr, 0, nullptr);
+
+  // Old memory is released when the pass ends, after the frame is done
+  pass_pending_ = true;
+  pass_frame_ = frame;
+}
+
+void Defragmenter::Finish() {
+  VmaDefragmentationStats stats{};
+  vmaEndDefragmentation(allocator_, context_, &stats);
+  context_ = VK_NULL_HANDLE;
+  updates_since_finish_ = 0;
+
+  blocks_freed_ += stats.deviceMemoryBlocksFreed;
+  LOG_INFO("Finished defragmentation, freed {} memory blocks",
+           stats.deviceMemoryBlocksFreed);
+}
+
+void Defragmenter::CopyBuffer(CommandBuffer command_buffer,
+                              BufferBase* buffer, VkBuffer new_buffer) {
+  VkBufferCopy copy_region{};
+  copy_region.size = buffer->buffer_size_;
+  vkCmdCopyBuffer(command_buffer.Get(), buffer->buffer_, new_buffer, 1,
+                  &copy_region);
+}
+
+void Defragmenter::CopyImage(CommandBuffer command_buffer, Image* image,
+                             const RegisteredImage& info, VkImage new_image) {
+  // Frames in flight may still sample the old image, the new one is written
+  // before anything later in the frame reads it
+  std::array<VkImageMemoryBarrier, 2> barriers{};
+  for (VkImageMemoryBarrier& barrier : barriers) {
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.subresourceRange.aspectMask = image->aspect_flags_;
+    barrier.subresourceRange.levelCount = image->mip_levels_;
+    barrier.subresourceRange.layerCount = image->array_layers_;
+  }
+
+  barriers[0].image = image->image_;
+  barriers[0].srcAccessMask = VK_ACCESS_MEMORY_WRITE_BIT;
+  barriers[0].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  barriers[0].oldLayout = info.layout;
+  barriers[0].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+
+  barriers[1].image = new_image;
+  barriers[1].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  barriers[1].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+
+  vkCmdPipelineBarrier(command_buffer.Get(), VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                       nullptr, static_cast<uint32_t>(barriers.size()),
+                       barriers.data());
+
+  std::vector<VkImageCopy> regions(image->mip_levels_);
+  VkExtent3D mip_extent = image->image_extent_;
+  for (uint32_t i = 0; i < image->mip_levels_; ++i) {
+    VkImageCopy& region = regions[i];
+    region.srcSubresource.aspectMask = image->aspect_flags_;
+    region.srcSubresource.mipLevel = i;
+    region.srcSubresource.layerCount = image->array_layers_;
+    region.dstSubresource = region.srcSubresource;
+    region.extent = mip_extent;
+
+    mip_extent.width = std::max(mip_extent.width >> 1, 1u);
+    mip_extent.height = std::max(mip_extent.height >> 1, 1u);
+  }
+
+  vkCmdCopyImage(command_buffer.Get(), image->image_,
+                 VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, new_image,
+                 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                 static_cast<uint32_t>(regions.size()), regions.data());
+
+  barriers[1].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barriers[1].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
+  barriers[1].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+  barriers[1].newLayout = info.layout;
+
+  vkCmdPipelineBarrier(command_buffer.Get(), VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &barriers[1]);
+}
+
+}  // namespace Renderer
\ No newline at end of file
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+#include <vma\include\vk_mem_alloc.h>
+
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "Buffer.h"
+#include "CommandBuffer.h"
+#include "Image.h"
+#include "LogicalDevice.h"
+
+namespace Renderer {
+
+/*
+Incremental defragmentation of device memory on top of VMA
+
+- Only registered resources are moved, everything else is left in place
+- Registered resources are expected to be read only on the GPU, their content
+  is copied in the frame command buffer on the graphics queue
+- Moved resources switch to their new copy right away, the old one is only
+  destroyed once frames in flight are done with it
+*/
+class Defragmenter {
+ public:
+  using ViewMovedCallback =
+      std::function<void(VkImageView old_view, VkImageView new_view)>;
+
+  void Init(VmaAllocator allocator, LogicalDevice* device);
+  void Destroy();
+
+  void Register(BufferBase* buffer);
+  /*
+  Register image kept in layout between uses
+
+  - on_view_moved is called after the image view got recreated, so that
+    descriptor sets can be patched
+  */
+  void Register(Image* image, VkImageLayout layout,
+                ViewMovedCallback on_view_moved = {});
+  void Unregister(BufferBase* buffer);
+  void Unregister(Image* image);
+
+  /*
+  Record single defragmentation pass moving at most max_bytes_per_pass
+
+  - New defragmentation starts once fragmentation exceeds threshold
+  - Must be recorded before anything using registered resources in frame
+  - Does nothing while pass of an earlier frame is not retired
+  */
+  void Update(CommandBuffer command_buffer, uint64_t frame,
+              VkDeviceSize max_bytes_per_pass, float threshold);
+  /*
+  Destroy resources replaced by pass recorded in completed_frame or earlier
+
+  - Has to run before anything moved can be freed, since the pass owns its
+    memory until it ends
+  */
+  void RetireMoves(uint64_t completed_frame);
+  /*
+  Whether buffer is part of a pass that is not retired yet, it must not be
+  destroyed until then
+  */
+  bool IsMoving(const BufferBase* buffer) const;
+
+  /*
+  Fraction of device local block memory not used by allocations
+  */
+  float GetFragmentation() const;
+  VkDeviceSize GetBytesMoved() const;
+  uint32_t GetAllocationsMoved() const;
+  uint32_t GetBlocksFreed() const;
+  bool IsRunning() const;
+
+ private:
+  struct RegisteredImage {
+    VkImageLayout layout;
+    ViewMovedCallback on_view_moved;
+  };
+
+  // Old handles of resource moved by pending pass
+  struct Move {
+    BufferBase* buffer = nullptr;
+    VkBuffer old_buffer = VK_NULL_HANDLE;
+    VkImage old_image = VK_NULL_HANDLE;
+    VkImageView old_view = VK_NULL_HANDLE;
+  };
+
+  void UpdateFragmentation();
+  void RunPass(CommandBuffer command_buffer, uint64_t frame);
+  void Finish();
+
+  void CopyBuffer(CommandBuffer command_buffer, BufferBase* buffer,
+                  VkBuffer new_buffer);
+  void CopyImage(CommandBuffer command_buffer, Image* image,
+                 const RegisteredImage& info, VkImage new_image);
+
+  VmaAllocator allocator_;
+  LogicalDevice* device_;
+
+  VmaDefragmentationContext context_ = VK_NULL_HANDLE;
+  // Pass waiting for the frame that recorded its copies
+  VmaDefragmentationPassMoveInfo pass_{};
+  bool pass_pending_ = false;
+  uint64_t pass_frame_ = 0;
+  std::vector<Move> pending_moves_;
+
+  std::unordered_set<BufferBase*> buffers_;
+  std::unordered_map<Image*, RegisteredImage> images_;
+
+  uint32_t updates_since_finish_ = 0;
+
+  float fragmentation_ = 0.f;
+  VkDeviceSize bytes_moved_ = 0;
+  uint32_t allocations_moved_ = 0;
+  uint32_t blocks_freed_ = 0;
+};
+
+}
\ No newline at end of file
@@ -54,22 +54,12 @@ VkResult Image::Create(VmaAllocator allocator, LogicalDevice* device,
   image_format_ = format;
   view_type_ = view_type;
   current_layout_ = VK_IMAGE_LAYOUT_UNDEFINED;
+  usage_ = usage;
+  samples_ = samples;
+  tiling_ = tiling;
+  aspect_flags_ = aspect_flags;
 
-  VkImageCreateInfo image_info{};
-  image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-  image_info.imageType = VK_IMAGE_TYPE_2D;
-  image_info.extent = image_extent_;
-  image_info.mipLevels = mip_levels_;
-  image_info.arrayLayers = array_layers_;
-  image_info.format = image_format_;
-  image_info.tiling = tiling;
-  image_info.initialLayout = current_layout_;
-  image_info.usage = usage;
-  image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-  image_info.samples = samples;
-  if (view_type_ == VK_IMAGE_VIEW_TYPE_CUBE ||
-      view_type_ == VK_IMAGE_VIEW_TYPE_CUBE_ARRAY)
-    image_info.flags = VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT;
+  VkImageCreateInfo image_info = GetCreateInfo();
 
   VmaAllocationCreateInfo alloc_info{};
   alloc_info.usage = VMA_MEMORY_USAGE_AUTO;
@@ -116,8 +106,12 @@ VkResult Image::Create(VmaAllocator allocator, LogicalDevice* device,
 }
 
 void Image::Destroy() {
+  if (image_ == VK_NULL_HANDLE) return;
+
   vkDestroyImageView(device_->Get(), image_view_, nullptr);
   vmaDestroyImage(allocator_, image_, allocation_);
+
+  image_ = VK_NULL_HANDLE;
 }
 
 VkImage Image::Get() { return image_; }
@@ -136,6 +130,14 @@ VkImageViewType Image::GetViewType() const { return view_type_; }
 
 VkImageLayout Image::GetLayout() const { return current_layout_; }
 
+VkDeviceSize Image::GetMemorySize() const {
+  if (image_ == VK_NULL_HANDLE) return 0;
+
+  VmaAllocationInfo allocation_info;
+  vmaGetAllocationInfo(allocator_, allocation_, &allocation_info);
+  return allocation_info.size;
+}
+
 void Image::LayoutTransition(CommandBuffer command_buffer,
                              const LayoutTransitionInfo& transition_info) {
   VkImageMemoryBarrier barrier{};
@@ -235,6 +237,25 @@ void Image::GenerateMipMaps(CommandBuffer command_buffer,
                        &barrier);
 }
 
+VkImageCreateInfo Image::GetCreateInfo() const {
+  VkImageCreateInfo image_info{};
+  image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  image_info.imageType = VK_IMAGE_TYPE_2D;
+  image_info.extent = image_extent_;
+  image_info.mipLevels = mip_levels_;
+  image_info.arrayLayers = array_layers_;
+  image_info.format = image_format_;
+  image_info.tiling = tiling_;
+  image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  image_info.usage = usage_;
+  image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  image_info.samples = samples_;
+  if (view_type_ == VK_IMAGE_VIEW_TYPE_CUBE ||
+      view_type_ == VK_IMAGE_VIEW_TYPE_CUBE_ARRAY)
+    image_info.flags = VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT;
+  return image_info;
+}
+
 VkResult Image::CreateImageView(VkImageAspectFlags aspect_flags) {
   VkImageViewCreateInfo create_info{};
   create_info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
@@ -9,6 +9,7 @@
 namespace Renderer {
 
 class Image {
+  friend class Defragmenter;
  public:
   Image();
   Image(VmaAllocator allocator, LogicalDevice* device, VkExtent3D extent,
@@ -79,6 +80,7 @@ class Image {
   uint32_t GetArrayLayers() const;
   VkImageViewType GetViewType() const;
   VkImageLayout GetLayout() const;
+  VkDeviceSize GetMemorySize() const;
 
   struct LayoutTransitionInfo {
     VkAccessFlags src_access;
@@ -134,11 +136,16 @@ class Image {
   uint32_t mip_levels_;
   uint32_t array_layers_;
   VkImageLayout current_layout_;
+  VkImageUsageFlags usage_;
+  VkSampleCountFlagBits samples_;
+  VkImageTiling tiling_;
+  VkImageAspectFlags aspect_flags_;
 
   VmaAllocator allocator_;
   LogicalDevice* device_;
 
  private:
+  VkImageCreateInfo GetCreateInfo() const;
   VkResult CreateImageView(
       VkImageAspectFlags aspect_flags = VK_IMAGE_ASPECT_COLOR_BIT);
 };
@@ -24,7 +24,9 @@ void IndexBuffer::Destroy() {
   buffer_.Destroy();
 }
 
-VkBuffer IndexBuffer::Get() { return buffer_.Get(); }
+VkBuffer IndexBuffer::Get() const { return buffer_.Get(); }
+
+Buffer<false>& IndexBuffer::GetBuffer() { return buffer_; }
 
 uint32_t IndexBuffer::GetIndicesCount() const {
   return static_cast<uint32_t>(buffer_.GetSize() / sizeof(uint32_t));
@@ -12,7 +12,8 @@ class IndexBuffer {
   void Create(VmaAllocator allocator, uint64_t size);
   void Destroy();
 
-  VkBuffer Get();
+  VkBuffer Get() const;
+  Buffer<false>& GetBuffer();
   uint32_t GetIndicesCount() const;
 
   void SetData(CommandBuffer command_buffer,
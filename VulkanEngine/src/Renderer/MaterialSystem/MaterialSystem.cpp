@@ -8,14 +8,33 @@
 
 namespace Renderer {
 
+const char* GetMeshPassName(MeshPassType type) {
+  switch (type) {
+    case MeshPassType::kForward:
+      return "Forward";
+    case MeshPassType::kTransparency:
+      return "Transparency";
+    case MeshPassType::kDirectionalShadow:
+      return "Directional shadow";
+    case MeshPassType::kPointShadow:
+      return "Point shadow";
+    case MeshPassType::kSpotShadow:
+      return "Spot shadow";
+  }
+  return "Unknown";
+}
+
 bool MaterialData::operator==(const MaterialData& other) const {
   if (other.base_template != base_template ||
-      other.textures.size() != textures.size()) {
+      other.textures.size() != textures.size() ||
+      other.buffers.size() != buffers.size()) {
     return false;
   }
 
   return (memcmp(other.textures.data(), textures.data(),
-                 textures.size() * sizeof(textures[0])) == 0);
+                 textures.size() * sizeof(textures[0])) == 0) &&
+         (memcmp(other.buffers.data(), buffers.data(),
+                 buffers.size() * sizeof(buffers[0])) == 0);
 }
 
 size_t MaterialData::hash() const {
@@ -29,6 +48,11 @@ size_t MaterialData::hash() const {
     result ^= std::hash<size_t>()(texture_hash);
   }
 
+  for (const VkDescriptorBufferInfo& buffer : buffers) {
+    result ^= std::hash<size_t>()(reinterpret_cast<size_t>(buffer.buffer)) ^
+              std::hash<VkDeviceSize>()(buffer.offset);
+  }
+
   return result;
 }
 
@@ -82,6 +106,10 @@ void MaterialSystem::BuildDefaultTemplates() {
       {"mesh_instanced.vert.spv"}, {"textured_lit_emissive.frag.spv"});
   ShaderEffect* textured_lit_normals = BuildEffect(
       {"mesh_instanced_tangent.vert.spv"}, {"textured_lit_normals.frag.spv"});
+  // Only variant writing page feedback, the others sample regular textures
+  // that have no pages to request
+  ShaderEffect* textured_lit_virtual = BuildEffect(
+      {"mesh_instanced.vert.spv"}, {"textured_lit_virtual.frag.spv"});
   ShaderEffect* opaque_shadowcast =
       BuildEffect({"shadowcast.vert.spv"}, {}, {"shadowcast.geom.spv"});
   ShaderEffect* opaque_shadowcast_point =
@@ -91,6 +119,22 @@ void MaterialSystem::BuildDefaultTemplates() {
       {"normals.vert.spv"}, {"normals.frag.spv"}, {"normals.geom.spv"});
   ShaderEffect* skybox = BuildEffect({"skybox.vert.spv"}, {"skybox.frag.spv"});
 
+  // Instance groups place their instances from a compact array, only the
+  // vertex shader differs
+  ShaderEffect* textured_lit_group =
+      BuildEffect({"mesh_group.vert.spv"}, {"textured_lit.frag.spv"});
+  ShaderEffect* textured_lit_emissive_group = BuildEffect(
+      {"mesh_group.vert.spv"}, {"textured_lit_emissive.frag.spv"});
+  ShaderEffect* textured_lit_normals_group = BuildEffect(
+      {"mesh_group_tangent.vert.spv"}, {"textured_lit_normals.frag.spv"});
+  ShaderEffect* textured_lit_virtual_group = BuildEffect(
+      {"mesh_group.vert.spv"}, {"textured_lit_virtual.frag.spv"});
+  ShaderEffect* opaque_shadowcast_group =
+      BuildEffect({"shadowcast_group.vert.spv"}, {}, {"shadowcast.geom.spv"});
+  ShaderEffect* opaque_shadowcast_point_group =
+      BuildEffect({"shadowcast_group.vert.spv"}, {"shadowcast_point.frag.spv"},
+                  {"shadowcast_point.geom.spv"});
+
   ShaderPass* default_pass = BuildShader(
       system.engine_->forward_pass_, system.forward_builder_, default_effect);
   ShaderPass* default_wireframe_pass = BuildShader(
@@ -103,6 +147,9 @@ void MaterialSystem::BuildDefaultTemplates() {
   ShaderPass* textured_lit_normals_pass =
       BuildShader(system.engine_->forward_pass_, system.forward_builder_,
                   textured_lit_normals);
+  ShaderPass* textured_lit_virtual_pass =
+      BuildShader(system.engine_->forward_pass_, system.forward_builder_,
+                  textured_lit_virtual);
   ShaderPass* opaque_shadowcast_pass =
       BuildShader(system.engine_->directional_shadow_pass_,
                   system.shadow_builder_, opaque_shadowcast);
@@ -114,6 +161,25 @@ void MaterialSystem::BuildDefaultTemplates() {
   ShaderPass* skybox_pass = BuildShader(system.engine_->forward_pass_,
                                         system.skybox_builder_, skybox);
 
+  ShaderPass* textured_lit_group_pass =
+      BuildShader(system.engine_->forward_pass_, system.forward_builder_,
+                  textured_lit_group);
+  ShaderPass* textured_lit_emissive_group_pass =
+      BuildShader(system.engine_->forward_pass_, system.forward_builder_,
+                  textured_lit_emissive_group);
+  ShaderPass* textured_lit_normals_group_pass =
+      BuildShader(system.engine_->forward_pass_, system.forward_builder_,
+                  textured_lit_normals_group);
+  ShaderPass* textured_lit_virtual_group_pass =
+      BuildShader(system.engine_->forward_pass_, system.forward_builder_,
+                  textured_lit_virtual_group);
+  ShaderPass* opaque_shadowcast_group_pass =
+      BuildShader(system.engine_->directional_shadow_pass_,
+                  system.shadow_builder_, opaque_shadowcast_group);
+  ShaderPass* opaque_shadowcast_point_group_pass =
+      BuildShader(system.engine_->point_shadow_pass_, system.shadow_builder_,
+                  opaque_shadowcast_point_group);
+
   {
     EffectTemplate default_template;
     default_template.pass_shaders[MeshPassType::kForward] = default_pass;
@@ -148,10 +214,39 @@ void MaterialSystem::BuildDefaultTemplates() {
         opaque_shadowcast_point_pass;
     default_textured.pass_shaders[MeshPassType::kSpotShadow] = nullptr;
 
+    default_textured.group_pass_shaders[MeshPassType::kForward] =
+        textured_lit_group_pass;
+    default_textured.group_pass_shaders[MeshPassType::kDirectionalShadow] =
+        opaque_shadowcast_group_pass;
+    default_textured.group_pass_shaders[MeshPassType::kPointShadow] =
+        opaque_shadowcast_point_group_pass;
+
     default_textured.transparency = Assets::TransparencyMode::kOpaque;
 
     system.template_cache_["texturedPBR_opaque"] = default_textured;
   }
+  {
+    EffectTemplate textured_virtual;
+    textured_virtual.pass_shaders[MeshPassType::kForward] =
+        textured_lit_virtual_pass;
+    textured_virtual.pass_shaders[MeshPassType::kTransparency] = nullptr;
+    textured_virtual.pass_shaders[MeshPassType::kDirectionalShadow] =
+        opaque_shadowcast_pass;
+    textured_virtual.pass_shaders[MeshPassType::kPointShadow] =
+        opaque_shadowcast_point_pass;
+    textured_virtual.pass_shaders[MeshPassType::kSpotShadow] = nullptr;
+
+    textured_virtual.group_pass_shaders[MeshPassType::kForward] =
+        textured_lit_virtual_group_pass;
+    textured_virtual.group_pass_shaders[MeshPassType::kDirectionalShadow] =
+        opaque_shadowcast_group_pass;
+    textured_virtual.group_pass_shaders[MeshPassType::kPointShadow] =
+        opaque_shadowcast_point_group_pass;
+
+    textured_virtual.transparency = Assets::TransparencyMode::kOpaque;
+
+    system.template_cache_["texturedPBR_virtual"] = textured_virtual;
+  }
   {
     EffectTemplate textured_emissive;
     textured_emissive.pass_shaders[MeshPassType::kForward] =
@@ -164,6 +259,13 @@ void MaterialSystem::BuildDefaultTemplates() {
         opaque_shadowcast_point_pass;
     textured_emissive.pass_shaders[MeshPassType::kSpotShadow] = nullptr;
 
+    textured_emissive.group_pass_shaders[MeshPassType::kForward] =
+        textured_lit_emissive_group_pass;
+    textured_emissive.group_pass_shaders[MeshPassType::kDirectionalShadow] =
+        opaque_shadowcast_group_pass;
+    textured_emissive.group_pass_shaders[MeshPassType::kPointShadow] =
+        opaque_shadowcast_point_group_pass;
+
     textured_emissive.transparency = Assets::TransparencyMode::kOpaque;
 
     system.template_cache_["texturedPBR_emissive"] = textured_emissive;
@@ -178,6 +280,13 @@ void MaterialSystem::BuildDefaultTemplates() {
         opaque_shadowcast_point_pass;
     textured_normals.pass_shaders[MeshPassType::kSpotShadow] = nullptr;
 
+    textured_normals.group_pass_shaders[MeshPassType::kForward] =
+        textured_lit_normals_group_pass;
+    textured_normals.group_pass_shaders[MeshPassType::kDirectionalShadow] =
+        opaque_shadowcast_group_pass;
+    textured_normals.group_pass_shaders[MeshPassType::kPointShadow] =
+        opaque_shadowcast_point_group_pass;
+
     textured_normals.transparency = Assets::TransparencyMode::kOpaque;
 
     system.template_cache_["texturedNormals"] = textured_normals;
@@ -294,8 +403,15 @@ Material* MaterialSystem::BuildMaterial(const std::string& name,
                         VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
                         VK_SHADER_STAGE_FRAGMENT_BIT);
     }
+    std::vector<VkDescriptorBufferInfo> buffer_infos = info.buffers;
+    for (uint32_t i = 0; i < buffer_infos.size(); ++i) {
+      builder.BindBuffer(static_cast<uint32_t>(info.textures.size()) + i,
+                         &buffer_infos[i], VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                         VK_SHADER_STAGE_FRAGMENT_BIT);
+    }
 
-    builder.Build(new_material->pass_sets[MeshPassType::kForward]);
+    builder.Build(new_material->pass_sets[MeshPassType::kForward],
+                  new_material->set_layout);
     builder.Build(new_material->pass_sets[MeshPassType::kTransparency]);
     LOG_INFO("Built new material '{}'", name);
 
@@ -315,6 +431,101 @@ Material* MaterialSystem::GetMaterial(const std::string& name) {
   return nullptr;
 }
 
+void MaterialSystem::ReplaceTexture(VkImageView old_view,
+                                    const SampledTexture& new_texture,
+                                    Engine::DeletionQueue& retire_queue) {
+  MaterialSystem& system = Get();
+
+  std::vector<std::pair<MaterialData, Material*>> rekeyed;
+
+  for (auto iter = system.material_cache_.begin();
+       iter != system.material_cache_.end();) {
+    Material* material = iter->second;
+
+    bool uses_texture = false;
+    for (SampledTexture& texture : material->textures) {
+      if (texture.view != old_view) continue;
+      texture = new_texture;
+      uses_texture = true;
+    }
+
+    if (!uses_texture) {
+      ++iter;
+      continue;
+    }
+
+    MaterialData key = iter->first;
+    key.textures = material->textures;
+    RebindMaterial(material, key.buffers, retire_queue);
+    rekeyed.push_back({std::move(key), material});
+    iter = system.material_cache_.erase(iter);
+  }
+
+  for (auto& [key, material] : rekeyed) system.material_cache_[key] = material;
+}
+
+void MaterialSystem::RebindMaterial(
+    Material* material, const std::vector<VkDescriptorBufferInfo>& buffers,
+    Engine::DeletionQueue& retire_queue) {
+  MaterialSystem& system = Get();
+  VkDevice device = system.engine_->device_.Get();
+
+  std::vector<VkDescriptorImageInfo> image_infos(material->textures.size());
+  for (uint32_t i = 0; i < material->textures.size(); ++i) {
+    image_infos[i].sampler = material->textures[i].sampler;
+    image_infos[i].imageView = material->textures[i].view;
+    image_infos[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  }
+
+  std::vector<VkWriteDescriptorSet> writes;
+  for (MeshPassType pass :
+       {MeshPassType::kForward, MeshPassType::kTransparency}) {
+    VkDescriptorSet set;
+    std::vector<VkDescriptorSet>& free_sets =
+        system.free_sets_[material->set_layout];
+    if (free_sets.empty()) {
+      system.engine_->descriptor_allocator_.Allocate(&set,
+                                                     material->set_layout);
+    } else {
+      set = free_sets.back();
+      free_sets.pop_back();
+    }
+
+    for (uint32_t i = 0; i < image_infos.size(); ++i) {
+      VkWriteDescriptorSet write{};
+      write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      write.dstSet = set;
+      write.dstBinding = i;
+      write.descriptorCount = 1;
+      write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+      write.pImageInfo = &image_infos[i];
+      writes.push_back(write);
+    }
+    for (uint32_t i = 0; i < buffers.size(); ++i) {
+      VkWriteDescriptorSet write{};
+      write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      write.dstSet = set;
+      write.dstBinding = static_cast<uint32_t>(image_infos.size()) + i;
+      write.descriptorCount = 1;
+      write.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      write.pBufferInfo = &buffers[i];
+      writes.push_back(write);
+    }
+
+    // Frames in flight may still bind the old set, so it is only reused after
+    // retire_queue is flushed
+    VkDescriptorSet old_set = material->pass_sets[pass];
+    VkDescriptorSetLayout layout = material->set_layout;
+    retire_queue.PushFunction([&system, layout, old_set]() {
+      system.free_sets_[layout].push_back(old_set);
+    });
+    material->pass_sets[pass] = set;
+  }
+
+  vkUpdateDescriptorSets(device, static_cast<uint32_t>(writes.size()),
+                         writes.data(), 0, nullptr);
+}
+
 void MaterialSystem::FillBuilders() {
   MaterialSystem& system = Get();
 
@@ -11,6 +11,7 @@
 #include "RenderPass.h"
 
 #include "MaterialAsset.h"
+#include "DeletionQueue.h"
 
 namespace Engine {
 class VulkanEngine;
@@ -38,12 +39,17 @@ enum class MeshPassType {
   _Size
 };
 
+const char* GetMeshPassName(MeshPassType type);
+
 template<typename T>
 class PerPassData {
  public:
   T& operator[](MeshPassType pass) {
     return data[static_cast<uint32_t>(pass)];
   }
+  const T& operator[](MeshPassType pass) const {
+    return data[static_cast<uint32_t>(pass)];
+  }
 
   void Clear(T&& val) {
     for (size_t i = 0; i < static_cast<size_t>(MeshPassType::_Size); ++i)
@@ -56,12 +62,16 @@ class PerPassData {
 
 struct EffectTemplate {
   PerPassData<ShaderPass*> pass_shaders;
+  // Same passes drawing instance groups, null where groups are not drawn
+  PerPassData<ShaderPass*> group_pass_shaders{};
 
   Assets::TransparencyMode transparency;
 };
 
 struct MaterialData {
   std::vector<SampledTexture> textures;
+  // Storage buffers, bound after the textures
+  std::vector<VkDescriptorBufferInfo> buffers;
   std::string base_template;
 
   bool operator==(const MaterialData& other) const;
@@ -72,6 +82,8 @@ struct MaterialData {
 struct Material {
   EffectTemplate* original;
   PerPassData<VkDescriptorSet> pass_sets;
+  // Shared by the forward and transparency sets
+  VkDescriptorSetLayout set_layout;
 
   std::vector<SampledTexture> textures;
 
@@ -93,6 +105,16 @@ class MaterialSystem {
                                  const MaterialData& info);
   static Material* GetMaterial(const std::string& name);
 
+  /*
+  Point every material sampling old_view at new_texture instead
+
+  - Materials switch to other descriptor sets, so frames in flight keep
+    sampling old_view. Replaced sets are reused once retire_queue is flushed
+  */
+  static void ReplaceTexture(VkImageView old_view,
+                             const SampledTexture& new_texture,
+                             Engine::DeletionQueue& retire_queue);
+
   static void FillBuilders();
 
   inline static MaterialSystem& Get();
@@ -107,6 +129,12 @@ class MaterialSystem {
                                    ShaderEffectStage fragment_shader = {},
                                    ShaderEffectStage geometry_shader = {});
 
+  // Point material at new forward and transparency sets holding its current
+  // textures, retiring the old ones to retire_queue
+  static void RebindMaterial(Material* material,
+                             const std::vector<VkDescriptorBufferInfo>& buffers,
+                             Engine::DeletionQueue& retire_queue);
+
   struct MaterialInfoHash {
     size_t operator()(const MaterialData& data) const { return data.hash(); }
   };
@@ -119,6 +147,9 @@ class MaterialSystem {
   std::unordered_map<std::string, EffectTemplate> template_cache_;
   std::unordered_map<std::string, Material*> materials_;
   std::unordered_map<MaterialData, Material*, MaterialInfoHash> material_cache_;
+  // Sets no pending command buffer uses anymore, by layout
+  std::unordered_map<VkDescriptorSetLayout, std::vector<VkDescriptorSet>>
+      free_sets_;
 
   Engine::VulkanEngine* engine_;
 };
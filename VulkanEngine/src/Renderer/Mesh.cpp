@@ -29,11 +29,25 @@ void Mesh::Create(VmaAllocator allocator, CommandBuffer command_buffer,
   index_buffer_.SetData(command_buffer, indices);
 }
 
+void Mesh::Create(VmaAllocator allocator, CommandBuffer command_buffer,
+                  const MeshData& data, bool retain_geometry) {
+  Create(allocator, command_buffer, data.vertices, data.indices);
+  bounds_ = data.bounds;
+
+  if (retain_geometry && !geometry_) {
+    auto geometry = std::make_shared<MeshGeometry>();
+    geometry->Build(data.vertices, data.indices);
+    geometry_ = std::move(geometry);
+  }
+}
+
 void Mesh::Destroy() {
   vertex_buffer_.Destroy();
   index_buffer_.Destroy();
 }
 
+bool Mesh::IsResident() const { return vertex_buffer_.Get() != VK_NULL_HANDLE; }
+
 uint32_t Mesh::GetVerticesCount() const {
   return vertex_buffer_.GetVerticesCount();
 }
@@ -43,7 +57,7 @@ uint32_t Mesh::GetIndicesCount() const {
 }
 
 bool Mesh::LoadFromAsset(VmaAllocator allocator, CommandBuffer command_buffer,
-                         const char* path) {
+                         const char* path, bool retain_geometry) {
   Assets::AssetFile file;
   bool loaded = Assets::LoadBinaryFile(path, file);
 
@@ -52,38 +66,42 @@ bool Mesh::LoadFromAsset(VmaAllocator allocator, CommandBuffer command_buffer,
     return false;
   }
 
-  Assets::MeshInfo mesh_info = Assets::ReadMeshInfo(file);
+  MeshData data;
+  if (!Decode(file, data)) return false;
 
-  std::vector<Renderer::Vertex> vertices;
-  std::vector<uint32_t> indices;
+  Create(allocator, command_buffer, data, retain_geometry);
+  return true;
+}
+
+bool Mesh::Decode(Assets::AssetFile& file, MeshData& data) {
+  Assets::MeshInfo mesh_info = Assets::ReadMeshInfo(file);
 
   size_t size = mesh_info.vertex_buffer_size;
   if (mesh_info.vertex_format == Assets::VertexFormat::PNCVT_F32)
     size /= sizeof(Assets::Vertex_f32_PNCVT);
   else if (mesh_info.vertex_format == Assets::VertexFormat::P32N8C8V16)
     size /= sizeof(Assets::Vertex_P32N8C8V16);
-  vertices.resize(size);
+  data.vertices.resize(size);
 
   size = mesh_info.index_buffer_size / mesh_info.index_size;
-  indices.resize(size);
+  data.indices.resize(size);
 
   Assets::UnpackMesh(&mesh_info, file.binary_blob.data(),
                      file.binary_blob.size(),
-                     reinterpret_cast<char*>(vertices.data()),
-                     reinterpret_cast<char*>(indices.data()));
+                     reinterpret_cast<char*>(data.vertices.data()),
+                     reinterpret_cast<char*>(data.indices.data()));
 
-  bounds_.extents.x = mesh_info.bounds.extents[0];
-  bounds_.extents.y = mesh_info.bounds.extents[1];
-  bounds_.extents.z = mesh_info.bounds.extents[2];
+  data.bounds.extents.x = mesh_info.bounds.extents[0];
+  data.bounds.extents.y = mesh_info.bounds.extents[1];
+  data.bounds.extents.z = mesh_info.bounds.extents[2];
 
-  bounds_.origin.x = mesh_info.bounds.origin[0];
-  bounds_.origin.y = mesh_info.bounds.origin[1];
-  bounds_.origin.z = mesh_info.bounds.origin[2];
+  data.bounds.origin.x = mesh_info.bounds.origin[0];
+  data.bounds.origin.y = mesh_info.bounds.origin[1];
+  data.bounds.origin.z = mesh_info.bounds.origin[2];
 
-  bounds_.radius = mesh_info.bounds.radius;
-  bounds_.valid = true;
+  data.bounds.radius = mesh_info.bounds.radius;
+  data.bounds.valid = true;
 
-  Create(allocator, command_buffer, vertices, indices);
   return true;
 }
 
@@ -1,9 +1,14 @@
 #pragma once
 
+#include <memory>
+
 #include <glm/glm.hpp>
 
 #include "VertexBuffer.h"
 #include "IndexBuffer.h"
+#include "MeshGeometry.h"
+
+#include "AssetLoader.h"
 
 namespace Renderer {
 
@@ -14,6 +19,15 @@ struct RenderBounds {
   bool valid;
 };
 
+/*
+Mesh decoded on CPU, not uploaded yet
+*/
+struct MeshData {
+  std::vector<Vertex> vertices;
+  std::vector<uint32_t> indices;
+  RenderBounds bounds;
+};
+
 class Mesh {
  public:
   Mesh();
@@ -25,13 +39,26 @@ class Mesh {
   void Create(VmaAllocator allocator, CommandBuffer command_buffer,
               const std::vector<Vertex>& vertices,
               const std::vector<uint32_t>& indices);
+  /*
+  retain_geometry keeps a CPU copy of the triangles for ray queries, built
+  only if the mesh has none yet
+  */
+  void Create(VmaAllocator allocator, CommandBuffer command_buffer,
+              const MeshData& data, bool retain_geometry = false);
+  // CPU geometry outlives the buffers, so evicted meshes can still be hit
   void Destroy();
+  // False from eviction until the buffers are created again
+  bool IsResident() const;
 
   uint32_t GetVerticesCount() const;
   uint32_t GetIndicesCount() const;
 
   bool LoadFromAsset(VmaAllocator allocator, CommandBuffer command_buffer,
-                     const char* path);
+                     const char* path, bool retain_geometry = false);
+  /*
+  Decode mesh asset, does not touch the GPU so it can run on any thread
+  */
+  static bool Decode(Assets::AssetFile& file, MeshData& data);
 
   void BindBuffers(CommandBuffer command_buffer);
 
@@ -42,12 +69,16 @@ class Mesh {
 
   const RenderBounds& GetBounds() const;
   RenderBounds& GetBounds();
+  // Null unless geometry was retained
+  const MeshGeometry* GetGeometry() const { return geometry_.get(); }
 
  private:
   VertexBuffer vertex_buffer_;
   IndexBuffer index_buffer_;
 
   RenderBounds bounds_;
+  // Shared by copies of the mesh, it never changes once built
+  std::shared_ptr<const MeshGeometry> geometry_;
 };
 
 }
\ No newline at end of file
@@ -0,0 +1,178 @@
+#include "MeshGeometry.h"
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+
+#include "Bvh.h"
+
+namespace Renderer {
+
+namespace {
+
+constexpr uint32_t kLeafSize = 4;
+
+}  // namespace
+
+void MeshGeometry::Build(const std::vector<Vertex>& vertices,
+                         const std::vector<uint32_t>& indices) {
+  triangles_.clear();
+  nodes_.clear();
+
+  size_t corner_count = indices.empty() ? vertices.size() : indices.size();
+  triangles_.resize(corner_count / 3);
+  for (size_t i = 0; i < triangles_.size(); ++i) {
+    for (size_t corner = 0; corner < 3; ++corner) {
+      size_t index = 3 * i + corner;
+      triangles_[i].vertices[corner] =
+          vertices[indices.empty() ? index : indices[index]].pos;
+    }
+  }
+  if (triangles_.empty()) return;
+
+  std::vector<glm::vec3> centroids(triangles_.size());
+  for (size_t i = 0; i < triangles_.size(); ++i) {
+    const Triangle& triangle = triangles_[i];
+    centroids[i] = (triangle.vertices[0] + triangle.vertices[1] +
+                    triangle.vertices[2]) /
+                   3.f;
+  }
+
+  nodes_.reserve(2 * (triangles_.size() / kLeafSize + 1));
+  BuildRange(centroids, 0, static_cast<uint32_t>(triangles_.size()));
+  nodes_.shrink_to_fit();
+}
+
+float MeshGeometry::IntersectRay(const glm::vec3& origin,
+                                 const glm::vec3& direction,
+                                 float max_distance) const {
+  if (nodes_.empty()) return -1.f;
+
+  glm::vec3 inverse_direction = 1.f / direction;
+  float closest = max_distance;
+  bool found = false;
+
+  // Median splits keep the depth at log2 of the leaf count
+  struct Entry {
+    uint32_t index;
+    float distance;
+  };
+  Entry stack[64];
+  uint32_t stack_size = 0;
+  float root_distance = Aabb{nodes_[0].min, nodes_[0].max}.IntersectRay(
+      origin, inverse_direction, closest);
+  if (root_distance >= 0.f) stack[stack_size++] = Entry{0, root_distance};
+
+  while (stack_size > 0) {
+    Entry entry = stack[--stack_size];
+    if (entry.distance > closest) continue;
+    const Node& node = nodes_[entry.index];
+
+    if (node.count == 0) {
+      Entry children[2] = {{entry.index + 1, 0.f}, {node.index, 0.f}};
+      for (Entry& child : children) {
+        const Node& child_node = nodes_[child.index];
+        child.distance = Aabb{child_node.min, child_node.max}.IntersectRay(
+            origin, inverse_direction, closest);
+      }
+      // Nearer child is popped first, its hits cut the other one short
+      if (children[0].distance >= 0.f && children[1].distance >= 0.f &&
+          children[0].distance < children[1].distance)
+        std::swap(children[0], children[1]);
+      for (const Entry& child : children) {
+        if (child.distance >= 0.f) stack[stack_size++] = child;
+      }
+      continue;
+    }
+
+    // Moller-Trumbore, without culling back faces
+    for (uint32_t i = node.index; i < node.index + node.count; ++i) {
+      const Triangle& triangle = triangles_[i];
+      glm::vec3 edge1 = triangle.vertices[1] - triangle.vertices[0];
+      glm::vec3 edge2 = triangle.vertices[2] - triangle.vertices[0];
+      glm::vec3 p = glm::cross(direction, edge2);
+      float determinant = glm::dot(edge1, p);
+      // Ray parallel to the triangle, scale of either is left alone so that
+      // tiny triangles are still hit
+      if (determinant == 0.f) continue;
+
+      float inverse_determinant = 1.f / determinant;
+      glm::vec3 offset = origin - triangle.vertices[0];
+      float u = glm::dot(offset, p) * inverse_determinant;
+      if (u < 0.f || u > 1.f) continue;
+      glm::vec3 q = glm::cross(offset, edge1);
+      float v = glm::dot(direction, q) * inverse_determinant;
+      if (v < 0.f || u + v > 1.f) continue;
+
+      float distance = glm::dot(edge2, q) * inverse_determinant;
+      if (distance >= 0.f && distance <= closest) {
+        closest = distance;
+        found = true;
+      }
+    }
+  }
+
+  return found ? closest : -1.f;
+}
+
+size_t MeshGeometry::GetMemorySize() const {
+  return triangles_.capacity() * sizeof(Triangle) +
+         nodes_.capacity() * sizeof(Node);
+}
+
+uint32_t MeshGeometry::BuildRange(std::vector<glm::vec3>& centroids,
+                                  uint32_t first, uint32_t last) {
+  uint32_t index = static_cast<uint32_t>(nodes_.size());
+  nodes_.emplace_back();
+
+  glm::vec3 min(std::numeric_limits<float>::max());
+  glm::vec3 max(std::numeric_limits<float>::lowest());
+  glm::vec3 centroid_min = min;
+  glm::vec3 centroid_max = max;
+  for (uint32_t i = first; i < last; ++i) {
+    for (const glm::vec3& vertex : triangles_[i].vertices) {
+      min = glm::min(min, vertex);
+      max = glm::max(max, vertex);
+    }
+    centroid_min = glm::min(centroid_min, centroids[i]);
+    centroid_max = glm::max(centroid_max, centroids[i]);
+  }
+  nodes_[index].min = min;
+  nodes_[index].max = max;
+
+  if (last - first <= kLeafSize) {
+    nodes_[index].index = first;
+    nodes_[index].count = last - first;
+    return index;
+  }
+
+  // Triangles and their centroids are reordered together
+  glm::vec3 size = centroid_max - centroid_min;
+  int axis = size.x > size.y ? (size.x > size.z ? 0 : 2)
+                             : (size.y > size.z ? 1 : 2);
+  std::vector<uint32_t> order(last - first);
+  std::iota(order.begin(), order.end(), first);
+  uint32_t middle = first + (last - first) / 2;
+  std::nth_element(order.begin(), order.begin() + (middle - first),
+                   order.end(), [&](uint32_t lhs, uint32_t rhs) {
+                     return centroids[lhs][axis] < centroids[rhs][axis];
+                   });
+
+  std::vector<Triangle> triangles(order.size());
+  std::vector<glm::vec3> sorted_centroids(order.size());
+  for (size_t i = 0; i < order.size(); ++i) {
+    triangles[i] = triangles_[order[i]];
+    sorted_centroids[i] = centroids[order[i]];
+  }
+  std::copy(triangles.begin(), triangles.end(), triangles_.begin() + first);
+  std::copy(sorted_centroids.begin(), sorted_centroids.end(),
+            centroids.begin() + first);
+
+  BuildRange(centroids, first, middle);
+  uint32_t right = BuildRange(centroids, middle, last);
+  nodes_[index].index = right;
+  nodes_[index].count = 0;
+  return index;
+}
+
+}  // namespace Renderer
\ No newline at end of file
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "Vertex.h"
+
+namespace Renderer {
+
+/*
+CPU copy of mesh triangles for exact ray queries, positions only
+
+- Triangles are reordered along a static BVH built once, so a ray visits
+  only the few triangles near it, even on meshes with millions of them
+- Vertices without indices are taken as a triangle list
+*/
+class MeshGeometry {
+ public:
+  void Build(const std::vector<Vertex>& vertices,
+             const std::vector<uint32_t>& indices);
+
+  /*
+  Distance along direction of the closest triangle hit within max_distance,
+  negative for a miss. Both faces count
+
+  - Distance is in units of direction, which need not be normalized, so
+    rays transformed into mesh space keep their distances
+  */
+  float IntersectRay(const glm::vec3& origin, const glm::vec3& direction,
+                     float max_distance) const;
+
+  size_t GetTriangleCount() const { return triangles_.size(); }
+  size_t GetMemorySize() const;
+
+ private:
+  struct Triangle {
+    glm::vec3 vertices[3];
+  };
+
+  // Children of inner nodes are the next node and the node at index
+  struct Node {
+    glm::vec3 min;
+    uint32_t index;
+    glm::vec3 max;
+    // Triangles of leaf starting at index, 0 for inner nodes
+    uint32_t count;
+  };
+
+  uint32_t BuildRange(std::vector<glm::vec3>& centroids, uint32_t first,
+                      uint32_t last);
+
+  std::vector<Triangle> triangles_;
+  std::vector<Node> nodes_;
+};
+
+}
\ No newline at end of file
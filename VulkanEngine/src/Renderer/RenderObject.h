@@ -9,10 +9,66 @@
 
 namespace Renderer {
 
+// World bounds of mesh with bounds original placed by transform
+inline RenderBounds TransformRenderBounds(const RenderBounds& original,
+                                          const glm::mat4& transform) {
+  std::array<glm::vec3, 8> verts;
+  for (size_t i = 0; i < 8; ++i) verts[i] = original.origin;
+
+  verts[0] += original.extents * glm::vec3(1, 1, 1);
+  verts[1] += original.extents * glm::vec3(1, 1, -1);
+  verts[2] += original.extents * glm::vec3(1, -1, 1);
+  verts[3] += original.extents * glm::vec3(1, -1, -1);
+  verts[4] += original.extents * glm::vec3(-1, 1, 1);
+  verts[5] += original.extents * glm::vec3(-1, 1, -1);
+  verts[6] += original.extents * glm::vec3(-1, -1, 1);
+  verts[7] += original.extents * glm::vec3(-1, -1, -1);
+
+  glm::vec3 min{std::numeric_limits<float>().max()};
+  glm::vec3 max{std::numeric_limits<float>().lowest()};
+
+  for (size_t i = 0; i < 8; ++i) {
+    verts[i] = transform * glm::vec4(verts[i], 1.f);
+    min = glm::min(verts[i], min);
+    max = glm::max(verts[i], max);
+  }
+
+  glm::vec3 extents = (max - min) / 2.f;
+  glm::vec3 origin = min + extents;
+
+  float max_scale = 0.f;
+  max_scale = std::max(max_scale,
+                       glm::length(glm::vec3(transform[0][0], transform[0][1],
+                                             transform[0][2])));
+  max_scale = std::max(max_scale,
+                       glm::length(glm::vec3(transform[1][0], transform[1][1],
+                                             transform[1][2])));
+  max_scale = std::max(max_scale,
+                       glm::length(glm::vec3(transform[2][0], transform[2][1],
+                                             transform[2][2])));
+
+  RenderBounds bounds;
+  bounds.extents = extents;
+  bounds.radius = max_scale * original.radius;
+  bounds.origin = origin;
+  bounds.valid = true;
+  return bounds;
+}
+
+/*
+How object is expected to change once registered
+
+- Static objects are kept apart from dynamic ones in object data, so that
+  frequent updates of dynamic objects upload only their region. Moving a
+  static object still works, at the cost of a scattered upload
+*/
+enum class Mobility { kStatic, kDynamic };
+
 struct RenderObject {
  public:
-  RenderObject() : model_mat(1.f) {}
-  RenderObject(Mesh* mesh, Material* material) : model_mat(1.f) {
+  RenderObject() : model_mat(1.f), mobility(Mobility::kDynamic) {}
+  RenderObject(Mesh* mesh, Material* material)
+      : model_mat(1.f), mobility(Mobility::kDynamic) {
     Create(mesh, material);
   }
 
@@ -25,49 +81,7 @@ struct RenderObject {
     const RenderBounds& original = mesh->GetBounds();
     if (!original.valid) return;
 
-    std::array<glm::vec3, 8> verts;
-    for (size_t i = 0; i < 8; ++i) verts[i] = original.origin;
-
-    verts[0] += original.extents * glm::vec3(1, 1, 1);
-    verts[1] += original.extents * glm::vec3(1, 1, -1);
-    verts[2] += original.extents * glm::vec3(1, -1, 1);
-    verts[3] += original.extents * glm::vec3(1, -1, -1);
-    verts[4] += original.extents * glm::vec3(-1, 1, 1);
-    verts[5] += original.extents * glm::vec3(-1, 1, -1);
-    verts[6] += original.extents * glm::vec3(-1, -1, 1);
-    verts[7] += original.extents * glm::vec3(-1, -1, -1);
-
-    glm::vec3 min{std::numeric_limits<float>().max()};
-    glm::vec3 max{std::numeric_limits<float>().min()};
-
-    glm::mat4 transform = model_mat;
-
-    for (size_t i = 0; i < 8; ++i) {
-      verts[i] = transform * glm::vec4(verts[i], 1.f);
-      min = glm::min(verts[i], min);
-      max = glm::max(verts[i], max);
-    }
-
-    glm::vec3 extents = (max - min) / 2.f;
-    glm::vec3 origin = min + extents;
-
-    float max_scale = 0.f;
-    max_scale = std::max(max_scale,
-                         glm::length(glm::vec3(transform[0][0], transform[0][1],
-                                               transform[0][2])));
-    max_scale = std::max(max_scale,
-                         glm::length(glm::vec3(transform[1][0], transform[1][1],
-                                               transform[1][2])));
-    max_scale = std::max(max_scale,
-                         glm::length(glm::vec3(transform[2][0], transform[2][1],
-                                               transform[2][2])));
-
-    float radius = max_scale * original.radius;
-
-    bounds.extents = extents;
-    bounds.radius = radius;
-    bounds.origin = origin;
-    bounds.valid = true;
+    bounds = TransformRenderBounds(original, model_mat);
   }
 
   Mesh* mesh;
@@ -77,6 +91,8 @@ struct RenderObject {
 
   RenderBounds bounds;
 
+  Mobility mobility;
+
   bool draw_forward_pass;
   bool draw_shadow_pass;
 };
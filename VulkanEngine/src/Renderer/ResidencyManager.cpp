@@ -0,0 +1,225 @@
+#include "ResidencyManager.h"
+
+#include <algorithm>
+
+namespace Renderer {
+
+void ResidencyManager::Init(VmaAllocator allocator) {
+  allocator_ = allocator;
+}
+
+uint32_t ResidencyManager::TrackTexture(const std::string& name,
+                                        const std::string& path,
+                                        VkImageView view, VkDeviceSize size) {
+  uint32_t id = Track({name, path, ResidentType::kTexture, size, 0, true,
+                       false});
+  texture_views_[view] = id;
+  return id;
+}
+
+uint32_t ResidencyManager::TrackMesh(const std::string& name,
+                                     const std::string& path, Mesh* mesh,
+                                     VkDeviceSize size) {
+  uint32_t id =
+      Track({name, path, ResidentType::kMesh, size, 0, true, false});
+  meshes_[mesh] = id;
+  return id;
+}
+
+void ResidencyManager::Pin(const std::string& name) {
+  auto iter = names_.find(name);
+  if (iter != names_.end()) resources_[iter->second].pinned = true;
+}
+
+void ResidencyManager::TouchTexture(VkImageView view, uint64_t frame) {
+  auto iter = texture_views_.find(view);
+  if (iter != texture_views_.end())
+    resources_[iter->second].last_used_frame = frame;
+}
+
+void ResidencyManager::TouchMesh(Mesh* mesh, uint64_t frame) {
+  auto iter = meshes_.find(mesh);
+  if (iter != meshes_.end()) resources_[iter->second].last_used_frame = frame;
+}
+
+void ResidencyManager::MarkEvicted(uint32_t id, VkImageView fallback_view) {
+  ResidentResource& resource = resources_[id];
+  resource.resident = false;
+  ++evictions_count_;
+
+  if (resource.type != ResidentType::kTexture) return;
+
+  for (auto iter = texture_views_.begin(); iter != texture_views_.end();) {
+    if (iter->second == id)
+      iter = texture_views_.erase(iter);
+    else
+      ++iter;
+  }
+  if (fallback_view != VK_NULL_HANDLE) texture_views_[fallback_view] = id;
+}
+
+void ResidencyManager::MarkResident(uint32_t id, VkDeviceSize size,
+                                    VkImageView view) {
+  ResidentResource& resource = resources_[id];
+  resource.resident = true;
+  resource.size = size;
+  ++reloads_count_;
+
+  if (resource.type != ResidentType::kTexture) return;
+
+  for (auto iter = texture_views_.begin(); iter != texture_views_.end();) {
+    if (iter->second == id)
+      iter = texture_views_.erase(iter);
+    else
+      ++iter;
+  }
+  if (view != VK_NULL_HANDLE) texture_views_[view] = id;
+}
+
+void ResidencyManager::ReplaceTextureView(VkImageView old_view,
+                                          VkImageView new_view) {
+  auto iter = texture_views_.find(old_view);
+  if (iter == texture_views_.end()) return;
+
+  uint32_t id = iter->second;
+  texture_views_.erase(iter);
+  texture_views_[new_view] = id;
+}
+
+void ResidencyManager::UpdateBudget() {
+  const VkPhysicalDeviceMemoryProperties* memory_props;
+  vmaGetMemoryProperties(allocator_, &memory_props);
+
+  std::vector<VmaBudget> budgets(memory_props->memoryHeapCount);
+  vmaGetHeapBudgets(allocator_, budgets.data());
+
+  budget_ = 0;
+  usage_ = 0;
+  for (uint32_t i = 0; i < memory_props->memoryHeapCount; ++i) {
+    if (!(memory_props->memoryHeaps[i].flags &
+          VK_MEMORY_HEAP_DEVICE_LOCAL_BIT))
+      continue;
+
+    budget_ += budgets[i].budget;
+    usage_ += budgets[i].usage;
+  }
+}
+
+std::vector<uint32_t> ResidencyManager::GetEvictionCandidates(
+    uint64_t frame, uint64_t min_unused_frames, float budget_fraction) const {
+  std::vector<uint32_t> candidates;
+
+  VkDeviceSize target =
+      static_cast<VkDeviceSize>(static_cast<double>(budget_) * budget_fraction);
+  if (usage_ <= target) return candidates;
+
+  for (uint32_t i = 0; i < resources_.size(); ++i) {
+    const ResidentResource& resource = resources_[i];
+    if (!resource.resident || resource.pinned) continue;
+    if (resource.last_used_frame + min_unused_frames > frame) continue;
+
+    candidates.push_back(i);
+  }
+
+  std::sort(candidates.begin(), candidates.end(),
+            [&](uint32_t a, uint32_t b) {
+    return resources_[a].last_used_frame < resources_[b].last_used_frame;
+  });
+
+  VkDeviceSize freed = 0;
+  size_t count = 0;
+  while (count < candidates.size() && usage_ - freed > target) {
+    freed += std::min(resources_[candidates[count]].size, usage_ - freed);
+    ++count;
+  }
+  candidates.resize(count);
+
+  return candidates;
+}
+
+std::vector<uint32_t> ResidencyManager::GetReloadRequests(
+    uint64_t frame) const {
+  std::vector<uint32_t> requests;
+  for (uint32_t i = 0; i < resources_.size(); ++i) {
+    const ResidentResource& resource = resources_[i];
+    if (!resource.resident && !resource.pinned &&
+        resource.last_used_frame == frame)
+      requests.push_back(i);
+  }
+  return requests;
+}
+
+void ResidencyManager::RequestFileLoad(uint32_t id) {
+  if (file_loads_.find(id) != file_loads_.end()) return;
+  for (const auto& [loaded_id, file] : loaded_files_)
+    if (loaded_id == id) return;
+
+  file_loads_[id] =
+      std::async(std::launch::async, [path = resources_[id].path]() {
+    Assets::AssetFile file;
+    Assets::LoadBinaryFile(path.c_str(), file);
+    return file;
+  });
+}
+
+std::vector<std::pair<uint32_t, Assets::AssetFile>>
+ResidencyManager::CollectLoadedFiles(VkDeviceSize max_bytes) {
+  for (auto iter = file_loads_.begin(); iter != file_loads_.end();) {
+    if (iter->second.wait_for(std::chrono::seconds(0)) ==
+        std::future_status::ready) {
+      loaded_files_.push_back({iter->first, iter->second.get()});
+      iter = file_loads_.erase(iter);
+    } else {
+      ++iter;
+    }
+  }
+
+  std::vector<std::pair<uint32_t, Assets::AssetFile>> files;
+  VkDeviceSize bytes = 0;
+  while (!loaded_files_.empty()) {
+    VkDeviceSize size = resources_[loaded_files_.front().first].size;
+    if (!files.empty() && bytes + size > max_bytes) break;
+    bytes += size;
+    files.push_back(std::move(loaded_files_.front()));
+    loaded_files_.pop_front();
+  }
+
+  return files;
+}
+
+ResidentResource& ResidencyManager::Get(uint32_t id) { return resources_[id]; }
+
+VkDeviceSize ResidencyManager::GetBudget() const { return budget_; }
+
+VkDeviceSize ResidencyManager::GetUsage() const { return usage_; }
+
+uint32_t ResidencyManager::GetResidentCount() const {
+  return static_cast<uint32_t>(
+      std::count_if(resources_.begin(), resources_.end(),
+                    [](const ResidentResource& r) { return r.resident; }));
+}
+
+uint32_t ResidencyManager::GetEvictedCount() const {
+  return static_cast<uint32_t>(resources_.size()) - GetResidentCount();
+}
+
+uint32_t ResidencyManager::GetEvictionsCount() const {
+  return evictions_count_;
+}
+
+uint32_t ResidencyManager::GetReloadsCount() const { return reloads_count_; }
+
+uint32_t ResidencyManager::Track(ResidentResource&& resource) {
+  auto iter = names_.find(resource.name);
+  if (iter != names_.end()) {
+    resources_[iter->second] = std::move(resource);
+    return iter->second;
+  }
+
+  uint32_t id = static_cast<uint32_t>(resources_.size());
+  names_[resource.name] = id;
+  resources_.push_back(std::move(resource));
+  return id;
+}
+
+}  // namespace Renderer
\ No newline at end of file
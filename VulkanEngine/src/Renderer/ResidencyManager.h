@@ -0,0 +1,126 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+#include <vma\include\vk_mem_alloc.h>
+
+#include <deque>
+#include <future>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "AssetLoader.h"
+
+namespace Renderer {
+
+class Mesh;
+
+enum class ResidentType { kTexture, kMesh };
+
+struct ResidentResource {
+  std::string name;
+  std::string path;
+  ResidentType type;
+
+  VkDeviceSize size;
+  uint64_t last_used_frame;
+
+  bool resident;
+  bool pinned;
+};
+
+/*
+Tracks device local memory budget and per resource usage
+
+- Decides what to evict and what to bring back, the owner of the resources
+  does the actual destruction and reloading
+*/
+class ResidencyManager {
+ public:
+  void Init(VmaAllocator allocator);
+
+  uint32_t TrackTexture(const std::string& name, const std::string& path,
+                        VkImageView view, VkDeviceSize size);
+  uint32_t TrackMesh(const std::string& name, const std::string& path,
+                     Mesh* mesh, VkDeviceSize size);
+  void Pin(const std::string& name);
+
+  void TouchTexture(VkImageView view, uint64_t frame);
+  void TouchMesh(Mesh* mesh, uint64_t frame);
+
+  /*
+  Mark resource as evicted
+
+  - fallback_view is the texture view bound in place of the evicted one
+  */
+  void MarkEvicted(uint32_t id, VkImageView fallback_view = VK_NULL_HANDLE);
+  void MarkResident(uint32_t id, VkDeviceSize size,
+                    VkImageView view = VK_NULL_HANDLE);
+  void ReplaceTextureView(VkImageView old_view, VkImageView new_view);
+
+  /*
+  Query VMA heap budgets
+
+  - Only device local heaps are accounted for
+  */
+  void UpdateBudget();
+
+  /*
+  Least recently used resources whose eviction brings usage under
+  budget * budget_fraction
+
+  - Resources used during the last min_unused_frames frames are never picked
+  */
+  std::vector<uint32_t> GetEvictionCandidates(uint64_t frame,
+                                              uint64_t min_unused_frames,
+                                              float budget_fraction) const;
+  /*
+  Evicted resources that were used during frame
+  */
+  std::vector<uint32_t> GetReloadRequests(uint64_t frame) const;
+
+  /*
+  Start reading resource file from disk on another thread
+
+  - Does nothing if the load is already in flight or not collected yet
+  */
+  void RequestFileLoad(uint32_t id);
+  /*
+  Loaded files, whose resources take at most max_bytes of memory but always at
+  least one entry if any is ready
+  */
+  std::vector<std::pair<uint32_t, Assets::AssetFile>> CollectLoadedFiles(
+      VkDeviceSize max_bytes);
+
+  ResidentResource& Get(uint32_t id);
+
+  VkDeviceSize GetBudget() const;
+  VkDeviceSize GetUsage() const;
+  uint32_t GetResidentCount() const;
+  uint32_t GetEvictedCount() const;
+  uint32_t GetEvictionsCount() const;
+  uint32_t GetReloadsCount() const;
+
+ private:
+  uint32_t Track(ResidentResource&& resource);
+
+  VmaAllocator allocator_;
+
+  VkDeviceSize budget_ = 0;
+  VkDeviceSize usage_ = 0;
+
+  uint32_t evictions_count_ = 0;
+  uint32_t reloads_count_ = 0;
+
+  std::vector<ResidentResource> resources_;
+  std::unordered_map<std::string, uint32_t> names_;
+  std::unordered_map<VkImageView, uint32_t> texture_views_;
+  std::unordered_map<Mesh*, uint32_t> meshes_;
+
+  std::unordered_map<uint32_t, std::future<Assets::AssetFile>> file_loads_;
+  // Loaded files left over by the budget of previous collections
+  std::deque<std::pair<uint32_t, Assets::AssetFile>> loaded_files_;
+};
+
+}
\ No newline at end of file
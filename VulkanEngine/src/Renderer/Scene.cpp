@@ -1,18 +1,107 @@
 #include "Scene.h"
 
-#include <future>
+#include <algorithm>
+#include <map>
 
+#include "BatchSort.h"
 #include "RenderObject.h"
+#include "ThreadPool.h"
 #include "VulkanEngine.h"
 #include "Logger.h"
 
 namespace Renderer {
 
-RenderScene::PassObject* RenderScene::MeshPass::Get(Handle<PassObject> handle) {
-  return &objects[handle.handle];
+namespace {
+
+// Objects handed to a worker at once by batch registration
+constexpr uint32_t kRegisterChunkSize = 4096;
+
+bool IsInBatch(const RenderScene::IndirectBatch& batch,
+               const RenderScene::PassObject& object) {
+  return batch.sort_key == object.sort_key &&
+         batch.mesh_id.handle == object.mesh_id.handle &&
+         batch.material.material == object.material.material &&
+         batch.material.shader_pass == object.material.shader_pass;
+}
+
+}  // namespace
+
+Handle<SceneObject> SceneObjectStorage::Insert(const SceneObject& object) {
+  transforms.push_back(object.transform_matrix);
+  bounds.push_back(object.bounds);
+  mesh_ids.push_back(object.mesh_id);
+  material_ids.push_back(object.material_id);
+  pass_indices.push_back(object.pass_indices);
+  update_indices.push_back(object.update_index);
+  return indices_.insert();
+}
+
+uint32_t SceneObjectStorage::InsertUninitialized(
+    uint32_t count, Handle<SceneObject>* handles) {
+  uint32_t first = GetSize();
+  size_t size = first + count;
+  transforms.resize(size);
+  bounds.resize(size);
+  mesh_ids.resize(size);
+  material_ids.resize(size);
+  pass_indices.resize(size);
+  update_indices.resize(size);
+
+  indices_.reserve(size);
+  for (uint32_t i = 0; i < count; ++i) handles[i] = indices_.insert();
+  return first;
+}
+
+void SceneObjectStorage::Erase(Handle<SceneObject> handle) {
+  uint32_t index = indices_.erase(handle);
+  if (index + 1 != transforms.size()) {
+    transforms[index] = transforms.back();
+    bounds[index] = bounds.back();
+    mesh_ids[index] = mesh_ids.back();
+    material_ids[index] = material_ids.back();
+    pass_indices[index] = pass_indices.back();
+    update_indices[index] = update_indices.back();
+  }
+  transforms.pop_back();
+  bounds.pop_back();
+  mesh_ids.pop_back();
+  material_ids.pop_back();
+  pass_indices.pop_back();
+  update_indices.pop_back();
+}
+
+void SceneObjectStorage::Swap(uint32_t first, uint32_t second) {
+  std::swap(transforms[first], transforms[second]);
+  std::swap(bounds[first], bounds[second]);
+  std::swap(mesh_ids[first], mesh_ids[second]);
+  std::swap(material_ids[first], material_ids[second]);
+  std::swap(pass_indices[first], pass_indices[second]);
+  std::swap(update_indices[first], update_indices[second]);
+  indices_.swap(first, second);
+}
+
+void SceneObjectStorage::Reserve(size_t count) {
+  transforms.reserve(count);
+  bounds.reserve(count);
+  mesh_ids.reserve(count);
+  material_ids.reserve(count);
+  pass_indices.reserve(count);
+  update_indices.reserve(count);
+  indices_.reserve(count);
 }
 
-void RenderScene::Init() {
+PassObject* RenderScene::MeshPass::Get(Handle<PassObject> handle) {
+  return objects.get(handle);
+}
+
+const PassObject* RenderScene::MeshPass::Get(
+    Handle<PassObject> handle) const {
+  return objects.get(handle);
+}
+
+void RenderScene::Init(Engine::ThreadPool* thread_pool) {
+  thread_pool_ = thread_pool;
+
   forward_pass.type = MeshPassType::kForward;
   transparent_pass.type = MeshPassType::kTransparency;
   directional_shadow_pass.type = MeshPassType::kDirectionalShadow;
@@ -23,6 +112,8 @@ void RenderScene::Destroy() {
   merged_index_buffer.Destroy();
   merged_vertex_buffer.Destroy();
   object_data_buffer.Destroy();
+  group_instance_buffer.Destroy();
+  group_buffer.Destroy();
 
   forward_pass.Destroy();
   transparent_pass.Destroy();
@@ -37,11 +128,10 @@ Handle<SceneObject> RenderScene::RegisterObject(RenderObject* object) {
   new_object.material_id = GetMaterialHandle(object->material);
   new_object.mesh_id = GetMeshHandle(object->mesh);
   new_object.update_index = -1;
-  new_object.pass_indices.Clear(-1);
-  Handle<SceneObject> handle;
-  handle.handle = static_cast<uint32_t>(renderables.size());
-
-  renderables.push_back(new_object);
+  new_object.pass_indices.Clear(Handle<PassObject>());
+  Handle<SceneObject> handle = renderables.Insert(new_object);
+  if (object->mobility == Mobility::kStatic)
+    MakeStatic(renderables.GetSize() - 1);
 
   if (object->draw_forward_pass) {
     if (object->material->original->pass_shaders[MeshPassType::kTransparency])
@@ -61,181 +151,603 @@ Handle<SceneObject> RenderScene::RegisterObject(RenderObject* object) {
   return handle;
 }
 
-void RenderScene::RegisterObjectBatch(RenderObject* first, uint32_t count) {
-  renderables.reserve(renderables.size() + count);
-  for (size_t i = 0; i < count; ++i) RegisterObject(&first[i]);
+std::vector<Handle<SceneObject>> RenderScene::RegisterObjectBatch(
+    RenderObject* first, uint32_t count) {
+  struct ResolvedPair {
+    Handle<DrawMesh> mesh_id;
+    Handle<Material> material_id;
+  };
+
+  // Objects of a prefab or a spawn mostly come in runs of the same pair, so
+  // the map is only consulted when the pair changes
+  std::map<std::pair<Mesh*, Material*>, uint32_t> pair_indices;
+  std::vector<ResolvedPair> pairs;
+  std::vector<uint32_t> object_pairs(count);
+  PerPassData<std::vector<uint32_t>> pass_objects;
+
+  for (uint32_t i = 0; i < count; ++i) {
+    RenderObject& object = first[i];
+    if (i > 0 && object.mesh == first[i - 1].mesh &&
+        object.material == first[i - 1].material) {
+      object_pairs[i] = object_pairs[i - 1];
+    } else {
+      auto [iter, inserted] = pair_indices.try_emplace(
+          std::make_pair(object.mesh, object.material),
+          static_cast<uint32_t>(pairs.size()));
+      if (inserted) {
+        ResolvedPair pair;
+        pair.mesh_id = GetMeshHandle(object.mesh);
+        pair.material_id = GetMaterialHandle(object.material);
+        pairs.push_back(pair);
+      }
+      object_pairs[i] = iter->second;
+    }
+
+    const PerPassData<ShaderPass*>& shaders =
+        object.material->original->pass_shaders;
+    if (object.draw_forward_pass) {
+      if (shaders[MeshPassType::kTransparency])
+        pass_objects[MeshPassType::kTransparency].push_back(i);
+      if (shaders[MeshPassType::kForward])
+        pass_objects[MeshPassType::kForward].push_back(i);
+    }
+    if (object.draw_shadow_pass) {
+      if (shaders[MeshPassType::kDirectionalShadow])
+        pass_objects[MeshPassType::kDirectionalShadow].push_back(i);
+      if (shaders[MeshPassType::kPointShadow])
+        pass_objects[MeshPassType::kPointShadow].push_back(i);
+    }
+  }
+
+  std::vector<Handle<SceneObject>> handles(count);
+  uint32_t first_index = renderables.InsertUninitialized(count, handles.data());
+  uint32_t first_dirty = static_cast<uint32_t>(dirty_objects.size());
+  dirty_objects.resize(dirty_objects.size() + count);
+
+  auto fill_chunk = [&](uint32_t chunk) {
+    uint32_t begin = chunk * kRegisterChunkSize;
+    uint32_t end = std::min(begin + kRegisterChunkSize, count);
+    for (uint32_t i = begin; i < end; ++i) {
+      uint32_t index = first_index + i;
+      const ResolvedPair& pair = pairs[object_pairs[i]];
+      renderables.transforms[index] = first[i].model_mat;
+      renderables.bounds[index] = first[i].bounds;
+      renderables.mesh_ids[index] = pair.mesh_id;
+      renderables.material_ids[index] = pair.material_id;
+      renderables.pass_indices[index].Clear(Handle<PassObject>());
+      renderables.update_indices[index] = first_dirty + i;
+      dirty_objects[first_dirty + i] = handles[i];
+    }
+  };
+
+  uint32_t chunk_count = (count + kRegisterChunkSize - 1) / kRegisterChunkSize;
+  if (thread_pool_ && chunk_count > 1) {
+    thread_pool_->ParallelFor(chunk_count, fill_chunk);
+  } else {
+    for (uint32_t chunk = 0; chunk < chunk_count; ++chunk) fill_chunk(chunk);
+  }
+
+  // New objects are dirty already, only dynamic objects in the way of static
+  // ones are touched
+  for (uint32_t i = 0; i < count; ++i) {
+    if (first[i].mobility == Mobility::kStatic)
+      MakeStatic(renderables.GetIndex(handles[i]));
+  }
+
+  MeshPass* passes[] = {&forward_pass, &transparent_pass,
+                        &directional_shadow_pass, &point_shadow_pass};
+  for (MeshPass* pass : passes) {
+    const std::vector<uint32_t>& objects = pass_objects[pass->type];
+    pass->unbatches_objects.reserve(pass->unbatches_objects.size() +
+                                    objects.size());
+    for (uint32_t i : objects) pass->unbatches_objects.push_back(handles[i]);
+  }
+
+  return handles;
+}
+
+void RenderScene::UnregisterObject(Handle<SceneObject> object_id) {
+  if (!renderables.Contains(object_id)) {
+    LOG_ERROR("Unregistering stale scene object handle {}:{}",
+              object_id.handle, object_id.generation);
+    return;
+  }
+
+  PerPassData<Handle<PassObject>>& pass_indices =
+      renderables.pass_indices[renderables.GetIndex(object_id)];
+  MeshPass* passes[] = {&forward_pass, &transparent_pass,
+                        &directional_shadow_pass, &point_shadow_pass};
+  for (MeshPass* pass : passes) {
+    Handle<PassObject>& pass_index = pass_indices[pass->type];
+    if (!pass_index.IsValid()) continue;
+
+    pass->objects_to_delete.push_back(pass_index);
+    pass_index = Handle<PassObject>();
+  }
+
+  // Last static object fills the hole, and the last dynamic object the one
+  // it left, so both regions stay dense
+  uint32_t index = renderables.GetIndex(object_id);
+  if (index < renderables.static_count) {
+    uint32_t last_static = renderables.static_count - 1;
+    SwapObjects(index, last_static);
+    SwapObjects(last_static, renderables.GetSize() - 1);
+    --renderables.static_count;
+    index = renderables.GetSize() - 1;
+  }
+
+  // Nothing references its object data anymore, so there is no point in
+  // uploading it
+  RemoveDirty(object_id);
+  bvh.Remove(object_id);
+
+  // Pending registrations of the object are skipped by RefreshPass, as the
+  // handle is stale by then
+  renderables.Erase(object_id);
+  if (index < renderables.GetSize()) MarkMoved(renderables.GetHandle(index));
+}
+
+void RenderScene::UnregisterObjectBatch(const Handle<SceneObject>* first,
+                                        uint32_t count) {
+  for (size_t i = 0; i < count; ++i) UnregisterObject(first[i]);
+}
+
+Handle<InstanceGroup> RenderScene::AddInstanceGroup(
+    Mesh* mesh, Material* material, std::vector<GPUGroupInstance> instances,
+    bool draw_shadow_pass) {
+  if (mesh->GetIndicesCount() == 0) {
+    LOG_ERROR("Instance group mesh has no indices");
+    return Handle<InstanceGroup>();
+  }
+
+  InstanceGroup group;
+  group.mesh_id = GetMeshHandle(mesh);
+  group.material_id = GetMaterialHandle(material);
+  group.instances = std::move(instances);
+  group.first_instance = 0;
+  group.draw_shadow_pass = draw_shadow_pass;
+
+  groups_changed_ = true;
+  return instance_groups.insert(std::move(group));
+}
+
+void RenderScene::RemoveInstanceGroup(Handle<InstanceGroup> group_id) {
+  if (!instance_groups.erase(group_id)) {
+    LOG_ERROR("Removing stale instance group handle {}:{}", group_id.handle,
+              group_id.generation);
+    return;
+  }
+  groups_changed_ = true;
 }
 
 void RenderScene::UpdateTransform(Handle<SceneObject> object_id,
                                   const glm::mat4& transform) {
-  GetObject(object_id)->transform_matrix = transform;
-  UpdateObject(object_id);
+  if (!renderables.Contains(object_id)) {
+    LOG_ERROR("Updating transform of stale scene object handle {}:{}",
+              object_id.handle, object_id.generation);
+    return;
+  }
+
+  // Batches depend only on mesh and material, so they are left as they are
+  uint32_t index = renderables.GetIndex(object_id);
+  renderables.transforms[index] = transform;
+
+  const RenderBounds& mesh_bounds =
+      GetMesh(renderables.mesh_ids[index])->mesh->GetBounds();
+  if (mesh_bounds.valid)
+    renderables.bounds[index] = TransformRenderBounds(mesh_bounds, transform);
+
+  MarkDirty(object_id);
 }
 
 void RenderScene::UpdateObject(Handle<SceneObject> object_id) {
-  PerPassData<int32_t>& pass_indices = GetObject(object_id)->pass_indices;
-  
-  if (pass_indices[MeshPassType::kForward] != -1) {
-    Handle<PassObject> obj;
-    obj.handle = pass_indices[MeshPassType::kForward];
+  if (!renderables.Contains(object_id)) {
+    LOG_ERROR("Updating stale scene object handle {}:{}", object_id.handle,
+              object_id.generation);
+    return;
+  }
 
-    forward_pass.objects_to_delete.push_back(obj);
+  PerPassData<Handle<PassObject>>& pass_indices =
+      renderables.pass_indices[renderables.GetIndex(object_id)];
+
+  if (pass_indices[MeshPassType::kForward].IsValid()) {
+    forward_pass.objects_to_delete.push_back(pass_indices[MeshPassType::kForward]);
     forward_pass.unbatches_objects.push_back(object_id);
 
-    pass_indices[MeshPassType::kForward] = -1;
+    pass_indices[MeshPassType::kForward] = Handle<PassObject>();
   }
 
-  if (pass_indices[MeshPassType::kTransparency] != -1) {
-    Handle<PassObject> obj;
-    obj.handle = pass_indices[MeshPassType::kTransparency];
-
-    transparent_pass.objects_to_delete.push_back(obj);
+  if (pass_indices[MeshPassType::kTransparency].IsValid()) {
+    transparent_pass.objects_to_delete.push_back(pass_indices[MeshPassType::kTransparency]);
     transparent_pass.unbatches_objects.push_back(object_id);
 
-    pass_indices[MeshPassType::kTransparency] = -1;
+    pass_indices[MeshPassType::kTransparency] = Handle<PassObject>();
   }
 
-  if (pass_indices[MeshPassType::kDirectionalShadow] != -1) {
-    Handle<PassObject> obj;
-    obj.handle = pass_indices[MeshPassType::kDirectionalShadow];
-
-    directional_shadow_pass.objects_to_delete.push_back(obj);
+  if (pass_indices[MeshPassType::kDirectionalShadow].IsValid()) {
+    directional_shadow_pass.objects_to_delete.push_back(pass_indices[MeshPassType::kDirectionalShadow]);
     directional_shadow_pass.unbatches_objects.push_back(object_id);
 
-    pass_indices[MeshPassType::kDirectionalShadow] = -1;
+    pass_indices[MeshPassType::kDirectionalShadow] = Handle<PassObject>();
   }
 
-  if (pass_indices[MeshPassType::kPointShadow] != -1) {
-    Handle<PassObject> obj;
-    obj.handle = pass_indices[MeshPassType::kPointShadow];
-
-    point_shadow_pass.objects_to_delete.push_back(obj);
+  if (pass_indices[MeshPassType::kPointShadow].IsValid()) {
+    point_shadow_pass.objects_to_delete.push_back(pass_indices[MeshPassType::kPointShadow]);
     point_shadow_pass.unbatches_objects.push_back(object_id);
 
-    pass_indices[MeshPassType::kPointShadow] = -1;
+    pass_indices[MeshPassType::kPointShadow] = Handle<PassObject>();
   }
 
-  if (GetObject(object_id)->update_index == static_cast<uint32_t>(-1)) {
-    GetObject(object_id)->update_index =
-        static_cast<uint32_t>(dirty_objects.size());
+  MarkDirty(object_id);
+}
+
+void RenderScene::MarkDirty(Handle<SceneObject> object_id) {
+  uint32_t& update_index =
+      renderables.update_indices[renderables.GetIndex(object_id)];
+  if (update_index == static_cast<uint32_t>(-1)) {
+    update_index = static_cast<uint32_t>(dirty_objects.size());
     dirty_objects.push_back(object_id);
   }
 }
 
-void RenderScene::FillObjectData(GPUObjectData* data) {
-  for (uint32_t i = 0; i < renderables.size(); ++i) {
-    Handle<SceneObject> handle;
-    handle.handle = i;
-    WriteObject(data + i, handle);
+void RenderScene::RemoveDirty(Handle<SceneObject> object_id) {
+  uint32_t& update_index =
+      renderables.update_indices[renderables.GetIndex(object_id)];
+  if (update_index == static_cast<uint32_t>(-1)) return;
+
+  Handle<SceneObject> moved = dirty_objects.back();
+  dirty_objects[update_index] = moved;
+  renderables.update_indices[renderables.GetIndex(moved)] = update_index;
+  dirty_objects.pop_back();
+
+  update_index = static_cast<uint32_t>(-1);
+}
+
+void RenderScene::MarkMoved(Handle<SceneObject> object_id) {
+  MarkDirty(object_id);
+
+  // Instances are only written when uploaded, so those not batched yet pick
+  // the new position up anyway
+  PerPassData<Handle<PassObject>>& pass_indices =
+      renderables.pass_indices[renderables.GetIndex(object_id)];
+  MeshPass* passes[] = {&forward_pass, &transparent_pass,
+                        &directional_shadow_pass, &point_shadow_pass};
+  for (MeshPass* pass : passes) {
+    Handle<PassObject> pass_index = pass_indices[pass->type];
+    if (pass_index.IsValid())
+      pass->dirty_instances.push_back(pass->Get(pass_index)->instance);
   }
 }
 
+void RenderScene::FillObjectData(GPUObjectData* data, uint32_t first,
+                                 uint32_t count) {
+  // Streams over transforms and bounds only, in the order of object data
+  for (uint32_t i = 0; i < count; ++i) WriteObject(data + i, first + i);
+}
+
+void RenderScene::SwapObjects(uint32_t first, uint32_t second) {
+  if (first == second) return;
+
+  renderables.Swap(first, second);
+  MarkMoved(renderables.GetHandle(first));
+  MarkMoved(renderables.GetHandle(second));
+}
+
+void RenderScene::MakeStatic(uint32_t index) {
+  SwapObjects(index, renderables.static_count);
+  ++renderables.static_count;
+}
+
+void RenderScene::MakeDynamic(Handle<SceneObject> object_id) {
+  uint32_t index = renderables.GetIndex(object_id);
+  if (index >= renderables.static_count) return;
+
+  --renderables.static_count;
+  SwapObjects(index, renderables.static_count);
+}
+
 void RenderScene::FillIndirectArray(GPUIndirectObject* data, MeshPass& pass) {
+  uint32_t first_instance = 0;
   for (size_t i = 0; i < pass.indirect_batches.size(); ++i) {
-    data[i].command.firstInstance = 0;
-    data[i].command.instanceCount = 0;
-    data[i].command.firstIndex = 0;
-    data[i].command.vertexOffset = 0;
-    data[i].command.indexCount = 0;
+    const IndirectBatch& batch = pass.indirect_batches[i];
+    const DrawMesh* mesh = GetMesh(batch.mesh_id);
+
+    VkDrawIndexedIndirectCommand& command = data[i].command;
+    command.instanceCount = 0;
+    command.firstInstance = first_instance;
+    if (mesh->index_count > 0) {
+      command.indexCount = mesh->index_count;
+      command.firstIndex = mesh->first_index;
+      command.vertexOffset = static_cast<int32_t>(mesh->first_vertex);
+    } else {
+      // Vertex count, instance count, first vertex and first instance
+      command.indexCount = mesh->vertex_count;
+      command.firstIndex = mesh->first_vertex;
+      command.vertexOffset = static_cast<int32_t>(first_instance);
+    }
+    first_instance += static_cast<uint32_t>(batch.objects.size());
+  }
+}
+
+void RenderScene::FillMultibatchArray(uint32_t* data, const MeshPass& pass) {
+  for (const Multibatch& multibatch : pass.multibatches) {
+    for (uint32_t i = 0; i < multibatch.count; ++i)
+      data[multibatch.first + i] = multibatch.first;
   }
 }
 
 void RenderScene::FillInstanceArray(GPUInstance* data, MeshPass& pass) {
-  size_t data_idx = 0;
-  for (size_t i = 0; i < pass.indirect_batches.size(); ++i) {
-    const IndirectBatch& batch = pass.indirect_batches[i];
-    DrawMesh* mesh = GetMesh(batch.mesh_id);
-    for (size_t j = 0; j < batch.count; ++j) {
-      data[data_idx].object_id =
-          pass.Get(pass.batches[j + batch.first].object)->original.handle;
-      data[data_idx].multibatch_id = batch.multibatch;
-      data[data_idx].first_index = mesh->first_index;
-      data[data_idx].index_count = mesh->index_count;
-      data[data_idx].vertex_offset = mesh->first_vertex;
-      ++data_idx;
+  for (uint32_t i = 0; i < pass.indirect_batches.size(); ++i) {
+    for (Handle<PassObject> handle : pass.indirect_batches[i].objects) {
+      PassObject* object = pass.Get(handle);
+      GPUInstance& instance = data[object->instance];
+      instance.object_id = GetObjectIndex(object->original);
+      instance.batch_id = i;
+    }
+  }
+  pass.dirty_instances.clear();
+}
+
+std::vector<VkBufferCopy> RenderScene::FillDirtyInstanceArray(
+    GPUInstance* data, MeshPass& pass) {
+  std::vector<uint32_t>& dirty = pass.dirty_instances;
+  std::sort(dirty.begin(), dirty.end());
+  dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+
+  std::vector<VkBufferCopy> regions;
+  uint32_t count = 0;
+  for (uint32_t instance : dirty) {
+    // Marked before the pass shrank
+    if (instance >= pass.instances.size()) break;
+
+    WriteInstance(data + count, pass, instance);
+
+    VkDeviceSize target_offset = instance * sizeof(GPUInstance);
+    if (regions.size() > 0 &&
+        regions.back().dstOffset + regions.back().size == target_offset) {
+      regions.back().size += sizeof(GPUInstance);
+    } else {
+      VkBufferCopy region{};
+      region.srcOffset = count * sizeof(GPUInstance);
+      region.dstOffset = target_offset;
+      region.size = sizeof(GPUInstance);
+      regions.push_back(region);
     }
+    ++count;
+  }
+  dirty.clear();
+
+  return regions;
+}
+
+void RenderScene::FillGroupInstanceArray(GPUGroupInstance* data) {
+  for (const InstanceGroup& group : instance_groups) {
+    std::copy(group.instances.begin(), group.instances.end(),
+              data + group.first_instance);
   }
 }
 
-void RenderScene::FillMultibatchesArray(Multibatch* data, MeshPass& pass) {
-  for (size_t i = 0; i < pass.multibatches.size(); ++i) {
-    data[i].first = pass.multibatches[i].first;
-    data[i].count = 0;
+void RenderScene::FillGroupArray(GPUInstanceGroup* data) {
+  for (size_t i = 0; i < instance_groups.size(); ++i) {
+    const InstanceGroup& group = instance_groups[i];
+    const RenderBounds& bounds = GetMesh(group.mesh_id)->mesh->GetBounds();
+    data[i].bounds = glm::vec4(bounds.origin, bounds.radius);
+    data[i].first_instance = group.first_instance;
+    data[i].instance_count = static_cast<uint32_t>(group.instances.size());
   }
 }
 
-void RenderScene::ClearCountArray(MeshPass& pass) {
-  memset(pass.clear_count_buffer.GetMappedMemory(), 0,
-         pass.clear_count_buffer.GetSize());
+void RenderScene::FillGroupIndirectArray(GPUIndirectObject* data,
+                                         MeshPass& pass) {
+  for (size_t i = 0; i < pass.groups.size(); ++i) {
+    const InstanceGroup& group = instance_groups[pass.groups[i]];
+    const DrawMesh* mesh = GetMesh(group.mesh_id);
+    data[i].command.indexCount = mesh->index_count;
+    data[i].command.instanceCount = 0;
+    data[i].command.firstIndex = mesh->first_index;
+    data[i].command.vertexOffset = mesh->first_vertex;
+    // Cull shader packs visible instances from here
+    data[i].command.firstInstance = group.first_instance;
+  }
 }
 
 void RenderScene::WriteObject(GPUObjectData* target,
                               Handle<SceneObject> object_id) {
-  SceneObject* renderable = GetObject(object_id);
+  WriteObject(target, renderables.GetIndex(object_id));
+}
+
+void RenderScene::WriteObject(GPUObjectData* target, uint32_t index) {
+  const RenderBounds& bounds = renderables.bounds[index];
   GPUObjectData object;
 
-  object.model_matrix = renderable->transform_matrix;
-  object.normal_matrix = glm::transpose(glm::inverse(object.model_matrix));
-  object.origin_radius =
-      glm::vec4(renderable->bounds.origin, renderable->bounds.radius);
-  object.extents = glm::vec4(renderable->bounds.extents,
-                             renderable->bounds.valid ? 1.f : 0.f);
+  const glm::mat4& transform = renderables.transforms[index];
+  for (int row = 0; row < 3; ++row) {
+    object.model_rows[row] = glm::vec4(transform[0][row], transform[1][row],
+                                       transform[2][row], transform[3][row]);
+  }
+  object.origin_radius = glm::vec4(bounds.origin, bounds.radius);
+  object.extents = glm::vec4(bounds.extents, 0.f);
 
   memcpy(target, &object, sizeof(GPUObjectData));
 }
 
+void RenderScene::WriteInstance(GPUInstance* target, MeshPass& pass,
+                                uint32_t instance) {
+  PassObject* object = pass.Get(pass.instances[instance]);
+
+  GPUInstance data;
+  data.object_id = GetObjectIndex(object->original);
+  data.batch_id = object->batch_id;
+
+  memcpy(target, &data, sizeof(GPUInstance));
+}
+
 void RenderScene::ClearDirtyObjects() {
   for (Handle<SceneObject> obj : dirty_objects)
-    GetObject(obj)->update_index = static_cast<uint32_t>(-1);
+    renderables.update_indices[renderables.GetIndex(obj)] =
+        static_cast<uint32_t>(-1);
   dirty_objects.clear();
 }
 
 void RenderScene::BuildBatches() {
-  auto forward =
-      std::async(std::launch::async, [&]() { RefreshPass(&forward_pass); });
-  auto transparent =
-      std::async(std::launch::async, [&]() { RefreshPass(&transparent_pass); });
-  auto shadow =
-      std::async(std::launch::async, [&]() { RefreshPass(&directional_shadow_pass); });
-  auto point_shadow = std::async(std::launch::async,
-                                 [&]() { RefreshPass(&point_shadow_pass); });
+  MeshPass* passes[] = {&forward_pass, &transparent_pass,
+                        &directional_shadow_pass, &point_shadow_pass};
+  if (!thread_pool_) {
+    for (MeshPass* pass : passes) RefreshPass(pass);
+  } else {
+    Engine::JobCounter counter;
+    for (MeshPass* pass : passes)
+      thread_pool_->Submit([this, pass]() { RefreshPass(pass); }, &counter);
+    thread_pool_->Wait(counter);
+  }
 
-  forward.get();
-  transparent.get();
-  shadow.get();
-  point_shadow.get();
+  if (groups_changed_) RefreshGroups();
 }
 
-void RenderScene::BuildIndirectBatches(MeshPass* pass,
-                                       std::vector<IndirectBatch>& out_batches,
-                                       std::vector<RenderBatch>& in_batches) {
-  if (in_batches.size() == 0) return;
-
-  IndirectBatch new_batch{};
-  new_batch.material = pass->Get(in_batches[0].object)->material;
-  new_batch.mesh_id = pass->Get(in_batches[0].object)->mesh_id;
+void RenderScene::UpdateHierarchy() {
+  hierarchy.Propagate(thread_pool_, [this](Handle<SceneObject> object_id,
+                                           const glm::mat4& world) {
+    UpdateTransform(object_id, world);
+  });
+}
 
-  out_batches.push_back(new_batch);
+void RenderScene::UpdateBvh() {
+  size_t new_count = 0;
+  for (Handle<SceneObject> object_id : dirty_objects) {
+    if (!bvh.Contains(object_id) &&
+        renderables.bounds[renderables.GetIndex(object_id)].valid)
+      ++new_count;
+  }
 
-  IndirectBatch* back = &pass->indirect_batches.back();
+  if (new_count > bvh.GetObjectCount()) {
+    std::vector<Handle<SceneObject>> objects;
+    std::vector<Aabb> bounds;
+    objects.reserve(renderables.GetSize());
+    bounds.reserve(renderables.GetSize());
+    for (uint32_t i = 0; i < renderables.GetSize(); ++i) {
+      if (!renderables.bounds[i].valid) continue;
+      objects.push_back(renderables.GetHandle(i));
+      bounds.push_back(Aabb::FromBounds(renderables.bounds[i]));
+    }
+    bvh.Build(objects, bounds);
+    return;
+  }
 
-  for (size_t i = 0; i < in_batches.size(); ++i) {
-    PassObject* obj = pass->Get(in_batches[i].object);
+  for (Handle<SceneObject> object_id : dirty_objects) {
+    const RenderBounds& bounds =
+        renderables.bounds[renderables.GetIndex(object_id)];
+    if (bounds.valid)
+      bvh.Insert(object_id, Aabb::FromBounds(bounds));
+    else
+      bvh.Remove(object_id);
+  }
+  bvh.Refit();
+}
 
-    bool same_mesh = obj->mesh_id.handle == back->mesh_id.handle;
-    bool same_material = obj->material == back->material;
+bool RenderScene::NeedsRefresh() const {
+  const MeshPass* passes[] = {&forward_pass, &transparent_pass,
+                              &directional_shadow_pass, &point_shadow_pass};
+  for (const MeshPass* pass : passes) {
+    if (pass->unbatches_objects.size() > 0 ||
+        pass->objects_to_delete.size() > 0)
+      return true;
+  }
+  return groups_changed_;
+}
 
-    if (same_mesh && same_material) {
-      ++back->count;
+Handle<SceneObject> RenderScene::RayCast(const glm::vec3& origin,
+                                         const glm::vec3& direction,
+                                         float max_distance,
+                                         float* distance) const {
+  glm::vec3 inverse_direction = 1.f / direction;
+  // Closest hit so far, so that triangles farther away are skipped
+  float closest = max_distance;
+  auto hit = [&](Handle<SceneObject> object_id, float) {
+    uint32_t index = renderables.GetIndex(object_id);
+    const DrawMesh* mesh = meshes_.get(renderables.mesh_ids[index]);
+    const MeshGeometry* geometry = mesh->mesh->GetGeometry();
+
+    float hit_distance;
+    if (geometry) {
+      // Affine transforms keep distances along the unnormalized direction
+      glm::mat4 world_to_mesh = glm::inverse(renderables.transforms[index]);
+      hit_distance = geometry->IntersectRay(
+          glm::vec3(world_to_mesh * glm::vec4(origin, 1.f)),
+          glm::vec3(world_to_mesh * glm::vec4(direction, 0.f)), closest);
     } else {
-      new_batch.first = static_cast<uint32_t>(i);
-      new_batch.count = 1;
-      new_batch.mesh_id = obj->mesh_id;
-      new_batch.material = obj->material;
-      out_batches.push_back(new_batch);
-      back = &out_batches.back();
+      hit_distance = Aabb::FromBounds(renderables.bounds[index])
+                         .IntersectRay(origin, inverse_direction, closest);
     }
-  }
+    if (hit_distance >= 0.f) closest = std::min(closest, hit_distance);
+    return hit_distance;
+  };
+
+  Handle<SceneObject> object_id;
+  float hit_distance =
+      bvh.RayCast(origin, direction, max_distance, hit, &object_id);
+  if (distance) *distance = hit_distance;
+  return hit_distance >= 0.f ? object_id : Handle<SceneObject>();
+}
+
+void RenderScene::QuerySphere(const glm::vec3& center, float radius,
+                              std::vector<Handle<SceneObject>>& result) const {
+  // Leaves of bvh are grown by a margin, candidates are tested again
+  size_t first = result.size();
+  bvh.QuerySphere(center, radius, result);
+  result.erase(
+      std::remove_if(result.begin() + first, result.end(),
+                     [&](Handle<SceneObject> object_id) {
+                       const RenderBounds& bounds =
+                           renderables.bounds[renderables.GetIndex(object_id)];
+                       Aabb box = Aabb::FromBounds(bounds);
+                       glm::vec3 offset =
+                           glm::clamp(center, box.min, box.max) - center;
+                       return glm::dot(offset, offset) > radius * radius;
+                     }),
+      result.end());
+}
+
+void RenderScene::QueryBox(const Aabb& box,
+                           std::vector<Handle<SceneObject>>& result) const {
+  size_t first = result.size();
+  bvh.QueryAabb(box, result);
+  result.erase(
+      std::remove_if(result.begin() + first, result.end(),
+                     [&](Handle<SceneObject> object_id) {
+                       uint32_t index = renderables.GetIndex(object_id);
+                       return !Aabb::FromBounds(renderables.bounds[index])
+                                   .Overlaps(box);
+                     }),
+      result.end());
+}
+
+void RenderScene::QueryFrustum(const glm::mat4& view_projection,
+                               std::vector<Handle<SceneObject>>& result) const {
+  // Planes of clip space, -w <= x, y, z <= w, pointing inwards
+  glm::mat4 rows = glm::transpose(view_projection);
+  glm::vec4 planes[6] = {rows[3] + rows[0], rows[3] - rows[0],
+                         rows[3] + rows[1], rows[3] - rows[1],
+                         rows[3] + rows[2], rows[3] - rows[2]};
+
+  size_t first = result.size();
+  bvh.QueryFrustum(planes, 6, result);
+  result.erase(
+      std::remove_if(
+          result.begin() + first, result.end(),
+          [&](Handle<SceneObject> object_id) {
+            Aabb box = Aabb::FromBounds(
+                renderables.bounds[renderables.GetIndex(object_id)]);
+            for (const glm::vec4& plane : planes) {
+              glm::vec3 farthest = glm::mix(
+                  box.min, box.max,
+                  glm::vec3(glm::greaterThanEqual(glm::vec3(plane),
+                                                  glm::vec3(0.f))));
+              if (glm::dot(glm::vec3(plane), farthest) + plane.w < 0.f)
+                return true;
+            }
+            return false;
+          }),
+      result.end());
 }
 
 void RenderScene::MergeMeshes(Engine::VulkanEngine* engine) {
@@ -251,6 +763,14 @@ void RenderScene::MergeMeshes(Engine::VulkanEngine* engine) {
 
     mesh.is_merged = true;
   }
+  // Draws point into the merged buffers now
+  needs_group_upload = true;
+  MeshPass* passes[] = {&forward_pass, &transparent_pass,
+                        &directional_shadow_pass, &point_shadow_pass};
+  for (MeshPass* pass : passes) {
+    BuildMultibatches(pass);
+    pass->needs_indirect_refresh = true;
+  }
   
   merged_vertex_buffer.Create(engine->GetAllocator(),
                               total_vertices * sizeof(Vertex));
@@ -272,185 +792,266 @@ void RenderScene::MergeMeshes(Engine::VulkanEngine* engine) {
 }
 
 void RenderScene::RefreshPass(MeshPass* pass) {
-  pass->needs_indirect_refresh = true;
-  pass->needs_instance_refresh = true;
+  bool batches_changed = false;
+  bool batches_emptied = false;
+  // Instance ranges of batches follow their sizes
+  bool instances_changed = pass->objects_to_delete.size() > 0 ||
+                           pass->unbatches_objects.size() > 0;
 
-  std::vector<uint32_t> new_objects;
   if (pass->objects_to_delete.size() > 0) {
     std::vector<RenderBatch> deletion_batches;
     deletion_batches.reserve(pass->objects_to_delete.size());
 
     for (Handle<PassObject> obj : pass->objects_to_delete) {
-      pass->reusable_objects.push_back(obj);
-      RenderBatch new_batch;
-
-      PassObject object = pass->objects[obj.handle];
-      new_batch.object = obj;
-
-      uint64_t pipeline_hash = std::hash<uint64_t>()(
-          uint64_t(object.material.shader_pass->pipeline.Get()));
-      int64_t set_hash =
-          std::hash<uint64_t>()(uint64_t(object.material.material_set));
-
-      uint64_t material_hash = pipeline_hash ^ set_hash;
-      uint64_t mesh_hash =
-          material_hash ^ static_cast<uint64_t>(object.mesh_id.handle);
-
-      new_batch.sort_key = mesh_hash;
-
-      pass->objects[obj.handle].material.shader_pass = nullptr;
-      pass->objects[obj.handle].mesh_id.handle = -1;
-      pass->objects[obj.handle].original.handle = -1;
-
-      deletion_batches.push_back(new_batch);
+      RenderBatch deletion_batch;
+      deletion_batch.object = obj;
+      deletion_batch.sort_key = pass->Get(obj)->sort_key;
+      deletion_batches.push_back(deletion_batch);
     }
 
     pass->objects_to_delete.clear();
 
-    std::sort(deletion_batches.begin(), deletion_batches.end(),
-              [](const RenderBatch& lhs, const RenderBatch& rhs) {
-                return (lhs.sort_key == rhs.sort_key
-                            ? lhs.object.handle < rhs.object.handle
-                            : lhs.sort_key < rhs.sort_key);
-              });
-
-    std::vector<RenderBatch> new_batches;
-    new_batches.reserve(pass->batches.size());
-    std::set_difference(pass->batches.begin(), pass->batches.end(),
-                        deletion_batches.begin(), deletion_batches.end(),
-                        std::back_inserter(new_batches),
-                        [](const RenderBatch& lhs, const RenderBatch& rhs) {
-                          return (lhs.sort_key == rhs.sort_key
-                                      ? lhs.object.handle < rhs.object.handle
-                                      : lhs.sort_key < rhs.sort_key);
-                        });
-    pass->batches = std::move(new_batches);
-  }
-
-  new_objects.reserve(pass->unbatches_objects.size());
+    // Objects of the same batch end up next to each other, so that the batch
+    // is looked up once
+    SortRenderBatches(deletion_batches, thread_pool_);
+
+    size_t batch_index = pass->indirect_batches.size();
+    for (const RenderBatch& deletion_batch : deletion_batches) {
+      PassObject* object = pass->Get(deletion_batch.object);
+      if (batch_index >= pass->indirect_batches.size() ||
+          !IsInBatch(pass->indirect_batches[batch_index], *object))
+        batch_index = FindBatch(pass, *object);
+
+      IndirectBatch& batch = pass->indirect_batches[batch_index];
+      Handle<PassObject> moved = batch.objects.back();
+      batch.objects[object->batch_index] = moved;
+      pass->Get(moved)->batch_index = object->batch_index;
+      batch.objects.pop_back();
+      batches_emptied = batches_emptied || batch.objects.empty();
+
+      RemoveInstance(pass, deletion_batch.object);
+      pass->objects.erase(deletion_batch.object);
+    }
+  }
+
+  std::vector<RenderBatch> new_batches;
+  new_batches.reserve(pass->unbatches_objects.size());
   for (Handle<SceneObject> obj : pass->unbatches_objects) {
+    // Unregistered before it was ever batched
+    if (!renderables.Contains(obj)) continue;
+    uint32_t object_index = renderables.GetIndex(obj);
+
     PassObject new_object;
     new_object.original = obj;
-    new_object.mesh_id = GetObject(obj)->mesh_id;
+    new_object.mesh_id = renderables.mesh_ids[object_index];
 
-    Material* material = GetMaterial(GetObject(obj)->material_id);
-    new_object.material.material_set = material->pass_sets[pass->type];
+    Material* material = GetMaterial(renderables.material_ids[object_index]);
+    new_object.material.material = material;
     new_object.material.shader_pass =
         material->original->pass_shaders[pass->type];
+    new_object.sort_key = GetSortKey(pass, new_object);
 
-    uint32_t handle = -1;
-
-    if (pass->reusable_objects.size() > 0) {
-      handle = pass->reusable_objects.back().handle;
-      pass->reusable_objects.pop_back();
-      pass->objects[handle] = new_object;
-    } else {
-      handle = static_cast<uint32_t>(pass->objects.size());
-      pass->objects.push_back(new_object);
-    }
+    RenderBatch new_batch;
+    new_batch.object = pass->objects.insert(new_object);
+    new_batch.sort_key = new_object.sort_key;
+    new_batches.push_back(new_batch);
 
-    new_objects.push_back(handle);
-    GetObject(obj)->pass_indices[pass->type] = static_cast<int32_t>(handle);
+    renderables.pass_indices[object_index][pass->type] = new_batch.object;
   }
   pass->unbatches_objects.clear();
 
-  std::vector<RenderBatch> new_batches;
-  new_batches.reserve(new_objects.size());
-  for (uint32_t i : new_objects) {
-    RenderBatch new_batch;
-    PassObject object = pass->objects[i];
-    new_batch.object.handle = i;
-
-    uint64_t pipeline_hash = std::hash<uint64_t>()(
-        uint64_t(object.material.shader_pass->pipeline.Get()));
-    int64_t set_hash =
-        std::hash<uint64_t>()(uint64_t(object.material.material_set));
-
-    uint64_t material_hash = pipeline_hash ^ set_hash;
-    uint64_t mesh_hash =
-        material_hash ^ static_cast<uint64_t>(object.mesh_id.handle);
+  SortRenderBatches(new_batches, thread_pool_);
+
+  size_t batch_index = pass->indirect_batches.size();
+  for (const RenderBatch& new_batch : new_batches) {
+    PassObject* object = pass->Get(new_batch.object);
+    if (batch_index >= pass->indirect_batches.size() ||
+        !IsInBatch(pass->indirect_batches[batch_index], *object)) {
+      batch_index = FindBatch(pass, *object);
+
+      if (batch_index == pass->indirect_batches.size() ||
+          !IsInBatch(pass->indirect_batches[batch_index], *object)) {
+        IndirectBatch batch;
+        batch.mesh_id = object->mesh_id;
+        batch.material = object->material;
+        batch.sort_key = object->sort_key;
+        batch.index = -1;
+        pass->indirect_batches.insert(
+            pass->indirect_batches.begin() + batch_index, std::move(batch));
+        batches_changed = true;
+      }
+    }
 
-    new_batch.sort_key = mesh_hash;
+    IndirectBatch& batch = pass->indirect_batches[batch_index];
+    // Batches shifted by this refresh update their objects once it is done
+    object->batch_id = batch.index;
+    object->batch_index = static_cast<uint32_t>(batch.objects.size());
+    batch.objects.push_back(new_batch.object);
+    AddInstance(pass, new_batch.object);
+  }
 
-    new_batches.push_back(new_batch);
+  // Emptied batches are dropped only now, objects that were moved out of a
+  // batch are often moved back in by the same refresh
+  if (batches_emptied) {
+    size_t batch_count = pass->indirect_batches.size();
+    pass->indirect_batches.erase(
+        std::remove_if(
+            pass->indirect_batches.begin(), pass->indirect_batches.end(),
+            [](const IndirectBatch& batch) { return batch.objects.empty(); }),
+        pass->indirect_batches.end());
+    batches_changed =
+        batches_changed || batch_count != pass->indirect_batches.size();
   }
 
-  std::sort(new_batches.begin(), new_batches.end(),
-            [](const RenderBatch& lhs, const RenderBatch& rhs) {
-              return (lhs.sort_key == rhs.sort_key
-                          ? lhs.object.handle < rhs.object.handle
-                          : lhs.sort_key < rhs.sort_key);
-            });
+  if (batches_changed) BuildMultibatches(pass);
+  if (batches_changed || instances_changed)
+    pass->needs_indirect_refresh = true;
+}
 
-  if (pass->batches.size() > 0 && new_batches.size() > 0) {
-    size_t index = pass->batches.size();
-    pass->batches.reserve(pass->batches.size() + new_batches.size());
+void RenderScene::RefreshGroups() {
+  // Groups are few and large, so packing them again from scratch costs about
+  // as much as the upload that follows anyway
+  uint32_t first_instance = 0;
+  for (InstanceGroup& group : instance_groups) {
+    group.first_instance = first_instance;
+    first_instance += static_cast<uint32_t>(group.instances.size());
+  }
+  group_instance_count_ = first_instance;
+
+  MeshPass* passes[] = {&forward_pass, &transparent_pass,
+                        &directional_shadow_pass, &point_shadow_pass};
+  for (MeshPass* pass : passes) {
+    bool shadow = pass->type == MeshPassType::kDirectionalShadow ||
+                  pass->type == MeshPassType::kPointShadow;
+
+    pass->groups.clear();
+    for (uint32_t i = 0; i < instance_groups.size(); ++i) {
+      const InstanceGroup& group = instance_groups[i];
+      if (shadow && !group.draw_shadow_pass) continue;
+      if (GetMaterial(group.material_id)
+              ->original->group_pass_shaders[pass->type])
+        pass->groups.push_back(i);
+    }
+  }
 
-    for (RenderBatch batch : new_batches) pass->batches.push_back(batch);
+  needs_group_upload = true;
+  groups_changed_ = false;
+}
 
-    RenderBatch* begin = pass->batches.data();
-    RenderBatch* mid = begin + index;
-    RenderBatch* end = begin + pass->batches.size();
+uint64_t RenderScene::GetSortKey(MeshPass* pass, const PassObject& object) {
+  // Ids are assigned per pass, passes are refreshed in parallel
+  auto pipeline = pass->pipeline_ids.try_emplace(
+      object.material.shader_pass->pipeline.Get(),
+      static_cast<uint32_t>(pass->pipeline_ids.size()));
+  auto material = pass->material_ids.try_emplace(
+      object.material.material,
+      static_cast<uint32_t>(pass->material_ids.size()));
+
+  uint64_t pipeline_id =
+      pipeline.first->second & ((1ull << kSortKeyPipelineBits) - 1);
+  uint64_t material_id =
+      material.first->second & ((1ull << kSortKeyMaterialBits) - 1);
+  uint64_t mesh_id = object.mesh_id.handle & ((1ull << kSortKeyMeshBits) - 1);
+
+  return (pipeline_id << (kSortKeyMaterialBits + kSortKeyMeshBits)) |
+         (material_id << kSortKeyMeshBits) | mesh_id;
+}
 
-    std::inplace_merge(begin, mid, end,
-                       [](const RenderBatch& lhs, const RenderBatch& rhs) {
-                         return (lhs.sort_key == rhs.sort_key
-                                     ? lhs.object.handle < rhs.object.handle
-                                     : lhs.sort_key < rhs.sort_key);
-                       });
-  } else if (pass->batches.size() == 0) {
-    pass->batches = std::move(new_batches);
+size_t RenderScene::FindBatch(const MeshPass* pass,
+                              const PassObject& object) const {
+  auto first = std::lower_bound(
+      pass->indirect_batches.begin(), pass->indirect_batches.end(),
+      object.sort_key, [](const IndirectBatch& batch, uint64_t sort_key) {
+        return batch.sort_key < sort_key;
+      });
+
+  // Different meshes and materials may end up with the same key
+  for (auto iter = first; iter != pass->indirect_batches.end() &&
+                          iter->sort_key == object.sort_key;
+       ++iter) {
+    if (IsInBatch(*iter, object))
+      return iter - pass->indirect_batches.begin();
   }
+  return first - pass->indirect_batches.begin();
+}
 
-  pass->indirect_batches.clear();
+void RenderScene::AddInstance(MeshPass* pass, Handle<PassObject> handle) {
+  PassObject* object = pass->Get(handle);
+  object->instance = static_cast<uint32_t>(pass->instances.size());
+  pass->instances.push_back(handle);
+  pass->dirty_instances.push_back(object->instance);
+}
+
+void RenderScene::RemoveInstance(MeshPass* pass, Handle<PassObject> handle) {
+  uint32_t instance = pass->Get(handle)->instance;
+  Handle<PassObject> moved = pass->instances.back();
+  pass->instances[instance] = moved;
+  pass->Get(moved)->instance = instance;
+  pass->instances.pop_back();
 
-  BuildIndirectBatches(pass, pass->indirect_batches, pass->batches);
+  if (instance < pass->instances.size())
+    pass->dirty_instances.push_back(instance);
+}
 
-  Multibatch new_batch;
+void RenderScene::BuildMultibatches(MeshPass* pass) {
   pass->multibatches.clear();
 
-  new_batch.first = 0;
-  new_batch.count = 1;
-
-  for (size_t i = 1; i < pass->indirect_batches.size(); ++i) {
-    IndirectBatch* join_batch = &pass->indirect_batches[new_batch.first];
-    IndirectBatch* batch = &pass->indirect_batches[i];
-
-    bool compatible_mesh = GetMesh(join_batch->mesh_id)->is_merged;
-    bool same_material = false;
-    if (compatible_mesh &&
-        join_batch->material.material_set == batch->material.material_set &&
-        join_batch->material.shader_pass == batch->material.shader_pass)
-      same_material = true;
-
-    pass->indirect_batches[new_batch.first].multibatch =
-        static_cast<uint32_t>(pass->multibatches.size());
-    if (compatible_mesh && same_material) {
-      ++new_batch.count;
-      batch->multibatch = join_batch->multibatch;
-    } else {
-      pass->multibatches.push_back(new_batch);
-      new_batch.first = static_cast<uint32_t>(i);
-      new_batch.count = 1;
+  for (size_t i = 0; i < pass->indirect_batches.size(); ++i) {
+    IndirectBatch& batch = pass->indirect_batches[i];
+
+    bool joined = false;
+    if (pass->multibatches.size() > 0) {
+      Multibatch& multibatch = pass->multibatches.back();
+      const IndirectBatch& join_batch =
+          pass->indirect_batches[multibatch.first];
+
+      // Single indirect call draws the whole multibatch, so meshes have to
+      // share buffers and the kind of draw
+      const DrawMesh* join_mesh = GetMesh(join_batch.mesh_id);
+      const DrawMesh* mesh = GetMesh(batch.mesh_id);
+      bool compatible_mesh =
+          join_mesh->is_merged && mesh->is_merged &&
+          (join_mesh->index_count > 0) == (mesh->index_count > 0);
+      bool same_material =
+          join_batch.material.material == batch.material.material &&
+          join_batch.material.shader_pass == batch.material.shader_pass;
+      if (compatible_mesh && same_material) {
+        ++multibatch.count;
+        joined = true;
+      }
     }
-  }
-  if (pass->indirect_batches.size() > 0) {
-    pass->indirect_batches[new_batch.first].multibatch =
-        static_cast<uint32_t>(pass->multibatches.size());
-  }
-  pass->multibatches.push_back(new_batch);
-}
 
-SceneObject* RenderScene::GetObject(Handle<SceneObject> object_id) {
-  return &renderables[object_id.handle];
+    if (!joined) {
+      Multibatch multibatch;
+      multibatch.first = static_cast<uint32_t>(i);
+      multibatch.count = 1;
+      pass->multibatches.push_back(multibatch);
+    }
+
+    // Instances carry the index of their batch, so only the ones of shifted
+    // batches have to be uploaded again
+    if (batch.index != i) {
+      batch.index = static_cast<uint32_t>(i);
+      for (Handle<PassObject> obj : batch.objects) {
+        PassObject* object = pass->Get(obj);
+        object->batch_id = static_cast<uint32_t>(i);
+        pass->dirty_instances.push_back(object->instance);
+      }
+    }
+  }
 }
 
 DrawMesh* RenderScene::GetMesh(Handle<DrawMesh> mesh_id) {
-  return &meshes_[mesh_id.handle];
+  return meshes_.get(mesh_id);
 }
 
 Material* RenderScene::GetMaterial(Handle<Material> material_id) {
-  return materials_[material_id.handle];
+  Material** material = materials_.get(material_id);
+  return material ? *material : nullptr;
+}
+
+uint32_t RenderScene::GetObjectIndex(Handle<SceneObject> object_id) const {
+  return renderables.GetIndex(object_id);
 }
 
 RenderScene::MeshPass* RenderScene::GetMeshPass(MeshPassType type) {
@@ -472,10 +1073,7 @@ Handle<Material> RenderScene::GetMaterialHandle(Material* material) {
   if (iter != material_handles_.end()) 
     return iter->second;
 
-  Handle<Material> handle;
-  uint32_t index = static_cast<uint32_t>(materials_.size());
-  materials_.push_back(material);
-  handle.handle = index;
+  Handle<Material> handle = materials_.insert(material);
   material_handles_[material] = handle;
   return handle;
 }
@@ -484,8 +1082,6 @@ Handle<DrawMesh> RenderScene::GetMeshHandle(Mesh* mesh) {
   auto iter = mesh_handles_.find(mesh);
   if (iter != mesh_handles_.end()) return iter->second;
 
-  Handle<DrawMesh> handle;
-  uint32_t index = static_cast<uint32_t>(meshes_.size());
   DrawMesh new_mesh;
   new_mesh.mesh = mesh;
   new_mesh.is_merged = false;
@@ -494,10 +1090,8 @@ Handle<DrawMesh> RenderScene::GetMeshHandle(Mesh* mesh) {
   new_mesh.index_count = static_cast<uint32_t>(mesh->GetIndicesCount());
   new_mesh.vertex_count = static_cast<uint32_t>(mesh->GetVerticesCount());
 
-  meshes_.push_back(new_mesh);
-
-  handle.handle = index;
-
+  Handle<DrawMesh> handle = meshes_.insert(new_mesh);
+  mesh_handles_[mesh] = handle;
   return handle;
 }
 
@@ -7,24 +7,24 @@
 #include <glm/glm.hpp>
 
 #include "Buffer.h"
+#include "Bvh.h"
 #include "MaterialSystem.h"
+#include "SlotMap.h"
+#include "TransformHierarchy.h"
 #include "VertexBuffer.h"
 #include "IndexBuffer.h"
 
 namespace Engine {
+class ThreadPool;
 class VulkanEngine;
 }
 
 namespace Renderer {
 
-template<typename T>
-struct Handle {
-  uint32_t handle;
-};
-
 class Mesh;
 struct RenderObject;
 struct GPUObjectData;
+struct SceneObject;
 
 struct GPUIndirectObject {
   VkDrawIndexedIndirectCommand command;
@@ -40,51 +40,163 @@ struct DrawMesh {
   Mesh* mesh;
 };
 
+struct PassMaterial {
+  // Sets are read from the material at draw time, as they change when its
+  // textures are replaced
+  Material* material;
+  ShaderPass* shader_pass;
+
+  bool operator==(const PassMaterial& other) {
+    return material == other.material &&
+           shader_pass == other.shader_pass;
+  }
+};
+
+struct PassObject {
+  PassMaterial material;
+  Handle<DrawMesh> mesh_id;
+  Handle<SceneObject> original;
+  uint64_t sort_key;
+  // Position in MeshPass::instances and in objects of its batch
+  uint32_t instance;
+  uint32_t batch_index;
+  // IndirectBatch::index of its batch, uploaded with the instance
+  uint32_t batch_id;
+};
+
+// Fields of single scene object, RenderScene stores them column-wise
 struct SceneObject {
   Handle<DrawMesh> mesh_id;
   Handle<Material> material_id;
 
   uint32_t update_index;
 
-  PerPassData<int32_t> pass_indices;
+  PerPassData<Handle<PassObject>> pass_indices;
 
   glm::mat4 transform_matrix;
 
   RenderBounds bounds;
 };
 
+/*
+Scene objects stored as one array per field, all in the same dense order, so
+that loops reading a field or two do not pull whole objects through the cache
+
+- Index of object in the arrays is its position in object data on GPU, it
+  changes when another object is erased
+- Static objects come first, dynamic ones after them. RenderScene keeps the
+  split when objects come and go
+*/
+class SceneObjectStorage {
+ public:
+  Handle<SceneObject> Insert(const SceneObject& object);
+  /*
+  Append count objects with uninitialized fields, writing their handles to
+  handles. Returns index of the first one
+  */
+  uint32_t InsertUninitialized(uint32_t count, Handle<SceneObject>* handles);
+  // Handle must not be stale. Last object is moved into its place
+  void Erase(Handle<SceneObject> handle);
+  bool Contains(Handle<SceneObject> handle) const {
+    return indices_.contains(handle);
+  }
+
+  // Handle must not be stale
+  uint32_t GetIndex(Handle<SceneObject> handle) const {
+    return indices_.index_of(handle);
+  }
+  Handle<SceneObject> GetHandle(uint32_t index) const {
+    return indices_.handle_at(index);
+  }
+  uint32_t GetSize() const { return static_cast<uint32_t>(indices_.size()); }
+
+  // Exchange positions of two objects
+  void Swap(uint32_t first, uint32_t second);
+  void Reserve(size_t count);
+
+  // Objects below this index are static
+  uint32_t static_count = 0;
+
+  std::vector<glm::mat4> transforms;
+  std::vector<RenderBounds> bounds;
+  std::vector<Handle<DrawMesh>> mesh_ids;
+  std::vector<Handle<Material>> material_ids;
+  std::vector<PerPassData<Handle<PassObject>>> pass_indices;
+  // Position in RenderScene::dirty_objects, -1 if not dirty
+  std::vector<uint32_t> update_indices;
+
+ private:
+  slot_indices<SceneObject> indices_;
+};
+
+/*
+Instance as culling reads it, mesh and range of visible instances come from
+the draw of its batch
+*/
 struct GPUInstance {
   uint32_t object_id;
-  uint32_t multibatch_id;
-  uint32_t first_index;
-  uint32_t index_count;
-  int32_t vertex_offset;
+  uint32_t batch_id;
+};
+
+/*
+Placement of single instance of an instance group, as laid out on GPU
+
+- Rotation is a unit quaternion, xyz being its imaginary part
+- Scale is uniform, so that bounds and normals stay cheap to transform
+*/
+struct GPUGroupInstance {
+  glm::vec3 position;
+  float scale;
+  glm::vec4 rotation;
+};
+
+struct GPUInstanceGroup {
+  // Bounding sphere of mesh, center and radius
+  glm::vec4 bounds;
+  uint32_t first_instance;
+  uint32_t instance_count;
+  uint32_t padding[2];
+};
+
+/*
+Many instances of single mesh and material, without any per-instance work on
+CPU once uploaded
+
+- Instances of all groups share one buffer, a compute pass culls them and
+  packs the visible ones behind a single indirect draw per pass
+- Instances stay on CPU as well, so that groups can be packed again when one
+  of them is removed
+*/
+struct InstanceGroup {
+  Handle<DrawMesh> mesh_id;
+  Handle<Material> material_id;
+  std::vector<GPUGroupInstance> instances;
+  // Position of first instance in RenderScene::group_instance_buffer
+  uint32_t first_instance;
+  bool draw_shadow_pass;
 };
 
 class RenderScene {
  public:
-  struct PassMaterial {
-    VkDescriptorSet material_set;
-    ShaderPass* shader_pass;
+  /*
+  Sort key layout from the most significant bit, so that batches sharing a
+  pipeline and then a material set end up next to each other
 
-    bool operator==(const PassMaterial& other) {
-      return material_set == other.material_set &&
-             shader_pass == other.shader_pass;
-    }
-  };
+  - Ids that do not fit wrap around, which only makes sorting worse as
+    batches are matched by mesh and material as well
+  */
+  static constexpr uint32_t kSortKeyPipelineBits = 16;
+  static constexpr uint32_t kSortKeyMaterialBits = 24;
+  static constexpr uint32_t kSortKeyMeshBits = 24;
 
-  struct PassObject {
-    PassMaterial material;
-    Handle<DrawMesh> mesh_id;
-    Handle<SceneObject> original;
-    int32_t built_batch;
-  };
+  using PassMaterial = Renderer::PassMaterial;
+  using PassObject = Renderer::PassObject;
 
   struct RenderBatch {
     Handle<PassObject> object;
     uint64_t sort_key;
 
-    bool operator==(const RenderBatch& other) {
+    bool operator==(const RenderBatch& other) const {
       return object.handle == other.object.handle && sort_key == other.sort_key;
     }
   };
@@ -92,9 +204,11 @@ class RenderScene {
   struct IndirectBatch {
     Handle<DrawMesh> mesh_id;
     PassMaterial material;
-    uint32_t first;
-    uint32_t count;
-    uint32_t multibatch;
+    uint64_t sort_key;
+    // Position in indirect_batches as of last BuildMultibatches
+    uint32_t index;
+    // Unordered, removal swaps with the last object
+    std::vector<Handle<PassObject>> objects;
   };
 
   struct Multibatch {
@@ -102,102 +216,282 @@ class RenderScene {
     uint32_t count;
   };
 
+  /*
+  Objects of single pass grouped into indirect batches
+
+  - Indirect batches are sorted by key, objects are added to and removed
+    from them in place, so multibatches are rebuilt only when a batch is
+    created or emptied
+  - GPU instances are kept dense in no particular order. Only instances
+    listed in dirty_instances have to be uploaded, unless
+    needs_instance_refresh is set
+  - Every batch has one draw, culling counts its visible instances into
+    instanceCount and packs their ids into the range of the batch, so a
+    multibatch is a single indirect call no matter how many instances it has
+  - Draws left without visible instances are dropped on the GPU after
+    culling, the multibatch call takes its draw count from there
+  */
   struct MeshPass {
     void Destroy() {
-      clear_count_buffer.Destroy();
-      count_buffer.Destroy();
       clear_indirect_buffer.Destroy();
       compacted_instance_buffer.Destroy();
       draw_indirect_buffer.Destroy();
+      multibatch_buffer.Destroy();
+      compacted_draw_buffer.Destroy();
+      draw_count_buffer.Destroy();
       pass_objects_buffer.Destroy();
-      clear_multibatches_buffer.Destroy();
-      multibatches_buffer.Destroy();
+      visibility_buffer.Destroy();
+      clear_group_draw_buffer.Destroy();
+      group_draw_buffer.Destroy();
+      group_visible_buffer.Destroy();
     }
 
     std::vector<Multibatch> multibatches;
     std::vector<IndirectBatch> indirect_batches;
     std::vector<Handle<SceneObject>> unbatches_objects;
-    std::vector<RenderBatch> batches;
-    std::vector<PassObject> objects;
-    std::vector<Handle<PassObject>> reusable_objects;
+    slot_map<PassObject> objects;
     std::vector<Handle<PassObject>> objects_to_delete;
 
-    Buffer<true> clear_count_buffer;
-    Buffer<false> count_buffer;
+    // Pass object of every GPU instance
+    std::vector<Handle<PassObject>> instances;
+    // Instances changed since last upload, may hold duplicates
+    std::vector<uint32_t> dirty_instances;
+
+    // Dense ids of pipelines and materials used in sort keys
+    std::unordered_map<VkPipeline, uint32_t> pipeline_ids;
+    std::unordered_map<Material*, uint32_t> material_ids;
+
     Buffer<false> compacted_instance_buffer;
     Buffer<false> pass_objects_buffer;
-    Buffer<true> clear_multibatches_buffer;
-    Buffer<false> multibatches_buffer;
+    // Nonzero for objects visible as of last two phase cull, by object id.
+    // Forward pass only. Objects moved since keep the value of their slot,
+    // which is only a hint
+    Buffer<false> visibility_buffer;
 
+    // Draw templates of batches, copied over the culled draws every frame
     Buffer<true> clear_indirect_buffer;
     Buffer<false> draw_indirect_buffer;
+    // Written along with the draw templates, see FillMultibatchArray
+    Buffer<true> multibatch_buffer;
+    // Culled draws with visible instances, packed from the first batch of
+    // their multibatch. Count of every multibatch is at its first batch
+    Buffer<false> compacted_draw_buffer;
+    Buffer<false> draw_count_buffer;
+
+    // Dense indices of instance groups drawn by the pass, in the order of
+    // their draws
+    std::vector<uint32_t> groups;
+    Buffer<true> clear_group_draw_buffer;
+    Buffer<false> group_draw_buffer;
+    // Visible instances of every group, packed from its first instance
+    Buffer<false> group_visible_buffer;
 
     PassObject* Get(Handle<PassObject> handle);
+    const PassObject* Get(Handle<PassObject> handle) const;
 
     MeshPassType type;
 
+    // Batches or their instance counts changed, draw templates are stale
     bool needs_indirect_refresh = true;
     bool needs_instance_refresh = true;
   };
 
-  void Init();
+  // thread_pool may be null, work is done on calling threads then
+  void Init(Engine::ThreadPool* thread_pool);
   void Destroy();
 
+  /*
+  Static objects go to the end of the static region of object data, the
+  dynamic object in their way is moved to the end
+  */
   Handle<SceneObject> RegisterObject(RenderObject* object);
 
-  void RegisterObjectBatch(RenderObject* first, uint32_t count);
-
+  /*
+  Same as registering objects one by one, in bulk
+
+  - Handles are resolved once per run of objects sharing mesh and material,
+    and once per distinct pair otherwise
+  - Columns are filled in parallel chunks, new objects are appended to the
+    dirty list all at once
+  */
+  std::vector<Handle<SceneObject>> RegisterObjectBatch(RenderObject* first,
+                                                       uint32_t count);
+
+  /*
+  Remove object from every pass, takes effect on the next BuildBatches
+
+  - Handle becomes stale right away
+  - Last object is moved into its place, so that object data stays dense.
+    Costs only a few operations per pass, regardless of scene size
+  */
+  void UnregisterObject(Handle<SceneObject> object_id);
+  void UnregisterObjectBatch(const Handle<SceneObject>* first, uint32_t count);
+  /*
+  Move static object to the dynamic region, for objects that start moving
+  every frame. Does nothing for dynamic objects
+  */
+  void MakeDynamic(Handle<SceneObject> object_id);
+
+  /*
+  Add instances of mesh, all drawn with material, takes effect on the next
+  BuildBatches
+
+  - Only passes the material has group shaders for draw the group
+  - Mesh must have indices
+  */
+  Handle<InstanceGroup> AddInstanceGroup(
+      Mesh* mesh, Material* material,
+      std::vector<GPUGroupInstance> instances, bool draw_shadow_pass);
+  void RemoveInstanceGroup(Handle<InstanceGroup> group_id);
+
+  // World bounds follow transform, batches are left as they are
   void UpdateTransform(Handle<SceneObject> object_id,
                        const glm::mat4& transform);
   void UpdateObject(Handle<SceneObject> object_id);
 
-  void FillObjectData(GPUObjectData* data);
+  // Write count objects starting at index first
+  void FillObjectData(GPUObjectData* data, uint32_t first, uint32_t count);
+  /*
+  Draw of every batch with no instances yet, first instance is the start of
+  its range of the compacted instance buffer
+
+  - Draws of batches without indices are laid out as VkDrawIndirectCommand
+  */
   void FillIndirectArray(GPUIndirectObject* data, MeshPass& pass);
+  // First batch of the multibatch of every batch
+  void FillMultibatchArray(uint32_t* data, const MeshPass& pass);
   void FillInstanceArray(GPUInstance* data, MeshPass& pass);
-  void FillMultibatchesArray(Multibatch* data, MeshPass& pass);
-  void ClearCountArray(MeshPass& pass);
+  /*
+  Write instances listed in pass.dirty_instances to data, tightly packed,
+  and clear the list. Returns copy regions from data into the instance
+  buffer, data must hold at least pass.dirty_instances.size() instances
+  */
+  std::vector<VkBufferCopy> FillDirtyInstanceArray(GPUInstance* data,
+                                                   MeshPass& pass);
+  void FillGroupInstanceArray(GPUGroupInstance* data);
+  void FillGroupArray(GPUInstanceGroup* data);
+  void FillGroupIndirectArray(GPUIndirectObject* data, MeshPass& pass);
 
   void WriteObject(GPUObjectData* target, Handle<SceneObject> object_id);
+  void WriteObject(GPUObjectData* target, uint32_t index);
+  void WriteInstance(GPUInstance* target, MeshPass& pass, uint32_t instance);
 
   void ClearDirtyObjects();
 
+  // Apply registrations, updates and removals to passes
   void BuildBatches();
-  void BuildIndirectBatches(MeshPass* pass,
-                            std::vector<IndirectBatch>& out_batches,
-                            std::vector<RenderBatch>& in_batches);
+  /*
+  Propagate changed local transforms of hierarchy, objects of nodes whose
+  world matrix changed are updated as by UpdateTransform
+  */
+  void UpdateHierarchy();
+  /*
+  Bring bvh up to date with dirty objects, has to run before they are
+  cleared
+
+  - Rebuilds it from scratch instead when more objects are new to it than
+    it holds, like after loading a prefab
+  */
+  void UpdateBvh();
+  // Whether anything is waiting for BuildBatches
+  bool NeedsRefresh() const;
+
+  /*
+  Closest object hit by the ray within max_distance, invalid handle if none
+
+  - Objects are looked up in bvh, so changes show up after UpdateBvh
+  - Triangles are tested if the mesh retained its geometry, world bounds
+    stand in otherwise
+  - direction need not be normalized, distance is in units of it
+  */
+  Handle<SceneObject> RayCast(const glm::vec3& origin,
+                              const glm::vec3& direction, float max_distance,
+                              float* distance = nullptr) const;
+  // Objects whose world bounds touch the volume, appended to result
+  void QuerySphere(const glm::vec3& center, float radius,
+                   std::vector<Handle<SceneObject>>& result) const;
+  void QueryBox(const Aabb& box,
+                std::vector<Handle<SceneObject>>& result) const;
+  /*
+  Objects whose world bounds are not outside the frustum of view_projection
+
+  - Objects between the camera and a near plane at depth 0 may be included
+  */
+  void QueryFrustum(const glm::mat4& view_projection,
+                    std::vector<Handle<SceneObject>>& result) const;
 
   void MergeMeshes(Engine::VulkanEngine* engine);
 
   void RefreshPass(MeshPass* pass);
 
-  SceneObject* GetObject(Handle<SceneObject> object_id);
+  // Null for stale handles
   DrawMesh* GetMesh(Handle<DrawMesh> mesh_id);
   Material* GetMaterial(Handle<Material> material_id);
 
+  // Position of object data in object_data_buffer
+  uint32_t GetObjectIndex(Handle<SceneObject> object_id) const;
+  // Instances of all groups, as of last BuildBatches
+  uint32_t GetGroupInstanceCount() const { return group_instance_count_; }
+
   MeshPass forward_pass;
   MeshPass transparent_pass;
   // Should rework this. It duplicates buffers
   MeshPass directional_shadow_pass;
   MeshPass point_shadow_pass;
   
-  std::vector<SceneObject> renderables;
+  // Object data is uploaded in this order
+  SceneObjectStorage renderables;
+  // Objects attached to nodes should be moved through it only
+  TransformHierarchy hierarchy;
+  // Objects with valid bounds, as of last UpdateBvh
+  Bvh bvh;
   
   std::vector<Handle<SceneObject>> dirty_objects;
 
   Buffer<false> object_data_buffer;
+
+  slot_map<InstanceGroup> instance_groups;
+  Buffer<false> group_instance_buffer;
+  Buffer<false> group_buffer;
+  // Groups were packed again, or their meshes moved
+  bool needs_group_upload = false;
   
   VertexBuffer merged_vertex_buffer;
   IndexBuffer merged_index_buffer;
 private:
   MeshPass* GetMeshPass(MeshPassType type);
+  void MarkDirty(Handle<SceneObject> object_id);
+  void RemoveDirty(Handle<SceneObject> object_id);
+  // Object took place of a removed one, its data and instances are refreshed
+  void MarkMoved(Handle<SceneObject> object_id);
+  // Swap objects and mark both moved
+  void SwapObjects(uint32_t first, uint32_t second);
+  // Move dynamic object at index to the end of the static region
+  void MakeStatic(uint32_t index);
+
+  // Pack instances of groups and pick groups drawn by every pass
+  void RefreshGroups();
+
+  uint64_t GetSortKey(MeshPass* pass, const PassObject& object);
+  // Index of batch drawing object in pass->indirect_batches, or its size
+  size_t FindBatch(const MeshPass* pass, const PassObject& object) const;
+  void AddInstance(MeshPass* pass, Handle<PassObject> handle);
+  void RemoveInstance(MeshPass* pass, Handle<PassObject> handle);
+  void BuildMultibatches(MeshPass* pass);
+
   Handle<Material> GetMaterialHandle(Material* material);
   Handle<DrawMesh> GetMeshHandle(Mesh* mesh);
 
-  std::vector<DrawMesh> meshes_;
-  std::vector<Material*> materials_;
+  Engine::ThreadPool* thread_pool_;
+
+  slot_map<DrawMesh> meshes_;
+  slot_map<Material*, Material> materials_;
 
   std::unordered_map<Material*, Handle<Material>> material_handles_;
   std::unordered_map<Mesh*, Handle<DrawMesh>> mesh_handles_;
+
+  bool groups_changed_ = false;
+  uint32_t group_instance_count_ = 0;
 };
 
 }
\ No newline at end of file
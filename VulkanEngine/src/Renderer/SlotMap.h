@@ -0,0 +1,224 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace Renderer {
+
+template<typename T>
+struct Handle {
+  static constexpr uint32_t kInvalid = static_cast<uint32_t>(-1);
+
+  // Slot index, kInvalid if handle refers to nothing
+  uint32_t handle = kInvalid;
+  uint32_t generation = 0;
+
+  bool IsValid() const { return handle != kInvalid; }
+
+  bool operator==(const Handle<T>& other) const {
+    return handle == other.handle && generation == other.generation;
+  }
+  bool operator!=(const Handle<T>& other) const { return !(*this == other); }
+};
+
+/*
+Dense indices of values addressed by handles, for containers keeping values
+in one or more arrays in the same dense order
+
+- Erasing moves the last value into the place of the erased one, which the
+  container has to mirror in its arrays
+- Every slot counts how many times its value was erased. Handles carry that
+  generation, so stale handles are detected instead of silently referring to
+  values inserted later
+- Insertion, erasure and lookup are O(1), without any hashing
+*/
+template<typename Tag>
+class slot_indices {
+ public:
+  using handle_type = Handle<Tag>;
+
+  // Value of new handle has to be appended to arrays of the container
+  handle_type insert() {
+    uint32_t slot_index;
+    if (free_head_ != handle_type::kInvalid) {
+      slot_index = free_head_;
+      free_head_ = slots_[slot_index].index;
+    } else {
+      slot_index = static_cast<uint32_t>(slots_.size());
+      slots_.push_back(Slot{0, 0});
+    }
+
+    Slot& slot = slots_[slot_index];
+    slot.index = static_cast<uint32_t>(value_slots_.size());
+    value_slots_.push_back(slot_index);
+
+    handle_type handle;
+    handle.handle = slot_index;
+    handle.generation = slot.generation;
+    return handle;
+  }
+
+  /*
+  Returns index of erased value, last value of the arrays has to be moved
+  there. Handle must not be stale
+  */
+  uint32_t erase(handle_type handle) {
+    Slot& slot = slots_[handle.handle];
+    uint32_t index = slot.index;
+    if (index + 1 != value_slots_.size()) {
+      value_slots_[index] = value_slots_.back();
+      slots_[value_slots_[index]].index = index;
+    }
+    value_slots_.pop_back();
+
+    ++slot.generation;
+    slot.index = free_head_;
+    free_head_ = handle.handle;
+    return index;
+  }
+
+  bool contains(handle_type handle) const {
+    return handle.handle < slots_.size() &&
+           slots_[handle.handle].generation == handle.generation;
+  }
+
+  /*
+  Position of value in dense storage, handle must not be stale
+
+  - Changes when the last value is moved by an erase
+  */
+  uint32_t index_of(handle_type handle) const {
+    return slots_[handle.handle].index;
+  }
+  handle_type handle_at(size_t index) const {
+    handle_type handle;
+    handle.handle = value_slots_[index];
+    handle.generation = slots_[handle.handle].generation;
+    return handle;
+  }
+
+  // Exchange positions of two values, the container has to mirror it
+  void swap(size_t first, size_t second) {
+    std::swap(value_slots_[first], value_slots_[second]);
+    slots_[value_slots_[first]].index = static_cast<uint32_t>(first);
+    slots_[value_slots_[second]].index = static_cast<uint32_t>(second);
+  }
+
+  size_t size() const noexcept { return value_slots_.size(); }
+  bool empty() const noexcept { return value_slots_.empty(); }
+
+  void reserve(size_t count) { value_slots_.reserve(count); }
+
+  // Handles given out before are left stale
+  void clear() {
+    for (uint32_t slot_index : value_slots_) {
+      ++slots_[slot_index].generation;
+      slots_[slot_index].index = free_head_;
+      free_head_ = slot_index;
+    }
+    value_slots_.clear();
+  }
+
+ private:
+  struct Slot {
+    // Position of value if occupied, next free slot otherwise
+    uint32_t index;
+    uint32_t generation;
+  };
+
+  // Slot of every value
+  std::vector<uint32_t> value_slots_;
+  std::vector<Slot> slots_;
+  uint32_t free_head_ = handle_type::kInvalid;
+};
+
+/*
+Values stored densely, addressed by handles that stay the same while values
+move around, see slot_indices
+
+- Iteration is always over contiguous memory
+- Handles are typed by Tag, so that maps of pointers can hand out handles of
+  the pointed to type
+*/
+template<typename T, typename Tag = T>
+class slot_map {
+ public:
+  using value_type = T;
+  using pointer = T*;
+  using const_pointer = const T*;
+  using reference = T&;
+  using const_reference = const T&;
+
+  using iterator = typename std::vector<T>::iterator;
+  using const_iterator = typename std::vector<T>::const_iterator;
+  using handle_type = Handle<Tag>;
+
+  handle_type insert(T value) {
+    values_.push_back(std::move(value));
+    return indices_.insert();
+  }
+
+  // Returns false if handle is stale
+  bool erase(handle_type handle) {
+    if (!contains(handle)) return false;
+
+    uint32_t index = indices_.erase(handle);
+    if (index + 1 != values_.size()) values_[index] = std::move(values_.back());
+    values_.pop_back();
+    return true;
+  }
+
+  bool contains(handle_type handle) const {
+    return indices_.contains(handle);
+  }
+
+  // Null if handle is stale
+  pointer get(handle_type handle) {
+    return contains(handle) ? &values_[indices_.index_of(handle)] : nullptr;
+  }
+  const_pointer get(handle_type handle) const {
+    return contains(handle) ? &values_[indices_.index_of(handle)] : nullptr;
+  }
+
+  uint32_t index_of(handle_type handle) const {
+    return indices_.index_of(handle);
+  }
+  handle_type handle_at(size_t index) const {
+    return indices_.handle_at(index);
+  }
+
+  reference operator[](size_t index) noexcept { return values_[index]; }
+  const_reference operator[](size_t index) const noexcept {
+    return values_[index];
+  }
+
+  pointer data() noexcept { return values_.data(); }
+  const_pointer data() const noexcept { return values_.data(); }
+
+  size_t size() const noexcept { return values_.size(); }
+  bool empty() const noexcept { return values_.empty(); }
+
+  void reserve(size_t count) {
+    values_.reserve(count);
+    indices_.reserve(count);
+  }
+
+  // Handles given out before are left stale
+  void clear() {
+    values_.clear();
+    indices_.clear();
+  }
+
+  iterator begin() noexcept { return values_.begin(); }
+  iterator end() noexcept { return values_.end(); }
+  const_iterator begin() const noexcept { return values_.begin(); }
+  const_iterator end() const noexcept { return values_.end(); }
+
+ private:
+  std::vector<T> values_;
+  slot_indices<Tag> indices_;
+};
+
+}
\ No newline at end of file
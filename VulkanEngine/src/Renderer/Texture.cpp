@@ -23,30 +23,86 @@ bool Texture::LoadFromAsset(VmaAllocator allocator, LogicalDevice* device,
     return false;
   }
 
-  Assets::TextureInfo texture_info = Assets::ReadTextureInfo(file);
+  return LoadFromAsset(allocator, device, command_buffer, file);
+}
 
-  VkDeviceSize image_size = texture_info.texture_size;
+bool Texture::LoadFromAsset(VmaAllocator allocator, LogicalDevice* device,
+                            CommandBuffer command_buffer,
+                            Assets::AssetFile& file, uint32_t first_mip) {
+  TextureData data;
+  if (!Decode(file, first_mip, data)) return false;
 
-  if (staging_buffer_.GetSize() < image_size) {
-    staging_buffer_.Destroy();
-    staging_buffer_.Create(
-        allocator, image_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
+  return Create(allocator, device, command_buffer, data);
+}
+
+bool Texture::Decode(Assets::AssetFile& file, uint32_t first_mip,
+                     TextureData& data) {
+  data.info = Assets::ReadTextureInfo(file);
+
+  if (data.info.mips.empty()) {
+    data.first_mip = 0;
+    data.pixels.resize(data.info.texture_size);
+    Assets::UnpackTexture(&data.info, file.binary_blob.data(),
+                          file.binary_blob.size(), data.pixels.data());
+    return true;
+  }
+
+  uint32_t mip_count = static_cast<uint32_t>(data.info.mips.size());
+  data.first_mip = std::min(first_mip, mip_count - 1);
+
+  size_t size = 0;
+  for (uint32_t i = data.first_mip; i < mip_count; ++i)
+    size += data.info.mips[i].data_size;
+  data.pixels.resize(size);
+
+  char* pixels = data.pixels.data();
+  for (uint32_t i = data.first_mip; i < mip_count; ++i) {
+    Assets::UnpackTextureMip(&data.info, i, file.binary_blob.data(), pixels);
+    pixels += data.info.mips[i].data_size;
+  }
+
+  return true;
+}
+
+bool Texture::Create(VmaAllocator allocator, LogicalDevice* device,
+                     CommandBuffer command_buffer, const TextureData& data) {
+  PrepareStaging(allocator, data.pixels.size());
+  memcpy(staging_buffer_.GetMappedMemory<char>(), data.pixels.data(),
+         data.pixels.size());
+
+  if (!data.info.mips.empty()) {
+    uint32_t mip_levels =
+        static_cast<uint32_t>(data.info.mips.size()) - data.first_mip;
+
+    const Assets::MipInfo& first = data.info.mips[data.first_mip];
+    VkResult res = CreateImage(allocator, device,
+                               {first.pixel_size[0], first.pixel_size[1], 1},
+                               mip_levels);
+    if (res != VK_SUCCESS) return false;
+
+    TransitionLevels(command_buffer, 0, mip_levels, VK_IMAGE_LAYOUT_UNDEFINED,
+                     VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0,
+                     VK_ACCESS_TRANSFER_WRITE_BIT,
+                     VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                     VK_PIPELINE_STAGE_TRANSFER_BIT);
+    CopyStagingToLevels(command_buffer, data.info, data.first_mip,
+                        mip_levels, 0);
+    TransitionLevels(command_buffer, 0, mip_levels,
+                     VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                     VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                     VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+                     VK_PIPELINE_STAGE_TRANSFER_BIT,
+                     VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+
+    first_mip_ = data.first_mip;
+    return true;
   }
-  
-  Assets::UnpackTexture(&texture_info, file.binary_blob.data(),
-                        file.binary_blob.size(),
-                        staging_buffer_.GetMappedMemory<char>());
 
-  VkExtent3D extent{static_cast<uint32_t>(texture_info.pixel_size[0]),
-                    static_cast<uint32_t>(texture_info.pixel_size[1]), 1};
+  VkExtent3D extent{static_cast<uint32_t>(data.info.pixel_size[0]),
+                    static_cast<uint32_t>(data.info.pixel_size[1]), 1};
   uint32_t mip_levels = Image::CalculateMipLevels(extent.width, extent.height);
-  image_.Create(allocator, device, extent,
-                VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
-                    VK_IMAGE_USAGE_TRANSFER_DST_BIT |
-                    VK_IMAGE_USAGE_SAMPLED_BIT,
-                VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT,
-                VK_SAMPLE_COUNT_1_BIT, mip_levels);
+  VkResult res = CreateImage(allocator, device, extent, mip_levels);
+  if (res != VK_SUCCESS) return false;
 
   Renderer::Image::LayoutTransitionInfo layout_info{};
   layout_info.dst_access = VK_ACCESS_TRANSFER_WRITE_BIT;
@@ -65,6 +121,7 @@ bool Texture::LoadFromAsset(VmaAllocator allocator, LogicalDevice* device,
   layout_info.aspect_flags = VK_IMAGE_ASPECT_COLOR_BIT;
   image_.GenerateMipMaps(command_buffer, layout_info);
 
+  first_mip_ = 0;
   return true;
 }
 
@@ -75,8 +132,220 @@ void Texture::Destroy() {
 
 void Texture::ReleaseStagingMemory() { staging_buffer_.Destroy(); }
 
+bool Texture::CreateLowResCopy(VmaAllocator allocator, LogicalDevice* device,
+                               CommandBuffer command_buffer,
+                               uint32_t max_extent, Texture& low_res) {
+  VkExtent3D extent = image_.GetExtent();
+  uint32_t mip_levels = image_.GetMipLevels();
+
+  uint32_t skipped_levels = 0;
+  while (skipped_levels + 1 < mip_levels &&
+         std::max(extent.width, extent.height) > max_extent) {
+    extent.width = std::max(extent.width >> 1, 1u);
+    extent.height = std::max(extent.height >> 1, 1u);
+    ++skipped_levels;
+  }
+  if (skipped_levels == 0) return false;
+
+  return DropMips(allocator, device, command_buffer,
+                  first_mip_ + skipped_levels, low_res);
+}
+
+bool Texture::DropMips(VmaAllocator allocator, LogicalDevice* device,
+                       CommandBuffer command_buffer, uint32_t first_mip,
+                       Texture& result) {
+  uint32_t mip_levels = image_.GetMipLevels();
+  if (first_mip <= first_mip_ || first_mip - first_mip_ >= mip_levels)
+    return false;
+
+  uint32_t skipped_levels = first_mip - first_mip_;
+  uint32_t copied_levels = mip_levels - skipped_levels;
+
+  VkExtent3D extent = image_.GetExtent();
+  extent.width = std::max(extent.width >> skipped_levels, 1u);
+  extent.height = std::max(extent.height >> skipped_levels, 1u);
+
+  VkResult res =
+      result.CreateImage(allocator, device, extent, copied_levels);
+  if (res != VK_SUCCESS) return false;
+
+  result.TransitionLevels(command_buffer, 0, copied_levels,
+                          VK_IMAGE_LAYOUT_UNDEFINED,
+                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0,
+                          VK_ACCESS_TRANSFER_WRITE_BIT,
+                          VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                          VK_PIPELINE_STAGE_TRANSFER_BIT);
+  CopyLevelsTo(command_buffer, skipped_levels, result, 0, copied_levels);
+  result.TransitionLevels(command_buffer, 0, copied_levels,
+                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                          VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                          VK_ACCESS_TRANSFER_WRITE_BIT,
+                          VK_ACCESS_SHADER_READ_BIT,
+                          VK_PIPELINE_STAGE_TRANSFER_BIT,
+                          VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+
+  result.first_mip_ = first_mip;
+  return true;
+}
+
+bool Texture::StreamMips(VmaAllocator allocator, LogicalDevice* device,
+                         CommandBuffer command_buffer,
+                         const Assets::TextureInfo& info, uint32_t first_mip,
+                         const std::vector<char>& pixels, Texture& result) {
+  if (first_mip >= first_mip_ || first_mip_ > info.mips.size()) return false;
+
+  uint32_t new_levels = first_mip_ - first_mip;
+  uint32_t mip_levels = image_.GetMipLevels() + new_levels;
+
+  result.PrepareStaging(allocator, pixels.size());
+  memcpy(result.staging_buffer_.GetMappedMemory<char>(), pixels.data(),
+         pixels.size());
+
+  const Assets::MipInfo& first = info.mips[first_mip];
+  VkResult res = result.CreateImage(
+      allocator, device, {first.pixel_size[0], first.pixel_size[1], 1},
+      mip_levels);
+  if (res != VK_SUCCESS) return false;
+
+  result.TransitionLevels(command_buffer, 0, mip_levels,
+                          VK_IMAGE_LAYOUT_UNDEFINED,
+                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0,
+                          VK_ACCESS_TRANSFER_WRITE_BIT,
+                          VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                          VK_PIPELINE_STAGE_TRANSFER_BIT);
+  result.CopyStagingToLevels(command_buffer, info, first_mip, new_levels, 0);
+  CopyLevelsTo(command_buffer, 0, result, new_levels, image_.GetMipLevels());
+  result.TransitionLevels(command_buffer, 0, mip_levels,
+                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                          VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                          VK_ACCESS_TRANSFER_WRITE_BIT,
+                          VK_ACCESS_SHADER_READ_BIT,
+                          VK_PIPELINE_STAGE_TRANSFER_BIT,
+                          VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+
+  result.first_mip_ = first_mip;
+  return true;
+}
+
 VkImage Texture::GetImage() { return image_.Get(); }
 
+Image& Texture::GetImageObject() { return image_; }
+
 VkImageView Texture::GetView() { return image_.GetView(); }
 
+VkDeviceSize Texture::GetMemorySize() const { return image_.GetMemorySize(); }
+
+uint32_t Texture::GetFirstMip() const { return first_mip_; }
+
+VkResult Texture::CreateImage(VmaAllocator allocator, LogicalDevice* device,
+                              VkExtent3D extent, uint32_t mip_levels) {
+  return image_.Create(allocator, device, extent,
+                       VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
+                           VK_IMAGE_USAGE_TRANSFER_DST_BIT |
+                           VK_IMAGE_USAGE_SAMPLED_BIT,
+                       VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT,
+                       VK_SAMPLE_COUNT_1_BIT, mip_levels);
+}
+
+void Texture::PrepareStaging(VmaAllocator allocator, VkDeviceSize size) {
+  if (staging_buffer_.GetSize() < size) {
+    staging_buffer_.Destroy();
+    staging_buffer_.Create(
+        allocator, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
+  }
+}
+
+void Texture::CopyStagingToLevels(CommandBuffer command_buffer,
+                                  const Assets::TextureInfo& info,
+                                  uint32_t first_mip, uint32_t count,
+                                  uint32_t dst_level) {
+  std::vector<VkBufferImageCopy> regions(count);
+  VkDeviceSize offset = 0;
+  for (uint32_t i = 0; i < count; ++i) {
+    const Assets::MipInfo& mip = info.mips[first_mip + i];
+
+    VkBufferImageCopy& region = regions[i];
+    region.bufferOffset = offset;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = dst_level + i;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent = {mip.pixel_size[0], mip.pixel_size[1], 1};
+
+    offset += mip.data_size;
+  }
+
+  vkCmdCopyBufferToImage(command_buffer.Get(), staging_buffer_.Get(),
+                         image_.Get(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                         static_cast<uint32_t>(regions.size()),
+                         regions.data());
+}
+
+void Texture::CopyLevelsTo(CommandBuffer command_buffer, uint32_t src_level,
+                           Texture& dst, uint32_t dst_level, uint32_t count) {
+  TransitionLevels(command_buffer, src_level, count,
+                   VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                   VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+                   VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                   VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+  VkExtent3D extent = image_.GetExtent();
+  extent.width = std::max(extent.width >> src_level, 1u);
+  extent.height = std::max(extent.height >> src_level, 1u);
+
+  std::vector<VkImageCopy> regions(count);
+  for (uint32_t i = 0; i < count; ++i) {
+    VkImageCopy& region = regions[i];
+    region.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.srcSubresource.mipLevel = src_level + i;
+    region.srcSubresource.layerCount = 1;
+    region.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.dstSubresource.mipLevel = dst_level + i;
+    region.dstSubresource.layerCount = 1;
+    region.extent = extent;
+
+    extent.width = std::max(extent.width >> 1, 1u);
+    extent.height = std::max(extent.height >> 1, 1u);
+  }
+
+  vkCmdCopyImage(command_buffer.Get(), image_.Get(),
+                 VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, dst.image_.Get(),
+                 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                 static_cast<uint32_t>(regions.size()), regions.data());
+
+  TransitionLevels(command_buffer, src_level, count,
+                   VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                   VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_SHADER_READ_BIT,
+                   VK_PIPELINE_STAGE_TRANSFER_BIT,
+                   VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+}
+
+void Texture::TransitionLevels(CommandBuffer command_buffer,
+                               uint32_t base_level, uint32_t count,
+                               VkImageLayout old_layout,
+                               VkImageLayout new_layout,
+                               VkAccessFlags src_access,
+                               VkAccessFlags dst_access,
+                               VkPipelineStageFlags src_stage,
+                               VkPipelineStageFlags dst_stage) {
+  VkImageMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = image_.Get();
+  barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  barrier.subresourceRange.baseMipLevel = base_level;
+  barrier.subresourceRange.levelCount = count;
+  barrier.subresourceRange.layerCount = 1;
+  barrier.srcAccessMask = src_access;
+  barrier.dstAccessMask = dst_access;
+  barrier.oldLayout = old_layout;
+  barrier.newLayout = new_layout;
+
+  vkCmdPipelineBarrier(command_buffer.Get(), src_stage, dst_stage, 0, 0,
+                       nullptr, 0, nullptr, 1, &barrier);
+}
+
 }  // namespace Renderer
\ No newline at end of file
@@ -3,11 +3,28 @@
 #include <vulkan/vulkan.hpp>
 #include <vma\include\vk_mem_alloc.h>
 
+#include <vector>
+
 #include "Buffer.h"
 #include "Image.h"
 
+#include "AssetLoader.h"
+#include "TextureAsset.h"
+
 namespace Renderer {
 
+/*
+Texture decoded on CPU, not uploaded yet
+
+- pixels holds mips from first_mip onwards one after another, or only the
+  top level if the asset has no stored mip chain
+*/
+struct TextureData {
+  Assets::TextureInfo info;
+  uint32_t first_mip = 0;
+  std::vector<char> pixels;
+};
+
 class Texture {
  public:
   Texture();
@@ -16,16 +33,93 @@ class Texture {
 
   bool LoadFromAsset(VmaAllocator allocator, LogicalDevice* device,
                      CommandBuffer command_buffer, const char* path);
+  /*
+  Load texture from asset
+
+  - Only mips from first_mip onwards are uploaded if the asset stores its mip
+    chain, otherwise whole texture is loaded and first_mip is ignored
+  */
+  bool LoadFromAsset(VmaAllocator allocator, LogicalDevice* device,
+                     CommandBuffer command_buffer, Assets::AssetFile& file,
+                     uint32_t first_mip = 0);
+  /*
+  Decode texture asset, does not touch the GPU so it can run on any thread
+  */
+  static bool Decode(Assets::AssetFile& file, uint32_t first_mip,
+                     TextureData& data);
+  bool Create(VmaAllocator allocator, LogicalDevice* device,
+              CommandBuffer command_buffer, const TextureData& data);
   void Destroy();
 
   void ReleaseStagingMemory();
 
+  /*
+  Copy the tail of the mip chain starting at the first mip not larger than
+  max_extent into low_res
+
+  - Returns false if the texture is already that small
+  */
+  bool CreateLowResCopy(VmaAllocator allocator, LogicalDevice* device,
+                        CommandBuffer command_buffer, uint32_t max_extent,
+                        Texture& low_res);
+  /*
+  Create copy of texture holding mips from first_mip onwards
+
+  - first_mip is index in the full mip chain, not in the resident one
+  - Returns false if first_mip is not coarser than the current first mip
+  */
+  bool DropMips(VmaAllocator allocator, LogicalDevice* device,
+                CommandBuffer command_buffer, uint32_t first_mip,
+                Texture& result);
+  /*
+  Create copy of texture extended with finer mips
+
+  - pixels holds mips from first_mip up to current first mip one after
+    another, as described by info
+  - Resident mips are copied over on the GPU
+  */
+  bool StreamMips(VmaAllocator allocator, LogicalDevice* device,
+                  CommandBuffer command_buffer,
+                  const Assets::TextureInfo& info, uint32_t first_mip,
+                  const std::vector<char>& pixels, Texture& result);
+
   VkImage GetImage();
+  Image& GetImageObject();
   VkImageView GetView();
+  VkDeviceSize GetMemorySize() const;
+  /*
+  Index of the resident level 0 in the full mip chain
+  */
+  uint32_t GetFirstMip() const;
 
  private:
+  VkResult CreateImage(VmaAllocator allocator, LogicalDevice* device,
+                       VkExtent3D extent, uint32_t mip_levels);
+  void PrepareStaging(VmaAllocator allocator, VkDeviceSize size);
+  /*
+  Copy staging buffer into consecutive levels starting at dst_level, levels
+  are described by mips of info starting at first_mip
+  */
+  void CopyStagingToLevels(CommandBuffer command_buffer,
+                           const Assets::TextureInfo& info,
+                           uint32_t first_mip, uint32_t count,
+                           uint32_t dst_level);
+  /*
+  Copy levels of this texture into dst, which has to be in transfer
+  destination layout, this texture is expected in shader read layout
+  */
+  void CopyLevelsTo(CommandBuffer command_buffer, uint32_t src_level,
+                    Texture& dst, uint32_t dst_level, uint32_t count);
+  void TransitionLevels(CommandBuffer command_buffer, uint32_t base_level,
+                        uint32_t count, VkImageLayout old_layout,
+                        VkImageLayout new_layout, VkAccessFlags src_access,
+                        VkAccessFlags dst_access,
+                        VkPipelineStageFlags src_stage,
+                        VkPipelineStageFlags dst_stage);
+
   Buffer<true> staging_buffer_;
   Image image_;
+  uint32_t first_mip_ = 0;
 };
 
 }
\ No newline at end of file
@@ -20,10 +20,14 @@ bool TextureCube::LoadFromDirectory(VmaAllocator allocator,
                                     LogicalDevice* device,
                                     CommandBuffer command_buffer,
                                     const char* path) {
-  uint64_t full_size = 0;
+  TextureCubeData data;
+  if (!Decode(path, data)) return false;
+
+  return Create(allocator, device, command_buffer, data);
+}
+
+bool TextureCube::Decode(const char* path, TextureCubeData& data) {
   uint64_t face_size = 0; // Should be same for all faces
-  std::array<char*, 6> face_data;
-  Assets::TextureInfo texture_info;
   for (uint32_t i = 0; i < 6; ++i) {
     std::string face_path = std::string{path} + '/' + faces_[i] + ".tx";
     Assets::AssetFile file;
@@ -34,17 +38,25 @@ bool TextureCube::LoadFromDirectory(VmaAllocator allocator,
       return false;
     }
 
-    texture_info = Assets::ReadTextureInfo(file);
+    Assets::TextureInfo texture_info = Assets::ReadTextureInfo(file);
 
     face_size = texture_info.texture_size;
-    full_size += face_size;
-
-    face_data[i] = static_cast<char*>(malloc(face_size));
+    data.pixel_size[0] = texture_info.pixel_size[0];
+    data.pixel_size[1] = texture_info.pixel_size[1];
+    data.pixels.resize(face_size * 6);
 
     Assets::UnpackTexture(&texture_info, file.binary_blob.data(),
-                          file.binary_blob.size(), face_data[i]);
+                          file.binary_blob.size(),
+                          data.pixels.data() + i * face_size);
   }
 
+  return true;
+}
+
+bool TextureCube::Create(VmaAllocator allocator, LogicalDevice* device,
+                         CommandBuffer command_buffer,
+                         const TextureCubeData& data) {
+  uint64_t full_size = data.pixels.size();
   if (staging_buffer_.GetSize() < full_size) {
     staging_buffer_.Destroy();
     staging_buffer_.Create(
@@ -52,14 +64,10 @@ bool TextureCube::LoadFromDirectory(VmaAllocator allocator,
         VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
   }
 
-  char* buffer_data = staging_buffer_.GetMappedMemory<char>();
-  for (uint32_t i = 0; i < 6; ++i) {
-    memcpy(buffer_data + (i * face_size), face_data[i], face_size);
-    free(face_data[i]);
-  }
+  memcpy(staging_buffer_.GetMappedMemory<char>(), data.pixels.data(),
+         full_size);
 
-  VkExtent3D extent{static_cast<uint32_t>(texture_info.pixel_size[0]),
-                    static_cast<uint32_t>(texture_info.pixel_size[1]), 1};
+  VkExtent3D extent{data.pixel_size[0], data.pixel_size[1], 1};
   image_.Create(allocator, device, extent,
                 VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
                     VK_IMAGE_USAGE_TRANSFER_DST_BIT |
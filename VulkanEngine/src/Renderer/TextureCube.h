@@ -3,11 +3,21 @@
 #include <vulkan/vulkan.hpp>
 #include <vma\include\vk_mem_alloc.h>
 
+#include <vector>
+
 #include "Buffer.h"
 #include "Image.h"
 
 namespace Renderer {
 
+/*
+Cube faces decoded on CPU one after another, not uploaded yet
+*/
+struct TextureCubeData {
+  uint32_t pixel_size[2];
+  std::vector<char> pixels;
+};
+
 class TextureCube {
  public:
   TextureCube();
@@ -16,6 +26,13 @@ class TextureCube {
 
   bool LoadFromDirectory(VmaAllocator allocator, LogicalDevice* device,
                          CommandBuffer command_buffer, const char* path);
+  /*
+  Decode cube faces from directory, does not touch the GPU so it can run on
+  any thread
+  */
+  static bool Decode(const char* path, TextureCubeData& data);
+  bool Create(VmaAllocator allocator, LogicalDevice* device,
+              CommandBuffer command_buffer, const TextureCubeData& data);
   void Destroy();
 
   void ReleaseStagingMemory();
@@ -0,0 +1,175 @@
+#include "TextureStreamer.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace Renderer {
+
+uint32_t TextureStreamer::GetFirstMipUnder(const Assets::TextureInfo& info,
+                                           uint32_t max_extent) {
+  uint32_t mip = 0;
+  while (mip + 1 < info.mips.size() &&
+         std::max(info.mips[mip].pixel_size[0],
+                  info.mips[mip].pixel_size[1]) > max_extent)
+    ++mip;
+  return mip;
+}
+
+uint32_t TextureStreamer::Track(const std::string& name,
+                                Assets::AssetFile&& file,
+                                const Assets::TextureInfo& info,
+                                uint32_t resident_mip, VkImageView view) {
+  StreamedTexture texture;
+  texture.name = name;
+  texture.file = std::make_shared<const Assets::AssetFile>(std::move(file));
+  texture.info = info;
+  texture.base_mip = resident_mip;
+  texture.resident_mip = resident_mip;
+  texture.required_mip = resident_mip;
+  texture.last_needed_frame = 0;
+
+  uint32_t id = static_cast<uint32_t>(textures_.size());
+  names_[name] = id;
+  views_[view] = id;
+  textures_.push_back(std::move(texture));
+  return id;
+}
+
+bool TextureStreamer::IsTracked(const std::string& name) const {
+  return names_.find(name) != names_.end();
+}
+
+void TextureStreamer::SetResident(const std::string& name,
+                                  uint32_t resident_mip, VkImageView old_view,
+                                  VkImageView new_view) {
+  auto iter = names_.find(name);
+  if (iter == names_.end()) return;
+
+  textures_[iter->second].resident_mip = resident_mip;
+  ReplaceTextureView(old_view, new_view);
+}
+
+void TextureStreamer::ReplaceTextureView(VkImageView old_view,
+                                         VkImageView new_view) {
+  auto iter = views_.find(old_view);
+  if (iter == views_.end()) return;
+
+  uint32_t id = iter->second;
+  views_.erase(iter);
+  views_[new_view] = id;
+}
+
+void TextureStreamer::BeginFrame() {
+  for (StreamedTexture& texture : textures_)
+    texture.required_mip = static_cast<uint32_t>(texture.info.mips.size()) - 1;
+}
+
+void TextureStreamer::RequestExtent(VkImageView view, float screen_extent) {
+  auto iter = views_.find(view);
+  if (iter == views_.end()) return;
+
+  StreamedTexture& texture = textures_[iter->second];
+  float texture_extent = static_cast<float>(std::max(
+      texture.info.pixel_size[0], texture.info.pixel_size[1]));
+  float mip = std::floor(
+      std::log2(texture_extent / std::max(screen_extent, 1.f)));
+
+  uint32_t max_mip = static_cast<uint32_t>(texture.info.mips.size()) - 1;
+  uint32_t required =
+      mip <= 0.f ? 0 : std::min(static_cast<uint32_t>(mip), max_mip);
+  texture.required_mip = std::min(texture.required_mip, required);
+}
+
+void TextureStreamer::RequestDecodes(uint64_t frame) {
+  for (uint32_t id = 0; id < textures_.size(); ++id) {
+    StreamedTexture& texture = textures_[id];
+    if (texture.required_mip <= texture.resident_mip)
+      texture.last_needed_frame = frame;
+
+    if (texture.required_mip >= texture.resident_mip) continue;
+    if (decodes_.find(id) != decodes_.end()) continue;
+    if (std::any_of(decoded_.begin(), decoded_.end(),
+                    [id](const StreamedMips& mips) { return mips.id == id; }))
+      continue;
+
+    decodes_[id] = std::async(
+        std::launch::async,
+        [id, file = texture.file, info = texture.info,
+         first_mip = texture.required_mip, end_mip = texture.resident_mip]() {
+      StreamedMips mips{id, first_mip, end_mip, {}};
+
+      size_t size = 0;
+      for (uint32_t i = first_mip; i < end_mip; ++i)
+        size += info.mips[i].data_size;
+      mips.pixels.resize(size);
+
+      char* data = mips.pixels.data();
+      for (uint32_t i = first_mip; i < end_mip; ++i) {
+        Assets::UnpackTextureMip(&info, i, file->binary_blob.data(), data);
+        data += info.mips[i].data_size;
+      }
+      return mips;
+    });
+  }
+}
+
+std::vector<StreamedMips> TextureStreamer::CollectDecodedMips(
+    VkDeviceSize max_bytes) {
+  for (auto iter = decodes_.begin(); iter != decodes_.end();) {
+    if (iter->second.wait_for(std::chrono::seconds(0)) ==
+        std::future_status::ready) {
+      decoded_.push_back(iter->second.get());
+      iter = decodes_.erase(iter);
+    } else {
+      ++iter;
+    }
+  }
+
+  std::vector<StreamedMips> mips;
+  VkDeviceSize bytes = 0;
+  while (!decoded_.empty() &&
+         (mips.empty() || bytes + decoded_.front().pixels.size() <= max_bytes)) {
+    bytes += decoded_.front().pixels.size();
+    mips.push_back(std::move(decoded_.front()));
+    decoded_.pop_front();
+  }
+  streamed_bytes_ += bytes;
+
+  return mips;
+}
+
+std::vector<std::pair<uint32_t, uint32_t>> TextureStreamer::GetDropRequests(
+    uint64_t frame, uint64_t drop_delay) const {
+  std::vector<std::pair<uint32_t, uint32_t>> requests;
+  for (uint32_t id = 0; id < textures_.size(); ++id) {
+    const StreamedTexture& texture = textures_[id];
+    if (texture.resident_mip >= texture.base_mip) continue;
+    if (texture.last_needed_frame + drop_delay > frame) continue;
+
+    requests.push_back(
+        {id, std::min(texture.required_mip, texture.base_mip)});
+  }
+  return requests;
+}
+
+StreamedTexture& TextureStreamer::Get(uint32_t id) { return textures_[id]; }
+
+uint32_t TextureStreamer::GetTrackedCount() const {
+  return static_cast<uint32_t>(textures_.size());
+}
+
+uint32_t TextureStreamer::GetPendingCount() const {
+  return static_cast<uint32_t>(decodes_.size() + decoded_.size());
+}
+
+uint32_t TextureStreamer::GetFullyResidentCount() const {
+  return static_cast<uint32_t>(
+      std::count_if(textures_.begin(), textures_.end(),
+                    [](const StreamedTexture& t) { return t.resident_mip == 0; }));
+}
+
+VkDeviceSize TextureStreamer::GetStreamedBytes() const {
+  return streamed_bytes_;
+}
+
+}  // namespace Renderer
\ No newline at end of file
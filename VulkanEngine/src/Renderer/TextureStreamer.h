@@ -0,0 +1,112 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <deque>
+#include <future>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "AssetLoader.h"
+#include "TextureAsset.h"
+
+namespace Renderer {
+
+struct StreamedTexture {
+  std::string name;
+  std::shared_ptr<const Assets::AssetFile> file;
+  Assets::TextureInfo info;
+
+  // Coarsest mip ever kept resident, the one uploaded on load
+  uint32_t base_mip;
+  uint32_t resident_mip;
+  // Finest mip requested during the current frame
+  uint32_t required_mip;
+  // Last frame that needed every resident mip
+  uint64_t last_needed_frame;
+};
+
+/*
+Mips decoded on a worker thread, ready to be uploaded
+*/
+struct StreamedMips {
+  uint32_t id;
+  uint32_t first_mip;
+  // Mip following the last decoded one, resident mip at time of request
+  uint32_t end_mip;
+  std::vector<char> pixels;
+};
+
+/*
+Tracks which mips of texture are needed on screen
+
+- Textures are loaded with the coarse tail of their mip chain only, finer
+  mips get decoded in the background once something needs them
+- Like ResidencyManager it only decides, the owner of the textures does the
+  uploads and the view swaps
+*/
+class TextureStreamer {
+ public:
+  /*
+  Finest mip that is not larger than max_extent
+  */
+  static uint32_t GetFirstMipUnder(const Assets::TextureInfo& info,
+                                   uint32_t max_extent);
+
+  uint32_t Track(const std::string& name, Assets::AssetFile&& file,
+                 const Assets::TextureInfo& info, uint32_t resident_mip,
+                 VkImageView view);
+  bool IsTracked(const std::string& name) const;
+
+  /*
+  Texture got replaced, either by streaming or by someone else
+  */
+  void SetResident(const std::string& name, uint32_t resident_mip,
+                   VkImageView old_view, VkImageView new_view);
+  void ReplaceTextureView(VkImageView old_view, VkImageView new_view);
+
+  void BeginFrame();
+  /*
+  Texture is sampled by object covering screen_extent pixels, which requires
+  the mip whose size matches that extent
+  */
+  void RequestExtent(VkImageView view, float screen_extent);
+  /*
+  Start decoding all missing mips of textures that need finer mips than
+  resident
+  */
+  void RequestDecodes(uint64_t frame);
+  /*
+  Decoded mips, at most max_bytes of them but always at least one entry if
+  any is ready
+  */
+  std::vector<StreamedMips> CollectDecodedMips(VkDeviceSize max_bytes);
+  /*
+  Textures holding finer mips than needed for longer than drop_delay frames,
+  paired with the mip they should be reduced to
+  */
+  std::vector<std::pair<uint32_t, uint32_t>> GetDropRequests(
+      uint64_t frame, uint64_t drop_delay) const;
+
+  StreamedTexture& Get(uint32_t id);
+
+  uint32_t GetTrackedCount() const;
+  uint32_t GetPendingCount() const;
+  uint32_t GetFullyResidentCount() const;
+  VkDeviceSize GetStreamedBytes() const;
+
+ private:
+  std::vector<StreamedTexture> textures_;
+  std::unordered_map<std::string, uint32_t> names_;
+  std::unordered_map<VkImageView, uint32_t> views_;
+
+  std::unordered_map<uint32_t, std::future<StreamedMips>> decodes_;
+  std::deque<StreamedMips> decoded_;
+
+  VkDeviceSize streamed_bytes_ = 0;
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,219 @@
+#include "TransformHierarchy.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "ThreadPool.h"
+
+namespace Renderer {
+
+namespace {
+
+// Nodes handed to a worker at once, matrix products are cheap
+constexpr uint32_t kChunkSize = 2048;
+
+}  // namespace
+
+Handle<TransformNode> TransformHierarchy::Add(Handle<TransformNode> parent,
+                                              const glm::mat4& local,
+                                              Handle<SceneObject> object) {
+  Location location;
+  location.depth = 0;
+  glm::mat4 world = local;
+
+  if (parent.IsValid()) {
+    Location& parent_location = GetLocation(parent);
+    world = levels_[parent_location.depth].worlds[parent_location.index] *
+            local;
+    location.depth = parent_location.depth + 1;
+  }
+
+  if (location.depth >= levels_.size()) levels_.resize(location.depth + 1);
+  Level& level = levels_[location.depth];
+  location.index = static_cast<uint32_t>(level.nodes.size());
+
+  Handle<TransformNode> node = locations_.insert(location);
+  Handle<TransformNode> next_sibling;
+  if (parent.IsValid()) {
+    Location& parent_location = GetLocation(parent);
+    Handle<TransformNode>& first_child =
+        levels_[parent_location.depth].first_children[parent_location.index];
+    next_sibling = first_child;
+    if (next_sibling.IsValid())
+      level.prev_siblings[GetLocation(next_sibling).index] = node;
+    first_child = node;
+  }
+
+  level.nodes.push_back(node);
+  level.parents.push_back(parent);
+  level.first_children.push_back({});
+  level.next_siblings.push_back(next_sibling);
+  level.prev_siblings.push_back({});
+  level.locals.push_back(local);
+  // Parent may still be waiting for propagation, so the node is propagated
+  // as well
+  level.worlds.push_back(world);
+  level.objects.push_back(object);
+  level.queued.push_back(1);
+  level.dirty_nodes.push_back(node);
+
+  return node;
+}
+
+bool TransformHierarchy::Remove(Handle<TransformNode> node) {
+  if (!locations_.contains(node)) return false;
+
+  Location location = GetLocation(node);
+  Level& level = levels_[location.depth];
+  if (level.first_children[location.index].IsValid()) return false;
+
+  Handle<TransformNode> parent = level.parents[location.index];
+  Handle<TransformNode> next_sibling = level.next_siblings[location.index];
+  Handle<TransformNode> prev_sibling = level.prev_siblings[location.index];
+  if (prev_sibling.IsValid()) {
+    level.next_siblings[GetLocation(prev_sibling).index] = next_sibling;
+  } else if (parent.IsValid()) {
+    Location& parent_location = GetLocation(parent);
+    levels_[parent_location.depth].first_children[parent_location.index] =
+        next_sibling;
+  }
+  if (next_sibling.IsValid())
+    level.prev_siblings[GetLocation(next_sibling).index] = prev_sibling;
+
+  // Its entry in dirty_nodes goes stale and is dropped by propagation
+  uint32_t index = location.index;
+  uint32_t last = static_cast<uint32_t>(level.nodes.size() - 1);
+  if (index != last) {
+    level.nodes[index] = level.nodes[last];
+    level.parents[index] = level.parents[last];
+    level.first_children[index] = level.first_children[last];
+    level.next_siblings[index] = level.next_siblings[last];
+    level.prev_siblings[index] = level.prev_siblings[last];
+    level.locals[index] = level.locals[last];
+    level.worlds[index] = level.worlds[last];
+    level.objects[index] = level.objects[last];
+    level.queued[index] = level.queued[last];
+    GetLocation(level.nodes[index]).index = index;
+  }
+  level.nodes.pop_back();
+  level.parents.pop_back();
+  level.first_children.pop_back();
+  level.next_siblings.pop_back();
+  level.prev_siblings.pop_back();
+  level.locals.pop_back();
+  level.worlds.pop_back();
+  level.objects.pop_back();
+  level.queued.pop_back();
+
+  locations_.erase(node);
+  while (levels_.size() > 0 && levels_.back().nodes.empty()) levels_.pop_back();
+  return true;
+}
+
+void TransformHierarchy::SetLocal(Handle<TransformNode> node,
+                                  const glm::mat4& local) {
+  if (!locations_.contains(node)) return;
+
+  const Location& location = GetLocation(node);
+  Level& level = levels_[location.depth];
+  level.locals[location.index] = local;
+  if (!level.queued[location.index]) {
+    level.queued[location.index] = 1;
+    level.dirty_nodes.push_back(node);
+  }
+}
+
+const glm::mat4* TransformHierarchy::GetWorld(
+    Handle<TransformNode> node) const {
+  const Location* location = locations_.get(node);
+  if (!location) return nullptr;
+  return &levels_[location->depth].worlds[location->index];
+}
+
+void TransformHierarchy::Propagate(
+    Engine::ThreadPool* thread_pool,
+    const std::function<void(Handle<SceneObject>, const glm::mat4&)>&
+        on_changed) {
+  updated_count_ = 0;
+
+  // Nodes of the previous level that got new world matrices
+  std::vector<Handle<TransformNode>> changed;
+  std::vector<Handle<TransformNode>> queue;
+  for (uint32_t depth = 0; depth < levels_.size(); ++depth) {
+    Level& level = levels_[depth];
+
+    queue.clear();
+    for (Handle<TransformNode> node : level.dirty_nodes)
+      if (locations_.contains(node)) queue.push_back(node);
+    level.dirty_nodes.clear();
+
+    if (depth > 0) {
+      const Level& parent_level = levels_[depth - 1];
+      for (Handle<TransformNode> parent : changed) {
+        Handle<TransformNode> child =
+            parent_level.first_children[GetLocation(parent).index];
+        while (child.IsValid()) {
+          uint32_t index = GetLocation(child).index;
+          if (!level.queued[index]) {
+            level.queued[index] = 1;
+            queue.push_back(child);
+          }
+          child = level.next_siblings[index];
+        }
+      }
+    }
+
+    std::swap(changed, queue);
+    if (changed.empty()) continue;
+
+    PropagateLevel(thread_pool, depth, changed);
+    updated_count_ += static_cast<uint32_t>(changed.size());
+
+    // Upload bookkeeping is not thread safe, and only changed nodes pay
+    for (Handle<TransformNode> node : changed) {
+      uint32_t index = GetLocation(node).index;
+      if (level.objects[index].IsValid())
+        on_changed(level.objects[index], level.worlds[index]);
+    }
+  }
+}
+
+TransformHierarchy::Location& TransformHierarchy::GetLocation(
+    Handle<TransformNode> node) {
+  return *locations_.get(node);
+}
+
+void TransformHierarchy::PropagateLevel(
+    Engine::ThreadPool* thread_pool, uint32_t depth,
+    const std::vector<Handle<TransformNode>>& queue) {
+  Level& level = levels_[depth];
+  const Level* parent_level = depth > 0 ? &levels_[depth - 1] : nullptr;
+
+  auto update_chunk = [&](uint32_t chunk) {
+    uint32_t first = chunk * kChunkSize;
+    uint32_t last =
+        std::min(first + kChunkSize, static_cast<uint32_t>(queue.size()));
+
+    for (uint32_t i = first; i < last; ++i) {
+      uint32_t index = locations_.get(queue[i])->index;
+      const Location* parent = parent_level
+                                   ? locations_.get(level.parents[index])
+                                   : nullptr;
+      level.queued[index] = 0;
+      level.worlds[index] = parent ? parent_level->worlds[parent->index] *
+                                         level.locals[index]
+                                   : level.locals[index];
+    }
+  };
+
+  uint32_t chunk_count =
+      static_cast<uint32_t>((queue.size() + kChunkSize - 1) / kChunkSize);
+  if (thread_pool && chunk_count > 1) {
+    thread_pool->ParallelFor(chunk_count, update_chunk);
+  } else {
+    for (uint32_t chunk = 0; chunk < chunk_count; ++chunk)
+      update_chunk(chunk);
+  }
+}
+
+}  // namespace Renderer
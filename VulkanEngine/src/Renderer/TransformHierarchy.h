@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "SlotMap.h"
+
+namespace Engine {
+class ThreadPool;
+}
+
+namespace Renderer {
+
+struct SceneObject;
+struct TransformNode;
+
+/*
+Parent links, local transforms and world matrices of nodes, stored level by
+level from the roots down
+
+- Every level keeps its nodes in arrays per field, in no particular order,
+  removal swaps with the last node of the level
+- Propagation walks levels in order, so parents are always done before their
+  children, and splits each level between workers
+- Only nodes whose local transform changed and their descendants get new
+  world matrices. Each level queues its changed nodes and children are found
+  through sibling links, so propagation costs as much as the nodes it
+  updates and a static hierarchy costs nothing
+*/
+class TransformHierarchy {
+ public:
+  /*
+  Add node below parent, or a root if parent is invalid. Object, if valid,
+  follows world matrix of the node
+  */
+  Handle<TransformNode> Add(Handle<TransformNode> parent,
+                            const glm::mat4& local,
+                            Handle<SceneObject> object = {});
+  // Returns false if node is stale or still has children
+  bool Remove(Handle<TransformNode> node);
+
+  void SetLocal(Handle<TransformNode> node, const glm::mat4& local);
+  // As of last propagation, null for stale handles
+  const glm::mat4* GetWorld(Handle<TransformNode> node) const;
+
+  /*
+  Recompute world matrices of changed subtrees, then call on_changed on the
+  calling thread for every object whose node got a new world matrix
+
+  - thread_pool may be null
+  */
+  void Propagate(Engine::ThreadPool* thread_pool,
+                 const std::function<void(Handle<SceneObject>,
+                                          const glm::mat4&)>& on_changed);
+
+  size_t GetNodeCount() const { return locations_.size(); }
+  uint32_t GetLevelCount() const {
+    return static_cast<uint32_t>(levels_.size());
+  }
+  // Nodes given new world matrices by last propagation
+  uint32_t GetUpdatedCount() const { return updated_count_; }
+
+ private:
+  struct Location {
+    uint32_t depth;
+    uint32_t index;
+  };
+
+  struct Level {
+    std::vector<Handle<TransformNode>> nodes;
+    std::vector<Handle<TransformNode>> parents;
+    // Children of a node are linked through their siblings
+    std::vector<Handle<TransformNode>> first_children;
+    std::vector<Handle<TransformNode>> next_siblings;
+    std::vector<Handle<TransformNode>> prev_siblings;
+    std::vector<glm::mat4> locals;
+    std::vector<glm::mat4> worlds;
+    std::vector<Handle<SceneObject>> objects;
+    // In dirty_nodes or already queued by the propagation in progress
+    std::vector<uint8_t> queued;
+    // Local transform changed since last propagation, holds handles of nodes
+    // removed in the meantime as well
+    std::vector<Handle<TransformNode>> dirty_nodes;
+  };
+
+  Location& GetLocation(Handle<TransformNode> node);
+
+  // New world matrices of queued nodes, their parents are done already
+  void PropagateLevel(Engine::ThreadPool* thread_pool, uint32_t depth,
+                      const std::vector<Handle<TransformNode>>& queue);
+
+  slot_map<Location, TransformNode> locations_;
+  std::vector<Level> levels_;
+
+  uint32_t updated_count_ = 0;
+};
+
+}
\ No newline at end of file
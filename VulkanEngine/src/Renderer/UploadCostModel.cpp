@@ -0,0 +1,50 @@
+#include "UploadCostModel.h"
+
+#include <algorithm>
+
+namespace Renderer {
+
+namespace {
+
+// Weight of a new sample in running averages
+constexpr double kSmoothing = 0.1;
+// Timer resolution swamps the cost of smaller uploads
+constexpr uint32_t kMinSampleObjects = 64;
+constexpr float kMinFullUploadFraction = 0.05f;
+constexpr float kMaxFullUploadFraction = 1.f;
+
+}  // namespace
+
+void UploadCostModel::RecordUpload(Path path, uint32_t object_count,
+                                   double cpu_milliseconds) {
+  if (object_count < kMinSampleObjects) return;
+
+  Sample& sample = pending_[static_cast<size_t>(path)];
+  sample.object_count = object_count;
+  sample.cpu_milliseconds = cpu_milliseconds;
+}
+
+bool UploadCostModel::IsPending(Path path) const {
+  return pending_[static_cast<size_t>(path)].object_count > 0;
+}
+
+void UploadCostModel::ResolveUpload(Path path, double gpu_milliseconds) {
+  Sample& sample = pending_[static_cast<size_t>(path)];
+  if (sample.object_count == 0) return;
+
+  double cost = (sample.cpu_milliseconds + gpu_milliseconds) /
+                static_cast<double>(sample.object_count);
+  double& average = costs_[static_cast<size_t>(path)];
+  average = average == 0.0 ? cost : average + (cost - average) * kSmoothing;
+  sample = Sample();
+
+  double full_cost = costs_[static_cast<size_t>(Path::kFull)];
+  double sparse_cost = costs_[static_cast<size_t>(Path::kSparse)];
+  if (full_cost == 0.0 || sparse_cost == 0.0) return;
+
+  full_upload_fraction_ =
+      std::clamp(static_cast<float>(full_cost / sparse_cost),
+                 kMinFullUploadFraction, kMaxFullUploadFraction);
+}
+
+}  // namespace Renderer
\ No newline at end of file
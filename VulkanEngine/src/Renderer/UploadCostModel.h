@@ -0,0 +1,42 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+namespace Renderer {
+
+/*
+Picks between uploading a whole region of object data and scattering only
+its dirty objects, from costs measured on previous frames
+
+- Both paths are timed per object, CPU writes plus GPU copies, and kept as
+  running averages. GPU timings arrive a frame late, so a recorded upload
+  stays pending until its timing is resolved
+- Scattering pays for every dirty object, a full upload for every object of
+  the region, so the break-even fraction of dirty objects is the ratio of
+  the two costs
+*/
+class UploadCostModel {
+ public:
+  enum class Path { kFull, kSparse };
+
+  // Fraction of dirty objects at and above which whole region is uploaded
+  float GetFullUploadFraction() const { return full_upload_fraction_; }
+
+  void RecordUpload(Path path, uint32_t object_count, double cpu_milliseconds);
+  bool IsPending(Path path) const;
+  void ResolveUpload(Path path, double gpu_milliseconds);
+
+ private:
+  struct Sample {
+    uint32_t object_count = 0;
+    double cpu_milliseconds = 0.0;
+  };
+
+  // Per object, 0 until first sample
+  std::array<double, 2> costs_{};
+  std::array<Sample, 2> pending_{};
+  float full_upload_fraction_ = 0.8f;
+};
+
+}
\ No newline at end of file
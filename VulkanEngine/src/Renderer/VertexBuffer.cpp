@@ -23,7 +23,9 @@ void VertexBuffer::Destroy() {
   buffer_.Destroy();
 }
 
-VkBuffer VertexBuffer::Get() { return buffer_.Get(); }
+VkBuffer VertexBuffer::Get() const { return buffer_.Get(); }
+
+Buffer<false>& VertexBuffer::GetBuffer() { return buffer_; }
 
 uint32_t VertexBuffer::GetVerticesCount() const {
   return static_cast<uint32_t>(buffer_.GetSize() / sizeof(Vertex));
@@ -15,7 +15,8 @@ class VertexBuffer {
   void Create(VmaAllocator allocator, uint64_t size);
   void Destroy();
 
-  VkBuffer Get();
+  VkBuffer Get() const;
+  Buffer<false>& GetBuffer();
   uint32_t GetVerticesCount() const;
 
   void SetData(CommandBuffer command_buffer,
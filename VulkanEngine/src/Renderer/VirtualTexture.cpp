@@ -0,0 +1,561 @@
+#include "VirtualTexture.h"
+
+#include <algorithm>
+#include <array>
+
+#include "Logger.h"
+
+namespace Renderer {
+
+namespace {
+
+void ImageBarrier(CommandBuffer command_buffer, VkImage image,
+                  VkImageLayout old_layout, VkImageLayout new_layout,
+                  VkAccessFlags src_access, VkAccessFlags dst_access,
+                  VkPipelineStageFlags src_stage,
+                  VkPipelineStageFlags dst_stage) {
+  VkImageMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.srcAccessMask = src_access;
+  barrier.dstAccessMask = dst_access;
+  barrier.oldLayout = old_layout;
+  barrier.newLayout = new_layout;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = image;
+  barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  barrier.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+  barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
+
+  vkCmdPipelineBarrier(command_buffer.Get(), src_stage, dst_stage, 0, 0,
+                       nullptr, 0, nullptr, 1, &barrier);
+}
+
+uint32_t PackEntry(uint32_t x, uint32_t y, uint32_t mip) {
+  return x | (y << 8) | (mip << 16) | (0xFFu << 24);
+}
+
+}  // namespace
+
+VkResult VirtualTextureCache::Init(VmaAllocator allocator,
+                                   LogicalDevice* device, uint32_t atlas_pages,
+                                   uint32_t feedback_capacity,
+                                   uint32_t frames_in_flight) {
+  allocator_ = allocator;
+  device_ = device;
+  // Page table stores slot coordinates in 8 bits
+  atlas_pages_ = std::clamp(atlas_pages, 1u, 255u);
+  feedback_capacity_ = feedback_capacity;
+
+  uint32_t atlas_extent = atlas_pages_ * (kPageSize + 2 * kPageBorder);
+  VkResult res = atlas_.Create(
+      allocator_, device_, {atlas_extent, atlas_extent, 1},
+      VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, 1,
+      VK_SAMPLE_COUNT_1_BIT, VK_FORMAT_R8G8B8A8_SRGB);
+  if (res != VK_SUCCESS) return res;
+
+  slots_.resize(atlas_pages_ * atlas_pages_);
+  free_slots_.resize(slots_.size());
+  for (uint32_t i = 0; i < free_slots_.size(); ++i)
+    free_slots_[i] = static_cast<uint32_t>(free_slots_.size()) - 1 - i;
+
+  // Borders make filtering inside pages safe, sampling is done at a single
+  // level of the atlas
+  atlas_sampler_.SetDefaults()
+      .SetAddressMode({VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+                       VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+                       VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE})
+      .SetMipmapMode(VK_SAMPLER_MIPMAP_MODE_NEAREST)
+      .Create(device_, 0.f, 0.f);
+  page_table_sampler_.SetDefaults()
+      .SetMagFilter(VK_FILTER_NEAREST)
+      .SetMinFilter(VK_FILTER_NEAREST)
+      .SetMipmapMode(VK_SAMPLER_MIPMAP_MODE_NEAREST)
+      .Create(device_);
+
+  VkDeviceSize feedback_size = feedback_capacity_ * sizeof(uint32_t);
+  res = feedback_buffer_.Create(
+      allocator_, feedback_size,
+      VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+          VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+  if (res != VK_SUCCESS) return res;
+
+  readback_buffers_.resize(frames_in_flight);
+  staging_buffers_.resize(frames_in_flight);
+  for (Buffer<true>& readback : readback_buffers_) {
+    res = readback.Create(allocator_, feedback_size,
+                          VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                          VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT);
+    if (res != VK_SUCCESS) return res;
+    memset(readback.GetMappedMemory(), 0, feedback_size);
+  }
+
+  return VK_SUCCESS;
+}
+
+void VirtualTextureCache::Destroy() {
+  // Decoding never touches the cache, but must not outlive the file paths
+  if (loading_.valid()) loading_.wait();
+
+  for (VirtualTexture& texture : textures_) texture.page_table.Destroy();
+  textures_.clear();
+
+  for (Buffer<true>& readback : readback_buffers_) readback.Destroy();
+  for (Buffer<true>& staging : staging_buffers_) staging.Destroy();
+  feedback_buffer_.Destroy();
+
+  page_table_sampler_.Destroy();
+  atlas_sampler_.Destroy();
+  atlas_.Destroy();
+}
+
+bool VirtualTextureCache::Load(const std::string& name,
+                               const std::string& path) {
+  if (IsLoaded(name)) return true;
+
+  VirtualTexture texture;
+  texture.name = name;
+  texture.path = path;
+
+  Assets::AssetFile file;
+  if (!Assets::LoadBinaryFileHeader(path.c_str(), file, texture.blob_offset))
+    return false;
+
+  auto info = std::make_shared<Assets::VirtualTextureInfo>(
+      Assets::ReadVirtualTextureInfo(file));
+  if (info->page_size != kPageSize || info->page_border != kPageBorder ||
+      info->mips.empty()) {
+    LOG_ERROR("Virtual texture '{}' has unsupported page layout", name);
+    return false;
+  }
+
+  uint32_t page_count = static_cast<uint32_t>(info->pages.size());
+  const Assets::VirtualMipInfo& coarsest = info->mips.back();
+  if (coarsest.page_count[0] * coarsest.page_count[1] > free_slots_.size()) {
+    LOG_ERROR("Virtual texture atlas is too small for '{}'", name);
+    return false;
+  }
+
+  // Storage buffer offsets have to be aligned, 64 entries cover the usual
+  // 256 byte limit
+  uint32_t feedback_offset = (feedback_size_ + 63) & ~63u;
+  if (feedback_offset + page_count > feedback_capacity_) {
+    LOG_ERROR("Virtual texture feedback buffer is full, can't load '{}'",
+              name);
+    return false;
+  }
+
+  VkResult res = texture.page_table.Create(
+      allocator_, device_,
+      {info->mips[0].page_count[0], info->mips[0].page_count[1], 1},
+      VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+      static_cast<uint32_t>(info->mips.size()), VK_SAMPLE_COUNT_1_BIT,
+      VK_FORMAT_R8G8B8A8_UINT);
+  if (res != VK_SUCCESS) return false;
+
+  texture.info = std::move(info);
+  texture.page_entries.resize(page_count, 0);
+  texture.page_slots.resize(page_count, kNoSlot);
+  texture.page_table_dirty = true;
+  texture.feedback_offset = feedback_offset;
+  feedback_size_ = feedback_offset + page_count;
+
+  names_[name] = static_cast<uint32_t>(textures_.size());
+  textures_.push_back(std::move(texture));
+
+  LOG_SUCCESS("Loaded virtual texture '{}' with {} pages", name, page_count);
+
+  return true;
+}
+
+bool VirtualTextureCache::IsLoaded(const std::string& name) const {
+  return names_.find(name) != names_.end();
+}
+
+void VirtualTextureCache::FillMaterial(const std::string& name,
+                                       MaterialData& material) {
+  VirtualTexture& texture = textures_[names_.at(name)];
+
+  material.textures.push_back({atlas_sampler_.Get(), atlas_.GetView()});
+  material.textures.push_back(
+      {page_table_sampler_.Get(), texture.page_table.GetView()});
+
+  VkDescriptorBufferInfo feedback_info{};
+  feedback_info.buffer = feedback_buffer_.Get();
+  feedback_info.offset = texture.feedback_offset * sizeof(uint32_t);
+  feedback_info.range = texture.page_slots.size() * sizeof(uint32_t);
+  material.buffers.push_back(feedback_info);
+}
+
+void VirtualTextureCache::Update(CommandBuffer command_buffer,
+                                 uint32_t frame_index, uint64_t frame_number,
+                                 uint32_t max_page_loads) {
+  ReadFeedback(frame_index, frame_number);
+
+  std::vector<LoadedPage> loaded;
+  if (loading_.valid() && loading_.wait_for(std::chrono::seconds(0)) ==
+                              std::future_status::ready)
+    loaded = loading_.get();
+
+  UploadPages(command_buffer, frame_index, frame_number, loaded);
+
+  StartLoads(max_page_loads);
+}
+
+void VirtualTextureCache::RecordFeedbackReadback(CommandBuffer command_buffer,
+                                                 uint32_t frame_index) {
+  if (feedback_size_ == 0) return;
+
+  VkDeviceSize size = feedback_size_ * sizeof(uint32_t);
+
+  VkBufferMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask =
+      VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.buffer = feedback_buffer_.Get();
+  barrier.size = size;
+  vkCmdPipelineBarrier(command_buffer.Get(),
+                       VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 1,
+                       &barrier, 0, nullptr);
+
+  VkBufferCopy copy_region{};
+  copy_region.size = size;
+  vkCmdCopyBuffer(command_buffer.Get(), feedback_buffer_.Get(),
+                  readback_buffers_[frame_index].Get(), 1, &copy_region);
+  vkCmdFillBuffer(command_buffer.Get(), feedback_buffer_.Get(), 0, size, 0);
+
+  std::array<VkBufferMemoryBarrier, 2> barriers = {barrier, barrier};
+  barriers[0].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barriers[0].dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barriers[1].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barriers[1].dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  barriers[1].buffer = readback_buffers_[frame_index].Get();
+  vkCmdPipelineBarrier(command_buffer.Get(), VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+                           VK_PIPELINE_STAGE_HOST_BIT,
+                       0, 0, nullptr, static_cast<uint32_t>(barriers.size()),
+                       barriers.data(), 0, nullptr);
+}
+
+uint64_t VirtualTextureCache::GetPageKey(uint32_t texture, uint32_t page) {
+  return (static_cast<uint64_t>(texture) << 32) | page;
+}
+
+void VirtualTextureCache::ReadFeedback(uint32_t frame_index,
+                                       uint64_t frame_number) {
+  requests_.clear();
+  requested_count_ = 0;
+
+  const uint32_t* feedback =
+      readback_buffers_[frame_index].GetMappedMemory<uint32_t>();
+
+  for (uint32_t id = 0; id < textures_.size(); ++id) {
+    const VirtualTexture& texture = textures_[id];
+    const Assets::VirtualTextureInfo& info = *texture.info;
+    uint32_t last_mip = static_cast<uint32_t>(info.mips.size()) - 1;
+
+    for (uint32_t mip = 0; mip <= last_mip; ++mip) {
+      const Assets::VirtualMipInfo& mip_info = info.mips[mip];
+      for (uint32_t y = 0; y < mip_info.page_count[1]; ++y) {
+        for (uint32_t x = 0; x < mip_info.page_count[0]; ++x) {
+          uint32_t page = info.GetPageIndex(mip, x, y);
+          // Coarsest mip is the fallback of everything else
+          if (mip != last_mip && !feedback[texture.feedback_offset + page])
+            continue;
+
+          ++requested_count_;
+          Request(id, mip, x, y, frame_number);
+        }
+      }
+    }
+  }
+
+  // Coarser pages first, they cover more of the screen and are fallbacks of
+  // the finer ones
+  std::stable_sort(requests_.begin(), requests_.end(),
+                   [](const PageRequest& a, const PageRequest& b) {
+    return a.mip > b.mip;
+  });
+}
+
+void VirtualTextureCache::Request(uint32_t texture, uint32_t mip, uint32_t x,
+                                  uint32_t y, uint64_t frame_number) {
+  VirtualTexture& virtual_texture = textures_[texture];
+  const Assets::VirtualTextureInfo& info = *virtual_texture.info;
+
+  // Ancestors are requested as well, so that there is something close to
+  // fall back to while the page itself loads
+  for (; mip < info.mips.size(); ++mip, x /= 2, y /= 2) {
+    uint32_t page = info.GetPageIndex(mip, x, y);
+    uint32_t slot = virtual_texture.page_slots[page];
+    if (slot != kNoSlot) {
+      // Already touched this frame, so were its ancestors
+      if (slots_[slot].last_used == frame_number) return;
+      slots_[slot].last_used = frame_number;
+      continue;
+    }
+
+    if (pending_.insert(GetPageKey(texture, page)).second)
+      requests_.push_back({texture, page, mip});
+  }
+}
+
+void VirtualTextureCache::StartLoads(uint32_t max_page_loads) {
+  if (loading_.valid()) {
+    // Requests not picked up stay unrequested, the feedback will ask again
+    for (const PageRequest& request : requests_)
+      pending_.erase(GetPageKey(request.texture, request.page));
+    return;
+  }
+
+  struct PageLoad {
+    uint32_t texture;
+    uint32_t page;
+    std::string path;
+    uint64_t offset;
+    std::shared_ptr<const Assets::VirtualTextureInfo> info;
+  };
+
+  std::vector<PageLoad> loads;
+  for (const PageRequest& request : requests_) {
+    uint64_t key = GetPageKey(request.texture, request.page);
+    if (loads.size() >= max_page_loads) {
+      pending_.erase(key);
+      continue;
+    }
+
+    const VirtualTexture& texture = textures_[request.texture];
+    loads.push_back(
+        {request.texture, request.page, texture.path,
+         texture.blob_offset +
+             texture.info->pages[request.page].compressed_offset,
+         texture.info});
+  }
+  requests_.clear();
+
+  if (loads.empty()) return;
+
+  loading_ = std::async(std::launch::async, [loads = std::move(loads)]() {
+    std::vector<LoadedPage> pages(loads.size());
+    std::vector<char> compressed;
+    for (size_t i = 0; i < loads.size(); ++i) {
+      const PageLoad& load = loads[i];
+      const Assets::VirtualPageInfo& page_info = load.info->pages[load.page];
+
+      LoadedPage& page = pages[i];
+      page.texture = load.texture;
+      page.page = load.page;
+
+      compressed.resize(page_info.compressed_size);
+      page.loaded = Assets::LoadBinaryFileRange(
+          load.path.c_str(), load.offset, page_info.compressed_size,
+          compressed.data());
+      if (!page.loaded) continue;
+
+      page.pixels.resize(load.info->GetPageDataSize());
+      Assets::UnpackVirtualPage(load.info.get(), load.page, compressed.data(),
+                                page.pixels.data());
+    }
+    return pages;
+  });
+}
+
+void VirtualTextureCache::UploadPages(CommandBuffer command_buffer,
+                                      uint32_t frame_index,
+                                      uint64_t frame_number,
+                                      std::vector<LoadedPage>& pages) {
+  const uint32_t stride = kPageSize + 2 * kPageBorder;
+  const VkDeviceSize page_size = stride * stride * 4;
+
+  uploaded_count_ = 0;
+  for (const LoadedPage& page : pages) {
+    pending_.erase(GetPageKey(page.texture, page.page));
+    if (page.loaded) ++uploaded_count_;
+  }
+
+  VkDeviceSize table_size = 0;
+  for (const VirtualTexture& texture : textures_)
+    table_size += texture.page_entries.size() * sizeof(uint32_t);
+
+  Buffer<true>& staging =
+      GetStaging(frame_index, uploaded_count_ * page_size + table_size);
+  char* staging_data = staging.GetMappedMemory<char>();
+  VkDeviceSize staging_offset = 0;
+
+  std::vector<VkBufferImageCopy> atlas_copies;
+  for (const LoadedPage& page : pages) {
+    if (!page.loaded) {
+      LOG_ERROR("Failed to load page {} of virtual texture '{}'", page.page,
+                textures_[page.texture].name);
+      continue;
+    }
+
+    uint32_t slot = AllocateSlot(frame_number);
+    // Everything resident is in use, page gets requested again later
+    if (slot == kNoSlot) continue;
+
+    VirtualTexture& texture = textures_[page.texture];
+    const Assets::VirtualTextureInfo& info = *texture.info;
+    uint32_t last_page = info.mips.back().first_page;
+
+    slots_[slot].texture = page.texture;
+    slots_[slot].page = page.page;
+    slots_[slot].last_used = frame_number;
+    slots_[slot].pinned = page.page >= last_page;
+    texture.page_slots[page.page] = slot;
+    texture.page_table_dirty = true;
+    ++resident_count_;
+
+    memcpy(staging_data + staging_offset, page.pixels.data(), page_size);
+
+    VkBufferImageCopy copy_region{};
+    copy_region.bufferOffset = staging_offset;
+    copy_region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    copy_region.imageSubresource.layerCount = 1;
+    copy_region.imageOffset = {
+        static_cast<int32_t>(slot % atlas_pages_ * stride),
+        static_cast<int32_t>(slot / atlas_pages_ * stride), 0};
+    copy_region.imageExtent = {stride, stride, 1};
+    atlas_copies.push_back(copy_region);
+
+    staging_offset += page_size;
+  }
+
+  // Atlas starts out undefined, it gets its layout before first use even if
+  // nothing is uploaded
+  if (!atlas_copies.empty() || !atlas_initialized_) {
+    // Slots may be sampled by previous frames
+    ImageBarrier(command_buffer, atlas_.Get(),
+                 atlas_initialized_ ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+                                    : VK_IMAGE_LAYOUT_UNDEFINED,
+                 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_ACCESS_SHADER_READ_BIT,
+                 VK_ACCESS_TRANSFER_WRITE_BIT,
+                 VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                 VK_PIPELINE_STAGE_TRANSFER_BIT);
+    if (!atlas_copies.empty()) {
+      vkCmdCopyBufferToImage(command_buffer.Get(), staging.Get(), atlas_.Get(),
+                             VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                             static_cast<uint32_t>(atlas_copies.size()),
+                             atlas_copies.data());
+    }
+    ImageBarrier(command_buffer, atlas_.Get(),
+                 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                 VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                 VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+                 VK_PIPELINE_STAGE_TRANSFER_BIT,
+                 VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+    atlas_initialized_ = true;
+  }
+
+  // Page tables are small, dirty ones are rewritten as a whole
+  for (VirtualTexture& texture : textures_) {
+    if (!texture.page_table_dirty) continue;
+    texture.page_table_dirty = false;
+
+    RefreshPageTable(texture);
+
+    const Assets::VirtualTextureInfo& info = *texture.info;
+    memcpy(staging_data + staging_offset, texture.page_entries.data(),
+           texture.page_entries.size() * sizeof(uint32_t));
+
+    std::vector<VkBufferImageCopy> table_copies(info.mips.size());
+    for (uint32_t mip = 0; mip < info.mips.size(); ++mip) {
+      VkBufferImageCopy& copy_region = table_copies[mip];
+      copy_region.bufferOffset =
+          staging_offset + info.mips[mip].first_page * sizeof(uint32_t);
+      copy_region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      copy_region.imageSubresource.mipLevel = mip;
+      copy_region.imageSubresource.layerCount = 1;
+      copy_region.imageExtent = {info.mips[mip].page_count[0],
+                                 info.mips[mip].page_count[1], 1};
+    }
+    staging_offset += texture.page_entries.size() * sizeof(uint32_t);
+
+    // Whole table is rewritten, previous contents can be dropped
+    ImageBarrier(command_buffer, texture.page_table.Get(),
+                 VK_IMAGE_LAYOUT_UNDEFINED,
+                 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                 VK_ACCESS_SHADER_READ_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                 VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                 VK_PIPELINE_STAGE_TRANSFER_BIT);
+    vkCmdCopyBufferToImage(command_buffer.Get(), staging.Get(),
+                           texture.page_table.Get(),
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                           static_cast<uint32_t>(table_copies.size()),
+                           table_copies.data());
+    ImageBarrier(command_buffer, texture.page_table.Get(),
+                 VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                 VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                 VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+                 VK_PIPELINE_STAGE_TRANSFER_BIT,
+                 VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+  }
+}
+
+uint32_t VirtualTextureCache::AllocateSlot(uint64_t frame_number) {
+  if (!free_slots_.empty()) {
+    uint32_t slot = free_slots_.back();
+    free_slots_.pop_back();
+    return slot;
+  }
+
+  // Least recently used page not needed by the current frame
+  uint32_t victim = kNoSlot;
+  for (uint32_t i = 0; i < slots_.size(); ++i) {
+    const Slot& slot = slots_[i];
+    if (slot.pinned || slot.last_used >= frame_number) continue;
+    if (victim == kNoSlot || slot.last_used < slots_[victim].last_used)
+      victim = i;
+  }
+  if (victim == kNoSlot) return kNoSlot;
+
+  VirtualTexture& texture = textures_[slots_[victim].texture];
+  texture.page_slots[slots_[victim].page] = kNoSlot;
+  texture.page_table_dirty = true;
+  --resident_count_;
+
+  return victim;
+}
+
+void VirtualTextureCache::RefreshPageTable(VirtualTexture& texture) {
+  const Assets::VirtualTextureInfo& info = *texture.info;
+
+  for (int32_t mip = static_cast<int32_t>(info.mips.size()) - 1; mip >= 0;
+       --mip) {
+    const Assets::VirtualMipInfo& mip_info = info.mips[mip];
+    for (uint32_t y = 0; y < mip_info.page_count[1]; ++y) {
+      for (uint32_t x = 0; x < mip_info.page_count[0]; ++x) {
+        uint32_t page = info.GetPageIndex(mip, x, y);
+        uint32_t slot = texture.page_slots[page];
+
+        if (slot != kNoSlot) {
+          texture.page_entries[page] =
+              PackEntry(slot % atlas_pages_, slot / atlas_pages_, mip);
+        } else if (mip + 1 < static_cast<int32_t>(info.mips.size())) {
+          texture.page_entries[page] =
+              texture.page_entries[info.GetPageIndex(mip + 1, x / 2, y / 2)];
+        } else {
+          texture.page_entries[page] = 0;
+        }
+      }
+    }
+  }
+}
+
+Buffer<true>& VirtualTextureCache::GetStaging(uint32_t frame_index,
+                                              VkDeviceSize size) {
+  // Frame's fence was waited for, so its staging buffer is free to reuse
+  Buffer<true>& staging = staging_buffers_[frame_index];
+  if (staging.GetSize() < size) {
+    staging.Destroy();
+    staging.Create(allocator_, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                   VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
+  }
+  return staging;
+}
+
+}  // namespace Renderer
\ No newline at end of file
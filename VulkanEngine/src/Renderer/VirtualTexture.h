@@ -0,0 +1,174 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+#include <vma\include\vk_mem_alloc.h>
+
+#include <future>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "Buffer.h"
+#include "CommandPool.h"
+#include "Image.h"
+#include "LogicalDevice.h"
+#include "MaterialSystem.h"
+#include "TextureSampler.h"
+
+#include "VirtualTextureAsset.h"
+
+namespace Renderer {
+
+struct VirtualTexture {
+  std::string name;
+  std::string path;
+  std::shared_ptr<const Assets::VirtualTextureInfo> info;
+  // Position of compressed pages in the asset file
+  uint64_t blob_offset;
+
+  // Texel per page of every mip, {atlas x, atlas y, mip sampled, valid}.
+  // Pages without data point at their closest resident ancestor
+  Image page_table;
+  std::vector<uint32_t> page_entries;
+  // Atlas slot of every page, kNoSlot if not resident
+  std::vector<uint32_t> page_slots;
+  bool page_table_dirty;
+
+  // First of the feedback entries of this texture, one per page
+  uint32_t feedback_offset;
+};
+
+/*
+Software virtual texturing, textures are split into pages which are loaded
+into a shared atlas once the GPU reports they are sampled
+
+- Fragment shaders look pages up in a per texture page table and write every
+  page they would like to sample into a feedback buffer, which gets read
+  back a few frames later
+- Requested pages are read from disk and decoded on a worker thread, then
+  copied into atlas slots, evicting the least recently used pages
+- Coarsest mip of every texture is never evicted, so that there is always
+  something to fall back to
+- Works with plain images and buffers only, no sparse binding is required
+*/
+class VirtualTextureCache {
+ public:
+  // Must match textured_lit_virtual.frag
+  static constexpr uint32_t kPageSize = 128;
+  static constexpr uint32_t kPageBorder = 4;
+  static constexpr uint32_t kNoSlot = UINT32_MAX;
+
+  /*
+  Create atlas of atlas_pages x atlas_pages slots and feedback buffer with
+  room for feedback_capacity pages in total
+  */
+  VkResult Init(VmaAllocator allocator, LogicalDevice* device,
+                uint32_t atlas_pages, uint32_t feedback_capacity,
+                uint32_t frames_in_flight);
+  void Destroy();
+
+  /*
+  Read page layout of virtual texture, pages themselves are loaded by
+  following updates
+  */
+  bool Load(const std::string& name, const std::string& path);
+  bool IsLoaded(const std::string& name) const;
+
+  /*
+  Atlas and page table of texture, followed by its feedback buffer range, in
+  the order textured_lit_virtual.frag binds them
+  */
+  void FillMaterial(const std::string& name, MaterialData& material);
+
+  /*
+  Handle feedback of frame that previously used frame_index, upload pages
+  that finished decoding and start decoding newly requested ones
+
+  - Frame's fence must be waited for already
+  - Must be recorded before anything samples virtual textures
+  */
+  void Update(CommandBuffer command_buffer, uint32_t frame_index,
+              uint64_t frame_number, uint32_t max_page_loads);
+  /*
+  Copy feedback of the current frame to its readback buffer and clear it
+
+  - Must be recorded after the last pass sampling virtual textures
+  */
+  void RecordFeedbackReadback(CommandBuffer command_buffer,
+                              uint32_t frame_index);
+
+  size_t GetTextureCount() const { return textures_.size(); }
+  uint32_t GetSlotCount() const { return static_cast<uint32_t>(slots_.size()); }
+  uint32_t GetResidentPageCount() const { return resident_count_; }
+  size_t GetPendingCount() const { return pending_.size(); }
+  uint32_t GetRequestedCount() const { return requested_count_; }
+  uint32_t GetUploadedCount() const { return uploaded_count_; }
+
+ private:
+  struct Slot {
+    uint32_t texture = kNoSlot;
+    uint32_t page = 0;
+    uint64_t last_used = 0;
+    bool pinned = false;
+  };
+
+  struct PageRequest {
+    uint32_t texture;
+    uint32_t page;
+    uint32_t mip;
+  };
+
+  struct LoadedPage {
+    uint32_t texture;
+    uint32_t page;
+    bool loaded;
+    std::vector<char> pixels;
+  };
+
+  static uint64_t GetPageKey(uint32_t texture, uint32_t page);
+
+  void ReadFeedback(uint32_t frame_index, uint64_t frame_number);
+  void Request(uint32_t texture, uint32_t mip, uint32_t x, uint32_t y,
+               uint64_t frame_number);
+  void StartLoads(uint32_t max_page_loads);
+  void UploadPages(CommandBuffer command_buffer, uint32_t frame_index,
+                   uint64_t frame_number, std::vector<LoadedPage>& pages);
+  uint32_t AllocateSlot(uint64_t frame_number);
+  void RefreshPageTable(VirtualTexture& texture);
+  Buffer<true>& GetStaging(uint32_t frame_index, VkDeviceSize size);
+
+  VmaAllocator allocator_;
+  LogicalDevice* device_;
+
+  Image atlas_;
+  uint32_t atlas_pages_;
+  bool atlas_initialized_ = false;
+  TextureSampler atlas_sampler_;
+  TextureSampler page_table_sampler_;
+
+  std::vector<VirtualTexture> textures_;
+  std::unordered_map<std::string, uint32_t> names_;
+
+  std::vector<Slot> slots_;
+  std::vector<uint32_t> free_slots_;
+  uint32_t resident_count_ = 0;
+
+  // Feedback written by shaders, plus copy of it for every frame in flight
+  Buffer<false> feedback_buffer_;
+  std::vector<Buffer<true>> readback_buffers_;
+  uint32_t feedback_capacity_;
+  uint32_t feedback_size_ = 0;
+
+  std::vector<Buffer<true>> staging_buffers_;
+
+  std::vector<PageRequest> requests_;
+  std::unordered_set<uint64_t> pending_;
+  std::future<std::vector<LoadedPage>> loading_;
+
+  uint32_t requested_count_ = 0;
+  uint32_t uploaded_count_ = 0;
+};
+
+}
\ No newline at end of file
@@ -37,6 +37,7 @@ VkResult LogicalDevice::Init(PhysicalDevice* physical_device) {
   features.fillModeNonSolid = VK_TRUE;
   features.imageCubeArray = VK_TRUE;
   features.independentBlend = VK_TRUE;
+  features.fragmentStoresAndAtomics = VK_TRUE;
   VkPhysicalDeviceFeatures2 device_features{};
   device_features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
   device_features.features = features;
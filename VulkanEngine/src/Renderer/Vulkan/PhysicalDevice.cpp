@@ -11,7 +11,8 @@ PhysicalDevice::PhysicalDevice() : device_(VK_NULL_HANDLE) {}
 PhysicalDevice::~PhysicalDevice() {}
 
 VkResult PhysicalDevice::Init(VulkanInstance* instance, Surface* surface,
-                          std::vector<const char*> device_extensions) {
+                          std::vector<const char*> device_extensions,
+                          std::vector<const char*> optional_extensions) {
   instance_ = instance;
   surface_ = surface;
   extensions_ = std::move(device_extensions);
@@ -33,7 +34,17 @@ VkResult PhysicalDevice::Init(VulkanInstance* instance, Surface* surface,
 
   if (device_ == VK_NULL_HANDLE) return VK_ERROR_DEVICE_LOST;
 
-  vkGetPhysicalDeviceProperties(device_, &properties_);
+  AddOptionalExtensions(optional_extensions);
+
+  subgroup_properties_ = {};
+  subgroup_properties_.sType =
+      VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES;
+  VkPhysicalDeviceProperties2 properties2{};
+  properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+  properties2.pNext = &subgroup_properties_;
+  vkGetPhysicalDeviceProperties2(device_, &properties2);
+  properties_ = properties2.properties;
+  subgroup_properties_.pNext = nullptr;
 
   VkSampleCountFlags counts = properties_.limits.framebufferColorSampleCounts &
                               properties_.limits.framebufferDepthSampleCounts;
@@ -52,10 +63,21 @@ VkSampleCountFlagBits PhysicalDevice::GetMaxSamples() const {
   return max_samples_;
 }
 
+const VkPhysicalDeviceSubgroupProperties&
+PhysicalDevice::GetSubgroupProperties() const {
+  return subgroup_properties_;
+}
+
 const std::vector<const char*>& PhysicalDevice::GetExtensions() const {
   return extensions_;
 }
 
+bool PhysicalDevice::IsExtensionEnabled(std::string_view extension) const {
+  for (const char* enabled : extensions_)
+    if (extension == enabled) return true;
+  return false;
+}
+
 const VulkanInstance* PhysicalDevice::GetInstance() const { return instance_; }
 
 const Surface* PhysicalDevice::GetSurface() const { return surface_; }
@@ -149,6 +171,28 @@ bool PhysicalDevice::CheckDeviceExtensionSupport(VkPhysicalDevice device) {
   return required_extensions.empty();
 }
 
+void PhysicalDevice::AddOptionalExtensions(
+    const std::vector<const char*>& extensions) {
+  uint32_t extensions_count = 0;
+  vkEnumerateDeviceExtensionProperties(device_, nullptr, &extensions_count,
+                                       nullptr);
+
+  std::vector<VkExtensionProperties> available_extensions(extensions_count);
+  vkEnumerateDeviceExtensionProperties(device_, nullptr, &extensions_count,
+                                       available_extensions.data());
+
+  std::unordered_set<std::string> available;
+  for (const auto& extension : available_extensions)
+    available.insert(extension.extensionName);
+
+  for (const char* extension : extensions) {
+    if (available.find(extension) != available.end())
+      extensions_.push_back(extension);
+    else
+      LOG_WARNING("Optional device extension not supported: {}", extension);
+  }
+}
+
 bool PhysicalDevice::IsDeviceSuitable(VkPhysicalDevice device) {
   QueueFamilyIndicies indicies = FindQueueFamilies(device);
 
@@ -164,7 +208,8 @@ bool PhysicalDevice::IsDeviceSuitable(VkPhysicalDevice device) {
 
   bool features_support = supported_features.samplerAnisotropy &&
                           supported_features.sampleRateShading &&
-                          supported_features.pipelineStatisticsQuery;
+                          supported_features.pipelineStatisticsQuery &&
+                          supported_features.fragmentStoresAndAtomics;
 
   return indicies.IsComplete() && extensions_supported && swap_chain_adequate &&
          features_support;
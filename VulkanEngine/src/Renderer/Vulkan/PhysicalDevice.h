@@ -3,6 +3,7 @@
 #include "vulkan/vulkan.hpp"
 
 #include <optional>
+#include <string_view>
 
 #include "VulkanInstance.h"
 #include "Surface.h"
@@ -37,13 +38,16 @@ class PhysicalDevice {
   ~PhysicalDevice();
 
   VkResult Init(VulkanInstance* instance, Surface* surface,
-                std::vector<const char*> device_extensions = {});
+                std::vector<const char*> device_extensions = {},
+                std::vector<const char*> optional_extensions = {});
 
   VkPhysicalDevice Get();
   VkPhysicalDeviceProperties GetProperties() const;
   VkSampleCountFlagBits GetMaxSamples() const;
+  const VkPhysicalDeviceSubgroupProperties& GetSubgroupProperties() const;
 
   const std::vector<const char*>& GetExtensions() const;
+  bool IsExtensionEnabled(std::string_view extension) const;
   const VulkanInstance* GetInstance() const;
   const Surface* GetSurface() const;
 
@@ -55,12 +59,14 @@ class PhysicalDevice {
   SwapChainSupportDetails QuerySwapChainSupport(VkPhysicalDevice device);
 
   bool CheckDeviceExtensionSupport(VkPhysicalDevice device);
+  void AddOptionalExtensions(const std::vector<const char*>& extensions);
 
   bool IsDeviceSuitable(VkPhysicalDevice device);
 
   VkPhysicalDevice device_ = VK_NULL_HANDLE;
   VkPhysicalDeviceProperties properties_;
   VkSampleCountFlagBits max_samples_;
+  VkPhysicalDeviceSubgroupProperties subgroup_properties_;
 
   VulkanInstance* instance_;
   Surface* surface_;
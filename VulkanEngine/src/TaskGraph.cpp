@@ -0,0 +1,123 @@
+#include "TaskGraph.h"
+
+#include <algorithm>
+
+#include "Logger.h"
+
+namespace Engine {
+
+TaskGraph::TaskId TaskGraph::Add(std::string name, std::function<void()> work,
+                                 const std::vector<TaskId>& dependencies,
+                                 Thread thread) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  TaskId id = static_cast<TaskId>(tasks_.size());
+  tasks_.push_back({});
+  Task& task = tasks_.back();
+  task.name = std::move(name);
+  task.work = std::move(work);
+  task.thread = thread;
+
+  for (TaskId dependency : dependencies) {
+    if (tasks_[dependency].finished) continue;
+    tasks_[dependency].dependents.push_back(id);
+    ++task.pending_dependencies;
+  }
+
+  if (thread_pool_ && task.pending_dependencies == 0) Schedule(id);
+
+  return id;
+}
+
+void TaskGraph::AddDependency(TaskId task, TaskId dependency) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (tasks_[dependency].finished) return;
+  tasks_[dependency].dependents.push_back(task);
+  ++tasks_[task].pending_dependencies;
+}
+
+void TaskGraph::Run(ThreadPool& thread_pool) {
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  thread_pool_ = &thread_pool;
+  start_time_ = std::chrono::steady_clock::now();
+
+  for (TaskId id = 0; id < tasks_.size(); ++id)
+    if (tasks_[id].pending_dependencies == 0) Schedule(id);
+
+  while (finished_count_ < tasks_.size()) {
+    if (main_thread_tasks_.empty()) {
+      condition_.wait(lock);
+      continue;
+    }
+
+    TaskId id = main_thread_tasks_.front();
+    main_thread_tasks_.pop_front();
+    Task* task = &tasks_[id];
+
+    lock.unlock();
+    Execute(task);
+    lock.lock();
+  }
+
+  thread_pool_ = nullptr;
+}
+
+void TaskGraph::LogTimeline(std::string_view title) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  std::vector<const Task*> sorted;
+  for (const Task& task : tasks_) sorted.push_back(&task);
+  std::sort(sorted.begin(), sorted.end(), [](const Task* a, const Task* b) {
+    return a->start_ms < b->start_ms;
+  });
+
+  double end_ms = 0.0;
+  for (const Task* task : sorted) {
+    std::string thread = task->worker_index < 0
+                             ? std::string("main")
+                             : fmt::format("worker {}", task->worker_index);
+    LOG_INFO("{:>9.2f} - {:>9.2f} ms ({:>8.2f} ms) [{:<9}] {}",
+             task->start_ms, task->end_ms, task->end_ms - task->start_ms,
+             thread, task->name);
+    end_ms = std::max(end_ms, task->end_ms);
+  }
+  LOG_INFO("{} took {:.2f} ms", title, end_ms);
+}
+
+void TaskGraph::Schedule(TaskId id) {
+  Task* task = &tasks_[id];
+  if (task->scheduled) return;
+  task->scheduled = true;
+
+  if (task->thread == Thread::kMain) {
+    main_thread_tasks_.push_back(id);
+    condition_.notify_all();
+  } else {
+    thread_pool_->Submit([this, task]() { Execute(task); });
+  }
+}
+
+void TaskGraph::Execute(Task* task) {
+  auto start = std::chrono::steady_clock::now();
+  task->work();
+  auto end = std::chrono::steady_clock::now();
+
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  task->start_ms =
+      std::chrono::duration<double, std::milli>(start - start_time_).count();
+  task->end_ms =
+      std::chrono::duration<double, std::milli>(end - start_time_).count();
+  task->worker_index = ThreadPool::GetWorkerIndex();
+  task->finished = true;
+  ++finished_count_;
+
+  for (TaskId dependent : task->dependents) {
+    if (--tasks_[dependent].pending_dependencies == 0) Schedule(dependent);
+  }
+  condition_.notify_all();
+}
+
+}  // namespace Engine
\ No newline at end of file
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "ThreadPool.h"
+
+namespace Engine {
+
+/*
+Set of named tasks with dependencies between them
+
+- Tasks run as soon as all their dependencies finished, main thread tasks on
+  the thread calling Run, the rest on the thread pool
+- Tasks can be added while the graph runs, e.g. once the amount of work is
+  known, and can be made dependencies of tasks that have not started yet
+- Start and end of every task are recorded, so the graph doubles as a
+  timeline of the work it ran
+*/
+class TaskGraph {
+ public:
+  using TaskId = uint32_t;
+
+  enum class Thread { kAny, kMain };
+
+  TaskId Add(std::string name, std::function<void()> work,
+             const std::vector<TaskId>& dependencies = {},
+             Thread thread = Thread::kAny);
+  /*
+  Make task wait for dependency as well
+
+  - task must not have started yet
+  */
+  void AddDependency(TaskId task, TaskId dependency);
+
+  /*
+  Run all tasks, returns once every task finished
+  */
+  void Run(ThreadPool& thread_pool);
+
+  void LogTimeline(std::string_view title) const;
+
+ private:
+  struct Task {
+    std::string name;
+    std::function<void()> work;
+    Thread thread;
+
+    std::vector<TaskId> dependents;
+    uint32_t pending_dependencies = 0;
+    bool scheduled = false;
+    bool finished = false;
+
+    double start_ms = 0.0;
+    double end_ms = 0.0;
+    int32_t worker_index = -1;
+  };
+
+  // Expects mutex_ to be locked
+  void Schedule(TaskId id);
+  void Execute(Task* task);
+
+  std::deque<Task> tasks_;
+  std::deque<TaskId> main_thread_tasks_;
+  uint32_t finished_count_ = 0;
+
+  ThreadPool* thread_pool_ = nullptr;
+  std::chrono::steady_clock::time_point start_time_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable condition_;
+};
+
+}
\ No newline at end of file
@@ -0,0 +1,288 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <chrono>
+
+namespace Engine {
+
+namespace {
+
+constexpr int64_t kInitialDequeCapacity = 256;
+constexpr size_t kArenaBlockSize = 64 * 1024;
+
+thread_local int32_t worker_index = -1;
+
+}  // namespace
+
+void* ThreadPool::JobArena::Allocate(size_t size, size_t alignment) {
+  while (block_ < blocks_.size()) {
+    Block& block = blocks_[block_];
+    uintptr_t address =
+        reinterpret_cast<uintptr_t>(block.memory.get()) + offset_;
+    size_t padding = (alignment - address % alignment) % alignment;
+    if (offset_ + padding + size <= block.size) {
+      offset_ += padding + size;
+      return block.memory.get() + offset_ - size;
+    }
+    ++block_;
+    offset_ = 0;
+  }
+
+  // Every kept block is full
+  size_t block_size = std::max(kArenaBlockSize, size + alignment);
+  blocks_.push_back({std::make_unique<uint8_t[]>(block_size), block_size});
+  block_ = blocks_.size() - 1;
+  offset_ = 0;
+  return Allocate(size, alignment);
+}
+
+void ThreadPool::JobArena::Reset() {
+  block_ = 0;
+  offset_ = 0;
+}
+
+ThreadPool::JobDeque::Ring::Ring(int64_t capacity)
+    : capacity(capacity), slots(new std::atomic<Job*>[capacity]) {}
+
+ThreadPool::Job* ThreadPool::JobDeque::Ring::Get(int64_t index) const {
+  return slots[index & (capacity - 1)].load(std::memory_order_relaxed);
+}
+
+void ThreadPool::JobDeque::Ring::Put(int64_t index, Job* job) {
+  slots[index & (capacity - 1)].store(job, std::memory_order_relaxed);
+}
+
+ThreadPool::JobDeque::JobDeque() {
+  rings_.push_back(std::make_unique<Ring>(kInitialDequeCapacity));
+  ring_.store(rings_.back().get(), std::memory_order_relaxed);
+}
+
+void ThreadPool::JobDeque::Push(Job* job) {
+  int64_t bottom = bottom_.load(std::memory_order_relaxed);
+  int64_t top = top_.load(std::memory_order_acquire);
+  Ring* ring = ring_.load(std::memory_order_relaxed);
+
+  if (bottom - top >= ring->capacity) {
+    auto grown = std::make_unique<Ring>(ring->capacity * 2);
+    for (int64_t i = top; i < bottom; ++i) grown->Put(i, ring->Get(i));
+    rings_.push_back(std::move(grown));
+    ring = rings_.back().get();
+    ring_.store(ring, std::memory_order_release);
+  }
+
+  ring->Put(bottom, job);
+  std::atomic_thread_fence(std::memory_order_release);
+  bottom_.store(bottom + 1, std::memory_order_relaxed);
+}
+
+ThreadPool::Job* ThreadPool::JobDeque::Take() {
+  int64_t bottom = bottom_.load(std::memory_order_relaxed) - 1;
+  Ring* ring = ring_.load(std::memory_order_relaxed);
+  // Claim the bottom job before looking at top, thieves see the claim
+  bottom_.store(bottom, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  int64_t top = top_.load(std::memory_order_relaxed);
+
+  if (top > bottom) {
+    bottom_.store(bottom + 1, std::memory_order_relaxed);
+    return nullptr;
+  }
+
+  Job* job = ring->Get(bottom);
+  if (top == bottom) {
+    // Last job, thieves may go for it as well
+    if (!top_.compare_exchange_strong(top, top + 1,
+                                      std::memory_order_seq_cst,
+                                      std::memory_order_relaxed))
+      job = nullptr;
+    bottom_.store(bottom + 1, std::memory_order_relaxed);
+  }
+  return job;
+}
+
+ThreadPool::Job* ThreadPool::JobDeque::Steal() {
+  int64_t top = top_.load(std::memory_order_acquire);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  int64_t bottom = bottom_.load(std::memory_order_acquire);
+  if (top >= bottom) return nullptr;
+
+  Job* job = ring_.load(std::memory_order_acquire)->Get(top);
+  if (!top_.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst,
+                                    std::memory_order_relaxed))
+    return nullptr;
+  return job;
+}
+
+void ThreadPool::Init(uint32_t thread_count) {
+  if (thread_count == 0)
+    thread_count = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+
+  stopping_ = false;
+  deques_.clear();
+  for (uint32_t i = 0; i < thread_count; ++i)
+    deques_.push_back(std::make_unique<JobDeque>());
+  arenas_ = std::vector<JobArena>(thread_count);
+  busy_nanoseconds_ =
+      std::make_unique<std::atomic<uint64_t>[]>(thread_count + 1);
+  for (uint32_t i = 0; i <= thread_count; ++i) busy_nanoseconds_[i] = 0;
+
+  threads_.reserve(thread_count);
+  for (uint32_t i = 0; i < thread_count; ++i)
+    threads_.emplace_back(&ThreadPool::WorkerLoop, this,
+                          static_cast<int32_t>(i));
+}
+
+void ThreadPool::Destroy() {
+  {
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+    stopping_ = true;
+  }
+  wake_condition_.notify_all();
+
+  for (std::thread& thread : threads_) thread.join();
+  threads_.clear();
+  deques_.clear();
+  arenas_.clear();
+}
+
+void ThreadPool::Wait(JobCounter& counter) {
+  uint32_t queue_index =
+      worker_index >= 0 ? static_cast<uint32_t>(worker_index)
+                        : GetThreadCount();
+  while (!counter.IsDone()) {
+    // Jobs of the counter may already run elsewhere with nothing left
+    // queued
+    if (!RunOne(queue_index)) std::this_thread::yield();
+  }
+}
+
+void ThreadPool::ParallelFor(uint32_t count,
+                             const std::function<void(uint32_t)>& work) {
+  if (count == 0) return;
+
+  // Indices are claimed in ranges, a few per thread, so that claiming stays
+  // cheap and uneven work still balances
+  uint32_t range = std::max(count / ((GetThreadCount() + 1) * 4), 1u);
+  std::atomic<uint32_t> next{0};
+  auto run = [&next, &work, count, range]() {
+    uint32_t begin;
+    while ((begin = next.fetch_add(range, std::memory_order_relaxed)) <
+           count) {
+      uint32_t end = std::min(begin + range, count);
+      for (uint32_t index = begin; index < end; ++index) work(index);
+    }
+  };
+
+  // Jobs finding no range left return right away
+  JobCounter counter;
+  uint32_t helpers =
+      std::min((count + range - 1) / range - 1, GetThreadCount());
+  for (uint32_t i = 0; i < helpers; ++i) Submit(run, &counter);
+  run();
+  Wait(counter);
+}
+
+void ThreadPool::ResetJobMemory() {
+  std::lock_guard<std::mutex> lock(external_mutex_);
+  // Workers only allocate from inside jobs, so none does while this is 0
+  if (unfinished_jobs_.load(std::memory_order_acquire) > 0) return;
+
+  for (JobArena& arena : arenas_) arena.Reset();
+  external_arena_.Reset();
+}
+
+uint32_t ThreadPool::GetThreadCount() const {
+  return static_cast<uint32_t>(threads_.size());
+}
+
+int32_t ThreadPool::GetWorkerIndex() { return worker_index; }
+
+std::vector<double> ThreadPool::TakeBusyTimes() {
+  std::vector<double> busy_times(GetThreadCount() + 1);
+  for (size_t i = 0; i < busy_times.size(); ++i)
+    busy_times[i] = busy_nanoseconds_[i].exchange(0) / 1000000.0;
+  return busy_times;
+}
+
+void* ThreadPool::AllocateJob(size_t size, size_t alignment) {
+  if (worker_index >= 0) {
+    unfinished_jobs_.fetch_add(1, std::memory_order_relaxed);
+    return arenas_[worker_index].Allocate(size, alignment);
+  }
+
+  // Counted under the lock, so a reset cannot slip in between
+  std::lock_guard<std::mutex> lock(external_mutex_);
+  unfinished_jobs_.fetch_add(1, std::memory_order_relaxed);
+  return external_arena_.Allocate(size, alignment);
+}
+
+void ThreadPool::Enqueue(Job* job) {
+  if (job->counter)
+    job->counter->pending_.fetch_add(1, std::memory_order_relaxed);
+
+  if (worker_index >= 0) {
+    deques_[worker_index]->Push(job);
+  } else {
+    std::lock_guard<std::mutex> lock(external_mutex_);
+    external_jobs_.push_back(job);
+  }
+  {
+    // Published once the job can be taken, and under the lock, so that a
+    // worker about to sleep cannot miss it
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+    queued_count_.fetch_add(1, std::memory_order_release);
+  }
+  wake_condition_.notify_one();
+}
+
+void ThreadPool::WorkerLoop(int32_t index) {
+  worker_index = index;
+
+  while (true) {
+    if (RunOne(static_cast<uint32_t>(index))) continue;
+
+    std::unique_lock<std::mutex> lock(sleep_mutex_);
+    wake_condition_.wait(lock, [this]() {
+      return stopping_ || queued_count_.load(std::memory_order_acquire) > 0;
+    });
+    if (stopping_ && queued_count_ <= 0) return;
+  }
+}
+
+bool ThreadPool::RunOne(uint32_t queue_index) {
+  // Not threads_, workers start running while it is still filled
+  uint32_t worker_count = static_cast<uint32_t>(deques_.size());
+
+  Job* job = nullptr;
+  if (queue_index < worker_count) job = deques_[queue_index]->Take();
+  if (!job) {
+    std::lock_guard<std::mutex> lock(external_mutex_);
+    if (!external_jobs_.empty()) {
+      job = external_jobs_.front();
+      external_jobs_.pop_front();
+    }
+  }
+  for (uint32_t i = 1; !job && i <= worker_count; ++i)
+    job = deques_[(queue_index + i) % worker_count]->Steal();
+  if (!job) return false;
+
+  queued_count_.fetch_sub(1, std::memory_order_acq_rel);
+  Execute(job, queue_index);
+  return true;
+}
+
+void ThreadPool::Execute(Job* job, uint32_t timing_index) {
+  JobCounter* counter = job->counter;
+
+  auto start = std::chrono::steady_clock::now();
+  job->run(*job);
+  auto end = std::chrono::steady_clock::now();
+  busy_nanoseconds_[timing_index] += static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+          .count());
+
+  if (counter) counter->pending_.fetch_sub(1, std::memory_order_acq_rel);
+  unfinished_jobs_.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+}  // namespace Engine
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace Engine {
+
+/*
+Number of unfinished jobs submitted with it, jobs of a frame step share one
+and the step waits on it
+*/
+class JobCounter {
+ public:
+  bool IsDone() const { return pending_.load(std::memory_order_acquire) == 0; }
+
+ private:
+  friend class ThreadPool;
+
+  std::atomic<uint32_t> pending_{0};
+};
+
+/*
+Persistent worker threads, one per core, stealing jobs from each other
+
+- Every worker owns a lock-free deque, jobs submitted by a worker go to its
+  own deque, jobs from other threads go to a shared queue
+- Workers take their own newest job first, which is still warm in cache,
+  then jobs from other threads, and steal the oldest job of another worker
+  once they run dry
+- Jobs and their captures are bump allocated from frame memory of the
+  submitting thread, which ResetJobMemory releases as a whole
+- Waiting threads run queued jobs until the counter drops to 0, so waiting
+  from inside a job cannot deadlock the pool
+*/
+class ThreadPool {
+ public:
+  /*
+  Start worker threads
+
+  - thread_count of 0 uses one thread less than hardware threads, leaving
+    one for the main thread
+  */
+  void Init(uint32_t thread_count = 0);
+  /*
+  Finish all submitted jobs and join worker threads
+  */
+  void Destroy();
+
+  // counter, if given, must outlive the job
+  template <typename Work>
+  void Submit(Work&& work, JobCounter* counter = nullptr);
+  // Help running jobs until all jobs of counter finished
+  void Wait(JobCounter& counter);
+  /*
+  Call work for every index below count, spread over the workers, returns
+  once all calls finished
+
+  - Calling thread takes indices as well, so it is safe to call from jobs of
+    this pool
+  */
+  void ParallelFor(uint32_t count, const std::function<void(uint32_t)>& work);
+  /*
+  Release memory of all finished jobs, called once per frame
+
+  - Skipped while any job is unfinished, memory is then released once the
+    pool is idle at a later call
+  */
+  void ResetJobMemory();
+
+  uint32_t GetThreadCount() const;
+  /*
+  Index of worker thread calling this, -1 outside of the pool
+  */
+  static int32_t GetWorkerIndex();
+
+  /*
+  Time every worker spent running jobs since last call, in milliseconds
+
+  - Includes jobs run by non worker threads while waiting as extra last
+    entry
+  */
+  std::vector<double> TakeBusyTimes();
+
+ private:
+  // Header of a job, the callable follows it in the same allocation
+  struct Job {
+    // Calls and destroys the callable
+    void (*run)(Job& job);
+    JobCounter* counter;
+  };
+
+  // Bump allocator keeping its blocks when reset
+  class JobArena {
+   public:
+    void* Allocate(size_t size, size_t alignment);
+    void Reset();
+
+   private:
+    struct Block {
+      std::unique_ptr<uint8_t[]> memory;
+      size_t size;
+    };
+
+    std::vector<Block> blocks_;
+    size_t block_ = 0;
+    size_t offset_ = 0;
+  };
+
+  /*
+  Chase-Lev deque, the owner pushes and takes at the bottom, thieves take
+  from the top, only the last job is raced for with a compare exchange
+  */
+  class JobDeque {
+   public:
+    JobDeque();
+
+    // Owner only
+    void Push(Job* job);
+    // Owner only, newest job or null
+    Job* Take();
+    // Oldest job, null if empty or another thread took it first
+    Job* Steal();
+
+   private:
+    struct Ring {
+      explicit Ring(int64_t capacity);
+      Job* Get(int64_t index) const;
+      void Put(int64_t index, Job* job);
+
+      int64_t capacity;
+      std::unique_ptr<std::atomic<Job*>[]> slots;
+    };
+
+    std::atomic<int64_t> top_{0};
+    std::atomic<int64_t> bottom_{0};
+    std::atomic<Ring*> ring_;
+    // Outgrown rings stay alive, thieves may still read from them
+    std::vector<std::unique_ptr<Ring>> rings_;
+  };
+
+  // Counts the job as unfinished, so its memory is not reset under it
+  void* AllocateJob(size_t size, size_t alignment);
+  void Enqueue(Job* job);
+  void WorkerLoop(int32_t index);
+  // Run one queued job, preferring the deque of queue_index
+  bool RunOne(uint32_t queue_index);
+  void Execute(Job* job, uint32_t timing_index);
+
+  std::vector<std::thread> threads_;
+  std::vector<std::unique_ptr<JobDeque>> deques_;
+  std::vector<JobArena> arenas_;
+  std::unique_ptr<std::atomic<uint64_t>[]> busy_nanoseconds_;
+  // Jobs allocated and not finished yet
+  std::atomic<uint32_t> unfinished_jobs_{0};
+  // Goes below 0 for a moment when a job is taken before its count was
+  // published
+  std::atomic<int32_t> queued_count_{0};
+
+  // Jobs and job memory of threads outside of the pool
+  std::mutex external_mutex_;
+  std::deque<Job*> external_jobs_;
+  JobArena external_arena_;
+
+  std::mutex sleep_mutex_;
+  std::condition_variable wake_condition_;
+  bool stopping_ = false;
+};
+
+template <typename Work>
+void ThreadPool::Submit(Work&& work, JobCounter* counter) {
+  struct TypedJob : Job {
+    std::decay_t<Work> work;
+  };
+
+  void* memory = AllocateJob(sizeof(TypedJob), alignof(TypedJob));
+  TypedJob* job = new (memory) TypedJob{{[](Job& base) {
+                                           TypedJob& typed =
+                                               static_cast<TypedJob&>(base);
+                                           typed.work();
+                                           typed.~TypedJob();
+                                         },
+                                         counter},
+                                        std::forward<Work>(work)};
+  Enqueue(job);
+}
+
+}
\ No newline at end of file
@@ -2,7 +2,10 @@
 
 #include <iostream>
 #include <functional>
-#include <future>
+#include <limits>
+#include <optional>
+#include <random>
+#include <unordered_set>
 
 #include <vulkan/vulkan.hpp>
 #include <vulkan/vk_enum_string_helper.h>
@@ -12,12 +15,14 @@
 
 #define GLM_FORCE_RADIANS
 #include <glm/gtx/transform.hpp>
+#include <glm/gtc/quaternion.hpp>
 
 #include <imgui/imgui.h>
 #include <imgui/backends/imgui_impl_glfw.h>
 #include <imgui/backends/imgui_impl_vulkan.h>
 #include <imgui/misc/cpp/imgui_stdlib.h>
 
+#include "BatchSort.h"
 #include "Console/CVAR.h"
 #include "Logger.h"
 #include "PipelineBarriers.h"
@@ -38,6 +43,10 @@ constexpr bool kEnableValidationLayers = false;
 constexpr bool kEnableValidationLayers = true;
 #endif
 
+// Profiler scopes of object data uploads, their timings tune the choice
+constexpr char kFullObjectUploadTimer[] = "Object Upload (full)";
+constexpr char kSparseObjectUploadTimer[] = "Object Upload (sparse)";
+
 namespace Engine {
 
 VulkanEngine::VulkanEngine()
@@ -52,9 +61,167 @@ VulkanEngine::VulkanEngine()
 VulkanEngine::~VulkanEngine() {}
 
 void VulkanEngine::Init() {
+  startup_begin_ = std::chrono::steady_clock::now();
   Logger::Get().SetTime();
   LOG_INFO("Initializing engine...");
 
+  InitCVars();
+  LOG_SUCCESS("Initialized CVar system");
+  thread_pool_.Init();
+
+  // Device CVars get registered while workers run, so they get everything
+  // they need from CVars up front
+  std::string asset_root = *CVarSystem::Get()->GetStringCVar("assets.path");
+  uint32_t initial_extent = GetInitialTextureExtent();
+
+  Renderer::CommandPool init_pool;
+  // Created once the device exists
+  std::optional<Renderer::CommandBuffer> upload_buffer;
+  Renderer::TextureCubeData skybox_data;
+  bool skybox_decoded = false;
+  Assets::PrefabInfo scene_prefab;
+  bool scene_scanned = false;
+
+  // File reads and decoding run on workers from the very start, device and
+  // pipeline creation run on main thread meanwhile. Uploads are recorded on
+  // main thread into single command buffer as soon as their data is ready
+  TaskGraph startup;
+
+  TaskGraph::TaskId device_task = startup.Add(
+      "Create device",
+      [&]() {
+    InitDevice();
+
+    VK_CHECK(init_pool.Create(
+        &device_, device_.GetQueueFamilies().graphics_family.value()));
+    device_.GetQueue(init_pool.GetQueueFamily()).BeginBatch();
+
+    upload_buffer.emplace(init_pool.GetBuffer());
+    upload_buffer->Begin();
+  },
+      {}, TaskGraph::Thread::kMain);
+
+  TaskGraph::TaskId targets_task = startup.Add(
+      "Create render targets", [&]() { InitRenderTargets(init_pool); },
+      {device_task}, TaskGraph::Thread::kMain);
+
+  TaskGraph::TaskId renderer_task = startup.Add(
+      "Create pipelines", [&]() { InitRenderer(init_pool); }, {targets_task},
+      TaskGraph::Thread::kMain);
+
+  TaskGraph::TaskId skybox_decode_task = startup.Add("Decode skybox", [&]() {
+    skybox_decoded = Renderer::TextureCube::Decode(
+        (asset_root + "/skybox").c_str(), skybox_data);
+  });
+
+  TaskGraph::TaskId skybox_upload_task = startup.Add(
+      "Upload skybox",
+      [&]() {
+    if (skybox_decoded)
+      skybox_texture_.Create(allocator_, &device_, *upload_buffer, skybox_data);
+  },
+      {device_task, skybox_decode_task}, TaskGraph::Thread::kMain);
+
+  TaskGraph::TaskId scene_task = startup.Add(
+      "Build scene",
+      [&]() {
+    if (scene_scanned) {
+      std::string prefab_path = AssetPath("Test.pfb");
+      Assets::PrefabInfo* prefab_info = new Assets::PrefabInfo;
+      *prefab_info = std::move(scene_prefab);
+      prefab_cache_[prefab_path] = prefab_info;
+      main_deletion_queue_.PushPointer(prefab_info);
+    }
+
+    InitScene(*upload_buffer);
+
+    upload_buffer->End();
+    upload_buffer->AddToBatch();
+
+    Renderer::Queue& init_queue = device_.GetQueue(init_pool.GetQueueFamily());
+    init_queue.EndBatch();
+
+    InitImgui(init_pool);
+
+    render_scene_.MergeMeshes(this);
+    render_scene_.BuildBatches();
+    defragmenter_.Register(&render_scene_.merged_vertex_buffer.GetBuffer());
+    defragmenter_.Register(&render_scene_.merged_index_buffer.GetBuffer());
+
+    init_queue.SubmitBatches();
+    device_.GetTransferQueue().SubmitBatches();
+    LOG_SUCCESS("Initialized scene");
+
+    device_.WaitIdle();
+  },
+      {renderer_task, skybox_upload_task}, TaskGraph::Thread::kMain);
+
+  TaskGraph::TaskId scan_task = startup.Add("Scan scene", [&]() {
+    std::vector<std::pair<std::string, std::string>> meshes = {
+        {"cube", asset_root + "/default/cube.mesh"}};
+    std::vector<std::pair<std::string, std::string>> textures = {
+        {"white", asset_root + "/default/white.tx"}};
+    scene_scanned = ScanPrefab(asset_root, asset_root + "/Test.pfb",
+                               scene_prefab, meshes, textures);
+
+    // Entries are created before any task runs, so that tasks only touch
+    // their own entry
+    std::vector<DecodedTexture*> decoded_textures;
+    for (const auto& [name, path] : textures)
+      decoded_textures.push_back(&decoded_textures_[name]);
+    std::vector<DecodedMesh*> decoded_meshes;
+    for (const auto& [name, path] : meshes)
+      decoded_meshes.push_back(&decoded_meshes_[name]);
+
+    for (size_t i = 0; i < textures.size(); ++i) {
+      const auto& [name, path] = textures[i];
+      TaskGraph::TaskId decode_task = startup.Add(
+          "Decode " + name,
+          [decoded = decoded_textures[i], path = path, initial_extent]() {
+        decoded->loaded = DecodeTexture(path, initial_extent, *decoded);
+      });
+      TaskGraph::TaskId upload_task = startup.Add(
+          "Upload " + name,
+          [this, &upload_buffer, name = name, path = path]() {
+        LoadTexture(*upload_buffer, name.c_str(), path.c_str());
+      },
+          {device_task, decode_task}, TaskGraph::Thread::kMain);
+      startup.AddDependency(scene_task, upload_task);
+    }
+
+    for (size_t i = 0; i < meshes.size(); ++i) {
+      const auto& [name, path] = meshes[i];
+      TaskGraph::TaskId decode_task = startup.Add(
+          "Decode " + name, [decoded = decoded_meshes[i], path = path]() {
+        decoded->loaded = DecodeMesh(path, *decoded);
+      });
+      TaskGraph::TaskId upload_task = startup.Add(
+          "Upload " + name,
+          [this, &upload_buffer, name = name, path = path]() {
+        LoadMesh(*upload_buffer, name.c_str(), path.c_str());
+      },
+          {device_task, decode_task}, TaskGraph::Thread::kMain);
+      startup.AddDependency(scene_task, upload_task);
+    }
+  });
+  startup.AddDependency(scene_task, scan_task);
+
+  startup.Run(thread_pool_);
+
+  decoded_textures_.clear();
+  decoded_meshes_.clear();
+  for (auto& [name, texture] : textures_) texture.ReleaseStagingMemory();
+  skybox_texture_.ReleaseStagingMemory();
+
+  is_initialized_ = true;
+
+  LOG_INFO("Finished initializing engine");
+  startup.LogTimeline("Startup");
+
+  init_pool.Destroy();
+}
+
+void VulkanEngine::InitDevice() {
   window_.Init(1600, 900, "Vulkan Engine", this);
   glfwSetInputMode(window_.GetWindow(), GLFW_CURSOR, GLFW_CURSOR_DISABLED);
   LOG_SUCCESS("Created window");
@@ -73,7 +240,8 @@ void VulkanEngine::Init() {
                             {VK_KHR_SWAPCHAIN_EXTENSION_NAME,
                              VK_KHR_SHADER_DRAW_PARAMETERS_EXTENSION_NAME,
                              VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME,
-                             VK_EXT_SAMPLER_FILTER_MINMAX_EXTENSION_NAME}));
+                             VK_EXT_SAMPLER_FILTER_MINMAX_EXTENSION_NAME},
+                            {VK_EXT_MEMORY_BUDGET_EXTENSION_NAME}));
   LOG_SUCCESS("Found GPU");
   samples_ = VK_SAMPLE_COUNT_4_BIT;
   VK_CHECK(device_.Init(&physical_device_));
@@ -82,23 +250,28 @@ void VulkanEngine::Init() {
   profiler_.Init(&device_,
                  physical_device_.GetProperties().limits.timestampPeriod);
   LOG_SUCCESS("Initialized profiler");
-  InitCVars();
-  LOG_SUCCESS("Initialized CVar system");
+  InitDeviceCVars();
 
   VmaAllocatorCreateInfo allocator_info{};
   allocator_info.instance = instance_.Get();
   allocator_info.physicalDevice = physical_device_.Get();
   allocator_info.device = device_.Get();
   allocator_info.vulkanApiVersion = VK_API_VERSION_1_2;
+  if (physical_device_.IsExtensionEnabled(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME))
+    allocator_info.flags |= VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT;
 
   VK_CHECK(vmaCreateAllocator(&allocator_info, &allocator_));
+  residency_.Init(allocator_);
+  defragmenter_.Init(allocator_, &device_);
+  VK_CHECK(virtual_textures_.Init(
+      allocator_, &device_,
+      static_cast<uint32_t>(*CVarSystem::Get()->GetIntCVar("vt.atlas_pages")),
+      static_cast<uint32_t>(
+          *CVarSystem::Get()->GetIntCVar("vt.feedback_capacity")),
+      kMaxFramesInFlight));
+}
 
-  Renderer::CommandPool init_pool;
-  VK_CHECK(init_pool.Create(
-      &device_, device_.GetQueueFamilies().graphics_family.value()));
-  Renderer::Queue& init_queue = device_.GetQueue(init_pool.GetQueueFamily());
-  init_queue.BeginBatch();
-
+void VulkanEngine::InitRenderTargets(Renderer::CommandPool& init_pool) {
   VK_CHECK(swapchain_.Create(&device_, &surface_));
   LOG_SUCCESS("Created swapchain");
 
@@ -192,16 +365,24 @@ void VulkanEngine::Init() {
     main_deletion_queue_.PushFunction(
         std::bind(&Renderer::DescriptorAllocator::Destroy,
                   frames_[i].dynamic_descriptor_allocator));
+    VK_CHECK(frames_[i].cull_stats_buffer.Create(
+        allocator_, sizeof(Renderer::GPUCullStats),
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT));
+    main_deletion_queue_.PushFunction(std::bind(
+        &Renderer::Buffer<true>::Destroy, frames_[i].cull_stats_buffer));
   }
 
   VK_CHECK(upload_pool_.Create(
       &device_, device_.GetQueueFamilies().transfer_family.value()));
   main_deletion_queue_.PushFunction(
       std::bind(&Renderer::CommandPool::Destroy, upload_pool_));
+}
 
+void VulkanEngine::InitRenderer(Renderer::CommandPool& init_pool) {
   shader_cache_.Init(&device_);
 
-  render_scene_.Init();
+  render_scene_.Init(&thread_pool_);
 
   Renderer::MaterialSystem::Init(this);
   LOG_SUCCESS("Initialized material system");
@@ -215,32 +396,16 @@ void VulkanEngine::Init() {
   LOG_SUCCESS("Initialized samplers");
   InitDepthPyramid(init_pool);
   LOG_SUCCESS("Created depth pyramid");
-
-  InitScene(init_pool);
-
-  init_queue.EndBatch();
-
-  InitImgui(init_pool);
-
-  render_scene_.MergeMeshes(this);
-  render_scene_.BuildBatches();
-
-  init_queue.SubmitBatches();
-  device_.GetTransferQueue().SubmitBatches();  
-  LOG_SUCCESS("Initialized scene");
-
-  device_.WaitIdle();
-  is_initialized_ = true;
-
-  LOG_INFO("Finished initializing engine");
-
-  init_pool.Destroy();
 }
 
 void VulkanEngine::Cleanup() {
+  thread_pool_.Destroy();
+
   if (is_initialized_) {
     ImGui_ImplVulkan_Shutdown();
 
+    // Resources retired by the last frames, before the textures they refer to
+    for (FrameData& frame : frames_) frame.deletion_queue.Flush();
     main_deletion_queue_.Flush();
     for (FrameData& frame : frames_)
       frame.dynamic_descriptor_allocator.Destroy();
@@ -271,6 +436,8 @@ void VulkanEngine::Cleanup() {
     layout_cache_.Destroy();
     descriptor_allocator_.Destroy();
 
+    virtual_textures_.Destroy();
+    defragmenter_.Destroy();
     vmaDestroyAllocator(allocator_);
 
     profiler_.Destroy();
@@ -311,10 +478,95 @@ void VulkanEngine::InitCVars() {
   AutoCVar_Int CVar_cull_occlusion_enable("culling.occlusion_culling",
                                           "Enable occlusion culling", 1,
                                           CVarFlagBits::kEditCheckbox);
+  AutoCVar_Int CVar_cull_two_phase(
+      "culling.two_phase",
+      "Draw instances visible last frame first, then occlusion cull the rest "
+      "against their depth",
+      1, CVarFlagBits::kEditCheckbox);
+  AutoCVar_Float CVar_cull_small_feature_size(
+      "culling.small_feature_size",
+      "Cull objects smaller than this many pixels on screen, 0 disables it",
+      0.f, CVarFlagBits::kEditFloatDrag);
+  AutoCVar_Int CVar_cull_subgroup_atomics(
+      "culling.subgroup_atomics",
+      "Add up counts of visible instances per subgroup before atomics, if "
+      "the device supports it",
+      1, CVarFlagBits::kEditCheckbox);
   AutoCVar_Float CVar_cull_dist("culling.distance",
                                 "Cull objects further than this", 1000.f,
                                 CVarFlagBits::kEditFloatDrag);
 
+  AutoCVar_Int CVar_retain_mesh_geometry(
+      "scene.retain_mesh_geometry",
+      "Keep CPU copies of mesh triangles for ray queries, applied to meshes "
+      "loaded later",
+      1, CVarFlagBits::kEditCheckbox);
+
+  AutoCVar_Int CVar_defrag_enable("defrag.enable",
+                                  "Defragment device memory when fragmented",
+                                  1, CVarFlagBits::kEditCheckbox);
+  AutoCVar_Float CVar_defrag_threshold(
+      "defrag.threshold", "Fragmentation that starts defragmentation", 0.3f,
+      CVarFlagBits::kEditFloatDrag);
+  AutoCVar_Int CVar_defrag_pass_size(
+      "defrag.pass_size_kb", "Max kilobytes moved by defragmentation per frame",
+      8192, CVarFlagBits::kAdvanced);
+
+  AutoCVar_Int CVar_residency_enable("residency.enable",
+                                     "Evict unused resources when over budget",
+                                     1, CVarFlagBits::kEditCheckbox);
+  AutoCVar_Float CVar_residency_budget(
+      "residency.budget_fraction",
+      "Fraction of device local budget to keep usage under", 0.9f,
+      CVarFlagBits::kEditFloatDrag);
+  AutoCVar_Int CVar_residency_min_unused(
+      "residency.min_unused_frames",
+      "Frames a resource must stay unused to be evicted", 120,
+      CVarFlagBits::kAdvanced);
+  AutoCVar_Int CVar_residency_fallback_extent(
+      "residency.fallback_extent",
+      "Max size of mip kept for evicted textures", 64,
+      CVarFlagBits::kAdvanced);
+  AutoCVar_Int CVar_residency_reload_size(
+      "residency.reload_kb", "Max kilobytes of resources reloaded per frame",
+      16384, CVarFlagBits::kAdvanced);
+
+  AutoCVar_Int CVar_streaming_enable(
+      "streaming.enable", "Stream texture mips based on their screen size", 1,
+      CVarFlagBits::kEditCheckbox);
+  AutoCVar_Int CVar_streaming_initial_extent(
+      "streaming.initial_extent",
+      "Max size of mip uploaded when texture is loaded", 128,
+      CVarFlagBits::kAdvanced);
+  AutoCVar_Int CVar_streaming_upload_size(
+      "streaming.upload_kb", "Max kilobytes of mips uploaded per frame", 16384,
+      CVarFlagBits::kAdvanced);
+  AutoCVar_Int CVar_streaming_swap_interval(
+      "streaming.swap_interval",
+      "Frames between texture swaps", 8,
+      CVarFlagBits::kAdvanced);
+  AutoCVar_Int CVar_streaming_drop_delay(
+      "streaming.drop_delay_frames",
+      "Frames mips must stay unneeded to be dropped", 600,
+      CVarFlagBits::kAdvanced);
+
+  AutoCVar_Int CVar_vt_atlas_pages(
+      "vt.atlas_pages",
+      "Pages per side of virtual texture atlas, applied on restart", 24,
+      CVarFlagBits::kAdvanced);
+  AutoCVar_Int CVar_vt_feedback_capacity(
+      "vt.feedback_capacity",
+      "Max pages of all virtual textures, applied on restart", 262144,
+      CVarFlagBits::kAdvanced);
+  AutoCVar_Int CVar_vt_page_loads(
+      "vt.page_loads", "Max virtual texture pages loaded per frame", 32,
+      CVarFlagBits::kAdvanced);
+
+  AutoCVar_String CVar_asset_path("assets.path", "Path to assets",
+                                  "asset_export", CVarFlagBits::kAdvanced);
+}
+
+void VulkanEngine::InitDeviceCVars() {
   const VkPhysicalDeviceProperties& props = physical_device_.GetProperties();
   AutoCVar_String CVar_device_type(
       "device_type", "Device type",
@@ -378,9 +630,10 @@ void VulkanEngine::InitCVars() {
       "limits.max_sample_count", "Max Sample Count",
       physical_device_.GetMaxSamples(),
       CVarFlagBits::kEditReadOnly | CVarFlagBits::kAdvanced);
-
-  AutoCVar_String CVar_asset_path("assets.path", "Path to assets",
-                                  "asset_export", CVarFlagBits::kAdvanced);
+  AutoCVar_Int CVar_subgroup_size(
+      "limits.subgroup_size", "Subgroup Size",
+      physical_device_.GetSubgroupProperties().subgroupSize,
+      CVarFlagBits::kEditReadOnly | CVarFlagBits::kAdvanced);
 }
 
 void VulkanEngine::InitRenderPasses(VkSampleCountFlagBits samples) {
@@ -463,6 +716,50 @@ void VulkanEngine::InitRenderPasses(VkSampleCountFlagBits samples) {
 
     main_deletion_queue_.PushFunction(
         std::bind(&Renderer::RenderPass::Destroy, forward_pass_));
+
+    // Compatible with the forward pass, so it shares framebuffer and
+    // pipelines. Resolve attachments are written again at its end
+    render_pass_builder.Clear();
+    color_attachment.SetOperations(VK_ATTACHMENT_LOAD_OP_LOAD,
+                                   VK_ATTACHMENT_STORE_OP_STORE)
+        .SetLayouts(VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                    VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+    bright_attachment.SetOperations(VK_ATTACHMENT_LOAD_OP_LOAD,
+                                    VK_ATTACHMENT_STORE_OP_STORE)
+        .SetLayouts(VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                    VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+    depth_attachment.SetOperations(VK_ATTACHMENT_LOAD_OP_LOAD,
+                                   VK_ATTACHMENT_STORE_OP_STORE)
+        .SetLayouts(VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+                    VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+
+    render_pass_builder.AddAttachment(color_attachment)
+        .AddAttachment(bright_attachment)
+        .AddAttachment(depth_attachment)
+        .AddAttachment(color_resolve_attachment)
+        .AddAttachment(bright_resolve_attachment)
+        .AddAttachment(depth_resolve_attachment);
+    render_pass_builder.AddSubpass(subpass);
+    render_pass_builder
+        .AddDependency(VK_SUBPASS_EXTERNAL, 0,
+                       VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                       VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+                       VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                       VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+                           VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT)
+        .AddDependency(VK_SUBPASS_EXTERNAL, 0,
+                       VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                           VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                       VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+                       VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT |
+                           VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+                       VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+                           VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT);
+
+    forward_late_pass_ = render_pass_builder.Build();
+
+    main_deletion_queue_.PushFunction(
+        std::bind(&Renderer::RenderPass::Destroy, forward_late_pass_));
   }
   render_pass_builder.Clear();
   {
@@ -633,6 +930,23 @@ void VulkanEngine::InitPipelines() {
 
   LoadComputeShader("Shaders/indirect_compute.comp.spv", cull_pipeline_,
                     cull_layout_);
+  const VkPhysicalDeviceSubgroupProperties& subgroup_properties =
+      physical_device_.GetSubgroupProperties();
+  VkSubgroupFeatureFlags cull_subgroup_features =
+      VK_SUBGROUP_FEATURE_BASIC_BIT | VK_SUBGROUP_FEATURE_BALLOT_BIT;
+  if ((subgroup_properties.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT) &&
+      (subgroup_properties.supportedOperations & cull_subgroup_features) ==
+          cull_subgroup_features) {
+    LoadComputeShader("Shaders/indirect_compute_subgroup.comp.spv",
+                      cull_subgroup_pipeline_, cull_subgroup_layout_);
+  } else {
+    LOG_WARNING("No subgroup ballot in compute shaders, culling uses plain "
+                "atomics");
+  }
+  LoadComputeShader("Shaders/indirect_compact.comp.spv",
+                    compact_draws_pipeline_, compact_draws_layout_);
+  LoadComputeShader("Shaders/instance_group_cull.comp.spv",
+                    group_cull_pipeline_, group_cull_layout_);
   LoadComputeShader("Shaders/depth_reduce.comp.spv", depth_reduce_pipeline_,
                     depth_reduce_layout_);
   LoadComputeShader("Shaders/sparse_upload.comp.spv", sparse_upload_pipeline_,
@@ -819,10 +1133,91 @@ bool VulkanEngine::LoadComputeShader(const char* path, VkPipeline& pipeline,
   return true;
 }
 
+bool VulkanEngine::DecodeMesh(const std::string& path, DecodedMesh& decoded) {
+  Assets::AssetFile file;
+  if (!Assets::LoadBinaryFile(path.c_str(), file)) return false;
+
+  return Renderer::Mesh::Decode(file, decoded.data);
+}
+
+bool VulkanEngine::DecodeTexture(const std::string& path,
+                                 uint32_t initial_extent,
+                                 DecodedTexture& decoded) {
+  if (!Assets::LoadBinaryFile(path.c_str(), decoded.file)) return false;
+
+  // Only the tail of the mip chain is uploaded right away, the rest gets
+  // streamed in once something on screen needs it
+  Assets::TextureInfo info = Assets::ReadTextureInfo(decoded.file);
+  uint32_t first_mip =
+      Renderer::TextureStreamer::GetFirstMipUnder(info, initial_extent);
+
+  return Renderer::Texture::Decode(decoded.file, first_mip, decoded.data);
+}
+
+bool VulkanEngine::ScanPrefab(
+    const std::string& asset_root, const std::string& path,
+    Assets::PrefabInfo& prefab_info,
+    std::vector<std::pair<std::string, std::string>>& meshes,
+    std::vector<std::pair<std::string, std::string>>& textures) {
+  Assets::AssetFile file;
+  if (!Assets::LoadBinaryFile(path.c_str(), file)) return false;
+  prefab_info = Assets::ReadPrefabInfo(&file);
+
+  std::unordered_set<std::string> names;
+  for (const auto& [name, asset_path] : meshes) names.insert(name);
+  for (const auto& [name, asset_path] : textures) names.insert(name);
+
+  std::unordered_set<std::string> materials;
+  for (const auto& [key, value] : prefab_info.node_meshes) {
+    if (names.insert(value.mesh_path).second)
+      meshes.push_back({value.mesh_path, asset_root + '/' + value.mesh_path});
+
+    if (!materials.insert(value.material_path).second) continue;
+
+    // Failures are left to LoadPrefab to report
+    Assets::AssetFile material_file;
+    std::string material_path = asset_root + '/' + value.material_path;
+    if (!Assets::LoadBinaryFile(material_path.c_str(), material_file))
+      continue;
+
+    Assets::MaterialInfo material_info =
+        Assets::ReadMaterialInfo(&material_file);
+    // Virtual textures are never decoded as a whole
+    if (material_info.base_effect == "texturedPBR_virtual") continue;
+    for (const auto& [texture_key, texture] : material_info.textures) {
+      if (names.insert(texture).second)
+        textures.push_back({texture, asset_root + '/' + texture});
+    }
+  }
+
+  return true;
+}
+
+uint32_t VulkanEngine::GetInitialTextureExtent() {
+  if (!*CVarSystem::Get()->GetIntCVar("streaming.enable")) return UINT32_MAX;
+  return static_cast<uint32_t>(
+      *CVarSystem::Get()->GetIntCVar("streaming.initial_extent"));
+}
+
 bool VulkanEngine::LoadMesh(Renderer::CommandBuffer command_buffer,
                             const char* name, const char* path) {
+  if (meshes_.find(name) != meshes_.end()) return true;
+
+  DecodedMesh decoded;
+  auto decoded_iter = decoded_meshes_.find(name);
+  if (decoded_iter != decoded_meshes_.end()) {
+    decoded = std::move(decoded_iter->second);
+    decoded_meshes_.erase(decoded_iter);
+  } else {
+    decoded.loaded = DecodeMesh(path, decoded);
+  }
+
   Renderer::Mesh mesh{};
-  bool loaded = mesh.LoadFromAsset(allocator_, command_buffer, path);
+  bool loaded = decoded.loaded;
+  bool retain_geometry =
+      *CVarSystem::Get()->GetIntCVar("scene.retain_mesh_geometry") != 0;
+  if (loaded)
+    mesh.Create(allocator_, command_buffer, decoded.data, retain_geometry);
   if (!loaded) {
     LOG_ERROR("Failed to load mesh '{}' from {}", name, path);
     return false;
@@ -830,7 +1225,15 @@ bool VulkanEngine::LoadMesh(Renderer::CommandBuffer command_buffer,
     LOG_SUCCESS("Loaded mesh '{}'", name);
   }
   meshes_[name] = mesh;
-  main_deletion_queue_.PushFunction(std::bind(&Renderer::Mesh::Destroy, mesh));
+  main_deletion_queue_.PushFunction(
+      [this, name = std::string(name)]() { meshes_[name].Destroy(); });
+
+  VkDeviceSize size =
+      mesh.GetVerticesCount() * sizeof(Renderer::Vertex) +
+      mesh.GetIndicesCount() * sizeof(uint32_t);
+  residency_.TrackMesh(name, path, &meshes_[name], size);
+  defragmenter_.Register(&meshes_[name].GetVertexBuffer().GetBuffer());
+  defragmenter_.Register(&meshes_[name].GetIndexBuffer().GetBuffer());
 
   return true;
 }
@@ -839,9 +1242,21 @@ bool VulkanEngine::LoadTexture(Renderer::CommandBuffer command_buffer,
                                const char* name, const char* path) {
   if (textures_.find(name) != textures_.end()) return true;
 
+  DecodedTexture decoded;
+  auto decoded_iter = decoded_textures_.find(name);
+  if (decoded_iter != decoded_textures_.end()) {
+    decoded = std::move(decoded_iter->second);
+    decoded_textures_.erase(decoded_iter);
+  } else {
+    decoded.loaded = DecodeTexture(path, GetInitialTextureExtent(), decoded);
+  }
+
   Renderer::Texture texture{};
-  bool loaded =
-      texture.LoadFromAsset(allocator_, &device_, command_buffer, path);
+  bool loaded = decoded.loaded;
+  if (loaded) {
+    loaded =
+        texture.Create(allocator_, &device_, command_buffer, decoded.data);
+  }
   if (!loaded) {
     LOG_ERROR("Failed to load texture '{}' from {}", name, path);
     return false;
@@ -850,7 +1265,26 @@ bool VulkanEngine::LoadTexture(Renderer::CommandBuffer command_buffer,
   }
   textures_[name] = texture;
   main_deletion_queue_.PushFunction(
-      std::bind(&Renderer::Texture::Destroy, texture));
+      [this, name = std::string(name)]() { textures_[name].Destroy(); });
+
+  if (texture.GetFirstMip() > 0) {
+    texture_streamer_.Track(name, std::move(decoded.file),
+                            decoded.data.info, texture.GetFirstMip(),
+                            texture.GetView());
+  }
+
+  residency_.TrackTexture(name, path, texture.GetView(),
+                          texture.GetMemorySize());
+  defragmenter_.Register(
+      &textures_[name].GetImageObject(),
+      VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+      [this](VkImageView old_view, VkImageView new_view) {
+    Renderer::MaterialSystem::ReplaceTexture(
+        old_view, {texture_sampler_.Get(), new_view},
+        frames_[frame_number_ % kMaxFramesInFlight].deletion_queue);
+    residency_.ReplaceTextureView(old_view, new_view);
+    texture_streamer_.ReplaceTextureView(old_view, new_view);
+  });
 
   return true;
 }
@@ -878,16 +1312,20 @@ bool VulkanEngine::LoadPrefab(Renderer::CommandBuffer command_buffer,
 
   std::unordered_map<uint64_t, glm::mat4> node_world_mats;
   std::vector<std::pair<uint64_t, glm::mat4>> pending_nodes;
+  // Parents before their children
+  std::vector<std::pair<uint64_t, glm::mat4>> node_order;
   for (auto& [key, value] : info->node_matrices) {
     glm::mat4 node_mat{1.f};
     const std::array<float, 16>& mat = info->matrices[value];
     memcpy(&node_mat, mat.data(), sizeof(glm::mat4));
 
     auto iter = info->node_parents.find(key);
-    if (iter == info->node_parents.end())
+    if (iter == info->node_parents.end()) {
       node_world_mats[key] = root * node_mat;
-    else
+      node_order.push_back({key, node_mat});
+    } else {
       pending_nodes.push_back({key, node_mat});
+    }
   }
 
   while (pending_nodes.size() > 0) {
@@ -899,6 +1337,7 @@ bool VulkanEngine::LoadPrefab(Renderer::CommandBuffer command_buffer,
       if (iter != node_world_mats.end()) {
         glm::mat4 node_mat = iter->second * pending_nodes[i].second;
         node_world_mats[node] = node_mat;
+        node_order.push_back(pending_nodes[i]);
 
         pending_nodes[i] = pending_nodes.back();
         pending_nodes.pop_back();
@@ -908,7 +1347,9 @@ bool VulkanEngine::LoadPrefab(Renderer::CommandBuffer command_buffer,
   }
 
   std::vector<Renderer::RenderObject> prefab_renderables;
+  std::vector<uint64_t> renderable_nodes;
   prefab_renderables.reserve(info->node_meshes.size());
+  renderable_nodes.reserve(info->node_meshes.size());
 
   for (auto& [key, value] : info->node_meshes) {
     if (!GetMesh(value.mesh_path)) {
@@ -938,6 +1379,15 @@ bool VulkanEngine::LoadPrefab(Renderer::CommandBuffer command_buffer,
       info.base_template = material_info.base_effect;
 
       for (const auto& [key, texture] : material_info.textures) {
+        // Pages of virtual textures are loaded on demand by the cache
+        if (material_info.base_effect == "texturedPBR_virtual") {
+          if (!virtual_textures_.Load(texture, AssetPath(texture)))
+            LOG_ERROR("Failed to load virtual texture '{}'", texture);
+          else
+            virtual_textures_.FillMaterial(texture, info);
+          continue;
+        }
+
         LoadTexture(command_buffer, texture.c_str(),
                     AssetPath(texture).c_str());
         Renderer::SampledTexture tex;
@@ -957,6 +1407,9 @@ bool VulkanEngine::LoadPrefab(Renderer::CommandBuffer command_buffer,
 
     object.draw_forward_pass = true;
     object.draw_shadow_pass = true;
+    // Prefabs are level geometry, they become dynamic once their root is
+    // moved
+    object.mobility = Renderer::Mobility::kStatic;
 
     glm::mat4 node_matrix{1.f};
 
@@ -970,16 +1423,54 @@ bool VulkanEngine::LoadPrefab(Renderer::CommandBuffer command_buffer,
     object.RefreshRenderBounds();
 
     prefab_renderables.push_back(object);
+    renderable_nodes.push_back(key);
   }
 
-  render_scene_.RegisterObjectBatch(
+  LoadedPrefab prefab;
+  prefab.objects = render_scene_.RegisterObjectBatch(
       prefab_renderables.data(),
       static_cast<uint32_t>(prefab_renderables.size()));
 
+  // Hierarchy is kept, so that moving the root moves the whole prefab
+  std::unordered_map<uint64_t, Renderer::Handle<Renderer::SceneObject>>
+      node_objects;
+  for (size_t i = 0; i < renderable_nodes.size(); ++i)
+    node_objects[renderable_nodes[i]] = prefab.objects[i];
+
+  prefab.path = path;
+  prefab.root_transform = root;
+  prefab.offset = glm::vec3(0.f);
+  prefab.root = render_scene_.hierarchy.Add({}, root);
+
+  std::unordered_map<uint64_t, Renderer::Handle<Renderer::TransformNode>>
+      nodes;
+  for (const auto& [key, local] : node_order) {
+    auto parent_iter = info->node_parents.find(key);
+    Renderer::Handle<Renderer::TransformNode> parent =
+        parent_iter == info->node_parents.end() ? prefab.root
+                                                : nodes[parent_iter->second];
+
+    Renderer::Handle<Renderer::SceneObject> object;
+    auto object_iter = node_objects.find(key);
+    if (object_iter != node_objects.end()) {
+      object = object_iter->second;
+      node_objects.erase(object_iter);
+    }
+
+    nodes[key] = render_scene_.hierarchy.Add(parent, local, object);
+    prefab.nodes.push_back(nodes[key]);
+  }
+  // Meshes of nodes without a matrix
+  for (const auto& [key, object] : node_objects)
+    prefab.nodes.push_back(
+        render_scene_.hierarchy.Add(prefab.root, glm::mat4{1.f}, object));
+
+  loaded_prefabs_.push_back(std::move(prefab));
+
   return true;
 }
 
-void VulkanEngine::InitScene(Renderer::CommandPool& init_pool) {
+void VulkanEngine::InitScene(Renderer::CommandBuffer command_buffer) {
   Renderer::DirectionalLight sunlight(
       glm::vec4(1.f), glm::vec3(0.f),
       *CVarSystem::Get()->GetVec3CVar("scene.sunlight_dir"),
@@ -992,9 +1483,6 @@ void VulkanEngine::InitScene(Renderer::CommandPool& init_pool) {
   point_light.SetSpecular(10.f);
   point_lights_.emplace_back(std::move(point_light));*/
 
-  Renderer::CommandBuffer command_buffer = init_pool.GetBuffer();
-  command_buffer.Begin();
-
   axes_buffer_.Create(allocator_, sizeof(Renderer::Vertex));
   axes_buffer_.SetData(
       command_buffer,
@@ -1003,8 +1491,7 @@ void VulkanEngine::InitScene(Renderer::CommandPool& init_pool) {
       std::bind(&Renderer::VertexBuffer::Destroy, axes_buffer_));
 
   LoadTexture(command_buffer, "white", AssetPath("default/white.tx").c_str());
-  skybox_texture_.LoadFromDirectory(allocator_, &device_, command_buffer,
-                                    AssetPath("skybox").c_str());
+  residency_.Pin("white");
 
   Renderer::MaterialData wireframe_info;
   wireframe_info.base_template = "default_wireframe";
@@ -1034,11 +1521,9 @@ void VulkanEngine::InitScene(Renderer::CommandPool& init_pool) {
   Renderer::MaterialSystem::BuildMaterial("skybox", skybox_info);
 
   LoadMesh(command_buffer, "cube", AssetPath("default/cube.mesh").c_str());
+  residency_.Pin("cube");
 
   LoadPrefab(command_buffer, AssetPath("Test.pfb").c_str());
-
-  command_buffer.End();
-  command_buffer.AddToBatch();
 }
 
 void VulkanEngine::InitImgui(Renderer::CommandPool& init_pool) {
@@ -1268,23 +1753,82 @@ void VulkanEngine::Draw() {
 
   VK_CHECK(vkResetFences(device_.Get(), 1, &frame.render_fence));
 
+  if (cull_readback_) ValidateCpuCulling();
+  ReportCullStats(frame);
+
+  // Last frame recorded in this slot is done, moves it made are retired
+  // before its deletion queue frees anything they still own
+  if (frame_number_ >= kMaxFramesInFlight)
+    defragmenter_.RetireMoves(frame_number_ - kMaxFramesInFlight);
   frame.deletion_queue.Flush();
   VK_CHECK(frame.command_pool.Reset());
   frame.dynamic_data.Reset();
   frame.dynamic_descriptor_allocator.ResetPools();
+  thread_pool_.ResetJobMemory();
 
   ImGui::Render();
 
   Renderer::CommandBuffer command_buffer = frame.command_pool.GetBuffer();
   VK_CHECK(command_buffer.Begin());
 
+  // Moves resources, so it has to run before anything is recorded
+  Defragment(command_buffer);
+
+  UpdateMeshReloadCheck(command_buffer);
   while (!prefabs_to_load_.empty()) {
     LoadPrefab(command_buffer, AssetPath(prefabs_to_load_.back()).c_str(),
                glm::mat4{1.f});
     prefabs_to_load_.pop_back();
-    render_scene_.BuildBatches();
   }
 
+  for (; prefabs_to_unload_ > 0 && !loaded_prefabs_.empty();
+       --prefabs_to_unload_) {
+    const LoadedPrefab& prefab = loaded_prefabs_.back();
+    // Children first
+    for (auto node = prefab.nodes.rbegin(); node != prefab.nodes.rend();
+         ++node)
+      render_scene_.hierarchy.Remove(*node);
+    render_scene_.hierarchy.Remove(prefab.root);
+    render_scene_.UnregisterObjectBatch(
+        prefab.objects.data(), static_cast<uint32_t>(prefab.objects.size()));
+    loaded_prefabs_.pop_back();
+  }
+  prefabs_to_unload_ = 0;
+
+  // Time spent in jobs since last frame, jobs run by waiting threads are
+  // reported apart from workers
+  std::vector<double> busy_times = thread_pool_.TakeBusyTimes();
+  uint32_t worker_count = thread_pool_.GetThreadCount();
+  double worker_busy_ms = 0.0;
+  for (uint32_t i = 0; i < worker_count; ++i) worker_busy_ms += busy_times[i];
+  if (worker_count > 0 && delta_time_ > 0.f) {
+    profiler_.stats["Worker utilization (%)"] = static_cast<int32_t>(
+        100.0 * worker_busy_ms / (delta_time_ * 1000.0 * worker_count));
+  }
+  profiler_.timings["Jobs on waiting threads"] = busy_times.back();
+
+  if (render_scene_.NeedsRefresh()) render_scene_.BuildBatches();
+
+  double hierarchy_start = glfwGetTime();
+  render_scene_.UpdateHierarchy();
+  profiler_.timings["Transform propagation"] =
+      (glfwGetTime() - hierarchy_start) * 1000.0;
+  profiler_.stats["Transform nodes updated"] =
+      render_scene_.hierarchy.GetUpdatedCount();
+
+  double bvh_start = glfwGetTime();
+  render_scene_.UpdateBvh();
+  profiler_.timings["BVH update"] = (glfwGetTime() - bvh_start) * 1000.0;
+  profiler_.stats["BVH objects"] =
+      static_cast<int32_t>(render_scene_.bvh.GetObjectCount());
+  profiler_.stats["Static objects"] = render_scene_.renderables.static_count;
+  profiler_.stats["Dynamic objects"] = render_scene_.renderables.GetSize() -
+                                       render_scene_.renderables.static_count;
+
+  UpdateResidency(command_buffer);
+  StreamTextures(command_buffer);
+  UpdateVirtualTextures(command_buffer, frame_index);
+
   profiler_.GrabQueries(command_buffer);
   {
     Renderer::VulkanScopeTimer timer(command_buffer, &profiler_, "Full Frame");
@@ -1321,32 +1865,100 @@ void VulkanEngine::Draw() {
     shadow_cull.frustum_cull = false;
     shadow_cull.occlusion_cull = false;
 
+    // CPU culling mirrors single phase culling only, so the frame it reads
+    // back falls back to it
+    bool two_phase = forward_cull.occlusion_cull &&
+                     *CVarSystem::Get()->GetIntCVar("culling.two_phase") &&
+                     !cull_readback_requested_ &&
+                     !render_scene_.forward_pass.indirect_batches.empty();
+    Renderer::OcclusionMode forward_occlusion =
+        !forward_cull.occlusion_cull ? Renderer::OcclusionMode::kNone
+        : two_phase                  ? Renderer::OcclusionMode::kEarly
+                                     : Renderer::OcclusionMode::kPyramid;
+    frame.two_phase_culled = two_phase;
+    frame.cull_stats_recorded = true;
+    vkCmdFillBuffer(command_buffer.Get(), frame.cull_stats_buffer.Get(), 0,
+                    VK_WHOLE_SIZE, 0);
+
+    VkMemoryBarrier stats_barrier{};
+    stats_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    stats_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    stats_barrier.dstAccessMask =
+        VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(command_buffer.Get(), VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                         &stats_barrier, 0, nullptr, 0, nullptr);
+
     {
       Renderer::VulkanScopeTimer timer2(command_buffer, &profiler_,
                                        "Culling");
 
-      ExecuteCull(command_buffer, render_scene_.forward_pass, forward_cull);
+      ExecuteCull(command_buffer, render_scene_.forward_pass, forward_cull,
+                  forward_occlusion);
       ExecuteCull(command_buffer, render_scene_.transparent_pass, forward_cull);
 
       ExecuteCull(command_buffer, render_scene_.directional_shadow_pass,
                   shadow_cull);
       ExecuteCull(command_buffer, render_scene_.point_shadow_pass,
                   shadow_cull);
-    
+
+      ExecuteGroupCull(command_buffer, render_scene_.forward_pass,
+                       forward_cull);
+      ExecuteGroupCull(command_buffer, render_scene_.transparent_pass,
+                       forward_cull);
+      ExecuteGroupCull(command_buffer, render_scene_.directional_shadow_pass,
+                       shadow_cull);
+      ExecuteGroupCull(command_buffer, render_scene_.point_shadow_pass,
+                       shadow_cull);
+
+      VkMemoryBarrier cull_barrier{};
+      cull_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+      cull_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+      cull_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+      vkCmdPipelineBarrier(command_buffer.Get(),
+                           VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                           VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1,
+                           &cull_barrier, 0, nullptr, 0, nullptr);
+
+      CompactDraws(command_buffer, render_scene_.forward_pass);
+      CompactDraws(command_buffer, render_scene_.transparent_pass);
+      CompactDraws(command_buffer, render_scene_.directional_shadow_pass);
+      CompactDraws(command_buffer, render_scene_.point_shadow_pass);
+
       vkCmdPipelineBarrier(command_buffer.Get(),
                            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
                            VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 0, nullptr,
                            static_cast<uint32_t>(post_cull_barriers_.size()),
                            post_cull_barriers_.data(), 0, nullptr);
+
+      if (cull_readback_requested_) {
+        RecordCullReadback(command_buffer, forward_cull);
+        cull_readback_requested_ = false;
+      }
     }
 
     DrawShadows(command_buffer);
 
-    DrawForward(command_buffer);
+    DrawForward(command_buffer, forward_occlusion);
+    if (two_phase) {
+      ReduceDepth(command_buffer);
+      ExecuteLateCull(command_buffer, forward_cull);
+      DrawForward(command_buffer, Renderer::OcclusionMode::kLate);
+    }
+    // Cull stats are read on the host once the frame fence is signaled
+    stats_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    stats_barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(command_buffer.Get(),
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &stats_barrier, 0,
+                         nullptr, 0, nullptr);
+    virtual_textures_.RecordFeedbackReadback(command_buffer, frame_index);
 
     PostProcessing(command_buffer);
 
-    if (forward_cull.occlusion_cull) ReduceDepth(command_buffer);
+    // Two phase culling reduced depth of early draws already, that is
+    // conservative enough for instance groups of the next frame
+    if (forward_cull.occlusion_cull && !two_phase) ReduceDepth(command_buffer);
 
     CopyRenderToSwapchain(command_buffer, image_index);
   }
@@ -1390,17 +2002,378 @@ void VulkanEngine::Draw() {
   frame_number_++;
 }
 
+void VulkanEngine::UpdateResidency(Renderer::CommandBuffer command_buffer) {
+  residency_.UpdateBudget();
+
+  if (*CVarSystem::Get()->GetIntCVar("residency.enable")) {
+    // Everything referenced by the draw lists counts as used this frame
+    for (Renderer::RenderScene::MeshPass* pass :
+         {&render_scene_.forward_pass, &render_scene_.transparent_pass,
+          &render_scene_.directional_shadow_pass,
+          &render_scene_.point_shadow_pass}) {
+      bool samples_textures =
+          pass->type == Renderer::MeshPassType::kForward ||
+          pass->type == Renderer::MeshPassType::kTransparency;
+
+      for (uint32_t group_index : pass->groups) {
+        const Renderer::InstanceGroup& group =
+            render_scene_.instance_groups[group_index];
+        Renderer::DrawMesh* draw_mesh = render_scene_.GetMesh(group.mesh_id);
+        if (!draw_mesh->is_merged)
+          residency_.TouchMesh(draw_mesh->mesh, frame_number_);
+
+        if (!samples_textures) continue;
+        for (const Renderer::SampledTexture& texture :
+             render_scene_.GetMaterial(group.material_id)->textures)
+          residency_.TouchTexture(texture.view, frame_number_);
+      }
+
+      for (const Renderer::RenderScene::IndirectBatch& batch :
+           pass->indirect_batches) {
+        Renderer::DrawMesh* draw_mesh = render_scene_.GetMesh(batch.mesh_id);
+        if (!draw_mesh->is_merged)
+          residency_.TouchMesh(draw_mesh->mesh, frame_number_);
+
+        if (!samples_textures || batch.objects.empty()) continue;
+
+        Renderer::RenderScene::PassObject* object =
+            pass->Get(batch.objects.front());
+        Renderer::Material* material =
+            render_scene_.GetMaterial(render_scene_.renderables.material_ids
+                                          [render_scene_.GetObjectIndex(
+                                              object->original)]);
+        for (const Renderer::SampledTexture& texture : material->textures)
+          residency_.TouchTexture(texture.view, frame_number_);
+      }
+    }
+
+    for (uint32_t id : residency_.GetReloadRequests(frame_number_)) {
+      Renderer::ResidentResource& resource = residency_.Get(id);
+      // Streaming brings back mips of its textures once they are needed
+      if (resource.type == Renderer::ResidentType::kTexture &&
+          texture_streamer_.IsTracked(resource.name)) {
+        Renderer::Texture& texture = textures_[resource.name];
+        residency_.MarkResident(id, texture.GetMemorySize(), texture.GetView());
+        continue;
+      }
+      residency_.RequestFileLoad(id);
+    }
+
+    Engine::DeletionQueue& deletion_queue =
+        frames_[frame_number_ % kMaxFramesInFlight].deletion_queue;
+    VkDeviceSize reload_size = static_cast<VkDeviceSize>(
+        *CVarSystem::Get()->GetIntCVar("residency.reload_kb")) * 1024;
+
+    bool meshes_reloaded = false;
+    for (auto& [id, file] : residency_.CollectLoadedFiles(reload_size)) {
+      Renderer::ResidentResource& resource = residency_.Get(id);
+      if (resource.type == Renderer::ResidentType::kMesh) {
+        Renderer::MeshData data;
+        if (file.binary_blob.empty() || !Renderer::Mesh::Decode(file, data)) {
+          LOG_ERROR("Failed to reload mesh '{}'", resource.name);
+          resource.pinned = true;
+          continue;
+        }
+        // Geometry retained on first load survives eviction
+        meshes_[resource.name].Create(allocator_, command_buffer, data);
+        residency_.MarkResident(id, resource.size);
+        meshes_reloaded = true;
+        continue;
+      }
+
+      Renderer::Texture texture{};
+      if (file.binary_blob.empty() ||
+          !texture.LoadFromAsset(allocator_, &device_, command_buffer, file)) {
+        LOG_ERROR("Failed to reload texture '{}'", resource.name);
+        resource.pinned = true;
+        continue;
+      }
+
+      // Frames in flight keep sampling the fallback until they finish
+      Renderer::Texture fallback = textures_[resource.name];
+      Renderer::MaterialSystem::ReplaceTexture(
+          fallback.GetView(), {texture_sampler_.Get(), texture.GetView()},
+          deletion_queue);
+      texture_streamer_.SetResident(resource.name, texture.GetFirstMip(),
+                                    fallback.GetView(), texture.GetView());
+      deletion_queue.PushFunction(
+          [fallback]() mutable { fallback.Destroy(); });
+
+      textures_[resource.name] = texture;
+      deletion_queue.PushFunction([this, name = resource.name]() {
+        textures_[name].ReleaseStagingMemory();
+      });
+      residency_.MarkResident(id, texture.GetMemorySize(), texture.GetView());
+    }
+
+    if (meshes_reloaded) {
+      VkMemoryBarrier barrier{};
+      barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+      barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+      barrier.dstAccessMask =
+          VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+      vkCmdPipelineBarrier(command_buffer.Get(), VK_PIPELINE_STAGE_TRANSFER_BIT,
+                           VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 1, &barrier,
+                           0, nullptr, 0, nullptr);
+    }
+
+    // Resources unused for longer than frames in flight are not referenced
+    // by any pending command buffer, so they can be dropped right away
+    uint64_t min_unused_frames = std::max<uint64_t>(
+        *CVarSystem::Get()->GetIntCVar("residency.min_unused_frames"),
+        kMaxFramesInFlight);
+    float budget_fraction =
+        *CVarSystem::Get()->GetFloatCVar("residency.budget_fraction");
+    uint32_t fallback_extent = static_cast<uint32_t>(
+        *CVarSystem::Get()->GetIntCVar("residency.fallback_extent"));
+
+    for (uint32_t id : residency_.GetEvictionCandidates(
+             frame_number_, min_unused_frames, budget_fraction)) {
+      Renderer::ResidentResource& resource = residency_.Get(id);
+      if (resource.type == Renderer::ResidentType::kMesh) {
+        Renderer::Mesh& mesh = meshes_[resource.name];
+        // Memory belongs to defragmentation pass until it is retired
+        if (defragmenter_.IsMoving(&mesh.GetVertexBuffer().GetBuffer()) ||
+            defragmenter_.IsMoving(&mesh.GetIndexBuffer().GetBuffer()))
+          continue;
+        mesh.Destroy();
+        residency_.MarkEvicted(id);
+        continue;
+      }
+
+      Renderer::Texture& texture = textures_[resource.name];
+      Renderer::Texture low_res{};
+      if (!texture.CreateLowResCopy(allocator_, &device_, command_buffer,
+                                    fallback_extent, low_res)) {
+        // Already as small as its fallback would be
+        resource.pinned = true;
+        continue;
+      }
+
+      Renderer::MaterialSystem::ReplaceTexture(
+          texture.GetView(), {texture_sampler_.Get(), low_res.GetView()},
+          deletion_queue);
+      texture_streamer_.SetResident(resource.name, low_res.GetFirstMip(),
+                                    texture.GetView(), low_res.GetView());
+      deletion_queue.PushFunction([texture]() mutable { texture.Destroy(); });
+
+      textures_[resource.name] = low_res;
+      residency_.MarkEvicted(id, low_res.GetView());
+      LOG_INFO("Evicted texture '{}'", resource.name);
+    }
+  }
+
+  constexpr VkDeviceSize kMegabyte = 1024 * 1024;
+  profiler_.stats["Memory budget MB"] =
+      static_cast<int32_t>(residency_.GetBudget() / kMegabyte);
+  profiler_.stats["Memory usage MB"] =
+      static_cast<int32_t>(residency_.GetUsage() / kMegabyte);
+  profiler_.stats["Resident resources"] = residency_.GetResidentCount();
+  profiler_.stats["Evicted resources"] = residency_.GetEvictedCount();
+  profiler_.stats["Evictions"] = residency_.GetEvictionsCount();
+  profiler_.stats["Reloads"] = residency_.GetReloadsCount();
+}
+
+void VulkanEngine::StreamTextures(Renderer::CommandBuffer command_buffer) {
+  if (*CVarSystem::Get()->GetIntCVar("streaming.enable") &&
+      texture_streamer_.GetTrackedCount() > 0) {
+    double start = glfwGetTime();
+
+    // Same bounding sphere projection as culling, the texture is assumed to
+    // be mapped once over the object
+    glm::mat4 view = camera_.GetViewMat();
+    glm::mat4 projection = camera_.GetProjMat();
+    float projection_scale =
+        std::abs(projection[1][1]) *
+        static_cast<float>(swapchain_.GetImageExtent().height);
+    float draw_dist = *CVarSystem::Get()->GetFloatCVar("culling.distance");
+
+    // Only objects in view request mips, the rest keep theirs until dropped
+    std::vector<Renderer::Handle<Renderer::SceneObject>> visible;
+    render_scene_.QueryFrustum(projection * view, visible);
+
+    texture_streamer_.BeginFrame();
+    const Renderer::SceneObjectStorage& objects = render_scene_.renderables;
+    for (Renderer::Handle<Renderer::SceneObject> object_id : visible) {
+      uint32_t i = objects.GetIndex(object_id);
+      const Renderer::RenderBounds& bounds = objects.bounds[i];
+      if (!bounds.valid) continue;
+
+      glm::vec3 center = view * glm::vec4(bounds.origin, 1.f);
+      float radius = bounds.radius;
+      if (center.z - radius > 0.f) continue;
+
+      float dist = glm::length(center) - radius;
+      if (dist > draw_dist) continue;
+
+      // Only objects passing the bounds test touch the other fields
+      const auto& pass_indices = objects.pass_indices[i];
+      if (!pass_indices[Renderer::MeshPassType::kForward].IsValid() &&
+          !pass_indices[Renderer::MeshPassType::kTransparency].IsValid())
+        continue;
+
+      float screen_extent = radius / std::max(dist, 0.1f) * projection_scale;
+
+      Renderer::Material* material =
+          render_scene_.GetMaterial(objects.material_ids[i]);
+      for (const Renderer::SampledTexture& texture : material->textures)
+        texture_streamer_.RequestExtent(texture.view, screen_extent);
+    }
+    texture_streamer_.RequestDecodes(frame_number_);
+
+    uint64_t swap_interval = std::max<uint64_t>(
+        *CVarSystem::Get()->GetIntCVar("streaming.swap_interval"), 1);
+    if (frame_number_ % swap_interval == 0) {
+      std::vector<Renderer::StreamedMips> streamed =
+          texture_streamer_.CollectDecodedMips(
+              static_cast<VkDeviceSize>(
+                  *CVarSystem::Get()->GetIntCVar("streaming.upload_kb")) *
+              1024);
+      std::vector<std::pair<uint32_t, uint32_t>> drops =
+          texture_streamer_.GetDropRequests(
+              frame_number_,
+              *CVarSystem::Get()->GetIntCVar("streaming.drop_delay_frames"));
+
+      // Frames in flight keep sampling replaced textures, they are retired
+      // with the frame
+      for (const Renderer::StreamedMips& mips : streamed) {
+        Renderer::StreamedTexture& info = texture_streamer_.Get(mips.id);
+        Renderer::Texture& texture = textures_[info.name];
+        // Resident mips changed while decoding
+        if (mips.end_mip != texture.GetFirstMip()) continue;
+
+        Renderer::Texture finer{};
+        if (!texture.StreamMips(allocator_, &device_, command_buffer,
+                                info.info, mips.first_mip, mips.pixels,
+                                finer)) {
+          LOG_ERROR("Failed to stream mips of texture '{}'", info.name);
+          continue;
+        }
+        SwapStreamedTexture(info.name, finer);
+      }
+
+      for (auto [id, mip] : drops) {
+        Renderer::StreamedTexture& info = texture_streamer_.Get(id);
+        Renderer::Texture coarser{};
+        if (!textures_[info.name].DropMips(allocator_, &device_,
+                                           command_buffer, mip, coarser))
+          continue;
+        SwapStreamedTexture(info.name, coarser);
+      }
+    }
+
+    profiler_.timings["Texture streaming (CPU)"] =
+        (glfwGetTime() - start) * 1000.0;
+  }
+
+  profiler_.stats["Streamed textures"] = texture_streamer_.GetTrackedCount();
+  profiler_.stats["Streamed textures at full res"] =
+      texture_streamer_.GetFullyResidentCount();
+  profiler_.stats["Pending mip decodes"] = texture_streamer_.GetPendingCount();
+  profiler_.stats["Streamed mips KB"] =
+      static_cast<int32_t>(texture_streamer_.GetStreamedBytes() / 1024);
+}
+
+void VulkanEngine::UpdateVirtualTextures(
+    Renderer::CommandBuffer command_buffer, uint32_t frame_index) {
+  if (virtual_textures_.GetTextureCount() > 0) {
+    double start = glfwGetTime();
+
+    virtual_textures_.Update(
+        command_buffer, frame_index, frame_number_,
+        static_cast<uint32_t>(*CVarSystem::Get()->GetIntCVar("vt.page_loads")));
+
+    profiler_.timings["Virtual texturing (CPU)"] =
+        (glfwGetTime() - start) * 1000.0;
+  }
+
+  profiler_.stats["Virtual textures"] =
+      static_cast<int32_t>(virtual_textures_.GetTextureCount());
+  profiler_.stats["VT resident pages"] =
+      virtual_textures_.GetResidentPageCount();
+  profiler_.stats["VT atlas slots"] = virtual_textures_.GetSlotCount();
+  profiler_.stats["VT pending pages"] =
+      static_cast<int32_t>(virtual_textures_.GetPendingCount());
+  profiler_.stats["VT requested pages"] =
+      virtual_textures_.GetRequestedCount();
+  profiler_.stats["VT uploaded pages"] = virtual_textures_.GetUploadedCount();
+}
+
+void VulkanEngine::SwapStreamedTexture(const std::string& name,
+                                       Renderer::Texture& texture) {
+  Engine::DeletionQueue& deletion_queue =
+      frames_[frame_number_ % kMaxFramesInFlight].deletion_queue;
+  Renderer::Texture old = textures_[name];
+  Renderer::MaterialSystem::ReplaceTexture(
+      old.GetView(), {texture_sampler_.Get(), texture.GetView()},
+      deletion_queue);
+  residency_.ReplaceTextureView(old.GetView(), texture.GetView());
+  texture_streamer_.SetResident(name, texture.GetFirstMip(), old.GetView(),
+                                texture.GetView());
+  textures_[name] = texture;
+
+  // Old texture is copy source of the current frame
+  deletion_queue.PushFunction(
+      [this, name, old, image = texture.GetImage()]() mutable {
+    old.Destroy();
+    // Texture swapped again in the meantime already owns its staging
+    Renderer::Texture& current = textures_[name];
+    if (current.GetImage() == image) current.ReleaseStagingMemory();
+  });
+}
+
+void VulkanEngine::Defragment(Renderer::CommandBuffer command_buffer) {
+  if (*CVarSystem::Get()->GetIntCVar("defrag.enable")) {
+    double start = glfwGetTime();
+    defragmenter_.Update(
+        command_buffer, frame_number_,
+        static_cast<VkDeviceSize>(
+            *CVarSystem::Get()->GetIntCVar("defrag.pass_size_kb")) *
+            1024,
+        *CVarSystem::Get()->GetFloatCVar("defrag.threshold"));
+    profiler_.timings["Defragmentation (CPU)"] =
+        (glfwGetTime() - start) * 1000.0;
+  }
+
+  profiler_.stats["Fragmentation %"] =
+      static_cast<int32_t>(defragmenter_.GetFragmentation() * 100.f);
+  profiler_.stats["Defrag moved KB"] =
+      static_cast<int32_t>(defragmenter_.GetBytesMoved() / 1024);
+  profiler_.stats["Defrag allocations moved"] =
+      defragmenter_.GetAllocationsMoved();
+  profiler_.stats["Defrag blocks freed"] = defragmenter_.GetBlocksFreed();
+}
+
 void VulkanEngine::ReadyMeshDraw(Renderer::CommandBuffer command_buffer) {
   const uint32_t frame_index = frame_number_ % kMaxFramesInFlight;
   FrameData& frame = frames_[frame_index];
 
-  if (render_scene_.dirty_objects.size() > 0) {
+  // Full reupload if too much changed
+  constexpr float kFullReuploadCoefficient = 0.8f;
+
+  // Object uploads of last frame have GPU timings by now
+  using UploadPath = Renderer::UploadCostModel::Path;
+  for (UploadPath path : {UploadPath::kFull, UploadPath::kSparse}) {
+    if (object_upload_costs_.IsPending(path)) {
+      object_upload_costs_.ResolveUpload(
+          path, profiler_.timings[path == UploadPath::kFull
+                                      ? kFullObjectUploadTimer
+                                      : kSparseObjectUploadTimer]);
+    }
+  }
+  const float full_upload_fraction =
+      object_upload_costs_.GetFullUploadFraction();
+  profiler_.stats["Full object upload above (%)"] =
+      static_cast<int32_t>(full_upload_fraction * 100.f);
 
-    // Realloc if not enough space
+  if (render_scene_.dirty_objects.size() > 0) {
+    // Realloc if not enough space, or if most of it is unused since objects
+    // were removed
     bool full_reupload = false;
     size_t copy_size =
-        render_scene_.renderables.size() * sizeof(Renderer::GPUObjectData);
-    if (copy_size > render_scene_.object_data_buffer.GetSize()) {
+        render_scene_.renderables.GetSize() * sizeof(Renderer::GPUObjectData);
+    if (copy_size > render_scene_.object_data_buffer.GetSize() ||
+        copy_size * 4 < render_scene_.object_data_buffer.GetSize()) {
       frame.deletion_queue.PushFunction(std::bind(
           &Renderer::Buffer<false>::Destroy, render_scene_.object_data_buffer));
       render_scene_.object_data_buffer.Create(
@@ -1410,257 +2383,298 @@ void VulkanEngine::ReadyMeshDraw(Renderer::CommandBuffer command_buffer) {
       full_reupload = true;
     }
 
-    // Full reupload if too much changed
-    constexpr float kFullReuploadCoefficient = 0.8f;
     full_reupload = full_reupload || render_scene_.dirty_objects.size() >=
-                                         render_scene_.renderables.size() *
-                                             kFullReuploadCoefficient;
+                                         render_scene_.renderables.GetSize() *
+                                             full_upload_fraction;
+    // Objects uploaded one by one, if any
+    const std::vector<Renderer::Handle<Renderer::SceneObject>>* scattered =
+        &render_scene_.dirty_objects;
+    std::vector<Renderer::Handle<Renderer::SceneObject>> static_dirty;
     if (full_reupload) {
+      Renderer::VulkanScopeTimer timer(command_buffer, &profiler_,
+                                       kFullObjectUploadTimer);
+      double fill_start = glfwGetTime();
       Renderer::Buffer<true> staging_buffer(
           allocator_, copy_size,
           VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
           VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
       Renderer::GPUObjectData* object_ssbo =
           staging_buffer.GetMappedMemory<Renderer::GPUObjectData>();
-      render_scene_.FillObjectData(object_ssbo);
+      render_scene_.FillObjectData(object_ssbo, 0,
+                                   render_scene_.renderables.GetSize());
+      object_upload_costs_.RecordUpload(
+          UploadPath::kFull, render_scene_.renderables.GetSize(),
+          (glfwGetTime() - fill_start) * 1000.0);
 
       frame.deletion_queue.PushFunction(
           std::bind(&Renderer::Buffer<true>::Destroy, staging_buffer));
 
       staging_buffer.CopyTo(command_buffer, render_scene_.object_data_buffer);
     } else {
-      uint64_t buffer_size =
-          sizeof(Renderer::GPUObjectData) * render_scene_.dirty_objects.size();
-      uint64_t word_size = sizeof(Renderer::GPUObjectData) / sizeof(uint32_t);
-      uint64_t upload_size =
-          render_scene_.dirty_objects.size() * word_size * sizeof(uint32_t);
-
-      Renderer::Buffer<true> new_buffer(
-          allocator_, buffer_size,
-          VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-          VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
-      Renderer::Buffer<true> target_buffer(
-          allocator_, upload_size,
-          VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-          VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
-      frame.deletion_queue.PushFunction(
-          std::bind(&Renderer::Buffer<true>::Destroy, new_buffer));
-      frame.deletion_queue.PushFunction(
-          std::bind(&Renderer::Buffer<true>::Destroy, target_buffer));
-
-      uint32_t* target_data = target_buffer.GetMappedMemory<uint32_t>();
-      Renderer::GPUObjectData* object_data =
-          new_buffer.GetMappedMemory<Renderer::GPUObjectData>();
-
-      uint32_t sidx = 0;
-      for (uint32_t i = 0; i < render_scene_.dirty_objects.size(); ++i) {
-        render_scene_.WriteObject(object_data + i,
-                                  render_scene_.dirty_objects[i]);
-        uint32_t dst_offset = static_cast<uint32_t>(
-            word_size * render_scene_.dirty_objects[i].handle);
-        for (uint32_t j = 0; j < word_size; ++j) {
-          target_data[sidx] = dst_offset + j;
-          ++sidx;
-        }
+      // Dynamic region gets the same treatment on its own, so that moving
+      // most dynamic objects does not scatter them, nor upload static ones
+      uint32_t static_count = render_scene_.renderables.static_count;
+      uint32_t dynamic_count =
+          render_scene_.renderables.GetSize() - static_count;
+      for (Renderer::Handle<Renderer::SceneObject> object :
+           render_scene_.dirty_objects) {
+        if (render_scene_.GetObjectIndex(object) < static_count)
+          static_dirty.push_back(object);
       }
-      uint32_t launch_count = sidx;
-
-      VkDescriptorBufferInfo index_data = target_buffer.GetDescriptorInfo();
-      VkDescriptorBufferInfo source_data = new_buffer.GetDescriptorInfo();
-      VkDescriptorBufferInfo target_info =
-          render_scene_.object_data_buffer.GetDescriptorInfo();
+      size_t dynamic_dirty =
+          render_scene_.dirty_objects.size() - static_dirty.size();
+
+      if (dynamic_dirty > 0 &&
+          dynamic_dirty >= dynamic_count * full_upload_fraction) {
+        Renderer::VulkanScopeTimer timer(command_buffer, &profiler_,
+                                         kFullObjectUploadTimer);
+        double fill_start = glfwGetTime();
+        Renderer::Buffer<true> staging_buffer(
+            allocator_, dynamic_count * sizeof(Renderer::GPUObjectData),
+            VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+            VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
+        render_scene_.FillObjectData(
+            staging_buffer.GetMappedMemory<Renderer::GPUObjectData>(),
+            static_count, dynamic_count);
+        object_upload_costs_.RecordUpload(
+            UploadPath::kFull, dynamic_count,
+            (glfwGetTime() - fill_start) * 1000.0);
 
-      VkDescriptorSet upload_set;
-      Renderer::DescriptorBuilder::Begin(&layout_cache_,
-                                         &frame.dynamic_descriptor_allocator)
-          .BindBuffer(0, &index_data, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-                      VK_SHADER_STAGE_COMPUTE_BIT)
-          .BindBuffer(1, &source_data, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-                      VK_SHADER_STAGE_COMPUTE_BIT)
-          .BindBuffer(2, &target_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
-                      VK_SHADER_STAGE_COMPUTE_BIT)
-          .Build(upload_set);
-
-      vkCmdBindPipeline(command_buffer.Get(), VK_PIPELINE_BIND_POINT_COMPUTE,
-                        sparse_upload_pipeline_);
-
-      vkCmdPushConstants(command_buffer.Get(), sparse_upload_layout_,
-                         VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t),
-                         &launch_count);
-      vkCmdBindDescriptorSets(
-          command_buffer.Get(), VK_PIPELINE_BIND_POINT_COMPUTE,
-          sparse_upload_layout_, 0, 1, &upload_set, 0, nullptr);
+        frame.deletion_queue.PushFunction(
+            std::bind(&Renderer::Buffer<true>::Destroy, staging_buffer));
 
-      vkCmdDispatch(command_buffer.Get(), launch_count / 256 + 1, 1, 1);
+        staging_buffer.CopyTo(command_buffer, render_scene_.object_data_buffer,
+                              static_count * sizeof(Renderer::GPUObjectData));
+        scattered = &static_dirty;
+      }
     }
 
+    if (!full_reupload && !scattered->empty())
+      ScatterObjectData(command_buffer, *scattered);
+
     Renderer::BufferMemoryBarrier barrier(
         render_scene_.object_data_buffer,
         device_.GetQueueFamilies().graphics_family.value());
-    barrier.SetSrcAccessMask(VK_ACCESS_TRANSFER_WRITE_BIT);
+    barrier.SetSrcAccessMask(VK_ACCESS_TRANSFER_WRITE_BIT |
+                             VK_ACCESS_SHADER_WRITE_BIT);
     barrier.SetDstAccessMask(VK_ACCESS_SHADER_WRITE_BIT |
                              VK_ACCESS_SHADER_READ_BIT);
 
     upload_barriers_.push_back(barrier.Get());
 
     render_scene_.ClearDirtyObjects();
+  }
 
-    Renderer::RenderScene::MeshPass* passes[4] = {
-        &render_scene_.forward_pass, &render_scene_.transparent_pass,
-        &render_scene_.directional_shadow_pass,
-        &render_scene_.point_shadow_pass};
-
-    for (size_t i = 0; i < 4; ++i) {
-      Renderer::RenderScene::MeshPass& pass = *passes[i];
-
-      uint32_t count_size = static_cast<uint32_t>(
-          pass.multibatches.size() * sizeof(uint32_t));
-      if (pass.count_buffer.GetSize() < count_size) {
-        frame.deletion_queue.PushFunction(std::bind(
-            &Renderer::Buffer<false>::Destroy, pass.count_buffer));
-        pass.count_buffer.Create(allocator_, count_size,
-                                 VK_BUFFER_USAGE_TRANSFER_DST_BIT |
-                                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
-                                     VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
-      }
+  Renderer::RenderScene::MeshPass* passes[4] = {
+      &render_scene_.forward_pass, &render_scene_.transparent_pass,
+      &render_scene_.directional_shadow_pass,
+      &render_scene_.point_shadow_pass};
 
-      uint32_t draw_indirect_size = static_cast<uint32_t>(
-          pass.indirect_batches.size() * sizeof(Renderer::GPUIndirectObject));
-      if (pass.draw_indirect_buffer.GetSize() < draw_indirect_size) {
-        frame.deletion_queue.PushFunction(std::bind(
-            &Renderer::Buffer<false>::Destroy, pass.draw_indirect_buffer));
-        pass.draw_indirect_buffer.Create(
-            allocator_, draw_indirect_size,
-            VK_BUFFER_USAGE_TRANSFER_DST_BIT |
-                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
-                VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
-      }
+  for (size_t i = 0; i < 4; ++i) {
+    Renderer::RenderScene::MeshPass& pass = *passes[i];
 
-      uint32_t compacted_instance_size =
-          static_cast<uint32_t>(pass.batches.size() * sizeof(uint32_t));
-      if (pass.compacted_instance_buffer.GetSize() < compacted_instance_size) {
-        frame.deletion_queue.PushFunction(std::bind(
-            &Renderer::Buffer<false>::Destroy, pass.compacted_instance_buffer));
-        pass.compacted_instance_buffer.Create(
-            allocator_, compacted_instance_size,
-            VK_BUFFER_USAGE_TRANSFER_DST_BIT |
-                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
-      }
+    uint32_t draw_indirect_size = static_cast<uint32_t>(
+        pass.indirect_batches.size() * sizeof(Renderer::GPUIndirectObject));
+    if (pass.draw_indirect_buffer.GetSize() < draw_indirect_size) {
+      frame.deletion_queue.PushFunction(std::bind(
+          &Renderer::Buffer<false>::Destroy, pass.draw_indirect_buffer));
+      pass.draw_indirect_buffer.Create(
+          allocator_, draw_indirect_size,
+          VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+              VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+              VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+    }
+    if (pass.compacted_draw_buffer.GetSize() < draw_indirect_size) {
+      frame.deletion_queue.PushFunction(std::bind(
+          &Renderer::Buffer<false>::Destroy, pass.compacted_draw_buffer));
+      pass.compacted_draw_buffer.Create(
+          allocator_, draw_indirect_size,
+          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+              VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+    }
 
-      uint32_t pass_objects_size = static_cast<uint32_t>(
-          pass.batches.size() * sizeof(Renderer::GPUInstance));
-      if (pass.pass_objects_buffer.GetSize() < pass_objects_size) {
-        frame.deletion_queue.PushFunction(std::bind(
-            &Renderer::Buffer<false>::Destroy, pass.pass_objects_buffer));
-        pass.pass_objects_buffer.Create(
-            allocator_, pass_objects_size,
-            VK_BUFFER_USAGE_TRANSFER_DST_BIT |
-                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
-      }
+    uint32_t draw_count_size =
+        static_cast<uint32_t>(pass.indirect_batches.size() * sizeof(uint32_t));
+    if (pass.draw_count_buffer.GetSize() < draw_count_size) {
+      frame.deletion_queue.PushFunction(std::bind(
+          &Renderer::Buffer<false>::Destroy, pass.draw_count_buffer));
+      pass.draw_count_buffer.Create(
+          allocator_, draw_count_size,
+          VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+              VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+              VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+    }
 
-      uint32_t multibatches_size = static_cast<uint32_t>(
-          pass.multibatches.size() * sizeof(Renderer::RenderScene::Multibatch));
-      if (pass.multibatches_buffer.GetSize() < multibatches_size) {
-        frame.deletion_queue.PushFunction(std::bind(
-            &Renderer::Buffer<false>::Destroy, pass.multibatches_buffer));
-        pass.multibatches_buffer.Create(allocator_, multibatches_size,
-                                        VK_BUFFER_USAGE_TRANSFER_DST_BIT |
-                                            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
-      }
+    uint32_t compacted_instance_size =
+        static_cast<uint32_t>(pass.instances.size() * sizeof(uint32_t));
+    if (pass.compacted_instance_buffer.GetSize() < compacted_instance_size) {
+      frame.deletion_queue.PushFunction(std::bind(
+          &Renderer::Buffer<false>::Destroy, pass.compacted_instance_buffer));
+      pass.compacted_instance_buffer.Create(
+          allocator_, compacted_instance_size,
+          VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+              VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
     }
 
-    std::vector<std::future<void>> async_calls;
-    async_calls.reserve(9);
-    
-    for (size_t i = 0; i < 4; ++i) {
-      Renderer::RenderScene::MeshPass* pass = passes[i];
-      Renderer::RenderScene* scene = &render_scene_;
+    uint32_t pass_objects_size = static_cast<uint32_t>(
+        pass.instances.size() * sizeof(Renderer::GPUInstance));
+    if (pass.pass_objects_buffer.GetSize() < pass_objects_size) {
+      frame.deletion_queue.PushFunction(std::bind(
+          &Renderer::Buffer<false>::Destroy, pass.pass_objects_buffer));
+      pass.pass_objects_buffer.Create(
+          allocator_, pass_objects_size,
+          VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+              VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+      // Contents of the old buffer are not carried over
+      pass.needs_instance_refresh = true;
+    }
+  }
 
-      if (pass->needs_indirect_refresh && pass->indirect_batches.size() > 0) {
-        if (pass->clear_indirect_buffer.Get() != VK_NULL_HANDLE) {
-          frame.deletion_queue.PushFunction(std::bind(
-              &Renderer::Buffer<true>::Destroy, pass->clear_indirect_buffer));
-        }
-        pass->clear_indirect_buffer.Create(
-            allocator_,
-            sizeof(Renderer::GPUIndirectObject) * pass->indirect_batches.size(),
-            VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
-                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
-                VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
-            VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
+  // Two phase culling runs for the forward pass only, it keeps visibility
+  // per object, so that it survives instances moving
+  Renderer::RenderScene::MeshPass& forward_pass = render_scene_.forward_pass;
+  uint32_t visibility_size = static_cast<uint32_t>(
+      render_scene_.renderables.GetSize() * sizeof(uint32_t));
+  if (forward_pass.visibility_buffer.GetSize() < visibility_size) {
+    frame.deletion_queue.PushFunction(std::bind(
+        &Renderer::Buffer<false>::Destroy, forward_pass.visibility_buffer));
+    forward_pass.visibility_buffer.Create(
+        allocator_, visibility_size,
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    // Nothing is known, so early phase draws everything in the frustum
+    vkCmdFillBuffer(command_buffer.Get(), forward_pass.visibility_buffer.Get(),
+                    0, VK_WHOLE_SIZE, 1);
 
-        Renderer::GPUIndirectObject* indirect =
-            pass->clear_indirect_buffer
-                .GetMappedMemory<Renderer::GPUIndirectObject>();
-        async_calls.push_back(std::async(std::launch::async, [=]() {
-          scene->FillIndirectArray(indirect, *pass);
-        }));
-
-        if (pass->clear_count_buffer.Get() != VK_NULL_HANDLE) {
-          frame.deletion_queue.PushFunction(std::bind(
-              &Renderer::Buffer<true>::Destroy, pass->clear_count_buffer));
-        }
-        pass->clear_count_buffer.Create(
-            allocator_,
-            sizeof(uint32_t) * pass->multibatches.size(),
-            VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
-                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
-                VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
-            VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
+    Renderer::BufferMemoryBarrier barrier(
+        forward_pass.visibility_buffer,
+        device_.GetQueueFamilies().graphics_family.value());
+    barrier.SetSrcAccessMask(VK_ACCESS_TRANSFER_WRITE_BIT);
+    barrier.SetDstAccessMask(VK_ACCESS_SHADER_READ_BIT |
+                             VK_ACCESS_SHADER_WRITE_BIT);
+    upload_barriers_.push_back(barrier.Get());
+  }
 
-        async_calls.push_back(std::async(
-            std::launch::async, [=]() { scene->ClearCountArray(*pass); }));
+  // Staging buffers are filled by workers while later passes are recorded
+  JobCounter fill_jobs;
+  int32_t uploaded_instances = 0;
 
-        if (pass->clear_multibatches_buffer.Get() != VK_NULL_HANDLE) {
-          frame.deletion_queue.PushFunction(std::bind(&Renderer::Buffer<true>::Destroy,
-                        pass->clear_multibatches_buffer));
-        }
-        pass->clear_multibatches_buffer.Create(
-            allocator_,
-            pass->multibatches.size() *
-                sizeof(Renderer::RenderScene::Multibatch),
-            VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
-                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-            VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
+  for (size_t i = 0; i < 4; ++i) {
+    Renderer::RenderScene::MeshPass* pass = passes[i];
+    Renderer::RenderScene* scene = &render_scene_;
 
-        Renderer::RenderScene::Multibatch* multibatch =
-            pass->clear_multibatches_buffer
-                .GetMappedMemory<Renderer::RenderScene::Multibatch>();
-        async_calls.push_back(std::async(std::launch::async, [=]() {
-          scene->FillMultibatchesArray(multibatch, *pass);
-        }));
+    if (pass->needs_indirect_refresh && pass->indirect_batches.size() > 0) {
+      if (pass->clear_indirect_buffer.Get() != VK_NULL_HANDLE) {
+        frame.deletion_queue.PushFunction(std::bind(
+            &Renderer::Buffer<true>::Destroy, pass->clear_indirect_buffer));
+      }
+      pass->clear_indirect_buffer.Create(
+          allocator_,
+          sizeof(Renderer::GPUIndirectObject) * pass->indirect_batches.size(),
+          VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+              VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+              VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+          VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
 
-        pass->needs_indirect_refresh = false;
+      if (pass->multibatch_buffer.Get() != VK_NULL_HANDLE) {
+        frame.deletion_queue.PushFunction(std::bind(
+            &Renderer::Buffer<true>::Destroy, pass->multibatch_buffer));
       }
+      pass->multibatch_buffer.Create(
+          allocator_, sizeof(uint32_t) * pass->indirect_batches.size(),
+          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+          VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
 
-      if (pass->needs_instance_refresh && pass->batches.size() > 0) {
-        Renderer::Buffer<true> instance_staging;
-        instance_staging.Create(
-            allocator_, sizeof(Renderer::GPUInstance) * pass->batches.size(),
-            VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
-                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-            VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
-        frame.deletion_queue.PushFunction(
-            std::bind(&Renderer::Buffer<true>::Destroy, instance_staging));
+      Renderer::GPUIndirectObject* indirect =
+          pass->clear_indirect_buffer
+              .GetMappedMemory<Renderer::GPUIndirectObject>();
+      uint32_t* multibatch_firsts =
+          pass->multibatch_buffer.GetMappedMemory<uint32_t>();
+      thread_pool_.Submit(
+          [=]() {
+            scene->FillIndirectArray(indirect, *pass);
+            scene->FillMultibatchArray(multibatch_firsts, *pass);
+          },
+          &fill_jobs);
+
+      pass->needs_indirect_refresh = false;
+    }
+
+    if (pass->instances.size() == 0) {
+      pass->dirty_instances.clear();
+      continue;
+    }
+
+    // Full reupload if too much changed
+    if (pass->dirty_instances.size() >=
+        pass->instances.size() * kFullReuploadCoefficient)
+      pass->needs_instance_refresh = true;
 
-        Renderer::GPUInstance* instance =
-            instance_staging.GetMappedMemory<Renderer::GPUInstance>();
+    Renderer::BufferMemoryBarrier instance_barrier(
+        pass->pass_objects_buffer,
+        device_.GetQueueFamilies().graphics_family.value());
+    instance_barrier.SetSrcAccessMask(VK_ACCESS_TRANSFER_WRITE_BIT);
+    instance_barrier.SetDstAccessMask(VK_ACCESS_SHADER_READ_BIT);
+
+    if (pass->needs_instance_refresh) {
+      Renderer::Buffer<true> instance_staging;
+      instance_staging.Create(
+          allocator_, sizeof(Renderer::GPUInstance) * pass->instances.size(),
+          VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+              VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+          VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
+      frame.deletion_queue.PushFunction(
+          std::bind(&Renderer::Buffer<true>::Destroy, instance_staging));
 
-        async_calls.push_back(std::async(std::launch::async, [=]() {
-          scene->FillInstanceArray(instance, *pass);
-        }));
+      Renderer::GPUInstance* instance =
+          instance_staging.GetMappedMemory<Renderer::GPUInstance>();
 
-        instance_staging.CopyTo(command_buffer, pass->pass_objects_buffer);
+      thread_pool_.Submit(
+          [=]() { scene->FillInstanceArray(instance, *pass); }, &fill_jobs);
 
-        upload_barriers_.push_back(barrier.Get());
+      instance_staging.CopyTo(command_buffer, pass->pass_objects_buffer);
 
-        pass->needs_instance_refresh = false;
+      upload_barriers_.push_back(instance_barrier.Get());
+      uploaded_instances += static_cast<int32_t>(pass->instances.size());
+
+      pass->needs_instance_refresh = false;
+    } else if (pass->dirty_instances.size() > 0) {
+      // Only instances that were added, moved or changed batch
+      Renderer::Buffer<true> instance_staging;
+      instance_staging.Create(
+          allocator_,
+          sizeof(Renderer::GPUInstance) * pass->dirty_instances.size(),
+          VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+          VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
+      frame.deletion_queue.PushFunction(
+          std::bind(&Renderer::Buffer<true>::Destroy, instance_staging));
+
+      std::vector<VkBufferCopy> regions = render_scene_.FillDirtyInstanceArray(
+          instance_staging.GetMappedMemory<Renderer::GPUInstance>(), *pass);
+      if (regions.size() > 0) {
+        vkCmdCopyBuffer(command_buffer.Get(), instance_staging.Get(),
+                        pass->pass_objects_buffer.Get(),
+                        static_cast<uint32_t>(regions.size()),
+                        regions.data());
+        upload_barriers_.push_back(instance_barrier.Get());
       }
+      for (const VkBufferCopy& region : regions)
+        uploaded_instances +=
+            static_cast<int32_t>(region.size / sizeof(Renderer::GPUInstance));
     }
+  }
 
-    for (auto& call : async_calls) call.get();
+  thread_pool_.Wait(fill_jobs);
 
-    vkCmdPipelineBarrier(command_buffer.Get(), VK_PIPELINE_STAGE_TRANSFER_BIT,
+  profiler_.stats["Uploaded instances"] = uploaded_instances;
+
+  ReadyInstanceGroups(command_buffer);
+
+  if (upload_barriers_.size() > 0) {
+    // Object data may also be written by the scatter pass
+    vkCmdPipelineBarrier(command_buffer.Get(),
+                         VK_PIPELINE_STAGE_TRANSFER_BIT |
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
                          VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr,
                          static_cast<uint32_t>(upload_barriers_.size()),
                          upload_barriers_.data(), 0, nullptr);
@@ -1668,18 +2682,244 @@ void VulkanEngine::ReadyMeshDraw(Renderer::CommandBuffer command_buffer) {
   }
 }
 
+void VulkanEngine::ScatterObjectData(
+    Renderer::CommandBuffer command_buffer,
+    const std::vector<Renderer::Handle<Renderer::SceneObject>>& objects) {
+  // Shorter runs are cheaper to scatter than to give a copy region
+  constexpr uint32_t kMinCopyRun = 8;
+  constexpr uint32_t kObjectSize = sizeof(Renderer::GPUObjectData);
+  const uint32_t frame_index = frame_number_ % kMaxFramesInFlight;
+  FrameData& frame = frames_[frame_index];
+
+  Renderer::VulkanScopeTimer timer(command_buffer, &profiler_,
+                                   kSparseObjectUploadTimer);
+  double fill_start = glfwGetTime();
+
+  // Sorted, so that objects adjacent in the buffer form runs
+  std::vector<uint32_t> indices(objects.size());
+  for (size_t i = 0; i < objects.size(); ++i)
+    indices[i] = render_scene_.GetObjectIndex(objects[i]);
+  std::sort(indices.begin(), indices.end());
+
+  std::vector<uint32_t> scatter_indices;
+  std::vector<VkBufferCopy> copy_regions;
+  for (size_t first = 0; first < indices.size();) {
+    size_t last = first + 1;
+    while (last < indices.size() && indices[last] == indices[last - 1] + 1)
+      ++last;
+
+    uint32_t run = static_cast<uint32_t>(last - first);
+    if (run >= kMinCopyRun) {
+      VkBufferCopy region{};
+      region.dstOffset = VkDeviceSize(indices[first]) * kObjectSize;
+      region.size = VkDeviceSize(run) * kObjectSize;
+      copy_regions.push_back(region);
+    } else {
+      scatter_indices.insert(scatter_indices.end(), indices.begin() + first,
+                             indices.begin() + last);
+    }
+    first = last;
+  }
+
+  // Scattered objects come first in staging, runs follow in order
+  Renderer::Buffer<true> staging_buffer(
+      allocator_, indices.size() * kObjectSize,
+      VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
+  frame.deletion_queue.PushFunction(
+      std::bind(&Renderer::Buffer<true>::Destroy, staging_buffer));
+  Renderer::GPUObjectData* object_data =
+      staging_buffer.GetMappedMemory<Renderer::GPUObjectData>();
+
+  for (uint32_t index : scatter_indices)
+    render_scene_.WriteObject(object_data++, index);
+  VkDeviceSize src_offset = scatter_indices.size() * kObjectSize;
+  for (VkBufferCopy& region : copy_regions) {
+    region.srcOffset = src_offset;
+    uint32_t first = static_cast<uint32_t>(region.dstOffset / kObjectSize);
+    uint32_t count = static_cast<uint32_t>(region.size / kObjectSize);
+    for (uint32_t i = 0; i < count; ++i)
+      render_scene_.WriteObject(object_data++, first + i);
+    src_offset += region.size;
+  }
+
+  if (!copy_regions.empty()) {
+    vkCmdCopyBuffer(command_buffer.Get(), staging_buffer.Get(),
+                    render_scene_.object_data_buffer.Get(),
+                    static_cast<uint32_t>(copy_regions.size()),
+                    copy_regions.data());
+  }
+
+  if (!scatter_indices.empty()) {
+    Renderer::Buffer<true> index_buffer(
+        allocator_, scatter_indices.size() * sizeof(uint32_t),
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
+    frame.deletion_queue.PushFunction(
+        std::bind(&Renderer::Buffer<true>::Destroy, index_buffer));
+    memcpy(index_buffer.GetMappedMemory<uint32_t>(), scatter_indices.data(),
+           scatter_indices.size() * sizeof(uint32_t));
+
+    VkDescriptorBufferInfo index_info = index_buffer.GetDescriptorInfo();
+    VkDescriptorBufferInfo source_info = staging_buffer.GetDescriptorInfo();
+    VkDescriptorBufferInfo target_info =
+        render_scene_.object_data_buffer.GetDescriptorInfo();
+
+    VkDescriptorSet upload_set;
+    Renderer::DescriptorBuilder::Begin(&layout_cache_,
+                                       &frame.dynamic_descriptor_allocator)
+        .BindBuffer(0, &index_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                    VK_SHADER_STAGE_COMPUTE_BIT)
+        .BindBuffer(1, &source_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                    VK_SHADER_STAGE_COMPUTE_BIT)
+        .BindBuffer(2, &target_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                    VK_SHADER_STAGE_COMPUTE_BIT)
+        .Build(upload_set);
+
+    // One lane per vec4 of every object
+    uint32_t constants[2] = {static_cast<uint32_t>(scatter_indices.size()),
+                             kObjectSize / sizeof(glm::vec4)};
+    uint32_t launch_count = constants[0] * constants[1];
+
+    vkCmdBindPipeline(command_buffer.Get(), VK_PIPELINE_BIND_POINT_COMPUTE,
+                      sparse_upload_pipeline_);
+    vkCmdPushConstants(command_buffer.Get(), sparse_upload_layout_,
+                       VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(constants),
+                       constants);
+    vkCmdBindDescriptorSets(command_buffer.Get(),
+                            VK_PIPELINE_BIND_POINT_COMPUTE,
+                            sparse_upload_layout_, 0, 1, &upload_set, 0,
+                            nullptr);
+    vkCmdDispatch(command_buffer.Get(), launch_count / 256 + 1, 1, 1);
+  }
+
+  object_upload_costs_.RecordUpload(
+      Renderer::UploadCostModel::Path::kSparse,
+      static_cast<uint32_t>(indices.size()),
+      (glfwGetTime() - fill_start) * 1000.0);
+  profiler_.stats["Objects copied"] =
+      static_cast<int32_t>(indices.size() - scatter_indices.size());
+  profiler_.stats["Objects scattered"] =
+      static_cast<int32_t>(scatter_indices.size());
+}
+
+void VulkanEngine::ReadyInstanceGroups(Renderer::CommandBuffer command_buffer) {
+  profiler_.stats["Group instances"] = render_scene_.GetGroupInstanceCount();
+
+  // Groups without instances are never culled nor drawn, so old buffers can
+  // wait for the next upload
+  uint32_t instance_count = render_scene_.GetGroupInstanceCount();
+  if (!render_scene_.needs_group_upload || instance_count == 0) return;
+  render_scene_.needs_group_upload = false;
+
+  const uint32_t frame_index = frame_number_ % kMaxFramesInFlight;
+  FrameData& frame = frames_[frame_index];
+
+  uint32_t group_count =
+      static_cast<uint32_t>(render_scene_.instance_groups.size());
+  size_t instances_size = instance_count * sizeof(Renderer::GPUGroupInstance);
+  size_t groups_size = group_count * sizeof(Renderer::GPUInstanceGroup);
+
+  // Groups are packed again as a whole, so their buffers are replaced
+  frame.deletion_queue.PushFunction(std::bind(
+      &Renderer::Buffer<false>::Destroy, render_scene_.group_instance_buffer));
+  render_scene_.group_instance_buffer.Create(
+      allocator_, instances_size,
+      VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+  frame.deletion_queue.PushFunction(std::bind(
+      &Renderer::Buffer<false>::Destroy, render_scene_.group_buffer));
+  render_scene_.group_buffer.Create(
+      allocator_, groups_size,
+      VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+
+  Renderer::Buffer<true> instance_staging(
+      allocator_, instances_size,
+      VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+      VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
+  render_scene_.FillGroupInstanceArray(
+      instance_staging.GetMappedMemory<Renderer::GPUGroupInstance>());
+  instance_staging.CopyTo(command_buffer, render_scene_.group_instance_buffer);
+  frame.deletion_queue.PushFunction(
+      std::bind(&Renderer::Buffer<true>::Destroy, instance_staging));
+
+  Renderer::Buffer<true> group_staging(
+      allocator_, groups_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+      VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
+  render_scene_.FillGroupArray(
+      group_staging.GetMappedMemory<Renderer::GPUInstanceGroup>());
+  group_staging.CopyTo(command_buffer, render_scene_.group_buffer);
+  frame.deletion_queue.PushFunction(
+      std::bind(&Renderer::Buffer<true>::Destroy, group_staging));
+
+  Renderer::BufferMemoryBarrier barrier(
+      render_scene_.group_instance_buffer,
+      device_.GetQueueFamilies().graphics_family.value());
+  barrier.SetSrcAccessMask(VK_ACCESS_TRANSFER_WRITE_BIT);
+  barrier.SetDstAccessMask(VK_ACCESS_SHADER_READ_BIT);
+  upload_barriers_.push_back(barrier.Get());
+  barrier.SetBuffer(render_scene_.group_buffer);
+  upload_barriers_.push_back(barrier.Get());
+
+  for (Renderer::RenderScene::MeshPass* pass :
+       {&render_scene_.forward_pass, &render_scene_.transparent_pass,
+        &render_scene_.directional_shadow_pass,
+        &render_scene_.point_shadow_pass}) {
+    if (pass->groups.empty()) continue;
+
+    if (pass->clear_group_draw_buffer.Get() != VK_NULL_HANDLE) {
+      frame.deletion_queue.PushFunction(std::bind(
+          &Renderer::Buffer<true>::Destroy, pass->clear_group_draw_buffer));
+    }
+    size_t draws_size = pass->groups.size() * sizeof(Renderer::GPUIndirectObject);
+    pass->clear_group_draw_buffer.Create(
+        allocator_, draws_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
+    render_scene_.FillGroupIndirectArray(
+        pass->clear_group_draw_buffer
+            .GetMappedMemory<Renderer::GPUIndirectObject>(),
+        *pass);
+
+    if (pass->group_draw_buffer.GetSize() < draws_size) {
+      frame.deletion_queue.PushFunction(std::bind(
+          &Renderer::Buffer<false>::Destroy, pass->group_draw_buffer));
+      pass->group_draw_buffer.Create(allocator_, draws_size,
+                                     VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                                         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                         VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+    }
+
+    size_t visible_size = instance_count * sizeof(uint32_t);
+    if (pass->group_visible_buffer.GetSize() < visible_size) {
+      frame.deletion_queue.PushFunction(std::bind(
+          &Renderer::Buffer<false>::Destroy, pass->group_visible_buffer));
+      pass->group_visible_buffer.Create(allocator_, visible_size,
+                                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    }
+  }
+}
+
 void VulkanEngine::ReadyCullData(Renderer::CommandBuffer command_buffer,
                                  Renderer::RenderScene::MeshPass& pass) {
+  if (!pass.groups.empty()) {
+    pass.clear_group_draw_buffer.CopyTo(command_buffer,
+                                        pass.group_draw_buffer);
+
+    Renderer::BufferMemoryBarrier barrier(
+        pass.group_draw_buffer,
+        device_.GetQueueFamilies().graphics_family.value());
+    barrier.SetSrcAccessMask(VK_ACCESS_TRANSFER_WRITE_BIT);
+    barrier.SetDstAccessMask(VK_ACCESS_SHADER_WRITE_BIT |
+                             VK_ACCESS_SHADER_READ_BIT);
+    pre_cull_barriers_.push_back(barrier.Get());
+  }
+
   if (pass.clear_indirect_buffer.Get() == VK_NULL_HANDLE) return;
   const uint32_t frame_index = frame_number_ % kMaxFramesInFlight;
   FrameData& frame = frames_[frame_index];
 
   pass.clear_indirect_buffer.CopyTo(command_buffer, pass.draw_indirect_buffer);
-
-  pass.clear_count_buffer.CopyTo(command_buffer, pass.count_buffer);
-
-  pass.clear_multibatches_buffer.CopyTo(command_buffer,
-                                        pass.multibatches_buffer);
+  vkCmdFillBuffer(command_buffer.Get(), pass.draw_count_buffer.Get(), 0,
+                  VK_WHOLE_SIZE, 0);
 
   Renderer::BufferMemoryBarrier barrier(
       pass.draw_indirect_buffer,
@@ -1689,16 +2929,55 @@ void VulkanEngine::ReadyCullData(Renderer::CommandBuffer command_buffer,
                            VK_ACCESS_SHADER_READ_BIT);
   pre_cull_barriers_.push_back(barrier.Get());
 
-  barrier.SetBuffer(pass.count_buffer);
+  barrier.SetBuffer(pass.draw_count_buffer);
   pre_cull_barriers_.push_back(barrier.Get());
+}
 
-  barrier.SetBuffer(pass.multibatches_buffer);
-  pre_cull_barriers_.push_back(barrier.Get());
+Renderer::DrawCullData VulkanEngine::BuildCullData(
+    const Renderer::CullParams& params, uint32_t max_draw_count,
+    std::optional<Renderer::OcclusionMode> occlusion_mode) {
+  glm::mat4 projection = params.proj_mat;
+  glm::mat4 projection_t = glm::transpose(projection);
+
+  glm::vec4 frustum_x =
+      (projection_t[3] + projection_t[0]) /
+      glm::length(glm::vec3(projection_t[3] + projection_t[0]));
+  glm::vec4 frustum_y =
+      (projection_t[3] + projection_t[1]) /
+      glm::length(glm::vec3(projection_t[3] + projection_t[1]));
+
+  Renderer::DrawCullData cull_data{};
+  cull_data.view = params.view_mat;
+  cull_data.P00 = projection[0][0];
+  cull_data.P11 = projection[1][1];
+  cull_data.z_near = 0.1f;
+  cull_data.z_far = params.draw_dist;
+  cull_data.frustum[0] = frustum_x.x;
+  cull_data.frustum[1] = frustum_x.z;
+  cull_data.frustum[2] = frustum_y.y;
+  cull_data.frustum[3] = frustum_y.z;
+  cull_data.max_draw_count = max_draw_count;
+  cull_data.culling_enabled = params.frustum_cull;
+  cull_data.occlusion_mode = occlusion_mode.value_or(
+      params.occlusion_cull ? Renderer::OcclusionMode::kPyramid
+                            : Renderer::OcclusionMode::kNone);
+  if (params.frustum_cull) {
+    float min_size =
+        *CVarSystem::Get()->GetFloatCVar("culling.small_feature_size");
+    VkExtent2D extent = swapchain_.GetImageExtent();
+    cull_data.min_width = min_size / static_cast<float>(extent.width);
+    cull_data.min_height = min_size / static_cast<float>(extent.height);
+  }
+
+  cull_data.dist_cull = (params.draw_dist > 10000.f ? 0 : 1);
+  return cull_data;
 }
 
-void VulkanEngine::ExecuteCull(Renderer::CommandBuffer command_buffer,
-                               const Renderer::RenderScene::MeshPass& pass,
-                               const Renderer::CullParams& params) {
+void VulkanEngine::ExecuteCull(
+    Renderer::CommandBuffer command_buffer,
+    const Renderer::RenderScene::MeshPass& pass,
+    const Renderer::CullParams& params,
+    std::optional<Renderer::OcclusionMode> occlusion_mode) {
   if (pass.indirect_batches.size() == 0) return;
   const uint32_t frame_index = frame_number_ % kMaxFramesInFlight;
   FrameData& frame = frames_[frame_index];
@@ -1712,19 +2991,21 @@ void VulkanEngine::ExecuteCull(Renderer::CommandBuffer command_buffer,
   VkDescriptorBufferInfo instance_info =
       pass.pass_objects_buffer.GetDescriptorInfo();
 
-  VkDescriptorBufferInfo multibach_info =
-      pass.multibatches_buffer.GetDescriptorInfo();
-
   VkDescriptorBufferInfo final_info =
       pass.compacted_instance_buffer.GetDescriptorInfo();
 
-  VkDescriptorBufferInfo count_info = pass.count_buffer.GetDescriptorInfo();
-
   VkDescriptorImageInfo depth_pyramid;
   depth_pyramid.sampler = depth_sampler_.Get();
   depth_pyramid.imageView = depth_pyramid_.GetView();
   depth_pyramid.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
 
+  // Only read and written by two phase culling, which only the forward pass
+  // does, other passes just need a valid binding
+  VkDescriptorBufferInfo visibility_info =
+      render_scene_.forward_pass.visibility_buffer.GetDescriptorInfo();
+  VkDescriptorBufferInfo stats_info =
+      frame.cull_stats_buffer.GetDescriptorInfo();
+
   VkDescriptorSet compute_set;
   Renderer::DescriptorBuilder::Begin(&layout_cache_,
                                      &frame.dynamic_descriptor_allocator)
@@ -1738,63 +3019,246 @@ void VulkanEngine::ExecuteCull(Renderer::CommandBuffer command_buffer,
                   VK_SHADER_STAGE_COMPUTE_BIT)
       .BindImage(4, &depth_pyramid, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
                  VK_SHADER_STAGE_COMPUTE_BIT)
-      .BindBuffer(5, &count_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .BindBuffer(5, &visibility_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
                   VK_SHADER_STAGE_COMPUTE_BIT)
-      .BindBuffer(6, &multibach_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .BindBuffer(6, &stats_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
                   VK_SHADER_STAGE_COMPUTE_BIT)
       .Build(compute_set);
 
-  glm::mat4 projection = params.proj_mat;
-  glm::mat4 projection_t = glm::transpose(projection);
+  Renderer::DrawCullData cull_data = BuildCullData(
+      params, static_cast<uint32_t>(pass.instances.size()), occlusion_mode);
+  DispatchCull(command_buffer, compute_set, cull_data,
+               static_cast<uint32_t>(pass.instances.size()),
+               *CVarSystem::Get()->GetIntCVar("culling.subgroup_atomics"));
 
-  glm::vec4 frustum_x =
-      (projection_t[3] + projection_t[0]) /
-      glm::length(glm::vec3(projection_t[3] + projection_t[0]));
-  glm::vec4 frustum_y =
-      (projection_t[3] + projection_t[1]) /
-      glm::length(glm::vec3(projection_t[3] + projection_t[1]));
+  Renderer::BufferMemoryBarrier barrier(
+      render_scene_.object_data_buffer,
+      device_.GetQueueFamilies().graphics_family.value());
+  barrier.SetSrcAccessMask(VK_ACCESS_SHADER_WRITE_BIT);
+  barrier.SetDstAccessMask(VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+  post_cull_barriers_.push_back(barrier.Get());
 
-  Renderer::DrawCullData cull_data{};
-  cull_data.view = params.view_mat;
-  cull_data.P00 = projection[0][0];
-  cull_data.P11 = projection[1][1];
-  cull_data.z_near = 0.1f;
-  cull_data.z_far = params.draw_dist;
-  cull_data.frustum[0] = frustum_x.x;
-  cull_data.frustum[1] = frustum_x.z;
-  cull_data.frustum[2] = frustum_y.y;
-  cull_data.frustum[3] = frustum_y.z;
-  cull_data.max_draw_count = static_cast<uint32_t>(pass.batches.size());
-  cull_data.culling_enabled = params.frustum_cull;
-  cull_data.occlusion_enabled = params.occlusion_cull;
-  cull_data.pyramid_width = static_cast<float>(depth_pyramid_width_);
-  cull_data.pyramid_height = static_cast<float>(depth_pyramid_height_);
+  barrier.SetBuffer(pass.compacted_instance_buffer);
+  post_cull_barriers_.push_back(barrier.Get());
 
-  cull_data.dist_cull = (params.draw_dist > 10000.f ? 0 : 1);
+  barrier.SetBuffer(pass.draw_indirect_buffer);
+  post_cull_barriers_.push_back(barrier.Get());
+}
+
+void VulkanEngine::DispatchCull(Renderer::CommandBuffer command_buffer,
+                                VkDescriptorSet compute_set,
+                                const Renderer::DrawCullData& cull_data,
+                                uint32_t instance_count, bool subgroups) {
+  subgroups = subgroups && cull_subgroup_pipeline_ != VK_NULL_HANDLE;
+  VkPipeline pipeline = subgroups ? cull_subgroup_pipeline_ : cull_pipeline_;
+  VkPipelineLayout layout = subgroups ? cull_subgroup_layout_ : cull_layout_;
 
   vkCmdBindPipeline(command_buffer.Get(), VK_PIPELINE_BIND_POINT_COMPUTE,
-                    cull_pipeline_);
+                    pipeline);
 
-  vkCmdPushConstants(command_buffer.Get(), cull_layout_,
-                     VK_SHADER_STAGE_COMPUTE_BIT, 0,
-                     sizeof(Renderer::DrawCullData), &cull_data);
+  vkCmdPushConstants(command_buffer.Get(), layout, VK_SHADER_STAGE_COMPUTE_BIT,
+                     0, sizeof(Renderer::DrawCullData), &cull_data);
 
   vkCmdBindDescriptorSets(command_buffer.Get(), VK_PIPELINE_BIND_POINT_COMPUTE,
-                          cull_layout_, 0, 1, &compute_set, 0, nullptr);
-  vkCmdDispatch(command_buffer.Get(),
-                static_cast<uint32_t>(pass.batches.size() / 256 + 1), 1, 1);
+                          layout, 0, 1, &compute_set, 0, nullptr);
+  vkCmdDispatch(command_buffer.Get(), instance_count / 256 + 1, 1, 1);
+}
+
+void VulkanEngine::CompactDraws(Renderer::CommandBuffer command_buffer,
+                                const Renderer::RenderScene::MeshPass& pass) {
+  if (pass.indirect_batches.size() == 0) return;
+  const uint32_t frame_index = frame_number_ % kMaxFramesInFlight;
+  FrameData& frame = frames_[frame_index];
+
+  VkDescriptorBufferInfo draw_info =
+      pass.draw_indirect_buffer.GetDescriptorInfo();
+  VkDescriptorBufferInfo multibatch_info =
+      pass.multibatch_buffer.GetDescriptorInfo();
+  VkDescriptorBufferInfo compacted_info =
+      pass.compacted_draw_buffer.GetDescriptorInfo();
+  VkDescriptorBufferInfo count_info =
+      pass.draw_count_buffer.GetDescriptorInfo();
+
+  VkDescriptorSet compute_set;
+  Renderer::DescriptorBuilder::Begin(&layout_cache_,
+                                     &frame.dynamic_descriptor_allocator)
+      .BindBuffer(0, &draw_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                  VK_SHADER_STAGE_COMPUTE_BIT)
+      .BindBuffer(1, &multibatch_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                  VK_SHADER_STAGE_COMPUTE_BIT)
+      .BindBuffer(2, &compacted_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                  VK_SHADER_STAGE_COMPUTE_BIT)
+      .BindBuffer(3, &count_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                  VK_SHADER_STAGE_COMPUTE_BIT)
+      .Build(compute_set);
+
+  uint32_t batch_count = static_cast<uint32_t>(pass.indirect_batches.size());
+  vkCmdBindPipeline(command_buffer.Get(), VK_PIPELINE_BIND_POINT_COMPUTE,
+                    compact_draws_pipeline_);
+  vkCmdPushConstants(command_buffer.Get(), compact_draws_layout_,
+                     VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t),
+                     &batch_count);
+  vkCmdBindDescriptorSets(command_buffer.Get(), VK_PIPELINE_BIND_POINT_COMPUTE,
+                          compact_draws_layout_, 0, 1, &compute_set, 0,
+                          nullptr);
+  vkCmdDispatch(command_buffer.Get(), batch_count / 256 + 1, 1, 1);
 
   Renderer::BufferMemoryBarrier barrier(
-      render_scene_.object_data_buffer,
+      pass.compacted_draw_buffer,
       device_.GetQueueFamilies().graphics_family.value());
   barrier.SetSrcAccessMask(VK_ACCESS_SHADER_WRITE_BIT);
   barrier.SetDstAccessMask(VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
   post_cull_barriers_.push_back(barrier.Get());
 
-  barrier.SetBuffer(pass.compacted_instance_buffer);
+  barrier.SetBuffer(pass.draw_count_buffer);
+  post_cull_barriers_.push_back(barrier.Get());
+}
+
+void VulkanEngine::ExecuteLateCull(Renderer::CommandBuffer command_buffer,
+                                   const Renderer::CullParams& params) {
+  Renderer::RenderScene::MeshPass& pass = render_scene_.forward_pass;
+  Renderer::VulkanScopeTimer timer(command_buffer, &profiler_, "Late Culling");
+
+  // Early draws have to be done reading draws and ids before they are reset
+  // and filled again
+  vkCmdPipelineBarrier(command_buffer.Get(),
+                       VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+                           VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT |
+                           VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       0, 0, nullptr, 0, nullptr, 0, nullptr);
+
+  post_cull_barriers_.clear();
+  pass.clear_indirect_buffer.CopyTo(command_buffer, pass.draw_indirect_buffer);
+  vkCmdFillBuffer(command_buffer.Get(), pass.draw_count_buffer.Get(), 0,
+                  VK_WHOLE_SIZE, 0);
+
+  Renderer::BufferMemoryBarrier barrier(
+      pass.draw_indirect_buffer,
+      device_.GetQueueFamilies().graphics_family.value());
+  barrier.SetSrcAccessMask(VK_ACCESS_TRANSFER_WRITE_BIT);
+  barrier.SetDstAccessMask(VK_ACCESS_SHADER_WRITE_BIT |
+                           VK_ACCESS_SHADER_READ_BIT);
+  barrier.Use(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+              VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+  barrier.SetBuffer(pass.draw_count_buffer);
+  barrier.Use(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+              VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+  ExecuteCull(command_buffer, pass, params, Renderer::OcclusionMode::kLate);
+
+  barrier.SetBuffer(pass.draw_indirect_buffer);
+  barrier.SetSrcAccessMask(VK_ACCESS_SHADER_WRITE_BIT);
+  barrier.SetDstAccessMask(VK_ACCESS_SHADER_READ_BIT);
+  barrier.Use(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+              VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+  CompactDraws(command_buffer, pass);
+
+  // Visibility is read by early culling of the next frame
+  barrier.SetBuffer(pass.visibility_buffer);
+  barrier.SetSrcAccessMask(VK_ACCESS_SHADER_WRITE_BIT);
+  barrier.SetDstAccessMask(VK_ACCESS_SHADER_READ_BIT |
+                           VK_ACCESS_SHADER_WRITE_BIT);
+  post_cull_barriers_.push_back(barrier.Get());
+
+  vkCmdPipelineBarrier(command_buffer.Get(),
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT |
+                           VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       0, 0, nullptr,
+                       static_cast<uint32_t>(post_cull_barriers_.size()),
+                       post_cull_barriers_.data(), 0, nullptr);
+}
+
+void VulkanEngine::ReportCullStats(FrameData& frame) {
+  if (!frame.cull_stats_recorded) return;
+
+  // Summed over all mesh passes, shadow passes do not cull though
+  const Renderer::GPUCullStats& stats =
+      *frame.cull_stats_buffer.GetMappedMemory<Renderer::GPUCullStats>();
+  profiler_.stats["Culled by sphere"] =
+      static_cast<int32_t>(stats.sphere_rejected);
+  profiler_.stats["Culled by box"] = static_cast<int32_t>(stats.box_rejected);
+  profiler_.stats["Culled as small feature"] =
+      static_cast<int32_t>(stats.small_rejected);
+  profiler_.stats["Culled by occlusion"] =
+      static_cast<int32_t>(stats.occlusion_rejected);
+
+  if (!frame.two_phase_culled) return;
+  profiler_.stats["Early drawn instances"] =
+      static_cast<int32_t>(stats.early_instances);
+  // Drawn late, as they were occluded or out of view last frame. With last
+  // frame visibility alone these would have popped in a frame late
+  profiler_.stats["Visibility false negatives"] =
+      static_cast<int32_t>(stats.late_instances);
+}
+
+void VulkanEngine::ExecuteGroupCull(Renderer::CommandBuffer command_buffer,
+                                    const Renderer::RenderScene::MeshPass& pass,
+                                    const Renderer::CullParams& params) {
+  if (pass.groups.empty()) return;
+  const uint32_t frame_index = frame_number_ % kMaxFramesInFlight;
+  FrameData& frame = frames_[frame_index];
+
+  VkDescriptorBufferInfo instance_info =
+      render_scene_.group_instance_buffer.GetDescriptorInfo();
+  VkDescriptorBufferInfo group_info =
+      render_scene_.group_buffer.GetDescriptorInfo();
+  VkDescriptorBufferInfo draw_info = pass.group_draw_buffer.GetDescriptorInfo();
+  VkDescriptorBufferInfo visible_info =
+      pass.group_visible_buffer.GetDescriptorInfo();
+
+  VkDescriptorImageInfo depth_pyramid;
+  depth_pyramid.sampler = depth_sampler_.Get();
+  depth_pyramid.imageView = depth_pyramid_.GetView();
+  depth_pyramid.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+  VkDescriptorSet compute_set;
+  Renderer::DescriptorBuilder::Begin(&layout_cache_,
+                                     &frame.dynamic_descriptor_allocator)
+      .BindBuffer(0, &instance_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                  VK_SHADER_STAGE_COMPUTE_BIT)
+      .BindBuffer(1, &group_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                  VK_SHADER_STAGE_COMPUTE_BIT)
+      .BindBuffer(2, &draw_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                  VK_SHADER_STAGE_COMPUTE_BIT)
+      .BindBuffer(3, &visible_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                  VK_SHADER_STAGE_COMPUTE_BIT)
+      .BindImage(4, &depth_pyramid, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                 VK_SHADER_STAGE_COMPUTE_BIT)
+      .Build(compute_set);
+
+  vkCmdBindPipeline(command_buffer.Get(), VK_PIPELINE_BIND_POINT_COMPUTE,
+                    group_cull_pipeline_);
+  vkCmdBindDescriptorSets(command_buffer.Get(), VK_PIPELINE_BIND_POINT_COMPUTE,
+                          group_cull_layout_, 0, 1, &compute_set, 0, nullptr);
+
+  // Single dispatch per group, instances of a group are contiguous
+  for (uint32_t i = 0; i < pass.groups.size(); ++i) {
+    uint32_t group_index = pass.groups[i];
+    uint32_t instance_count = static_cast<uint32_t>(
+        render_scene_.instance_groups[group_index].instances.size());
+    if (instance_count == 0) continue;
+
+    Renderer::GroupCullData cull_data;
+    cull_data.cull_data = BuildCullData(params, instance_count);
+    cull_data.group_index = group_index;
+    cull_data.draw_index = i;
+
+    vkCmdPushConstants(command_buffer.Get(), group_cull_layout_,
+                       VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                       sizeof(Renderer::GroupCullData), &cull_data);
+    vkCmdDispatch(command_buffer.Get(), instance_count / 256 + 1, 1, 1);
+  }
+
+  Renderer::BufferMemoryBarrier barrier(
+      pass.group_draw_buffer,
+      device_.GetQueueFamilies().graphics_family.value());
+  barrier.SetSrcAccessMask(VK_ACCESS_SHADER_WRITE_BIT);
+  barrier.SetDstAccessMask(VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
   post_cull_barriers_.push_back(barrier.Get());
 
-  barrier.SetBuffer(pass.count_buffer);
+  barrier.SetBuffer(pass.group_visible_buffer);
   post_cull_barriers_.push_back(barrier.Get());
 }
 
@@ -1927,14 +3391,18 @@ void VulkanEngine::DrawShadows(Renderer::CommandBuffer command_buffer) {
 
 }
 
-void VulkanEngine::DrawForward(Renderer::CommandBuffer command_buffer) {
+void VulkanEngine::DrawForward(Renderer::CommandBuffer command_buffer,
+                               Renderer::OcclusionMode occlusion_mode) {
   const uint32_t frame_index = frame_number_ % kMaxFramesInFlight;
   FrameData& frame = frames_[frame_index];
   Renderer::RenderScene::MeshPass& pass = render_scene_.forward_pass;
+  bool late = occlusion_mode == Renderer::OcclusionMode::kLate;
 
-  Renderer::VulkanScopeTimer timer(command_buffer, &profiler_, "Forward Draw");
-  Renderer::VulkanPipelineStatRecorder stats(command_buffer, &profiler_,
-                                             "Total Primitives");
+  Renderer::VulkanScopeTimer timer(
+      command_buffer, &profiler_, late ? "Forward Late Draw" : "Forward Draw");
+  Renderer::VulkanPipelineStatRecorder stats(
+      command_buffer, &profiler_,
+      late ? "Late Primitives" : "Total Primitives");
 
   VkClearValue clear_value{};
   auto clear_color = CVarSystem::Get()->GetVec4CVar("scene.clear_color");
@@ -1948,7 +3416,8 @@ void VulkanEngine::DrawForward(Renderer::CommandBuffer command_buffer) {
                                               clear_value, depth_clear}};
   begin_info.framebuffer = forward_framebuffer_.Get();
   begin_info.render_area = {{0, 0}, swapchain_.GetImageExtent()};
-  forward_pass_.Begin(command_buffer, begin_info);
+  Renderer::RenderPass& render_pass = late ? forward_late_pass_ : forward_pass_;
+  render_pass.Begin(command_buffer, begin_info);
 
   VkExtent2D extent = swapchain_.GetImageExtent();
   VkViewport viewport{0.f, 0.f,
@@ -2024,20 +3493,28 @@ void VulkanEngine::DrawForward(Renderer::CommandBuffer command_buffer) {
   draw_params.global_set = frame.global_descriptor;
   draw_params.object_data_set = frame.object_descriptor;
 
-  ExecuteDraw(command_buffer, pass, draw_params);
+  ExecuteDraw(command_buffer, pass, draw_params, late);
 
-  DrawSkybox(command_buffer, scene_info, scene_data_offset);
+  // Covers whatever is left, so it goes after everything else
+  if (occlusion_mode != Renderer::OcclusionMode::kEarly)
+    DrawSkybox(command_buffer, scene_info, scene_data_offset);
 
-  forward_pass_.End(command_buffer);
+  render_pass.End(command_buffer);
 }
 
 void VulkanEngine::ExecuteDraw(Renderer::CommandBuffer command_buffer,
                                const Renderer::RenderScene::MeshPass& pass,
-                               const Renderer::DrawParams& draw_params) {
+                               const Renderer::DrawParams& draw_params,
+                               bool late) {
   const uint32_t frame_index = frame_number_ % kMaxFramesInFlight;
   FrameData& frame = frames_[frame_index];
 
-  if (pass.indirect_batches.size() == 0) return;
+  Renderer::DrawStats stats;
+  if (!late) ExecuteGroupDraw(command_buffer, pass, draw_params, stats);
+  if (pass.indirect_batches.size() == 0) {
+    ReportDrawStats(pass.type, stats, late);
+    return;
+  }
 
   Renderer::Mesh* last_mesh = nullptr;
   Renderer::Material* last_material = nullptr;
@@ -2050,15 +3527,24 @@ void VulkanEngine::ExecuteDraw(Renderer::CommandBuffer command_buffer,
   vkCmdBindIndexBuffer(command_buffer.Get(),
                         render_scene_.merged_index_buffer.Get(), 0,
                         VK_INDEX_TYPE_UINT32);
+  ++stats.vertex_index_binds;
 
   for (size_t i = 0; i < pass.multibatches.size(); ++i) {
     auto& multibatch = pass.multibatches[i];
     auto& instance = pass.indirect_batches[multibatch.first];
 
     Renderer::Pipeline new_pipeline = instance.material.shader_pass->pipeline;
-    VkDescriptorSet new_material_set = instance.material.material_set;
+    VkDescriptorSet new_material_set =
+        instance.material.material->pass_sets[pass.type];
 
     Renderer::Mesh* draw_mesh = render_scene_.GetMesh(instance.mesh_id)->mesh;
+    bool merged = render_scene_.GetMesh(instance.mesh_id)->is_merged;
+    // Evicted meshes are drawn again once their reload lands, meshes of a
+    // multibatch are merged unless it holds a single batch
+    if (!merged && !draw_mesh->IsResident()) {
+      ++stats.evicted_mesh_skips;
+      continue;
+    }
 
     if (new_pipeline.Get() != last_pipeline) {
       last_pipeline = new_pipeline.Get();
@@ -2072,6 +3558,8 @@ void VulkanEngine::ExecuteDraw(Renderer::CommandBuffer command_buffer,
                               VK_PIPELINE_BIND_POINT_GRAPHICS,
                               new_pipeline.GetLayout(), 1, 1,
                               &draw_params.object_data_set, 0, nullptr);
+      ++stats.pipeline_binds;
+      stats.descriptor_set_binds += 2;
     }
 
     if (new_material_set != last_material_set) {
@@ -2079,6 +3567,7 @@ void VulkanEngine::ExecuteDraw(Renderer::CommandBuffer command_buffer,
       vkCmdBindDescriptorSets(
           command_buffer.Get(), VK_PIPELINE_BIND_POINT_GRAPHICS,
           new_pipeline.GetLayout(), 2, 1, &new_material_set, 0, nullptr);
+      ++stats.descriptor_set_binds;
     }
 
     if (draw_params.push_constants.has_value()) {
@@ -2089,7 +3578,6 @@ void VulkanEngine::ExecuteDraw(Renderer::CommandBuffer command_buffer,
                          constants.data);
     }
 
-    bool merged = render_scene_.GetMesh(instance.mesh_id)->is_merged;
     if (merged) {
       if (last_mesh != nullptr) {
         VkDeviceSize offset = 0;
@@ -2099,6 +3587,7 @@ void VulkanEngine::ExecuteDraw(Renderer::CommandBuffer command_buffer,
         vkCmdBindIndexBuffer(command_buffer.Get(),
                               render_scene_.merged_index_buffer.Get(), 0,
                               VK_INDEX_TYPE_UINT32);
+        ++stats.vertex_index_binds;
         last_mesh = nullptr;
       }
     } else if (last_mesh != draw_mesh) {
@@ -2109,20 +3598,32 @@ void VulkanEngine::ExecuteDraw(Renderer::CommandBuffer command_buffer,
       vkCmdBindIndexBuffer(command_buffer.Get(),
                             draw_mesh->GetIndexBuffer().Get(), 0,
                             VK_INDEX_TYPE_UINT32);
+      ++stats.vertex_index_binds;
       last_mesh = draw_mesh;
     }
 
+    // Draws of batches with visible instances, packed by CompactDraws.
+    // Meshes of a multibatch either all have indices or none does
     bool has_indices = draw_mesh->GetIndicesCount() > 0;
-    if (!has_indices) {
-      vkCmdDraw(command_buffer.Get(), draw_mesh->GetVerticesCount(),
-                instance.count, 0, instance.first);
-    } else {
-      vkCmdDrawIndexedIndirectCount(
-          command_buffer.Get(), pass.draw_indirect_buffer.Get(),
-          multibatch.first * sizeof(Renderer::GPUIndirectObject),
-          pass.count_buffer.Get(), i * sizeof(uint32_t),
-          multibatch.count, sizeof(Renderer::GPUIndirectObject));
-    }
+    auto draw_multibatch = [&]() {
+      VkDeviceSize offset =
+          multibatch.first * sizeof(Renderer::GPUIndirectObject);
+      VkDeviceSize count_offset = multibatch.first * sizeof(uint32_t);
+      if (has_indices) {
+        vkCmdDrawIndexedIndirectCount(
+            command_buffer.Get(), pass.compacted_draw_buffer.Get(), offset,
+            pass.draw_count_buffer.Get(), count_offset, multibatch.count,
+            sizeof(Renderer::GPUIndirectObject));
+      } else {
+        vkCmdDrawIndirectCount(
+            command_buffer.Get(), pass.compacted_draw_buffer.Get(), offset,
+            pass.draw_count_buffer.Get(), count_offset, multibatch.count,
+            sizeof(Renderer::GPUIndirectObject));
+      }
+      ++stats.indirect_draws;
+      stats.indirect_commands += static_cast<int32_t>(multibatch.count);
+    };
+    draw_multibatch();
 
     bool show_normals = *CVarSystem::Get()->GetIntCVar("show_normals");
     if (show_normals && pass.type == Renderer::MeshPassType::kForward) {
@@ -2154,21 +3655,128 @@ void VulkanEngine::ExecuteDraw(Renderer::CommandBuffer command_buffer,
       vkCmdBindDescriptorSets(
           command_buffer.Get(), VK_PIPELINE_BIND_POINT_GRAPHICS,
           pipeline.GetLayout(), 1, 1, &draw_params.object_data_set, 0, nullptr);
+      ++stats.pipeline_binds;
+      stats.descriptor_set_binds += 2;
 
-      if (!has_indices) {
-        vkCmdDraw(command_buffer.Get(), draw_mesh->GetVerticesCount(),
-                  instance.count, 0, instance.first);
-      } else {
-        vkCmdDrawIndexedIndirectCount(
-            command_buffer.Get(), pass.draw_indirect_buffer.Get(),
-            multibatch.first * sizeof(Renderer::GPUIndirectObject),
-            pass.count_buffer.Get(), i * sizeof(uint32_t),
-            multibatch.count, sizeof(Renderer::GPUIndirectObject));
-      }
+      draw_multibatch();
+    }
+  }
+
+  ReportDrawStats(pass.type, stats, late);
+}
+
+void VulkanEngine::ExecuteGroupDraw(Renderer::CommandBuffer command_buffer,
+                                    const Renderer::RenderScene::MeshPass& pass,
+                                    const Renderer::DrawParams& draw_params,
+                                    Renderer::DrawStats& stats) {
+  if (pass.groups.empty()) return;
+  const uint32_t frame_index = frame_number_ % kMaxFramesInFlight;
+  FrameData& frame = frames_[frame_index];
+
+  VkDescriptorBufferInfo instance_info =
+      render_scene_.group_instance_buffer.GetDescriptorInfo();
+  VkDescriptorBufferInfo visible_info =
+      pass.group_visible_buffer.GetDescriptorInfo();
+  VkDescriptorSet group_set;
+  Renderer::DescriptorBuilder::Begin(&layout_cache_,
+                                     &frame.dynamic_descriptor_allocator)
+      .BindBuffer(0, &instance_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                  VK_SHADER_STAGE_VERTEX_BIT)
+      .BindBuffer(1, &visible_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                  VK_SHADER_STAGE_VERTEX_BIT)
+      .Build(group_set);
+
+  VkPipeline last_pipeline = nullptr;
+  VkDescriptorSet last_material_set = nullptr;
+  VkBuffer last_vertex_buffer = nullptr;
+
+  for (size_t i = 0; i < pass.groups.size(); ++i) {
+    const Renderer::InstanceGroup& group =
+        render_scene_.instance_groups[pass.groups[i]];
+    const Renderer::DrawMesh* draw_mesh = render_scene_.GetMesh(group.mesh_id);
+    if (!draw_mesh->is_merged && !draw_mesh->mesh->IsResident()) {
+      ++stats.evicted_mesh_skips;
+      continue;
     }
+
+    Renderer::Material* material =
+        render_scene_.GetMaterial(group.material_id);
+    Renderer::Pipeline pipeline =
+        material->original->group_pass_shaders[pass.type]->pipeline;
+    VkDescriptorSet material_set = material->pass_sets[pass.type];
+
+    if (pipeline.Get() != last_pipeline) {
+      last_pipeline = pipeline.Get();
+      pipeline.Bind(command_buffer);
+      vkCmdBindDescriptorSets(
+          command_buffer.Get(), VK_PIPELINE_BIND_POINT_GRAPHICS,
+          pipeline.GetLayout(), 0, 1, &draw_params.global_set,
+          static_cast<uint32_t>(draw_params.offsets.size()),
+          draw_params.offsets.data());
+      vkCmdBindDescriptorSets(command_buffer.Get(),
+                              VK_PIPELINE_BIND_POINT_GRAPHICS,
+                              pipeline.GetLayout(), 1, 1, &group_set, 0,
+                              nullptr);
+      ++stats.pipeline_binds;
+      stats.descriptor_set_binds += 2;
+    }
+
+    if (material_set != last_material_set) {
+      last_material_set = material_set;
+      vkCmdBindDescriptorSets(
+          command_buffer.Get(), VK_PIPELINE_BIND_POINT_GRAPHICS,
+          pipeline.GetLayout(), 2, 1, &material_set, 0, nullptr);
+      ++stats.descriptor_set_binds;
+    }
+
+    if (draw_params.push_constants.has_value()) {
+      const Renderer::PushConstants& constants =
+          draw_params.push_constants.value();
+      vkCmdPushConstants(command_buffer.Get(), pipeline.GetLayout(),
+                         constants.stages, constants.offset, constants.size,
+                         constants.data);
+    }
+
+    VkBuffer vertex_buffer =
+        draw_mesh->is_merged ? render_scene_.merged_vertex_buffer.Get()
+                             : draw_mesh->mesh->GetVertexBuffer().Get();
+    if (vertex_buffer != last_vertex_buffer) {
+      last_vertex_buffer = vertex_buffer;
+      VkDeviceSize offset = 0;
+      vkCmdBindVertexBuffers(command_buffer.Get(), 0, 1, &vertex_buffer,
+                             &offset);
+      vkCmdBindIndexBuffer(command_buffer.Get(),
+                           draw_mesh->is_merged
+                               ? render_scene_.merged_index_buffer.Get()
+                               : draw_mesh->mesh->GetIndexBuffer().Get(),
+                           0, VK_INDEX_TYPE_UINT32);
+      ++stats.vertex_index_binds;
+    }
+
+    vkCmdDrawIndexedIndirect(command_buffer.Get(), pass.group_draw_buffer.Get(),
+                             i * sizeof(Renderer::GPUIndirectObject), 1,
+                             sizeof(Renderer::GPUIndirectObject));
+    ++stats.indirect_draws;
+    ++stats.indirect_commands;
   }
 }
 
+void VulkanEngine::ReportDrawStats(Renderer::MeshPassType pass_type,
+                                   const Renderer::DrawStats& stats,
+                                   bool late) {
+  std::string name = Renderer::GetMeshPassName(pass_type);
+  if (late) name += " late";
+  profiler_.stats[name + " pipeline binds"] = stats.pipeline_binds;
+  profiler_.stats[name + " descriptor set binds"] =
+      stats.descriptor_set_binds;
+  profiler_.stats[name + " vertex/index binds"] = stats.vertex_index_binds;
+  profiler_.stats[name + " indirect draws"] = stats.indirect_draws;
+  profiler_.stats[name + " indirect commands"] = stats.indirect_commands;
+  profiler_.stats[name + " evicted mesh skips"] = stats.evicted_mesh_skips;
+  if (mesh_reload_check_)
+    mesh_reload_check_->skipped_draws += stats.evicted_mesh_skips;
+}
+
 void VulkanEngine::DrawSkybox(Renderer::CommandBuffer command_buffer,
                               VkDescriptorBufferInfo scene_info,
                               uint32_t dynamic_offset) {
@@ -2545,6 +4153,917 @@ void VulkanEngine::DrawMenu() {
   ImGui::End();
 }
 
+void VulkanEngine::SpawnInstanceGroup() {
+  constexpr uint32_t kSide = 1000;
+  constexpr float kSpacing = 2.f;
+
+  Renderer::Mesh* mesh = GetMesh("cube");
+  Renderer::Material* material =
+      Renderer::MaterialSystem::GetMaterial("default");
+  if (!mesh || !material) {
+    LOG_ERROR("Instance group needs cube mesh and default material");
+    return;
+  }
+
+  // Every group lands below the previous one
+  float height = -20.f - 10.f * static_cast<float>(instance_groups_.size());
+  std::mt19937 generator(static_cast<uint32_t>(instance_groups_.size()));
+  std::uniform_real_distribution<float> unit(0.f, 1.f);
+
+  std::vector<Renderer::GPUGroupInstance> instances(kSide * kSide);
+  for (uint32_t i = 0; i < instances.size(); ++i) {
+    Renderer::GPUGroupInstance& instance = instances[i];
+    instance.position =
+        glm::vec3((float(i % kSide) - kSide / 2.f) * kSpacing, height,
+                  (float(i / kSide) - kSide / 2.f) * kSpacing);
+    instance.scale = 0.25f + 0.5f * unit(generator);
+    glm::quat rotation = glm::angleAxis(
+        unit(generator) * glm::two_pi<float>(),
+        glm::normalize(glm::vec3(unit(generator), 1.f, unit(generator))));
+    instance.rotation =
+        glm::vec4(rotation.x, rotation.y, rotation.z, rotation.w);
+  }
+
+  Renderer::Handle<Renderer::InstanceGroup> group =
+      render_scene_.AddInstanceGroup(mesh, material, std::move(instances),
+                                     true);
+  if (group.IsValid()) instance_groups_.push_back(group);
+}
+
+void VulkanEngine::RecordCullReadback(Renderer::CommandBuffer command_buffer,
+                                      const Renderer::CullParams& params) {
+  Renderer::RenderScene::MeshPass& pass = render_scene_.forward_pass;
+  if (pass.instances.empty() ||
+      pass.clear_indirect_buffer.Get() == VK_NULL_HANDLE) {
+    LOG_ERROR("Forward pass has nothing to cull");
+    return;
+  }
+
+  CullReadback readback;
+  Renderer::GatherCullInput(render_scene_, pass, readback.input);
+  readback.cull_data =
+      BuildCullData(params, static_cast<uint32_t>(pass.instances.size()));
+
+  VkDeviceSize draws_size =
+      pass.indirect_batches.size() * sizeof(Renderer::GPUIndirectObject);
+  VkDeviceSize ids_size = pass.instances.size() * sizeof(uint32_t);
+
+  std::vector<VkBufferImageCopy> pyramid_regions(depth_pyramid_levels_);
+  VkDeviceSize pyramid_size = 0;
+  for (uint32_t i = 0; i < depth_pyramid_levels_; ++i) {
+    VkBufferImageCopy& region = pyramid_regions[i];
+    region = {};
+    region.bufferOffset = pyramid_size;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = i;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent = {std::max(depth_pyramid_width_ >> i, 1u),
+                          std::max(depth_pyramid_height_ >> i, 1u), 1};
+    pyramid_size += region.imageExtent.width * region.imageExtent.height *
+                    sizeof(float);
+  }
+
+  for (auto [buffer, size] :
+       {std::make_pair(&readback.draws, draws_size),
+        std::make_pair(&readback.instance_ids, ids_size),
+        std::make_pair(&readback.depth_pyramid, pyramid_size)}) {
+    buffer->Create(allocator_, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                   VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT);
+  }
+
+  VkMemoryBarrier barrier{};
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  vkCmdPipelineBarrier(command_buffer.Get(),
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0,
+                       nullptr, 0, nullptr);
+
+  VkBufferCopy copy{};
+  copy.size = draws_size;
+  vkCmdCopyBuffer(command_buffer.Get(), pass.draw_indirect_buffer.Get(),
+                  readback.draws.Get(), 1, &copy);
+  copy.size = ids_size;
+  vkCmdCopyBuffer(command_buffer.Get(), pass.compacted_instance_buffer.Get(),
+                  readback.instance_ids.Get(), 1, &copy);
+  // Still holds the pyramid culling used, it is reduced again later on
+  vkCmdCopyImageToBuffer(command_buffer.Get(), depth_pyramid_.Get(),
+                         VK_IMAGE_LAYOUT_GENERAL, readback.depth_pyramid.Get(),
+                         static_cast<uint32_t>(pyramid_regions.size()),
+                         pyramid_regions.data());
+
+  // Depth reduction must not overwrite the pyramid before it is copied
+  vkCmdPipelineBarrier(command_buffer.Get(), VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0,
+                       nullptr, 0, nullptr);
+
+  cull_readback_ = std::move(readback);
+}
+
+void VulkanEngine::ValidateCpuCulling() {
+  device_.WaitIdle();
+  CullReadback& readback = *cull_readback_;
+
+  Renderer::CpuDepthPyramid pyramid;
+  pyramid.width = depth_pyramid_width_;
+  pyramid.height = depth_pyramid_height_;
+  const float* texels = readback.depth_pyramid.GetMappedMemory<float>();
+  for (uint32_t i = 0; i < depth_pyramid_levels_; ++i) {
+    size_t size = size_t(std::max(depth_pyramid_width_ >> i, 1u)) *
+                  std::max(depth_pyramid_height_ >> i, 1u);
+    pyramid.levels.emplace_back(texels, texels + size);
+    texels += size;
+  }
+
+  Renderer::CpuCullOutput output;
+  double start = glfwGetTime();
+  Renderer::CullOnCpu(readback.input, readback.cull_data, &pyramid, nullptr,
+                      output);
+  double single_ms = (glfwGetTime() - start) * 1000.0;
+  start = glfwGetTime();
+  Renderer::CullOnCpu(readback.input, readback.cull_data, &pyramid,
+                      &thread_pool_, output);
+  double parallel_ms = (glfwGetTime() - start) * 1000.0;
+
+  // Instances of a batch are compared as sets, GPU order is arbitrary
+  const Renderer::GPUIndirectObject* gpu_draws =
+      readback.draws.GetMappedMemory<Renderer::GPUIndirectObject>();
+  const uint32_t* gpu_ids = readback.instance_ids.GetMappedMemory<uint32_t>();
+  uint32_t cpu_visible = 0;
+  uint32_t gpu_visible = 0;
+  uint32_t mismatched_batches = 0;
+  for (size_t i = 0; i < output.draws.size(); ++i) {
+    const VkDrawIndexedIndirectCommand& cpu_draw = output.draws[i].command;
+    const VkDrawIndexedIndirectCommand& gpu_draw = gpu_draws[i].command;
+    cpu_visible += cpu_draw.instanceCount;
+    gpu_visible += gpu_draw.instanceCount;
+
+    const uint32_t* cpu_first = &output.instance_ids[cpu_draw.firstInstance];
+    std::vector<uint32_t> cpu_instances(cpu_first,
+                                        cpu_first + cpu_draw.instanceCount);
+    std::vector<uint32_t> gpu_instances(
+        gpu_ids + gpu_draw.firstInstance,
+        gpu_ids + gpu_draw.firstInstance + gpu_draw.instanceCount);
+    std::sort(cpu_instances.begin(), cpu_instances.end());
+    std::sort(gpu_instances.begin(), gpu_instances.end());
+    if (cpu_instances != gpu_instances) ++mismatched_batches;
+  }
+
+  LOG_INFO(
+      "CPU culling, {} instances: {} visible on CPU, {} on GPU, {:.3f} ms, "
+      "{:.3f} ms on {} threads",
+      readback.input.instances.size(), cpu_visible, gpu_visible, single_ms,
+      parallel_ms, thread_pool_.GetThreadCount() + 1);
+  // Spheres touching a plane may land on either side due to rounding
+  if (mismatched_batches > 0) {
+    LOG_ERROR("CPU culling differs in {} of {} batches", mismatched_batches,
+              output.draws.size());
+  }
+
+  readback.draws.Destroy();
+  readback.instance_ids.Destroy();
+  readback.depth_pyramid.Destroy();
+  cull_readback_.reset();
+}
+
+void VulkanEngine::StartMeshReloadCheck() {
+  if (!*CVarSystem::Get()->GetIntCVar("residency.enable")) {
+    LOG_ERROR("Mesh reload check needs residency.enable");
+    return;
+  }
+  if (loaded_prefabs_.empty() || prefabs_to_unload_ > 0) {
+    LOG_ERROR("Mesh reload check needs a loaded prefab");
+    return;
+  }
+
+  const LoadedPrefab& prefab = loaded_prefabs_.back();
+  MeshReloadCheck check;
+  check.prefab_path = prefab.path;
+  check.root_transform = prefab.root_transform;
+  for (Renderer::Handle<Renderer::SceneObject> object : prefab.objects) {
+    const Renderer::DrawMesh* draw_mesh =
+        render_scene_.GetMesh(render_scene_.renderables.mesh_ids
+                                  [render_scene_.GetObjectIndex(object)]);
+    if (!draw_mesh->is_merged &&
+        std::find(check.meshes.begin(), check.meshes.end(),
+                  draw_mesh->mesh) == check.meshes.end())
+      check.meshes.push_back(draw_mesh->mesh);
+  }
+  if (check.meshes.empty()) {
+    LOG_ERROR("Meshes of last prefab are merged, load one at runtime first");
+    return;
+  }
+
+  // Every resource unused for a few frames is evicted meanwhile, they come
+  // back once used again
+  check.budget_fraction =
+      *CVarSystem::Get()->GetFloatCVar("residency.budget_fraction");
+  CVarSystem::Get()->SetFloatCVar("residency.budget_fraction", 0.f);
+  check.start_frame = frame_number_;
+  mesh_reload_check_ = std::move(check);
+  ++prefabs_to_unload_;
+}
+
+void VulkanEngine::UpdateMeshReloadCheck(
+    Renderer::CommandBuffer command_buffer) {
+  if (!mesh_reload_check_) return;
+  MeshReloadCheck& check = *mesh_reload_check_;
+
+  // Eviction waits out frames in flight and reloads wait for file reads,
+  // both take far fewer frames
+  constexpr uint64_t kMaxFrames = 1000;
+  size_t resident_count = std::count_if(
+      check.meshes.begin(), check.meshes.end(),
+      [](const Renderer::Mesh* mesh) { return mesh->IsResident(); });
+  uint64_t frames = frame_number_ - check.start_frame;
+
+  if (!check.reloading) {
+    if (resident_count > 0 && frames <= kMaxFrames) return;
+
+    CVarSystem::Get()->SetFloatCVar("residency.budget_fraction",
+                                    check.budget_fraction);
+    if (resident_count > 0) {
+      LOG_ERROR(
+          "Mesh reload check: {} of {} meshes not evicted after {} frames, "
+          "are they used by other objects?",
+          resident_count, check.meshes.size(), frames);
+      mesh_reload_check_.reset();
+      return;
+    }
+
+    // Registered while the meshes are evicted, which is what draws have to
+    // cope with
+    LoadPrefab(command_buffer, check.prefab_path.c_str(),
+               check.root_transform);
+    check.reloading = true;
+    check.start_frame = frame_number_;
+    check.skipped_draws = 0;
+    return;
+  }
+
+  if (resident_count < check.meshes.size() && frames <= kMaxFrames) return;
+
+  // Draws binding an evicted mesh would be reported by validation layers
+  if (resident_count < check.meshes.size()) {
+    LOG_ERROR("Mesh reload check: {} of {} meshes not reloaded after {} frames",
+              check.meshes.size() - resident_count, check.meshes.size(),
+              frames);
+  } else {
+    LOG_INFO(
+        "Mesh reload check: {} meshes reloaded after {} frames, {} draws "
+        "skipped meanwhile",
+        check.meshes.size(), frames, check.skipped_draws);
+  }
+  mesh_reload_check_.reset();
+}
+
+void VulkanEngine::BenchmarkBatchSort() {
+  using RenderBatch = Renderer::RenderScene::RenderBatch;
+
+  auto measure = [](std::vector<RenderBatch> batches, auto sort,
+                    std::vector<RenderBatch>& result) {
+    double start = glfwGetTime();
+    sort(batches);
+    double time = (glfwGetTime() - start) * 1000.0;
+    result = std::move(batches);
+    return time;
+  };
+
+  std::mt19937_64 random(42);
+  // Unique keys, and keys of a scene with few distinct meshes and materials
+  for (uint64_t distinct_keys : {uint64_t(0), uint64_t(1024)}) {
+    for (size_t size : {1000, 10000, 100000, 1000000}) {
+      std::vector<RenderBatch> batches(size);
+      for (size_t i = 0; i < size; ++i) {
+        batches[i].object.handle = static_cast<uint32_t>(i);
+        batches[i].sort_key =
+            distinct_keys == 0 ? random() : random() % distinct_keys;
+      }
+
+      std::vector<RenderBatch> expected;
+      std::vector<RenderBatch> sorted;
+      double std_sort_ms = measure(
+          batches,
+          [](std::vector<RenderBatch>& data) {
+            std::sort(data.begin(), data.end(),
+                      [](const RenderBatch& lhs, const RenderBatch& rhs) {
+                        return (lhs.sort_key == rhs.sort_key
+                                    ? lhs.object.handle < rhs.object.handle
+                                    : lhs.sort_key < rhs.sort_key);
+                      });
+          },
+          expected);
+      double radix_ms = measure(
+          batches,
+          [](std::vector<RenderBatch>& data) {
+            Renderer::SortRenderBatches(data, nullptr);
+          },
+          sorted);
+      bool radix_valid = sorted == expected;
+      double parallel_ms = measure(
+          batches,
+          [this](std::vector<RenderBatch>& data) {
+            Renderer::SortRenderBatches(data, &thread_pool_);
+          },
+          sorted);
+      bool parallel_valid = sorted == expected;
+
+      LOG_INFO(
+          "Batch sort, {} batches, {} keys: std::sort {:.3f} ms, radix {:.3f} "
+          "ms, parallel radix {:.3f} ms on {} threads",
+          size, distinct_keys == 0 ? "unique" : std::to_string(distinct_keys),
+          std_sort_ms, radix_ms, parallel_ms,
+          thread_pool_.GetThreadCount() + 1);
+      if (!radix_valid || !parallel_valid)
+        LOG_ERROR("Radix sort order differs from std::sort");
+    }
+  }
+}
+
+void VulkanEngine::BenchmarkSceneLayout() {
+  constexpr uint32_t kObjectCount = 1000000;
+  constexpr int kRepeats = 5;
+
+  // Same objects as whole structs, the layout used before, and as columns
+  std::mt19937 random(42);
+  std::uniform_real_distribution<float> position(-1000.f, 1000.f);
+  std::vector<Renderer::SceneObject> structs(kObjectCount);
+  Renderer::SceneObjectStorage columns;
+  columns.Reserve(kObjectCount);
+  for (Renderer::SceneObject& object : structs) {
+    object.transform_matrix = glm::translate(
+        glm::mat4{1.f},
+        glm::vec3(position(random), position(random), position(random)));
+    object.bounds.origin = glm::vec3(object.transform_matrix[3]);
+    object.bounds.radius = 1.f;
+    object.bounds.extents = glm::vec3(1.f);
+    object.bounds.valid = true;
+    object.update_index = 0;
+    object.pass_indices.Clear(
+        Renderer::Handle<Renderer::RenderScene::PassObject>());
+    columns.Insert(object);
+  }
+
+  // Best of several runs, so that page faults of the first one do not count
+  auto measure = [](auto loop) {
+    double best = std::numeric_limits<double>::max();
+    for (int i = 0; i < kRepeats; ++i) {
+      double start = glfwGetTime();
+      loop();
+      best = std::min(best, (glfwGetTime() - start) * 1000.0);
+    }
+    return best;
+  };
+  auto log_result = [](const char* loop, double struct_ms, size_t struct_size,
+                       double column_ms, size_t column_size) {
+    double struct_mb = double(struct_size) * kObjectCount / (1024.0 * 1024.0);
+    double column_mb = double(column_size) * kObjectCount / (1024.0 * 1024.0);
+    LOG_INFO(
+        "Scene layout, {} of {} objects: structs {:.3f} ms over {:.1f} MB, "
+        "columns {:.3f} ms over {:.1f} MB",
+        loop, kObjectCount, struct_ms, struct_mb, column_ms, column_mb);
+  };
+
+  // Like ClearDirtyObjects after a full reupload
+  double struct_ms = measure([&]() {
+    for (Renderer::SceneObject& object : structs)
+      object.update_index = static_cast<uint32_t>(-1);
+  });
+  double column_ms = measure([&]() {
+    std::fill(columns.update_indices.begin(), columns.update_indices.end(),
+              static_cast<uint32_t>(-1));
+  });
+  log_result("clearing dirty flags", struct_ms, sizeof(Renderer::SceneObject),
+             column_ms, sizeof(uint32_t));
+
+  // Like the bounds test of StreamTextures
+  uint32_t struct_visible = 0;
+  uint32_t column_visible = 0;
+  struct_ms = measure([&]() {
+    struct_visible = 0;
+    for (const Renderer::SceneObject& object : structs)
+      struct_visible +=
+          object.bounds.valid && object.bounds.origin.z < object.bounds.radius;
+  });
+  column_ms = measure([&]() {
+    column_visible = 0;
+    for (const Renderer::RenderBounds& bounds : columns.bounds)
+      column_visible += bounds.valid && bounds.origin.z < bounds.radius;
+  });
+  log_result("testing bounds", struct_ms, sizeof(Renderer::SceneObject),
+             column_ms, sizeof(Renderer::RenderBounds));
+
+  // Like FillObjectData without the normal matrix, which costs the same in
+  // both layouts
+  std::vector<glm::mat4> matrices(kObjectCount);
+  struct_ms = measure([&]() {
+    for (uint32_t i = 0; i < kObjectCount; ++i)
+      matrices[i] = structs[i].transform_matrix;
+  });
+  column_ms = measure([&]() {
+    std::copy(columns.transforms.begin(), columns.transforms.end(),
+              matrices.begin());
+  });
+  log_result("copying transforms", struct_ms, sizeof(Renderer::SceneObject),
+             column_ms, sizeof(glm::mat4));
+
+  if (struct_visible != column_visible)
+    LOG_ERROR("Scene layouts disagree on visible objects");
+}
+
+void VulkanEngine::BenchmarkObjectRegistration() {
+  constexpr uint32_t kObjectCount = 100000;
+
+  Renderer::Mesh* mesh = GetMesh("cube");
+  Renderer::Material* material =
+      Renderer::MaterialSystem::GetMaterial("default");
+  if (!mesh || !material) {
+    LOG_ERROR("Registration benchmark needs cube mesh and default material");
+    return;
+  }
+
+  // Grid of cubes below the scene
+  std::vector<Renderer::RenderObject> objects(kObjectCount);
+  for (uint32_t i = 0; i < kObjectCount; ++i) {
+    Renderer::RenderObject& object = objects[i];
+    object.Create(mesh, material);
+    object.model_mat = glm::translate(
+        glm::mat4{1.f}, glm::vec3(float(i % 1000), -1000.f, float(i / 1000)));
+    object.RefreshRenderBounds();
+    object.draw_forward_pass = true;
+    object.draw_shadow_pass = true;
+  }
+
+  // Objects are gone before the next BuildBatches, so they never show up
+  auto measure = [this](auto registration) {
+    double start = glfwGetTime();
+    std::vector<Renderer::Handle<Renderer::SceneObject>> handles =
+        registration();
+    double time = glfwGetTime() - start;
+    render_scene_.UnregisterObjectBatch(
+        handles.data(), static_cast<uint32_t>(handles.size()));
+    return time;
+  };
+
+  double single_s = measure([&]() {
+    std::vector<Renderer::Handle<Renderer::SceneObject>> handles;
+    handles.reserve(kObjectCount);
+    for (Renderer::RenderObject& object : objects)
+      handles.push_back(render_scene_.RegisterObject(&object));
+    return handles;
+  });
+  double batch_s = measure([&]() {
+    return render_scene_.RegisterObjectBatch(objects.data(), kObjectCount);
+  });
+
+  LOG_INFO("Object registration, {} objects: one by one {:.3f} ms, batch "
+           "{:.3f} ms",
+           kObjectCount, single_s * 1000.0, batch_s * 1000.0);
+}
+
+void VulkanEngine::BenchmarkBvh() {
+  constexpr int kQueryCount = 1000;
+  using ObjectHandle = Renderer::Handle<Renderer::SceneObject>;
+
+  // Boxes of a few meters in a cube whose volume grows with the count, so
+  // that queries return similar numbers of objects at every size
+  std::mt19937 random(42);
+  for (uint32_t count : {10000u, 100000u, 1000000u}) {
+    float half_size = 10.f * std::cbrt(static_cast<float>(count));
+    std::uniform_real_distribution<float> position(-half_size, half_size);
+    std::uniform_real_distribution<float> extent(0.5f, 4.f);
+    auto random_box = [&]() {
+      glm::vec3 center(position(random), position(random), position(random));
+      glm::vec3 half_extents(extent(random), extent(random), extent(random));
+      return Renderer::Aabb{center - half_extents, center + half_extents};
+    };
+
+    std::vector<ObjectHandle> objects(count);
+    std::vector<Renderer::Aabb> bounds(count);
+    for (uint32_t i = 0; i < count; ++i) {
+      objects[i].handle = i;
+      bounds[i] = random_box();
+    }
+
+    Renderer::Bvh bvh;
+    double start = glfwGetTime();
+    bvh.Build(objects, bounds);
+    double build_ms = (glfwGetTime() - start) * 1000.0;
+    uint32_t depth = bvh.GetDepth();
+    float sah_cost = bvh.GetSahCost();
+
+    // Tenth of the objects moves a little, as in a frame
+    std::uniform_real_distribution<float> offset(-1.f, 1.f);
+    start = glfwGetTime();
+    for (uint32_t i = 0; i < count; i += 10) {
+      glm::vec3 move(offset(random), offset(random), offset(random));
+      bounds[i] = Renderer::Aabb{bounds[i].min + move, bounds[i].max + move};
+      bvh.Update(objects[i], bounds[i]);
+    }
+    bvh.Refit();
+    double refit_ms = (glfwGetTime() - start) * 1000.0;
+
+    // Hundredth is removed and inserted elsewhere
+    start = glfwGetTime();
+    for (uint32_t i = 5; i < count; i += 100) {
+      bvh.Remove(objects[i]);
+      ++objects[i].generation;
+      bounds[i] = random_box();
+      bvh.Insert(objects[i], bounds[i]);
+    }
+    double reinsert_ms = (glfwGetTime() - start) * 1000.0;
+
+    std::vector<ObjectHandle> result;
+    size_t sphere_hits = 0;
+    start = glfwGetTime();
+    for (int i = 0; i < kQueryCount; ++i) {
+      result.clear();
+      bvh.QuerySphere(random_box().min, 20.f, result);
+      sphere_hits += result.size();
+    }
+    double sphere_ms = (glfwGetTime() - start) * 1000.0;
+
+    size_t aabb_hits = 0;
+    start = glfwGetTime();
+    for (int i = 0; i < kQueryCount; ++i) {
+      result.clear();
+      glm::vec3 corner = random_box().min;
+      bvh.QueryAabb(Renderer::Aabb{corner, corner + 40.f}, result);
+      aabb_hits += result.size();
+    }
+    double aabb_ms = (glfwGetTime() - start) * 1000.0;
+
+    // Narrow frusta looking down +z from random points
+    size_t frustum_hits = 0;
+    start = glfwGetTime();
+    for (int i = 0; i < kQueryCount; ++i) {
+      result.clear();
+      glm::vec3 eye = random_box().min;
+      glm::mat4 view_projection =
+          glm::perspective(glm::radians(30.f), 1.f, 0.1f, 100.f) *
+          glm::lookAt(eye, eye + glm::vec3(0.f, 0.f, 1.f),
+                      glm::vec3(0.f, 1.f, 0.f));
+      glm::mat4 rows = glm::transpose(view_projection);
+      glm::vec4 planes[6] = {rows[3] + rows[0], rows[3] - rows[0],
+                             rows[3] + rows[1], rows[3] - rows[1],
+                             rows[3] + rows[2], rows[3] - rows[2]};
+      bvh.QueryFrustum(planes, 6, result);
+      frustum_hits += result.size();
+    }
+    double frustum_ms = (glfwGetTime() - start) * 1000.0;
+
+    // Rays hit the boxes themselves, the nearest one is kept
+    auto hit_box = [](ObjectHandle, float distance) {
+      return distance;
+    };
+    std::uniform_real_distribution<float> direction(-1.f, 1.f);
+    std::vector<std::pair<glm::vec3, glm::vec3>> rays(kQueryCount);
+    for (auto& [origin, ray_direction] : rays) {
+      origin = random_box().min;
+      ray_direction = glm::normalize(glm::vec3(
+          direction(random), direction(random), direction(random)));
+    }
+    size_t ray_hits = 0;
+    start = glfwGetTime();
+    for (const auto& [origin, ray_direction] : rays) {
+      if (bvh.RayCast(origin, ray_direction, 2.f * half_size, hit_box) >= 0.f)
+        ++ray_hits;
+    }
+    double ray_ms = (glfwGetTime() - start) * 1000.0;
+
+    // Fat leaves make queries return a superset of overlapping objects, none
+    // may be missing
+    bool valid = true;
+    for (int i = 0; i < 10 && valid; ++i) {
+      glm::vec3 corner = random_box().min;
+      Renderer::Aabb query{corner, corner + 40.f};
+      result.clear();
+      bvh.QueryAabb(query, result);
+      std::unordered_set<uint32_t> found;
+      for (ObjectHandle object : result) found.insert(object.handle);
+      for (uint32_t j = 0; j < count && valid; ++j) {
+        if (bounds[j].Overlaps(query) && found.count(j) == 0) valid = false;
+      }
+    }
+
+    LOG_INFO(
+        "BVH, {} objects: build {:.3f} ms, depth {}, SAH cost {:.1f}, update "
+        "and refit of {} {:.3f} ms, reinsertion of {} {:.3f} ms",
+        count, build_ms, depth, sah_cost, (count + 9) / 10, refit_ms,
+        (count + 94) / 100, reinsert_ms);
+    LOG_INFO(
+        "BVH, {} objects, {} queries: sphere {:.3f} ms ({} hits), AABB "
+        "{:.3f} ms ({} hits), frustum {:.3f} ms ({} hits), ray {:.3f} ms "
+        "({} hits)",
+        count, kQueryCount, sphere_ms, sphere_hits, aabb_ms, aabb_hits,
+        frustum_ms, frustum_hits, ray_ms, ray_hits);
+    if (!valid) LOG_ERROR("BVH query missed overlapping objects");
+  }
+}
+
+void VulkanEngine::BenchmarkSceneQueries() {
+  constexpr int kRayCount = 10000;
+  constexpr int kVolumeQueryCount = 100;
+  using ObjectHandle = Renderer::Handle<Renderer::SceneObject>;
+
+  // Rays through random points of the view, from near to far plane, so that
+  // distances are fractions of the view depth
+  glm::mat4 view_projection = camera_.GetProjMat() * camera_.GetViewMat();
+  glm::mat4 clip_to_world = glm::inverse(view_projection);
+  auto unproject = [&](float x, float y, float z) {
+    glm::vec4 world = clip_to_world * glm::vec4(x, y, z, 1.f);
+    return glm::vec3(world) / world.w;
+  };
+
+  std::mt19937 random(42);
+  std::uniform_real_distribution<float> screen(-1.f, 1.f);
+  std::vector<std::pair<glm::vec3, glm::vec3>> rays(kRayCount);
+  for (auto& [origin, direction] : rays) {
+    float x = screen(random);
+    float y = screen(random);
+    origin = unproject(x, y, -1.f);
+    direction = unproject(x, y, 1.f) - origin;
+  }
+
+  int hits = 0;
+  double start = glfwGetTime();
+  for (const auto& [origin, direction] : rays) {
+    if (render_scene_.RayCast(origin, direction, 1.f).IsValid()) ++hits;
+  }
+  double ray_us = (glfwGetTime() - start) * 1e6 / kRayCount;
+
+  float center_distance = -1.f;
+  ObjectHandle center = render_scene_.RayCast(
+      camera_.GetPosition(), camera_.GetDirection(),
+      *CVarSystem::Get()->GetFloatCVar("culling.distance"), &center_distance);
+
+  std::vector<ObjectHandle> result;
+  auto measure = [&](auto query) {
+    double query_start = glfwGetTime();
+    for (int i = 0; i < kVolumeQueryCount; ++i) {
+      result.clear();
+      query();
+    }
+    return (glfwGetTime() - query_start) * 1e6 / kVolumeQueryCount;
+  };
+  glm::vec3 position = camera_.GetPosition();
+  double sphere_us = measure(
+      [&]() { render_scene_.QuerySphere(position, 50.f, result); });
+  size_t sphere_count = result.size();
+  double box_us = measure([&]() {
+    render_scene_.QueryBox(Renderer::Aabb{position - 50.f, position + 50.f},
+                           result);
+  });
+  size_t box_count = result.size();
+  double frustum_us = measure(
+      [&]() { render_scene_.QueryFrustum(view_projection, result); });
+  size_t frustum_count = result.size();
+
+  LOG_INFO(
+      "Scene queries, {} objects: {} rays {:.2f} us each ({} hits), sphere "
+      "{:.2f} us ({} objects), box {:.2f} us ({} objects), view frustum "
+      "{:.2f} us ({} objects)",
+      render_scene_.bvh.GetObjectCount(), kRayCount, ray_us, hits, sphere_us,
+      sphere_count, box_us, box_count, frustum_us, frustum_count);
+  if (center.IsValid()) {
+    LOG_INFO("Object {}:{} is at view center, {:.2f} away", center.handle,
+             center.generation, center_distance);
+  }
+}
+
+void VulkanEngine::BenchmarkCullDispatch() {
+  constexpr uint32_t kInstanceCounts[] = {100000, 1000000};
+  // Instances are sorted by batch like in mesh passes, so that thousands of
+  // lanes contend on the count of one batch
+  constexpr uint32_t kBatchCount = 256;
+  constexpr uint32_t kRepeats = 8;
+
+  Renderer::CommandPool pool;
+  VK_CHECK(pool.Create(&device_,
+                       device_.GetQueueFamilies().graphics_family.value()));
+  Renderer::DescriptorAllocator descriptor_allocator;
+  descriptor_allocator.Init(&device_);
+
+  VkQueryPoolCreateInfo query_pool_info{};
+  query_pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+  query_pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+  query_pool_info.queryCount = 2 * kRepeats;
+  VkQueryPool query_pool;
+  VK_CHECK(vkCreateQueryPool(device_.Get(), &query_pool_info, nullptr,
+                             &query_pool));
+
+  Renderer::CullParams params;
+  params.view_mat = camera_.GetViewMat();
+  params.proj_mat = camera_.GetProjMat(true);
+  params.frustum_cull = true;
+  params.occlusion_cull = false;
+  params.draw_dist = *CVarSystem::Get()->GetFloatCVar("culling.distance");
+  glm::vec3 position = camera_.GetPosition();
+
+  std::mt19937 random(42);
+  std::uniform_real_distribution<float> offset(-200.f, 200.f);
+  std::uniform_real_distribution<float> radius(0.5f, 2.f);
+
+  for (uint32_t instance_count : kInstanceCounts) {
+    VkBufferUsageFlags storage_usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    VmaAllocationCreateFlags host_write =
+        VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
+    Renderer::Buffer<true> object_buffer, instance_buffer, clear_draw_buffer,
+        draw_readback_buffer;
+    Renderer::Buffer<false> draw_buffer, final_buffer, visibility_buffer,
+        stats_buffer;
+    VK_CHECK(object_buffer.Create(
+        allocator_, instance_count * sizeof(Renderer::GPUObjectData),
+        storage_usage, host_write));
+    VK_CHECK(instance_buffer.Create(
+        allocator_, instance_count * sizeof(Renderer::GPUInstance),
+        storage_usage, host_write));
+    VK_CHECK(clear_draw_buffer.Create(
+        allocator_, kBatchCount * sizeof(Renderer::GPUIndirectObject),
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT, host_write));
+    VK_CHECK(draw_readback_buffer.Create(
+        allocator_, kBatchCount * sizeof(Renderer::GPUIndirectObject),
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT));
+    VK_CHECK(draw_buffer.Create(
+        allocator_, kBatchCount * sizeof(Renderer::GPUIndirectObject),
+        storage_usage | VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT));
+    VK_CHECK(final_buffer.Create(allocator_, instance_count * sizeof(uint32_t),
+                                 storage_usage));
+    VK_CHECK(visibility_buffer.Create(
+        allocator_, instance_count * sizeof(uint32_t), storage_usage));
+    VK_CHECK(stats_buffer.Create(allocator_, sizeof(Renderer::GPUCullStats),
+                                 storage_usage));
+
+    // Unit cubes scaled to random sizes around the camera, about half of
+    // them end up in view
+    Renderer::GPUObjectData* objects =
+        object_buffer.GetMappedMemory<Renderer::GPUObjectData>();
+    Renderer::GPUInstance* instances =
+        instance_buffer.GetMappedMemory<Renderer::GPUInstance>();
+    for (uint32_t i = 0; i < instance_count; ++i) {
+      glm::vec3 center =
+          position + glm::vec3(offset(random), offset(random), offset(random));
+      float extent = radius(random);
+      objects[i].model_rows[0] = glm::vec4(extent, 0.f, 0.f, center.x);
+      objects[i].model_rows[1] = glm::vec4(0.f, extent, 0.f, center.y);
+      objects[i].model_rows[2] = glm::vec4(0.f, 0.f, extent, center.z);
+      objects[i].origin_radius = glm::vec4(center, extent * glm::sqrt(3.f));
+      objects[i].extents = glm::vec4(glm::vec3(extent), 0.f);
+      instances[i].object_id = i;
+      instances[i].batch_id =
+          static_cast<uint32_t>(uint64_t(i) * kBatchCount / instance_count);
+    }
+    Renderer::GPUIndirectObject* clear_draws =
+        clear_draw_buffer.GetMappedMemory<Renderer::GPUIndirectObject>();
+    for (uint32_t batch = 0; batch < kBatchCount; ++batch) {
+      clear_draws[batch] = {};
+      clear_draws[batch].command.indexCount = 36;
+      clear_draws[batch].command.firstInstance = static_cast<uint32_t>(
+          (uint64_t(batch) * instance_count + kBatchCount - 1) / kBatchCount);
+    }
+
+    VkDescriptorBufferInfo object_info = object_buffer.GetDescriptorInfo();
+    VkDescriptorBufferInfo draw_info = draw_buffer.GetDescriptorInfo();
+    VkDescriptorBufferInfo instance_info = instance_buffer.GetDescriptorInfo();
+    VkDescriptorBufferInfo final_info = final_buffer.GetDescriptorInfo();
+    VkDescriptorImageInfo depth_pyramid;
+    depth_pyramid.sampler = depth_sampler_.Get();
+    depth_pyramid.imageView = depth_pyramid_.GetView();
+    depth_pyramid.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    VkDescriptorBufferInfo visibility_info =
+        visibility_buffer.GetDescriptorInfo();
+    VkDescriptorBufferInfo stats_info = stats_buffer.GetDescriptorInfo();
+
+    VkDescriptorSet compute_set;
+    Renderer::DescriptorBuilder::Begin(&layout_cache_, &descriptor_allocator)
+        .BindBuffer(0, &object_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                    VK_SHADER_STAGE_COMPUTE_BIT)
+        .BindBuffer(1, &draw_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                    VK_SHADER_STAGE_COMPUTE_BIT)
+        .BindBuffer(2, &instance_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                    VK_SHADER_STAGE_COMPUTE_BIT)
+        .BindBuffer(3, &final_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                    VK_SHADER_STAGE_COMPUTE_BIT)
+        .BindImage(4, &depth_pyramid,
+                   VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                   VK_SHADER_STAGE_COMPUTE_BIT)
+        .BindBuffer(5, &visibility_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                    VK_SHADER_STAGE_COMPUTE_BIT)
+        .BindBuffer(6, &stats_info, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                    VK_SHADER_STAGE_COMPUTE_BIT)
+        .Build(compute_set);
+
+    Renderer::DrawCullData cull_data =
+        BuildCullData(params, instance_count, Renderer::OcclusionMode::kNone);
+
+    // Milliseconds per dispatch and visible instances of the last one
+    auto measure = [&](bool subgroups, uint32_t& visible_count) {
+      Renderer::CommandBuffer command_buffer = pool.GetBuffer();
+      command_buffer.Begin();
+      vkCmdResetQueryPool(command_buffer.Get(), query_pool, 0,
+                          2 * kRepeats);
+      for (uint32_t i = 0; i < kRepeats; ++i) {
+        clear_draw_buffer.CopyTo(command_buffer, draw_buffer);
+        vkCmdFillBuffer(command_buffer.Get(), stats_buffer.Get(), 0,
+                        VK_WHOLE_SIZE, 0);
+        Renderer::BufferMemoryBarrier barrier(
+            draw_buffer, device_.GetQueueFamilies().graphics_family.value());
+        barrier.SetSrcAccessMask(VK_ACCESS_TRANSFER_WRITE_BIT);
+        barrier.SetDstAccessMask(VK_ACCESS_SHADER_READ_BIT |
+                                 VK_ACCESS_SHADER_WRITE_BIT);
+        barrier.Use(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+        barrier.SetBuffer(stats_buffer);
+        barrier.Use(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+        vkCmdWriteTimestamp(command_buffer.Get(),
+                            VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_pool,
+                            2 * i);
+        DispatchCull(command_buffer, compute_set, cull_data, instance_count,
+                     subgroups);
+        vkCmdWriteTimestamp(command_buffer.Get(),
+                            VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_pool,
+                            2 * i + 1);
+
+        barrier.SetBuffer(draw_buffer);
+        barrier.SetSrcAccessMask(VK_ACCESS_SHADER_WRITE_BIT);
+        barrier.SetDstAccessMask(VK_ACCESS_TRANSFER_READ_BIT |
+                                 VK_ACCESS_TRANSFER_WRITE_BIT);
+        barrier.Use(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                    VK_PIPELINE_STAGE_TRANSFER_BIT);
+        barrier.SetBuffer(stats_buffer);
+        barrier.Use(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                    VK_PIPELINE_STAGE_TRANSFER_BIT);
+      }
+      draw_buffer.CopyTo(command_buffer, draw_readback_buffer);
+      Renderer::BufferMemoryBarrier barrier(
+          draw_readback_buffer,
+          device_.GetQueueFamilies().graphics_family.value());
+      barrier.SetSrcAccessMask(VK_ACCESS_TRANSFER_WRITE_BIT);
+      barrier.SetDstAccessMask(VK_ACCESS_HOST_READ_BIT);
+      barrier.Use(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                  VK_PIPELINE_STAGE_HOST_BIT);
+      command_buffer.End();
+      command_buffer.Submit();
+      device_.GetGraphicsQueue().SubmitBatches();
+      device_.GetGraphicsQueue().WaitIdle();
+
+      std::array<uint64_t, 2 * kRepeats> timestamps;
+      vkGetQueryPoolResults(device_.Get(), query_pool, 0, 2 * kRepeats,
+                            sizeof(timestamps), timestamps.data(),
+                            sizeof(uint64_t),
+                            VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+      uint64_t ticks = 0;
+      for (uint32_t i = 0; i < kRepeats; ++i)
+        ticks += timestamps[2 * i + 1] - timestamps[2 * i];
+
+      visible_count = 0;
+      const Renderer::GPUIndirectObject* draws =
+          draw_readback_buffer.GetMappedMemory<Renderer::GPUIndirectObject>();
+      for (uint32_t batch = 0; batch < kBatchCount; ++batch)
+        visible_count += draws[batch].command.instanceCount;
+
+      float period = physical_device_.GetProperties().limits.timestampPeriod;
+      return static_cast<double>(ticks) * period / 1e6 / kRepeats;
+    };
+
+    uint32_t plain_visible = 0;
+    double plain_ms = measure(false, plain_visible);
+    if (cull_subgroup_pipeline_ != VK_NULL_HANDLE) {
+      uint32_t subgroup_visible = 0;
+      double subgroup_ms = measure(true, subgroup_visible);
+      LOG_INFO(
+          "Cull dispatch, {} instances in {} batches, {} visible: plain "
+          "atomics {:.3f} ms, subgroup atomics {:.3f} ms ({} visible)",
+          instance_count, kBatchCount, plain_visible, plain_ms, subgroup_ms,
+          subgroup_visible);
+    } else {
+      LOG_INFO(
+          "Cull dispatch, {} instances in {} batches, {} visible: plain "
+          "atomics {:.3f} ms, no subgroup support",
+          instance_count, kBatchCount, plain_visible, plain_ms);
+    }
+
+    object_buffer.Destroy();
+    instance_buffer.Destroy();
+    clear_draw_buffer.Destroy();
+    draw_readback_buffer.Destroy();
+    draw_buffer.Destroy();
+    final_buffer.Destroy();
+    visibility_buffer.Destroy();
+    stats_buffer.Destroy();
+    descriptor_allocator.ResetPools();
+  }
+
+  vkDestroyQueryPool(device_.Get(), query_pool, nullptr);
+  descriptor_allocator.Destroy();
+  pool.Destroy();
+}
+
 void VulkanEngine::DrawToolbar() {
   if (ImGui::BeginMainMenuBar()) {
     if (ImGui::BeginMenu("Debug")) {
@@ -2564,12 +5083,52 @@ void VulkanEngine::DrawToolbar() {
         }
         ImGui::EndMenu();
       }
+      if (ImGui::BeginMenu("Benchmarks")) {
+        if (ImGui::MenuItem("Batch sort")) BenchmarkBatchSort();
+        if (ImGui::MenuItem("Scene layout")) BenchmarkSceneLayout();
+        if (ImGui::MenuItem("Object registration"))
+          BenchmarkObjectRegistration();
+        if (ImGui::MenuItem("BVH")) BenchmarkBvh();
+        if (ImGui::MenuItem("Scene queries")) BenchmarkSceneQueries();
+        if (ImGui::MenuItem("Cull dispatch")) BenchmarkCullDispatch();
+        if (ImGui::MenuItem("CPU culling")) cull_readback_requested_ = true;
+        if (ImGui::MenuItem("Mesh reload", nullptr, false,
+                            !mesh_reload_check_))
+          StartMeshReloadCheck();
+        ImGui::EndMenu();
+      }
       ImGui::EndMenu();
     }
 
     bool open_popup = false;
     if (ImGui::BeginMenu("Scene")) {
       if (ImGui::MenuItem("Load Prefab")) open_popup = true;
+      if (ImGui::MenuItem("Unload Last Prefab", nullptr, false,
+                          loaded_prefabs_.size() > prefabs_to_unload_))
+        ++prefabs_to_unload_;
+      if (ImGui::MenuItem("Spawn Instance Group")) SpawnInstanceGroup();
+      if (ImGui::MenuItem("Remove Instance Groups", nullptr, false,
+                          !instance_groups_.empty())) {
+        for (Renderer::Handle<Renderer::InstanceGroup> group : instance_groups_)
+          render_scene_.RemoveInstanceGroup(group);
+        instance_groups_.clear();
+      }
+      if (!loaded_prefabs_.empty()) {
+        LoadedPrefab& prefab = loaded_prefabs_.back();
+        if (ImGui::DragFloat3("Last Prefab Offset", &prefab.offset.x, 0.1f)) {
+          // Dragging moves every object each frame, which the static region
+          // is not meant for
+          if (!prefab.dynamic) {
+            for (Renderer::Handle<Renderer::SceneObject> object :
+                 prefab.objects)
+              render_scene_.MakeDynamic(object);
+            prefab.dynamic = true;
+          }
+          render_scene_.hierarchy.SetLocal(
+              prefab.root, glm::translate(glm::mat4{1.f}, prefab.offset) *
+                               prefab.root_transform);
+        }
+      }
       ImGui::EndMenu();
     }
     if (open_popup) {
@@ -2630,6 +5189,13 @@ void VulkanEngine::Run() {
     DrawToolbar();
 
     Draw();
+
+    if (frame_number_ == 1) {
+      LOG_INFO("First frame after {:.2f} ms",
+               std::chrono::duration<double, std::milli>(
+                   std::chrono::steady_clock::now() - startup_begin_)
+                   .count());
+    }
   }
 
   device_.WaitIdle();
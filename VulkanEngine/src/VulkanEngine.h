@@ -1,11 +1,15 @@
 #pragma once
 
+#include <chrono>
+#include <optional>
 #include <string>
 #include <vector>
 #include <unordered_map>
 
 #include "Camera.h"
 #include "CommandPool.h"
+#include "CpuCulling.h"
+#include "Defragmenter.h"
 #include "DeletionQueue.h"
 #include "Descriptors.h"
 #include "Framebuffer.h"
@@ -20,13 +24,19 @@
 #include "PushBuffer.h"
 #include "RenderObject.h"
 #include "RenderPass.h"
+#include "ResidencyManager.h"
 #include "Scene.h"
 #include "Shaders.h"
 #include "Surface.h"
 #include "Swapchain.h"
+#include "TaskGraph.h"
 #include "Texture.h"
 #include "TextureCube.h"
 #include "TextureSampler.h"
+#include "TextureStreamer.h"
+#include "ThreadPool.h"
+#include "UploadCostModel.h"
+#include "VirtualTexture.h"
 #include "VulkanInstance.h"
 #include "VulkanProfiler.h"
 #include "Window.h"
@@ -61,9 +71,16 @@ struct GPUSceneData {
   GPUSpotLight spot_lights[kMaxSpotLights];
 };
 
+/*
+Per object data read by culling and vertex shaders
+
+- Model matrix is affine, so only its first three rows are stored, with
+  translation in w. Shaders derive the normal matrix from it
+- Bounds are the world space sphere, and half extents of the world space
+  box around the same center, which is tighter for long thin objects
+*/
 struct GPUObjectData {
-  glm::mat4 model_matrix;
-  glm::mat4 normal_matrix;
+  glm::vec4 model_rows[3];
   glm::vec4 origin_radius;
   glm::vec4 extents;
 };
@@ -76,19 +93,64 @@ struct CullParams {
   float draw_dist;
 };
 
+/*
+How cull shaders decide occlusion of instances that pass the frustum test
+
+- Two phase culling first draws instances visible last frame, then tests
+  the rest against depth of those draws. Instance groups and CPU culling
+  only know kNone and kPyramid
+*/
+enum class OcclusionMode : int32_t {
+  kNone,
+  // Depth pyramid of the previous frame
+  kPyramid,
+  // Visibility of the last frame, without depth test
+  kEarly,
+  // Depth pyramid of early draws, only instances early phase skipped are
+  // drawn and visibility of all is stored for the next frame
+  kLate
+};
+
 struct DrawCullData {
   glm::mat4 view;
   float P00, P11, z_near, z_far;
   float frustum[4];
-  float pyramid_width, pyramid_height;
+  // Instances smaller than this on screen in both directions are culled,
+  // in fractions of its size. Shaders take pyramid size from the texture
+  float min_width, min_height;
 
   uint32_t max_draw_count;
 
   int culling_enabled;
-  int occlusion_enabled;
+  OcclusionMode occlusion_mode;
   int dist_cull;
 };
 
+/*
+Counted by mesh pass culling, read back once the frame is done
+
+- Early and late instances are counted by two phase culling only
+- Rejections are counted by the test that rejected the instance, once per
+  instance and frame
+*/
+struct GPUCullStats {
+  uint32_t early_instances;
+  // Visible instances that were not visible last frame, the ones culling
+  // with last frame data alone would have missed
+  uint32_t late_instances;
+  uint32_t sphere_rejected;
+  uint32_t box_rejected;
+  uint32_t small_rejected;
+  uint32_t occlusion_rejected;
+};
+
+// Cull data of single instance group, fills push constants up to the limit
+struct GroupCullData {
+  DrawCullData cull_data;
+  uint32_t group_index;
+  uint32_t draw_index;
+};
+
 struct PushConstants {
   VkShaderStageFlags stages;
   uint32_t offset;
@@ -103,6 +165,19 @@ struct DrawParams {
   std::optional<PushConstants> push_constants;
 };
 
+// Commands recorded by single ExecuteDraw
+struct DrawStats {
+  int32_t pipeline_binds = 0;
+  int32_t descriptor_set_binds = 0;
+  int32_t vertex_index_binds = 0;
+  int32_t indirect_draws = 0;
+  // Draw commands indirect draws may read, one per batch, those of batches
+  // without visible instances are dropped on the GPU
+  int32_t indirect_commands = 0;
+  // Batches and groups skipped until their evicted mesh is reloaded
+  int32_t evicted_mesh_skips = 0;
+};
+
 }
 
 namespace Engine {
@@ -121,6 +196,11 @@ struct FrameData {
   VkDescriptorSet global_descriptor;
   VkDescriptorSet object_descriptor;
 
+  Renderer::Buffer<true> cull_stats_buffer;
+  // Whether cull stats hold counts of the last frame using the frame data
+  bool cull_stats_recorded = false;
+  bool two_phase_culled = false;
+
   DeletionQueue deletion_queue;
 };
 
@@ -142,18 +222,131 @@ class VulkanEngine {
   void Run();
 
  private:
+  struct DecodedTexture {
+    bool loaded = false;
+    Assets::AssetFile file;
+    Renderer::TextureData data;
+  };
+
+  struct DecodedMesh {
+    bool loaded = false;
+    Renderer::MeshData data;
+  };
+
+  struct LoadedPrefab {
+    std::string path;
+    // Places the whole prefab, nodes of the prefab hang below it
+    Renderer::Handle<Renderer::TransformNode> root;
+    glm::mat4 root_transform;
+    glm::vec3 offset;
+    // Objects were moved to the dynamic region once the root got dragged
+    bool dynamic = false;
+    // Parents come before their children
+    std::vector<Renderer::Handle<Renderer::TransformNode>> nodes;
+    std::vector<Renderer::Handle<Renderer::SceneObject>> objects;
+  };
+
+  // Prefab unloaded, waiting for its meshes to be evicted, then loaded again
+  struct MeshReloadCheck {
+    std::string prefab_path;
+    glm::mat4 root_transform;
+    // Drawn from their own buffers, merged ones never go away
+    std::vector<Renderer::Mesh*> meshes;
+    float budget_fraction;
+    bool reloading = false;
+    uint64_t start_frame;
+    int32_t skipped_draws = 0;
+  };
+
+  // Culling results of the forward pass read back to compare with CPU culling
+  struct CullReadback {
+    Renderer::CpuCullInput input;
+    Renderer::DrawCullData cull_data;
+    Renderer::Buffer<true> draws;
+    Renderer::Buffer<true> instance_ids;
+    Renderer::Buffer<true> depth_pyramid;
+  };
+
   void Draw();
+  void UpdateResidency(Renderer::CommandBuffer command_buffer);
+  void StreamTextures(Renderer::CommandBuffer command_buffer);
+  void SwapStreamedTexture(const std::string& name,
+                           Renderer::Texture& texture);
+  void UpdateVirtualTextures(Renderer::CommandBuffer command_buffer,
+                             uint32_t frame_index);
+  void Defragment(Renderer::CommandBuffer command_buffer);
   void ReadyMeshDraw(Renderer::CommandBuffer command_buffer);
+  /*
+  Upload data of given objects only. Runs of adjacent objects are copied,
+  the rest is scattered by a compute pass
+  */
+  void ScatterObjectData(
+      Renderer::CommandBuffer command_buffer,
+      const std::vector<Renderer::Handle<Renderer::SceneObject>>& objects);
+  // Upload instance groups after they were packed again
+  void ReadyInstanceGroups(Renderer::CommandBuffer command_buffer);
   void ReadyCullData(Renderer::CommandBuffer command_buffer,
                         Renderer::RenderScene::MeshPass& pass);
-  void ExecuteCull(Renderer::CommandBuffer command_buffer,
-                   const Renderer::RenderScene::MeshPass& pass,
-                   const Renderer::CullParams& params);
+  // Occlusion mode of params is kNone or kPyramid, unless overridden
+  Renderer::DrawCullData BuildCullData(
+      const Renderer::CullParams& params, uint32_t max_draw_count,
+      std::optional<Renderer::OcclusionMode> occlusion_mode = {});
+  void ExecuteCull(
+      Renderer::CommandBuffer command_buffer,
+      const Renderer::RenderScene::MeshPass& pass,
+      const Renderer::CullParams& params,
+      std::optional<Renderer::OcclusionMode> occlusion_mode = {});
+  /*
+  Bind instance cull pipeline and dispatch it over instance_count instances
+
+  - Subgroup variant aggregates atomics per subgroup, it is used if the
+    device supports it, unless subgroups is false
+  */
+  void DispatchCull(Renderer::CommandBuffer command_buffer,
+                    VkDescriptorSet compute_set,
+                    const Renderer::DrawCullData& cull_data,
+                    uint32_t instance_count, bool subgroups);
+  /*
+  Pack culled draws of pass that have visible instances into its compacted
+  draw buffer, per multibatch, and count them
+
+  - Draws of the pass have to be culled, with a barrier in between
+  */
+  void CompactDraws(Renderer::CommandBuffer command_buffer,
+                    const Renderer::RenderScene::MeshPass& pass);
+  /*
+  Second phase of two phase culling of the forward pass, after its early
+  draws were reduced into the depth pyramid
+
+  - Draws of the early phase are reset, so the late draws only hold
+    instances early phase did not draw
+  */
+  void ExecuteLateCull(Renderer::CommandBuffer command_buffer,
+                       const Renderer::CullParams& params);
+  // Log counters of the frame that last used frame data, if it had any
+  void ReportCullStats(FrameData& frame);
+  void ExecuteGroupCull(Renderer::CommandBuffer command_buffer,
+                        const Renderer::RenderScene::MeshPass& pass,
+                        const Renderer::CullParams& params);
   void DrawShadows(Renderer::CommandBuffer command_buffer);
-  void DrawForward(Renderer::CommandBuffer command_buffer);
+  /*
+  Early phase clears the targets and leaves out the skybox, late phase
+  draws on top of it. Other modes do both
+  */
+  void DrawForward(Renderer::CommandBuffer command_buffer,
+                   Renderer::OcclusionMode occlusion_mode);
+  // Late draws of two phase culling leave out instance groups, which were
+  // drawn early, and report their stats apart
   void ExecuteDraw(Renderer::CommandBuffer command_buffer,
                    const Renderer::RenderScene::MeshPass& pass,
-                   const Renderer::DrawParams& draw_params);
+                   const Renderer::DrawParams& draw_params, bool late = false);
+  // Object data set of draw_params is replaced by instances of groups
+  void ExecuteGroupDraw(Renderer::CommandBuffer command_buffer,
+                        const Renderer::RenderScene::MeshPass& pass,
+                        const Renderer::DrawParams& draw_params,
+                        Renderer::DrawStats& stats);
+  void ReportDrawStats(Renderer::MeshPassType pass_type,
+                       const Renderer::DrawStats& stats, bool late = false);
   void DrawSkybox(Renderer::CommandBuffer command_buffer,
                   VkDescriptorBufferInfo scene_info, uint32_t dynamic_offset);
   void DrawCoordAxes(Renderer::CommandBuffer command_buffer,
@@ -166,8 +359,38 @@ class VulkanEngine {
 
   void DrawMenu();
   void DrawToolbar();
+  // Scatter a million cubes below the scene as single instance group
+  void SpawnInstanceGroup();
+
+  // Benchmarks started from the Debug menu, results are logged
+  void BenchmarkBatchSort();
+  void BenchmarkSceneLayout();
+  void BenchmarkObjectRegistration();
+  void BenchmarkBvh();
+  // Rays through the view and volume queries around the camera
+  void BenchmarkSceneQueries();
+  // GPU time of instance culling with and without subgroup atomics
+  void BenchmarkCullDispatch();
+  // Copy GPU culling results of the frame being recorded for comparison
+  void RecordCullReadback(Renderer::CommandBuffer command_buffer,
+                          const Renderer::CullParams& params);
+  // Waits for the GPU, then culls the same input on CPU and compares
+  void ValidateCpuCulling();
+  /*
+  Unload last prefab, let its meshes get evicted and load it again, draws
+  have to skip the meshes until their reload lands
+
+  - Runs over many frames, UpdateMeshReloadCheck advances it and logs the
+    result
+  */
+  void StartMeshReloadCheck();
+  void UpdateMeshReloadCheck(Renderer::CommandBuffer command_buffer);
 
   void InitCVars();
+  void InitDeviceCVars();
+  void InitDevice();
+  void InitRenderTargets(Renderer::CommandPool& init_pool);
+  void InitRenderer(Renderer::CommandPool& init_pool);
   void InitRenderPasses(VkSampleCountFlagBits samples);
   void InitFramebuffers();
   void InitSyncStructures();
@@ -183,11 +406,28 @@ class VulkanEngine {
                    const char* path);
   bool LoadPrefab(Renderer::CommandBuffer command_buffer, const char* path,
                   glm::mat4 root = glm::mat4{1.f});
-  void InitScene(Renderer::CommandPool& init_pool);
+  void InitScene(Renderer::CommandBuffer command_buffer);
   void InitImgui(Renderer::CommandPool& init_pool);
 
   void RecreateSwapchain(Renderer::CommandPool& command_pool);
 
+  /*
+  Decoding only touches its arguments, so it is safe to run on worker threads
+  */
+  static bool DecodeMesh(const std::string& path, DecodedMesh& decoded);
+  static bool DecodeTexture(const std::string& path, uint32_t initial_extent,
+                            DecodedTexture& decoded);
+  /*
+  Read prefab and its materials, appending meshes and textures they need as
+  {name, path} pairs not already in the lists
+  */
+  static bool ScanPrefab(
+      const std::string& asset_root, const std::string& path,
+      Assets::PrefabInfo& prefab_info,
+      std::vector<std::pair<std::string, std::string>>& meshes,
+      std::vector<std::pair<std::string, std::string>>& textures);
+  uint32_t GetInitialTextureExtent();
+
   std::string AssetPath(std::string_view path);
   Renderer::Mesh* GetMesh(const std::string& name);
 
@@ -202,6 +442,9 @@ class VulkanEngine {
   bool cursor_enabled_;
   bool menu_opened_;
 
+  ThreadPool thread_pool_;
+  std::chrono::steady_clock::time_point startup_begin_;
+
   Renderer::Window window_;
 
   Renderer::VulkanInstance instance_;
@@ -210,6 +453,10 @@ class VulkanEngine {
   Renderer::LogicalDevice device_;
 
   Renderer::VulkanProfiler profiler_;
+  Renderer::ResidencyManager residency_;
+  Renderer::TextureStreamer texture_streamer_;
+  Renderer::VirtualTextureCache virtual_textures_;
+  Renderer::Defragmenter defragmenter_;
 
   VmaAllocator allocator_;
   DeletionQueue main_deletion_queue_;
@@ -237,6 +484,8 @@ class VulkanEngine {
   VkImageView depth_pyramid_mips_[16] = {};
 
   Renderer::RenderPass forward_pass_;
+  // Forward pass keeping contents of the targets, for late draws
+  Renderer::RenderPass forward_late_pass_;
   Renderer::RenderPass directional_shadow_pass_;
   Renderer::RenderPass point_shadow_pass_;
   Renderer::RenderPass copy_pass_;
@@ -260,9 +509,19 @@ class VulkanEngine {
 
   VkPipeline sparse_upload_pipeline_;
   VkPipelineLayout sparse_upload_layout_;
+  Renderer::UploadCostModel object_upload_costs_;
 
   VkPipeline cull_pipeline_;
   VkPipelineLayout cull_layout_;
+  // Null if device lacks subgroup ballot in compute shaders
+  VkPipeline cull_subgroup_pipeline_ = VK_NULL_HANDLE;
+  VkPipelineLayout cull_subgroup_layout_ = VK_NULL_HANDLE;
+
+  VkPipeline compact_draws_pipeline_;
+  VkPipelineLayout compact_draws_layout_;
+
+  VkPipeline group_cull_pipeline_;
+  VkPipelineLayout group_cull_layout_;
 
   VkPipeline depth_reduce_pipeline_;
   VkPipelineLayout depth_reduce_layout_;
@@ -291,8 +550,20 @@ class VulkanEngine {
   std::unordered_map<std::string, Renderer::Mesh> meshes_;
   std::unordered_map<std::string, Renderer::Texture> textures_;
   std::unordered_map<std::string, Assets::PrefabInfo*> prefab_cache_;
+  // Assets decoded ahead of time during startup, consumed by LoadMesh and
+  // LoadTexture
+  std::unordered_map<std::string, DecodedMesh> decoded_meshes_;
+  std::unordered_map<std::string, DecodedTexture> decoded_textures_;
 
   std::deque<std::string> prefabs_to_load_;
+  // In load order
+  std::vector<LoadedPrefab> loaded_prefabs_;
+  // Most recently loaded prefabs to remove on the next frame
+  uint32_t prefabs_to_unload_ = 0;
+  std::vector<Renderer::Handle<Renderer::InstanceGroup>> instance_groups_;
+  bool cull_readback_requested_ = false;
+  std::optional<CullReadback> cull_readback_;
+  std::optional<MeshReloadCheck> mesh_reload_check_;
 
   Renderer::TextureSampler texture_sampler_;
   Renderer::TextureSampler depth_sampler_;
@@ -123,7 +123,7 @@ project "VulkanEngine"
             "_WIN32"
         }
 		postbuildcommands {
-			("for %%f in (%{prj.location}Shaders\\*.vert %{prj.location}Shaders\\*.frag %{prj.location}Shaders\\*.comp %{prj.location}Shaders\\*.geom) do " .. vulkan_sdk .. "/Bin/glslangValidator.exe -V -o %%f.spv %%f")
+			("for %%f in (%{prj.location}Shaders\\*.vert %{prj.location}Shaders\\*.frag %{prj.location}Shaders\\*.comp %{prj.location}Shaders\\*.geom) do " .. vulkan_sdk .. "/Bin/glslangValidator.exe -V --target-env vulkan1.2 -o %%f.spv %%f")
 		}
         
     filter "configurations:Debug"